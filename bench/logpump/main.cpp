@@ -0,0 +1,110 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+#include "misc_utils.h"
+#include "logpump.h"
+#include "logfile.h"
+
+static int64_t total_bytes = 1024ll * 1024 * 1024;
+static int line_sz = 100;
+static const char *file_path = "/tmp/logpump_bench.log";
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double thread_cpu_s() {
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+            ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void th_writer(int fd) {
+    std::string chunk;
+    while ((int)chunk.size() < 64 * 1024) {
+        std::string line = sformat("[%ld][bench:%d:out] ", chunk.size(), getpid());
+        line.resize(line_sz - 1, 'x');
+        chunk += line + "\n";
+    }
+    int64_t left = total_bytes;
+    while (left > 0) {
+        int64_t sz = std::min(left, (int64_t)chunk.size());
+        if (write_sz(fd, chunk.data(), sz) < 0) {
+            DBGE("Failed to write the input");
+            return ;
+        }
+        left -= sz;
+    }
+    close(fd);
+}
+
+static void th_drain(int fd) {
+    char buff[64 * 1024];
+    while (read(fd, buff, sizeof(buff)) > 0)
+        ;
+}
+
+static int run(bool zero_copy) {
+    int in[2], ext[2];
+    ASSERT_FN(pipe2(in, O_CLOEXEC));
+    ASSERT_FN(pipe2(ext, O_CLOEXEC));
+    ASSERT_FN(fcntl(ext[1], F_SETFL, O_NONBLOCK));
+    logpump_pipe_size(in[1], LOGPUMP_PIPE_SZ);
+    logpump_pipe_size(ext[1], LOGPUMP_PIPE_SZ);
+
+    int file_fd, null_fd;
+    ASSERT_FN(file_fd = open(file_path, LOGFILE_OPEN_FLAGS, 0666)); /* as the log segments are */
+    ASSERT_FN(null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC));
+
+    logpump_t pump;
+    ASSERT_FN(pump.init(in[0], zero_copy));
+
+    std::thread writer(th_writer, in[1]);
+    std::thread drain(th_drain, ext[0]);
+
+    double start = now_s();
+    double start_cpu = thread_cpu_s();
+    int64_t moved = 0;
+    ssize_t ret;
+    while ((ret = pump.pump(file_fd, ext[1], null_fd)) > 0)
+        moved += ret;
+    double secs = now_s() - start;
+    double cpu = thread_cpu_s() - start_cpu;
+
+    writer.join();
+    close(ext[1]);
+    drain.join();
+
+    DBG("%-9s: %ld MB in %.2fs, %.1f MB/s, pump cpu %.2fs (%.0f%%)%s",
+            zero_copy ? "zero-copy" : "copy", moved / (1024 * 1024), secs,
+            moved / (1024. * 1024.) / secs, cpu, cpu / secs * 100,
+            zero_copy && !pump.zero_copy ? " [fell back to copy]" : "");
+
+    pump.uninit();
+    close(in[0]);
+    close(ext[0]);
+    close(file_fd);
+    close(null_fd);
+    unlink(file_path);
+    return ret < 0 ? -1 : 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc > 1)
+        total_bytes = atoll(argv[1]) * 1024 * 1024;
+    if (argc > 2)
+        line_sz = std::max(atoi(argv[2]), 64);
+    if (argc > 3)
+        file_path = argv[3];
+
+    ASSERT_FN(run(false));
+    ASSERT_FN(run(true));
+    return 0;
+}
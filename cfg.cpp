@@ -1,79 +1,675 @@
 #include "cfg.h"
 
 #include <fstream>
+#include <dirent.h>
+#include <thread>
+#include <set>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <errno.h>
 
 #include "debug.h"
 #include "json.h"
 #include "path_utils.h"
 
+#define CFG_CACHE_MAGIC     "PMGRCFG1"
+#define CFG_CACHE_VERSION   1
+
 static config_t cfg;
 
-int cfg_read() {
-    using namespace nlohmann;
-    auto _cfg = cfg;
-    _cfg.tasks.clear();
+/* a task with all of it's options, as found in a file */
+struct cfg_task_t {
+    pmgr_task_t o;
+    int32_t heartbeat_ms = 0;
+    bool has_probe = false;
+    cfg_probe_t probe;
+    bool has_ratelim = false;
+    cfg_ratelim_t ratelim;
+};
 
-    auto cfg_path = path_get_relative(CONFIG_PATH);
-    std::ifstream ifile(cfg_path.c_str());
-    if (!ifile.good()) {
-        DBG("Failed to open the config file: %s", cfg_path.c_str());
+/* a parsed config file, it is parsed again only if it's changed */
+struct cfg_file_t {
+    int64_t mtime_ns = 0;
+    int64_t size = 0;
+    uint64_t hash = 0;
+    std::string globals;        /* main file only, the json without the tasks */
+    std::vector<cfg_task_t> tasks;
+};
+
+/* The binary cache, procmgr.json.cache, holds the parsed files, such that the unchanged ones
+don't need to be read again. It is mmaped and it's layout is:
+
+    cfg_cache_hdr_t
+    cfg_cache_file_t[file_cnt]
+    cfg_cache_task_t[task_cnt]
+    the strings, zero terminated, referenced by their offset in this blob */
+#define CFG_CACHE_NOSTR 0xffffffff
+
+struct PACKED_STRUCT cfg_cache_hdr_t {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    file_cnt;
+    uint32_t    task_cnt;
+    uint32_t    strings_sz;
+};
+
+struct PACKED_STRUCT cfg_cache_file_t {
+    uint32_t    path;
+    uint32_t    globals;
+    int64_t     mtime_ns;
+    int64_t     size;
+    uint64_t    hash;
+    uint32_t    first_task;
+    uint32_t    task_cnt;
+};
+
+struct PACKED_STRUCT cfg_cache_task_t {
+    uint32_t    name;
+    uint32_t    path;
+    uint32_t    pwd;
+    uint32_t    usr;
+    uint32_t    grp;
+    int32_t     flags;
+    int32_t     heartbeat_ms;
+    uint32_t    probe_type;         /* CFG_CACHE_NOSTR if there is no probe */
+    uint32_t    probe_target;
+    int32_t     probe_interval_ms;
+    int32_t     probe_timeout_ms;
+    int32_t     probe_failures;
+    int32_t     has_ratelim;
+    int64_t     bytes_s;
+    int64_t     lines_s;
+    int64_t     burst_bytes;
+    int64_t     burst_lines;
+    int32_t     sample;
+};
+
+/* by path, kept between reloads */
+static std::map<std::string, cfg_file_t> files_cache;
+static bool disk_cache_loaded = false;
+
+static uint64_t fnv1a(const std::string &data) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int cfg_probe_port(const std::string &target) {
+    char *end = NULL;
+    errno = 0;
+    long port = strtol(target.c_str(), &end, 10);
+    if (target.empty() || errno || *end || port < 1 || port > 65535)
+        return -1;
+    return port;
+}
+
+static int parse_task(nlohmann::json &task, cfg_task_t &ct) {
+    pmgr_task_t &pt = ct.o;
+    pt = pmgr_task_t{
+        .hdr = {
+            .size = sizeof(pmgr_task_t),
+            .type = PMGR_MSG_ADD,
+        }
+    };
+    /* the conf.d files can have anything in them, a string has to fit it's field */
+    auto copy_str = [&task](char *dst, size_t max, const char *key) {
+        if (!HAS(task, key))
+            return true;
+        std::string str = task[key].get<std::string>();
+        if (str.size() >= max) {
+            DBG("The %s of the task is too long: %s", key, str.c_str());
+            return false;
+        }
+        strcpy(dst, str.c_str());
+        return true;
+    };
+    if (!HAS(task, "name") || !HAS(task, "path") ||
+            !copy_str(pt.task_name, PMGR_MAX_TASK_NAME, "name") ||
+            !copy_str(pt.task_path, PMGR_MAX_TASK_PATH, "path") ||
+            !copy_str(pt.task_pwd, PMGR_MAX_TASK_PATH, "pwd") ||
+            !copy_str(pt.task_usr, PMGR_MAX_TASK_USR, "user") ||
+            !copy_str(pt.task_grp, PMGR_MAX_TASK_GRP, "group"))
+    {
         return -1;
     }
+
+    int32_t flags = 0;
+    for (auto &flag : task["flags"]) {
+        if (flag.get<std::string>() == "PERSIST") {
+            flags |= (int32_t)PMGR_TASK_FLAG_PERSIST;
+        }
+        else if (flag.get<std::string>() == "NOSTDIO") {
+            flags |= (int32_t)PMGR_TASK_FLAG_NOSTDIO;
+        }
+        else if (flag.get<std::string>() == "PWDSELF") {
+            flags |= (int32_t)PMGR_TASK_FLAG_PWDSELF;
+        }
+        else if (flag.get<std::string>() == "AUTORUN") {
+            flags |= (int32_t)PMGR_TASK_FLAG_AUTORUN;
+        }
+        else if (flag.get<std::string>() == "LOWPRIO") {
+            flags |= (int32_t)PMGR_TASK_FLAG_LOWPRIO;
+        }
+        else if (flag.get<std::string>() == "SHEDSTOP") {
+            flags |= (int32_t)PMGR_TASK_FLAG_SHEDSTOP;
+        }
+        else if (flag.get<std::string>() == "SHEDFRZ") {
+            flags |= (int32_t)PMGR_TASK_FLAG_SHEDFRZ;
+        }
+        else {
+            DBG("Unknown flag: %s", flag.get<std::string>().c_str());
+            return -1;
+        }
+    }
+    pt.flags = (pmgr_task_flags_e)flags;
+
+    if (HAS(task, "probe")) {
+        auto &jprobe = task["probe"];
+        cfg_probe_t probe{
+            .type = jprobe["type"].get<std::string>(),
+            .target = jprobe["target"].get<std::string>(),
+        };
+        if (HAS(jprobe, "interval_ms"))
+            probe.interval_ms = jprobe["interval_ms"].get<int32_t>();
+        if (HAS(jprobe, "timeout_ms"))
+            probe.timeout_ms = jprobe["timeout_ms"].get<int32_t>();
+        if (HAS(jprobe, "failures"))
+            probe.failures = jprobe["failures"].get<int32_t>();
+        if (probe.type != "exec" && probe.type != "unix" && probe.type != "tcp" &&
+                probe.type != "chan")
+        {
+            DBG("Unknown probe type: %s", probe.type.c_str());
+            return -1;
+        }
+        if (probe.interval_ms <= 0 || probe.timeout_ms <= 0 || probe.failures <= 0) {
+            DBG("Probe interval, timeout and failures must be positive");
+            return -1;
+        }
+        if (probe.target.size() + 1 >= PMGR_MAX_TASK_PATH) {
+            DBG("Probe target too long");
+            return -1;
+        }
+        if (probe.type == "tcp" && cfg_probe_port(probe.target) < 0) {
+            DBG("Invalid probe port: %s", probe.target.c_str());
+            return -1;
+        }
+        ct.has_probe = true;
+        ct.probe = probe;
+    }
+    if (HAS(task, "heartbeat_ms")) {
+        int32_t deadline_ms = task["heartbeat_ms"].get<int32_t>();
+        if (deadline_ms <= 0) {
+            DBG("Heartbeat deadline must be positive");
+            return -1;
+        }
+        ct.heartbeat_ms = deadline_ms;
+    }
+    if (HAS(task, "rate_limit")) {
+        auto &jlim = task["rate_limit"];
+        cfg_ratelim_t lim;
+        if (HAS(jlim, "bytes_s"))
+            lim.bytes_s = jlim["bytes_s"].get<int64_t>();
+        if (HAS(jlim, "lines_s"))
+            lim.lines_s = jlim["lines_s"].get<int64_t>();
+        if (HAS(jlim, "burst_bytes"))
+            lim.burst_bytes = jlim["burst_bytes"].get<int64_t>();
+        if (HAS(jlim, "burst_lines"))
+            lim.burst_lines = jlim["burst_lines"].get<int64_t>();
+        if (HAS(jlim, "sample"))
+            lim.sample = jlim["sample"].get<int32_t>();
+        if (lim.bytes_s < 0 || lim.lines_s < 0 || lim.burst_bytes < 0 ||
+                lim.burst_lines < 0 || lim.sample < 0)
+        {
+            DBG("Rate limits can't be negative");
+            return -1;
+        }
+        if (!lim.burst_bytes)
+            lim.burst_bytes = lim.bytes_s;
+        if (!lim.burst_lines)
+            lim.burst_lines = lim.lines_s;
+        ct.has_ratelim = true;
+        ct.ratelim = lim;
+    }
+    return 0;
+}
+
+/* everything but the tasks, those are in the main config file only */
+static int parse_globals(nlohmann::json &jcfg, config_t &_cfg) {
+    _cfg.sock_path = jcfg["sock_path"];
+    _cfg.sock_perm = std::stoi(jcfg["sock_perm"].get<std::string>(), nullptr, 8);
+    if (HAS(jcfg, "log_sock_path"))
+        _cfg.log_sock_path = jcfg["log_sock_path"];
+    if (HAS(jcfg, "conf_dir"))
+        _cfg.conf_dir = jcfg["conf_dir"];
+    if (HAS(jcfg, "stats_ms"))
+        _cfg.stats_ms = jcfg["stats_ms"].get<int32_t>();
+    if (_cfg.stats_ms <= 0) {
+        DBG("stats_ms must be positive");
+        return -1;
+    }
+
+    if (HAS(jcfg, "log")) {
+        auto &jlog = jcfg["log"];
+        if (HAS(jlog, "dir"))
+            _cfg.log.dir = jlog["dir"].get<std::string>();
+        if (HAS(jlog, "seg_size"))
+            _cfg.log.seg_size = jlog["seg_size"].get<int64_t>();
+        if (HAS(jlog, "seg_age_s"))
+            _cfg.log.seg_age_s = jlog["seg_age_s"].get<int64_t>();
+        if (HAS(jlog, "max_bytes"))
+            _cfg.log.max_bytes = jlog["max_bytes"].get<int64_t>();
+        if (HAS(jlog, "per_task"))
+            _cfg.log.per_task = jlog["per_task"].get<bool>();
+        if (HAS(jlog, "splice"))
+            _cfg.log.splice = jlog["splice"].get<bool>();
+        if (HAS(jlog, "store"))
+            _cfg.log.store = jlog["store"].get<bool>();
+        if (_cfg.log.seg_size <= 0 || _cfg.log.seg_age_s <= 0 || _cfg.log.max_bytes <= 0) {
+            DBG("Log segment size, age and max bytes must be positive");
+            return -1;
+        }
+    }
+
+    if (HAS(jcfg, "psi")) {
+        auto &jpsi = jcfg["psi"];
+        if (HAS(jpsi, "hold_ms"))
+            _cfg.psi_hold_ms = jpsi["hold_ms"].get<int32_t>();
+        for (auto &trig : jpsi["triggers"]) {
+            cfg_psi_t psi{
+                .res = trig["res"].get<std::string>(),
+                .kind = HAS(trig, "kind") ? trig["kind"].get<std::string>() : "some",
+                .stall_us = trig["stall_us"].get<int64_t>(),
+                .window_us = trig["window_us"].get<int64_t>(),
+            };
+            if (psi.res != "cpu" && psi.res != "memory" && psi.res != "io") {
+                DBG("Unknown pressure resource: %s", psi.res.c_str());
+                return -1;
+            }
+            if (psi.kind != "some" && psi.kind != "full") {
+                DBG("Unknown pressure kind: %s", psi.kind.c_str());
+                return -1;
+            }
+            _cfg.psi.push_back(psi);
+        }
+    }
+    return 0;
+}
+
+/* The main file has the globals and a "tasks" array, the files in conf_dir have a task object,
+an array of tasks or a {"tasks": [...]} object. */
+static int parse_file(const std::string &data, bool is_main, cfg_file_t &cf) {
+    using namespace nlohmann;
     try {
-        std::string scfg((std::istreambuf_iterator<char>(ifile)),
-                          std::istreambuf_iterator<char>());
-        json jcfg = json::parse(scfg, nullptr, true, true);
+        json jcfg = json::parse(data, nullptr, true, true);
+        json *jtasks = &jcfg;
+        if (jcfg.is_object() && HAS(jcfg, "tasks"))
+            jtasks = &jcfg["tasks"];
+        else if (is_main)
+            jtasks = nullptr;
 
-        _cfg.sock_path = jcfg["sock_path"];
-        _cfg.sock_perm = std::stoi(jcfg["sock_perm"].get<std::string>(), nullptr, 8);
+        cf.tasks.clear();
+        if (jtasks && jtasks->is_object()) {
+            cfg_task_t ct;
+            ASSERT_FN(parse_task(*jtasks, ct));
+            cf.tasks.push_back(ct);
+        }
+        else if (jtasks) {
+            for (auto &task : *jtasks) {
+                cfg_task_t ct;
+                ASSERT_FN(parse_task(task, ct));
+                cf.tasks.push_back(ct);
+            }
+        }
+        if (is_main) {
+            jcfg.erase("tasks");
+            cf.globals = jcfg.dump();
+        }
+    }
+    catch (json::exception& e) {
+        DBG("Config error: %s", e.what());
+        return -1;
+    }
+    return 0;
+}
+
+static std::string cache_path() {
+    return path_get_relative(CONFIG_PATH) + ".cache";
+}
+
+static uint32_t put_str(std::string &strings, const std::string &str) {
+    uint32_t off = strings.size();
+    strings.append(str.c_str(), str.size() + 1);
+    return off;
+}
+
+static bool get_str(const char *strings, uint32_t sz, uint32_t off, std::string &str, size_t max) {
+    if (off >= sz || !memchr(strings + off, 0, sz - off))
+        return false;
+    str = strings + off;
+    return str.size() < max;
+}
 
-        for (auto &task : jcfg["tasks"]) {
-            pmgr_task_t pt{
+static void load_disk_cache() {
+    disk_cache_loaded = true;
+
+    int fd = open(cache_path().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return ;
+    FnScope scope([fd]{ close(fd); });
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(cfg_cache_hdr_t))
+        return ;
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return ;
+    scope([map, &st]{ munmap(map, st.st_size); });
+
+    auto hdr = (const cfg_cache_hdr_t *)map;
+    if (memcmp(hdr->magic, CFG_CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != CFG_CACHE_VERSION)
+        return ;
+    uint64_t expect = sizeof(cfg_cache_hdr_t) + (uint64_t)hdr->file_cnt * sizeof(cfg_cache_file_t)
+            + (uint64_t)hdr->task_cnt * sizeof(cfg_cache_task_t) + hdr->strings_sz;
+    if (expect != (uint64_t)st.st_size) {
+        DBG("Ignoring corrupted config cache");
+        return ;
+    }
+    auto files = (const cfg_cache_file_t *)(hdr + 1);
+    auto tasks = (const cfg_cache_task_t *)(files + hdr->file_cnt);
+    auto strings = (const char *)(tasks + hdr->task_cnt);
+    uint32_t ssz = hdr->strings_sz;
+
+    std::map<std::string, cfg_file_t> loaded;
+    for (uint32_t i = 0; i < hdr->file_cnt; i++) {
+        auto &f = files[i];
+        std::string path;
+        cfg_file_t cf{ .mtime_ns = f.mtime_ns, .size = f.size, .hash = f.hash };
+        if ((uint64_t)f.first_task + f.task_cnt > hdr->task_cnt ||
+                !get_str(strings, ssz, f.path, path, PATH_MAX) ||
+                !get_str(strings, ssz, f.globals, cf.globals, SIZE_MAX))
+        {
+            DBG("Ignoring corrupted config cache");
+            return ;
+        }
+        for (uint32_t j = f.first_task; j < f.first_task + f.task_cnt; j++) {
+            auto &t = tasks[j];
+            std::string name, tpath, pwd, usr, grp;
+            cfg_task_t ct{ .heartbeat_ms = t.heartbeat_ms };
+            if (!get_str(strings, ssz, t.name, name, PMGR_MAX_TASK_NAME) ||
+                    !get_str(strings, ssz, t.path, tpath, PMGR_MAX_TASK_PATH) ||
+                    !get_str(strings, ssz, t.pwd, pwd, PMGR_MAX_TASK_PATH) ||
+                    !get_str(strings, ssz, t.usr, usr, PMGR_MAX_TASK_USR) ||
+                    !get_str(strings, ssz, t.grp, grp, PMGR_MAX_TASK_GRP))
+            {
+                DBG("Ignoring corrupted config cache");
+                return ;
+            }
+            ct.o = pmgr_task_t{
                 .hdr = {
                     .size = sizeof(pmgr_task_t),
                     .type = PMGR_MSG_ADD,
-                }
+                },
+                .flags = (pmgr_task_flags_e)t.flags,
             };
-            strcpy(pt.task_name, task["name"].get<std::string>().c_str());
-            strcpy(pt.task_path, task["path"].get<std::string>().c_str());
-            if (HAS(task, "pwd"))
-                strcpy(pt.task_pwd, task["pwd"].get<std::string>().c_str());
-            if (HAS(task, "user"))
-                strcpy(pt.task_usr, task["user"].get<std::string>().c_str());
-            if (HAS(task, "group"))
-                strcpy(pt.task_grp, task["group"].get<std::string>().c_str());
-
-            int32_t flags = 0;
-            for (auto &flag : task["flags"]) {
-                if (flag.get<std::string>() == "PERSIST") {
-                    flags |= (int32_t)PMGR_TASK_FLAG_PERSIST;
-                }
-                else if (flag.get<std::string>() == "NOSTDIO") {
-                    flags |= (int32_t)PMGR_TASK_FLAG_NOSTDIO;
-                }
-                else if (flag.get<std::string>() == "PWDSELF") {
-                    flags |= (int32_t)PMGR_TASK_FLAG_PWDSELF;
-                }
-                else if (flag.get<std::string>() == "AUTORUN") {
-                    flags |= (int32_t)PMGR_TASK_FLAG_AUTORUN;
-                }
-                else {
-                    DBG("Unknown flag: %s", flag.get<std::string>().c_str());
-                    return -1;
+            strcpy(ct.o.task_name, name.c_str());
+            strcpy(ct.o.task_path, tpath.c_str());
+            strcpy(ct.o.task_pwd, pwd.c_str());
+            strcpy(ct.o.task_usr, usr.c_str());
+            strcpy(ct.o.task_grp, grp.c_str());
+            if (t.probe_type != CFG_CACHE_NOSTR) {
+                ct.has_probe = true;
+                ct.probe.interval_ms = t.probe_interval_ms;
+                ct.probe.timeout_ms = t.probe_timeout_ms;
+                ct.probe.failures = t.probe_failures;
+                if (!get_str(strings, ssz, t.probe_type, ct.probe.type, 8) ||
+                        !get_str(strings, ssz, t.probe_target, ct.probe.target,
+                        PMGR_MAX_TASK_PATH) ||
+                        (ct.probe.type == "tcp" && cfg_probe_port(ct.probe.target) < 0))
+                {
+                    DBG("Ignoring corrupted config cache");
+                    return ;
                 }
             }
-            pt.flags = (pmgr_task_flags_e)flags;
-            _cfg.tasks.push_back(pt);
+            if (t.has_ratelim) {
+                ct.has_ratelim = true;
+                ct.ratelim = cfg_ratelim_t{
+                    .bytes_s = t.bytes_s,
+                    .lines_s = t.lines_s,
+                    .burst_bytes = t.burst_bytes,
+                    .burst_lines = t.burst_lines,
+                    .sample = t.sample,
+                };
+            }
+            cf.tasks.push_back(ct);
+        }
+        loaded[path] = std::move(cf);
+    }
+    files_cache = std::move(loaded);
+}
+
+/* written to a temporary file and renamed over, such that a reader never sees half of it */
+static int save_disk_cache() {
+    std::vector<cfg_cache_file_t> files;
+    std::vector<cfg_cache_task_t> tasks;
+    std::string strings;
+    for (auto &[path, cf] : files_cache) {
+        cfg_cache_file_t f{
+            .path = put_str(strings, path),
+            .globals = put_str(strings, cf.globals),
+            .mtime_ns = cf.mtime_ns,
+            .size = cf.size,
+            .hash = cf.hash,
+            .first_task = (uint32_t)tasks.size(),
+            .task_cnt = (uint32_t)cf.tasks.size(),
+        };
+        for (auto &ct : cf.tasks) {
+            cfg_cache_task_t t{
+                .name = put_str(strings, ct.o.task_name),
+                .path = put_str(strings, ct.o.task_path),
+                .pwd = put_str(strings, ct.o.task_pwd),
+                .usr = put_str(strings, ct.o.task_usr),
+                .grp = put_str(strings, ct.o.task_grp),
+                .flags = ct.o.flags,
+                .heartbeat_ms = ct.heartbeat_ms,
+                .probe_type = CFG_CACHE_NOSTR,
+                .probe_target = CFG_CACHE_NOSTR,
+            };
+            if (ct.has_probe) {
+                t.probe_type = put_str(strings, ct.probe.type);
+                t.probe_target = put_str(strings, ct.probe.target);
+                t.probe_interval_ms = ct.probe.interval_ms;
+                t.probe_timeout_ms = ct.probe.timeout_ms;
+                t.probe_failures = ct.probe.failures;
+            }
+            if (ct.has_ratelim) {
+                t.has_ratelim = 1;
+                t.bytes_s = ct.ratelim.bytes_s;
+                t.lines_s = ct.ratelim.lines_s;
+                t.burst_bytes = ct.ratelim.burst_bytes;
+                t.burst_lines = ct.ratelim.burst_lines;
+                t.sample = ct.ratelim.sample;
+            }
+            tasks.push_back(t);
+        }
+        files.push_back(f);
+    }
+    cfg_cache_hdr_t hdr{
+        .version = CFG_CACHE_VERSION,
+        .file_cnt = (uint32_t)files.size(),
+        .task_cnt = (uint32_t)tasks.size(),
+        .strings_sz = (uint32_t)strings.size(),
+    };
+    memcpy(hdr.magic, CFG_CACHE_MAGIC, sizeof(hdr.magic));
+
+    std::string tmp_path = cache_path() + sformat(".%d", getpid());
+    int fd = open(tmp_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1; /* a ctrl command may not be allowed to write here, that's fine */
+    FnScope scope([fd]{ close(fd); });
+    if (write_sz(fd, &hdr, sizeof(hdr)) < 0 ||
+            write_sz(fd, files.data(), files.size() * sizeof(files[0])) < 0 ||
+            write_sz(fd, tasks.data(), tasks.size() * sizeof(tasks[0])) < 0 ||
+            write_sz(fd, strings.data(), strings.size()) < 0 ||
+            rename(tmp_path.c_str(), cache_path().c_str()) < 0)
+    {
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+struct cfg_load_t {
+    std::string path;
+    bool is_main = false;
+    struct stat st;
+    bool changed = false;       /* the parsed file differs from the cache */
+    int err = 0;
+    cfg_file_t cf;
+};
+
+/* checks the file against the cache and parses it only if it's content changed */
+static void load_file(cfg_load_t &ld) {
+    if (stat(ld.path.c_str(), &ld.st) < 0) {
+        DBGE("Failed to stat the config file: %s", ld.path.c_str());
+        ld.err = -1;
+        return ;
+    }
+    int64_t mtime_ns = ld.st.st_mtim.tv_sec * 1000'000'000LL + ld.st.st_mtim.tv_nsec;
+    /* this runs in parallel, but the cache is only read until all the files are loaded */
+    auto cached = files_cache.find(ld.path);
+    if (cached != files_cache.end()) {
+        auto &cf = cached->second;
+        if (cf.mtime_ns == mtime_ns && cf.size == ld.st.st_size) {
+            ld.cf = cf;
+            return ;
         }
     }
+
+    std::ifstream ifile(ld.path.c_str());
+    if (!ifile.good()) {
+        DBG("Failed to open the config file: %s", ld.path.c_str());
+        ld.err = -1;
+        return ;
+    }
+    std::string data((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+
+    ld.changed = true;
+    uint64_t hash = fnv1a(data);
+    if (cached != files_cache.end() && cached->second.hash == hash) {
+        /* only touched */
+        ld.cf = cached->second;
+    }
+    else if (parse_file(data, ld.is_main, ld.cf) < 0) {
+        DBG("In config file: %s", ld.path.c_str());
+        ld.err = -1;
+        return ;
+    }
+    ld.cf.mtime_ns = mtime_ns;
+    ld.cf.size = data.size();
+    ld.cf.hash = hash;
+}
+
+static std::vector<std::string> list_conf_dir(const std::string &dir) {
+    std::vector<std::string> paths;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return paths;
+    while (struct dirent *ent = readdir(d)) {
+        std::string fname = ent->d_name;
+        if (fname.size() <= 5 || fname[0] == '.' || fname.substr(fname.size() - 5) != ".json")
+            continue;
+        paths.push_back(dir + "/" + fname);
+    }
+    closedir(d);
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+int cfg_read() {
+    using namespace nlohmann;
+    auto _cfg = cfg;
+    _cfg.tasks.clear();
+    _cfg.probes.clear();
+    _cfg.heartbeats.clear();
+    _cfg.ratelims.clear();
+    _cfg.psi.clear();
+
+    if (!disk_cache_loaded)
+        load_disk_cache();
+
+    std::vector<cfg_load_t> loads(1);
+    loads[0].path = path_get_relative(CONFIG_PATH);
+    loads[0].is_main = true;
+    load_file(loads[0]);
+    if (loads[0].err < 0)
+        return -1;
+    try {
+        json jglobals = json::parse(loads[0].cf.globals);
+        ASSERT_FN(parse_globals(jglobals, _cfg));
+    }
     catch (json::exception& e) {
         DBG("Config error: %s", e.what());
         return -1;
     }
+
+    /* the service files are independent, so they are loaded in parallel */
+    for (auto &path : list_conf_dir(path_get_relative(_cfg.conf_dir)))
+        loads.push_back(cfg_load_t{ .path = path });
+    std::atomic<size_t> next_load = 1;
+    auto th_load = [&loads, &next_load]{
+        size_t i;
+        while ((i = next_load++) < loads.size())
+            load_file(loads[i]);
+    };
+    std::vector<std::thread> ths;
+    size_t th_cnt = std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()),
+            (loads.size() - 1) / 16);
+    for (size_t i = 0; i < th_cnt; i++)
+        ths.push_back(std::thread(th_load));
+    th_load();
+    for (auto &th : ths)
+        th.join();
+
+    bool changed = false;
+    std::set<std::string> names;
+    std::map<std::string, cfg_file_t> new_cache;
+    for (auto &ld : loads) {
+        if (ld.err < 0)
+            return -1;
+        changed |= ld.changed;
+        for (auto &ct : ld.cf.tasks) {
+            std::string name = ct.o.task_name;
+            if (HAS(names, name)) {
+                DBG("Task %s is defined twice, again in %s", name.c_str(), ld.path.c_str());
+                return -1;
+            }
+            names.insert(name);
+            _cfg.tasks.push_back(ct.o);
+            if (ct.has_probe)
+                _cfg.probes[name] = ct.probe;
+            if (ct.heartbeat_ms)
+                _cfg.heartbeats[name] = ct.heartbeat_ms;
+            if (ct.has_ratelim)
+                _cfg.ratelims[name] = ct.ratelim;
+        }
+        new_cache[ld.path] = std::move(ld.cf);
+    }
+
+    /* removed files also mean a new cache */
+    changed |= new_cache.size() != files_cache.size();
+    files_cache = std::move(new_cache);
+    if (changed)
+        save_disk_cache();
+
     cfg = _cfg;
     return 0;
 }
 
 config_t *cfg_get() {
     return &cfg;
-}
\ No newline at end of file
+}
@@ -4,16 +4,59 @@
 #include <string>
 
 #include "procmgr.h"
+#include "logfile.h"
 
 #define CONFIG_PATH "procmgr.json"
 
+/* a pressure stall trigger, see https://docs.kernel.org/accounting/psi.html */
+struct cfg_psi_t {
+    std::string res;            /* cpu, memory or io */
+    std::string kind;           /* some or full */
+    int64_t     stall_us;
+    int64_t     window_us;
+};
+
+/* a health probe, the task is considered hung if it fails 'failures' times in a row */
+struct cfg_probe_t {
+    std::string type;           /* exec, unix, tcp or chan */
+    std::string target;         /* command, socket path, port or channel name */
+    int32_t     interval_ms = 5000;
+    int32_t     timeout_ms = 1000;
+    int32_t     failures = 3;
+};
+
+/* output rate limit, a token bucket for bytes and one for lines, a rate of 0 is not limited */
+struct cfg_ratelim_t {
+    int64_t     bytes_s = 0;
+    int64_t     lines_s = 0;
+    int64_t     burst_bytes = 0;    /* defaults to one second worth */
+    int64_t     burst_lines = 0;
+    int32_t     sample = 0;         /* over the limit 1 in 'sample' lines is still let through */
+};
+
 struct config_t {
     std::string sock_path;
+    std::string log_sock_path = "./procmgr.log.sock";
+    std::string conf_dir = "./conf.d";  /* more tasks, one or more in each <name>.json */
     int32_t sock_perm = 0;
+    logfile_cfg_t log;
     std::vector<pmgr_task_t> tasks;
+    std::map<std::string, cfg_probe_t> probes; /* by task name */
+    std::map<std::string, int32_t> heartbeats; /* by task name, the deadline in ms */
+    std::map<std::string, cfg_ratelim_t> ratelims; /* by task name */
+
+    /* how often the running tasks are sampled, for the PMGR_EVENT_TASK_STATS listeners */
+    int32_t stats_ms = 2000;
+
+    /* pressure is considered gone after this much time without a trigger firing */
+    int32_t psi_hold_ms = 10000;
+    std::vector<cfg_psi_t> psi;
 };
 
 int         cfg_read();
 config_t    *cfg_get();
 
+/* the port of a tcp probe target, -1 if it's not a number in 1..65535 */
+int         cfg_probe_port(const std::string &target);
+
 #endif
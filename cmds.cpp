@@ -1,11 +1,17 @@
 #include "cmds.h"
 #include "cfg.h"
 #include "procmgr.h"
+#include "pmgr2.h"
 #include "tasks.h"
+#include "metrics.h"
 #include "sys_utils.h"
 #include "path_utils.h"
 
 #include <sys/stat.h>
+#include <sys/epoll.h>
+
+/* the bytes that can wait for a slow connection that gets events, after that it's dropped */
+#define CMDS_OUT_MAX (4 * 1024 * 1024)
 
 static int open_socket() {
     int fd;
@@ -25,33 +31,19 @@ static int open_socket() {
     return fd;
 }
 
-static co::task_t read_msg(int fd, std::vector<uint8_t> &msg, int &len) {
-    msg.resize(sizeof(int));
-    ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, msg.data(), sizeof(int)) == sizeof(int)));
-
-    len = *(int *)msg.data();
+/* the size (first field of the header) was already read, to tell v1 and v2 apart */
+static co::task_t read_msg(int fd, std::vector<uint8_t> &msg, int len) {
     if (len < sizeof(pmgr_hdr_t)) {
         DBG("Invalid message size");
         co_return -1;
     }
     msg.resize(len);
+    *(int *)msg.data() = len;
     int rest = len - sizeof(int);
     ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, msg.data() + sizeof(int), rest) == rest));
     co_return 0;
 }
 
-static void trigger_event(pmgr_event_e type) {
-    pmgr_event_t ev{
-        .hdr {
-            .size = sizeof(pmgr_event_t),
-            .type = PMGR_MSG_EVENT_LOOP,
-        },
-        .ev_type = type,
-    };
-    strcpy(ev.task_name, "");
-    cmds_trigger_event(&ev);
-}
-
 #define VALIDATE_SIZE(hdr, type) { \
     if ((hdr)->size != sizeof(type)) { \
         DBG("Invalid size"); \
@@ -104,15 +96,23 @@ static co::task_t co_do_cmd(int fd, pmgr_hdr_t *hdr) {
                 ASSERT_COFN(write_sz(fd, &t, sizeof(t)));
             }
         } break;
+        case PMGR_MSG_METRICS: {
+            DBG("METRICS");
+            std::vector<pmgr_metric_t> metrics;
+            ASSERT_COFN(metrics_list(metrics)); /* contains terminator */
+            for (auto &m : metrics) {
+                ASSERT_COFN(write_sz(fd, &m, sizeof(m)));
+            }
+        } break;
         case PMGR_MSG_LOAD_CFG: {
             DBG("LOAD CFG");
             /* TODO: */
-            trigger_event(PMGR_EVENT_CFG_RELOAD);
+            cmds_event(PMGR_EVENT_CFG_RELOAD);
         } break;
         case PMGR_MSG_CLEAR: {
             DBG("CLEAR");
             ASSERT_COFN(co_await co_tasks_clear());
-            trigger_event(PMGR_EVENT_CLEAR);
+            cmds_event(PMGR_EVENT_CLEAR);
         } break;
         case PMGR_MSG_GET_PID: {
             VALIDATE_SIZE(hdr, pmgr_chann_identity_t);
@@ -120,7 +120,7 @@ static co::task_t co_do_cmd(int fd, pmgr_hdr_t *hdr) {
             pmgr_task_t task{};
             ASSERT_COFN(tasks_get(msg->task_pid, &task));
             ASSERT_COFN(write_sz(fd, &task, sizeof(task)));
-        }
+        } break;
         case PMGR_MSG_GET_NAME: {
             VALIDATE_SIZE(hdr, pmgr_chann_identity_t);
             auto msg = (pmgr_chann_identity_t *)hdr;
@@ -134,7 +134,7 @@ static co::task_t co_do_cmd(int fd, pmgr_hdr_t *hdr) {
             ASSERT_COFN(CHK_BOOL(has_ending));
             ASSERT_COFN(tasks_get(msg->task_name, &task));
             ASSERT_COFN(write_sz(fd, &task, sizeof(task)));
-        }
+        } break;
         default: {
             DBG("Invalid message received");
         }
@@ -144,44 +144,188 @@ static co::task_t co_do_cmd(int fd, pmgr_hdr_t *hdr) {
 
 static std::map<pid_t, std::set<int>>       pid2fd[32];
 static std::map<std::string, std::set<int>> name2fd[32];
+static std::set<int>                        v2_event_fds; /* those get PMGR_MSG_EVENT frames */
+
+/* The connections that get events are written without blocking, a slow reader (a procmgr top on a
+slow terminal) must not stop procmgr. What doesn't fit in the socket waits here and is written by
+co_cmds_flush when there is space, the next writes go after it. The fd is closed by the flush if
+it's still running when the connection is done. */
+struct cmds_out_t {
+    std::string buf;
+    bool closing = false;
+};
+
+static std::map<int, std::shared_ptr<cmds_out_t>> outs;
+static std::vector<int> new_outs;
+static co::sem_t new_outs_sem;
+
+static int cmds_send(int fd, const void *data, size_t len) {
+    if (HAS(outs, fd)) {
+        auto out = outs[fd];
+        if (out->buf.size() + len > CMDS_OUT_MAX) {
+            DBG("fd:%d is too slow, dropping it", fd);
+            shutdown(fd, SHUT_RDWR);
+            return -1;
+        }
+        out->buf.append((const char *)data, len);
+        return 0;
+    }
+    ssize_t ret = send(fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+    ret = std::max<ssize_t>(ret, 0);
+    if ((size_t)ret == len)
+        return 0;
+    auto out = std::make_shared<cmds_out_t>();
+    out->buf.assign((const char *)data + ret, len - ret);
+    outs[fd] = out;
+    new_outs.push_back(fd);
+    new_outs_sem.rel();
+    return 0;
+}
 
-void cmds_trigger_event(pmgr_event_t *ev) {
-    /* TODO: take this event and send it to all listeners */
-    for (int i = 0; i < 32; i++) {
-        if (ev->ev_type & (1 << i)) {
-            if (HAS(pid2fd[i], ev->task_pid)) {
-                for (int fd : pid2fd[i][ev->task_pid]) {
-                    DBG("Send 1 to %d", fd);
-                    write_sz(fd, ev, sizeof(*ev));
-                }
-            }
-            if (HAS(name2fd[i], ev->task_name)) {
-                for (int fd : name2fd[i][ev->task_name]) {
-                    write_sz(fd, ev, sizeof(*ev));
-                }
-            }
-            for (int fd : pid2fd[i][-1]) {
-                write_sz(fd, ev, sizeof(*ev));
-            }
-            for (int fd : name2fd[i][""]) {
-                write_sz(fd, ev, sizeof(*ev));
-            }
+static void cmds_close(int fd) {
+    if (!HAS(outs, fd)) {
+        close(fd);
+        return ;
+    }
+    /* the peer is done, what it didn't read is dropped, the flush sees the error and closes */
+    outs[fd]->closing = true;
+    shutdown(fd, SHUT_RDWR);
+}
+
+static co::task_t co_cmds_flush(int fd) {
+    auto out = outs[fd];
+    while (out->buf.size()) {
+        if (co_await co::wait_event(fd, EPOLLOUT) < 0)
+            break;
+        ssize_t ret = send(fd, out->buf.data(), out->buf.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (ret <= 0) {
+            shutdown(fd, SHUT_RDWR);
+            break;
         }
+        out->buf.erase(0, ret);
     }
+    outs.erase(fd);
+    if (out->closing)
+        close(fd);
+    co_return 0;
 }
 
-co::task_t co_event_registration(int fd) {
+static co::task_t co_cmds_flushes() {
+    while (true) {
+        co_await new_outs_sem;
+
+        auto fds = new_outs;
+        new_outs.clear();
+        for (int fd : fds)
+            co_await co::sched(co_cmds_flush(fd));
+    }
+    co_return 0;
+}
+
+/* what a connection registered for, so it can be removed when the connection is closed */
+struct event_regs_t {
     std::set<pid_t> pid_regs[32];
     std::set<std::string> name_regs[32];
+};
+
+static void register_events(int fd, event_regs_t &regs, int32_t ev_type, int32_t ev_flags,
+        pid_t pid, const std::string& name) {
+    DBG("fd:%d event registration for events: [%x], flags: [%x] pid: [%d] name: [%s]",
+            fd, ev_type, ev_flags, int(pid), name.c_str());
+    ev_type &= PMGR_EVENT_MASK;
+    for (int32_t i = 0; i < 32; i++) {
+        if (ev_type & (1 << i)) {
+            if (ev_flags & PMGR_EVENT_FLAG_PID_FILTER) {
+                regs.pid_regs[i].insert(pid);
+                pid2fd[i][pid].insert(fd);
+            }
+            if (ev_flags & PMGR_EVENT_FLAG_NAME_FILTER) {
+                regs.name_regs[i].insert(name);
+                name2fd[i][name].insert(fd);
+            }
+        }
+    }
+}
 
-    FnScope scope([fd, &pid_regs, &name_regs]{
-        close(fd);
-        for (int i = 0; i < 32; i++) {
-            for (auto &pid : pid_regs[i])
-                pid2fd[i][pid].erase(fd);
-            for (auto &name : name_regs[i])
-                name2fd[i][name].erase(fd);
+static void unregister_events(int fd, event_regs_t &regs) {
+    for (int i = 0; i < 32; i++) {
+        for (auto &pid : regs.pid_regs[i])
+            pid2fd[i][pid].erase(fd);
+        for (auto &name : regs.name_regs[i])
+            name2fd[i][name].erase(fd);
+        regs.pid_regs[i].clear();
+        regs.name_regs[i].clear();
+    }
+}
+
+bool cmds_has_listeners(int32_t ev_type) {
+    for (int i = 0; i < 32; i++) {
+        if (!(ev_type & (1 << i)))
+            continue;
+        for (auto &[pid, fds] : pid2fd[i])
+            if (fds.size())
+                return true;
+        for (auto &[name, fds] : name2fd[i])
+            if (fds.size())
+                return true;
+    }
+    return false;
+}
+
+void cmds_trigger_event(pmgr_event_t *ev, const pmgr2_msg_t *fields) {
+    /* a connection can be registered more than once for an event, it gets it only once */
+    std::set<int> fds;
+    for (int i = 0; i < 32; i++) {
+        if (ev->ev_type & (1 << i)) {
+            if (HAS(pid2fd[i], ev->task_pid))
+                fds.insert(pid2fd[i][ev->task_pid].begin(), pid2fd[i][ev->task_pid].end());
+            if (HAS(name2fd[i], ev->task_name))
+                fds.insert(name2fd[i][ev->task_name].begin(), name2fd[i][ev->task_name].end());
+            fds.insert(pid2fd[i][-1].begin(), pid2fd[i][-1].end());
+            fds.insert(name2fd[i][""].begin(), name2fd[i][""].end());
         }
+    }
+
+    std::string v2_frame;
+    if (v2_event_fds.size()) {
+        pmgr2_msg_t msg(PMGR_MSG_EVENT);
+        pmgr2_put_event(msg, *ev);
+        if (fields)
+            msg.fields.insert(msg.fields.end(), fields->fields.begin(), fields->fields.end());
+        v2_frame = msg.encode();
+    }
+    for (int fd : fds) {
+        if (HAS(v2_event_fds, fd))
+            cmds_send(fd, v2_frame.data(), v2_frame.size());
+        else if (ev->ev_type != PMGR_EVENT_TASK_STATS)
+            cmds_send(fd, ev, sizeof(*ev));
+    }
+}
+
+void cmds_event(pmgr_event_e type, const std::string& task_name, pid_t pid,
+        const pmgr2_msg_t *fields) {
+    pmgr_event_t ev{
+        .hdr {
+            .size = sizeof(pmgr_event_t),
+            .type = PMGR_MSG_EVENT_LOOP,
+        },
+        .ev_type = type,
+        .task_pid = pid,
+    };
+    strncpy(ev.task_name, task_name.c_str(), PMGR_MAX_TASK_NAME - 1);
+    cmds_trigger_event(&ev, fields);
+}
+
+co::task_t co_event_registration(int fd) {
+    event_regs_t regs;
+
+    FnScope scope([fd, &regs]{
+        unregister_events(fd, regs);
+        cmds_close(fd);
     });
     while (true) {
         pmgr_event_t ev_reg;
@@ -213,36 +357,15 @@ co::task_t co_event_registration(int fd) {
             invalid_msg = true;
         }
 
-        std::string name;
-        pid_t pid;
-        int32_t ev_type;
-        if (!invalid_msg) {
-            name = ev_reg.task_name;
-            pid = ev_reg.task_pid;
-            ev_type = ((int32_t)ev_reg.ev_type) & PMGR_EVENT_MASK;
-        }
-
         if (invalid_msg) {
             retmsg.retval = -2;
         }
         else {
-            DBG("fd:%d event registration for events: [%x], flags: [%x] pid: [%d] name: [%s]",
-                    fd, ev_reg.ev_type, ev_reg.ev_flags, int(pid), name.c_str());
-            for (int32_t i = 0; i < 32; i++) {
-                if (ev_type & (1 << i)) {
-                    if (ev_reg.ev_flags & PMGR_EVENT_FLAG_PID_FILTER) {
-                        pid_regs[i].insert(pid);
-                        pid2fd[i][pid].insert(fd);
-                    }
-                    if (ev_reg.ev_flags & PMGR_EVENT_FLAG_NAME_FILTER) {
-                        name_regs[i].insert(name);
-                        name2fd[i][name].insert(fd);
-                    }
-                }
-            }
+            register_events(fd, regs, ev_reg.ev_type, ev_reg.ev_flags, ev_reg.task_pid,
+                    ev_reg.task_name);
         }
 
-        if (write_sz(fd, &retmsg, sizeof(retmsg)) < 0) {
+        if (cmds_send(fd, &retmsg, sizeof(retmsg)) < 0) {
             DBG("Failed to send return value");
             continue;
         }
@@ -251,6 +374,216 @@ co::task_t co_event_registration(int fd) {
     co_return 0;
 }
 
+/* a v2 connection (see pmgr2.h) */
+struct v2_conn_t {
+    int fd;
+    uint32_t caps = 0;
+    pmgr2_reader_t reader;
+    event_regs_t regs;
+};
+
+static int v2_send(v2_conn_t &conn, const pmgr2_msg_t &msg) {
+    std::string frame = msg.encode();
+    ASSERT_FN(cmds_send(conn.fd, frame.data(), frame.size()));
+    return 0;
+}
+
+/* strings that end up in the v1 structs must fit in them, they are not truncated */
+static int v2_copy_str(char *dst, const std::string& src, size_t max_len) {
+    if (src.size() >= max_len || src.find('\0') != std::string::npos) {
+        DBG("Invalid string: %s", src.c_str());
+        return -1;
+    }
+    strcpy(dst, src.c_str());
+    return 0;
+}
+
+static int v2_get_task(const pmgr2_msg_t &msg, pmgr_task_t *task, std::vector<std::string>& argv,
+        std::vector<std::string>& env) {
+    *task = pmgr_task_t{};
+    task->hdr.size = sizeof(pmgr_task_t);
+    task->hdr.type = PMGR_MSG_ADD;
+    task->flags = (pmgr_task_flags_e)msg.get_int(PMGR2_F_FLAGS);
+
+    argv = msg.get_strs(PMGR2_F_ARG);
+    env = msg.get_strs(PMGR2_F_ENV);
+
+    ASSERT_FN(v2_copy_str(task->task_name, msg.get_str(PMGR2_F_NAME), PMGR_MAX_TASK_NAME));
+    ASSERT_FN(v2_copy_str(task->task_pwd, msg.get_str(PMGR2_F_PWD), PMGR_MAX_TASK_PATH));
+    ASSERT_FN(v2_copy_str(task->task_usr, msg.get_str(PMGR2_F_USR), PMGR_MAX_TASK_USR));
+    ASSERT_FN(v2_copy_str(task->task_grp, msg.get_str(PMGR2_F_GRP), PMGR_MAX_TASK_GRP));
+    if (argv.empty()) {
+        ASSERT_FN(v2_copy_str(task->task_path, msg.get_str(PMGR2_F_PATH), PMGR_MAX_TASK_PATH));
+        return 0;
+    }
+
+    /* the path is only shown to users now, so it can be cut */
+    std::string path;
+    for (auto &a : argv)
+        path += (path.size() ? " " : "") + a;
+    path = path.substr(0, std::min(path.find('\0'), size_t(PMGR_MAX_TASK_PATH - 1)));
+    strcpy(task->task_path, path.c_str());
+    return 0;
+}
+
+static co::task_t co_do_cmd_v2(v2_conn_t &conn, const pmgr2_msg_t &msg) {
+    uint64_t req_id = msg.req_id();
+    std::string name = msg.get_str(PMGR2_F_NAME);
+    if (name.size() >= PMGR_MAX_TASK_NAME) {
+        DBG("Task name too long");
+        co_return -1;
+    }
+
+    switch (msg.type()) {
+        case PMGR_MSG_STOP: {
+            DBG("STOP[%s]", name.c_str());
+            ASSERT_COFN(tasks_stop(name));
+        } break;
+        case PMGR_MSG_WAITSTOP: {
+            DBG("WAITSTOP[%s]", name.c_str());
+            ASSERT_COFN(co_await co_tasks_waitstop(name));
+        } break;
+        case PMGR_MSG_WAITRM: {
+            DBG("WAITRM[%s]", name.c_str());
+            ASSERT_COFN(co_await co_tasks_waitrm(name));
+        } break;
+        case PMGR_MSG_START: {
+            DBG("START[%s]", name.c_str());
+            ASSERT_COFN(tasks_start(name));
+        } break;
+        case PMGR_MSG_ADD: {
+            if (msg.has(PMGR2_F_ARG) && !(conn.caps & PMGR2_CAP_ARGV)) {
+                DBG("Argv was not negotiated");
+                co_return -1;
+            }
+            pmgr_task_t task;
+            std::vector<std::string> argv, env;
+            ASSERT_COFN(v2_get_task(msg, &task, argv, env));
+            ASSERT_COFN(tasks_add(&task, argv, env));
+            DBG("ADDED[%s:%s]", task.task_name, task.task_path);
+        } break;
+        case PMGR_MSG_RM: {
+            DBG("RM[%s]", name.c_str());
+            ASSERT_COFN(tasks_rm(name));
+        } break;
+        case PMGR_MSG_LIST: {
+            DBG("LIST");
+            std::vector<pmgr_task_t> tasks;
+            ASSERT_COFN(tasks_list(tasks));
+            for (auto &t : tasks) {
+                if (t.list_terminator)
+                    continue;
+                pmgr2_msg_t rep(PMGR_MSG_REPLAY, req_id);
+                pmgr2_put_task(rep, t);
+                tasks_put_stats(t.task_name, rep);
+                ASSERT_COFN(v2_send(conn, rep));
+            }
+        } break;
+        case PMGR_MSG_METRICS: {
+            DBG("METRICS");
+            std::vector<pmgr_metric_t> metrics;
+            ASSERT_COFN(metrics_list(metrics));
+            for (auto &m : metrics) {
+                if (m.list_terminator)
+                    continue;
+                pmgr2_msg_t rep(PMGR_MSG_METRIC, req_id);
+                rep.add_str(PMGR2_F_NAME, m.task_name);
+                rep.add_str(PMGR2_F_METRIC, m.name);
+                rep.add_int(PMGR2_F_VALUE, m.value);
+                ASSERT_COFN(v2_send(conn, rep));
+            }
+        } break;
+        case PMGR_MSG_LOAD_CFG: {
+            DBG("LOAD CFG");
+            /* TODO: */
+            cmds_event(PMGR_EVENT_CFG_RELOAD);
+        } break;
+        case PMGR_MSG_CLEAR: {
+            DBG("CLEAR");
+            ASSERT_COFN(co_await co_tasks_clear());
+            cmds_event(PMGR_EVENT_CLEAR);
+        } break;
+        case PMGR_MSG_GET_PID:
+        case PMGR_MSG_GET_NAME: {
+            pmgr_task_t task{};
+            if (msg.type() == PMGR_MSG_GET_PID) {
+                ASSERT_COFN(tasks_get(msg.get_int(PMGR2_F_PID), &task));
+            }
+            else {
+                ASSERT_COFN(tasks_get(name, &task));
+            }
+            pmgr2_msg_t rep(PMGR_MSG_REPLAY, req_id);
+            pmgr2_put_task(rep, task);
+            ASSERT_COFN(v2_send(conn, rep));
+        } break;
+        case PMGR_MSG_REGISTER_EVENT: {
+            if (!(conn.caps & PMGR2_CAP_EVENTS)) {
+                DBG("Events were not negotiated");
+                co_return -1;
+            }
+            pid_t pid = msg.get_int(PMGR2_F_PID, -1);
+            if (pid < -1) {
+                DBG("Invalid pid: %d", int(pid));
+                co_return -1;
+            }
+            register_events(conn.fd, conn.regs, msg.get_int(PMGR2_F_EV_TYPE),
+                    msg.get_int(PMGR2_F_FLAGS), pid, name);
+            v2_event_fds.insert(conn.fd);
+        } break;
+        case PMGR_MSG_UNREGISTER_EVENT: {
+            unregister_events(conn.fd, conn.regs);
+        } break;
+        default: {
+            DBG("Invalid message received: %d", msg.type());
+            co_return -1;
+        }
+    }
+    co_return 0;
+}
+
+/* the v2 handshake: after the magic, the client sends it's version and the capabilities it wants,
+the server replies with the magic, it's version and the capabilities that will be used */
+static co::task_t co_cmds_v2(int fd) {
+    v2_conn_t conn{ .fd = fd, .reader = { .fd = fd } };
+    FnScope scope([&conn]{
+        unregister_events(conn.fd, conn.regs);
+        v2_event_fds.erase(conn.fd);
+        cmds_close(conn.fd);
+    });
+
+    uint64_t version, caps;
+    ASSERT_COFN(CHK_BOOL(co_await co_pmgr2_read_varint(conn.reader, version) > 0));
+    ASSERT_COFN(CHK_BOOL(co_await co_pmgr2_read_varint(conn.reader, caps) > 0));
+    if (version < PMGR2_VERSION) {
+        DBG("Unsupported client version: %lu", version);
+        co_return -1;
+    }
+    conn.caps = caps & PMGR2_CAP_ALL;
+
+    std::string hello = pmgr2_hello(conn.caps);
+    ASSERT_COFN(write_sz(fd, hello.data(), hello.size()));
+
+    DBG("fd:%d v2 connection, caps: [%x]", fd, conn.caps);
+    while (true) {
+        pmgr2_msg_t msg;
+        int ret = co_await co_pmgr2_read_msg(conn.reader, msg);
+        ASSERT_COFN(ret);
+        if (ret == 0)
+            break;
+
+        /* TODO: return values are bad, only -1, should be more expresive */
+        int retval = co_await co_do_cmd_v2(conn, msg);
+        pmgr2_msg_t rep(PMGR_MSG_RETVAL, msg.req_id());
+        rep.add_int(PMGR2_F_RETVAL, retval);
+        ASSERT_COFN(v2_send(conn, rep));
+
+        if (!(conn.caps & PMGR2_CAP_PIPELINE) && !HAS(v2_event_fds, fd))
+            break;
+    }
+    DBG("v2 conndone");
+    co_return 0;
+}
+
 co::task_t co_cmds() {
     int usock_fd;
 
@@ -258,6 +591,7 @@ co::task_t co_cmds() {
     ASSERT_ECOFN(listen(usock_fd, 4096));
 
     DBG("Created socket, waiting clients");
+    co_await co::sched(co_cmds_flushes());
 
     while (true) {
         DBG("usock_fd: %d", usock_fd);
@@ -279,6 +613,16 @@ co::task_t co_cmds() {
         DBG("Connected: path: [%s] pid: %d", path_pid_path(ucred.pid).c_str(), ucred.pid);
 
         int len = 0;
+        if (co_await co::read_sz(remote_fd, &len, sizeof(len)) != sizeof(len)) {
+            DBG("Failed to receive request");
+            continue ;
+        }
+        if (len == PMGR2_MAGIC) {
+            close_fd.disable();
+            co_await co::sched(co_cmds_v2(remote_fd));
+            continue;
+        }
+
         std::vector<uint8_t> msg;
         if (co_await read_msg(remote_fd, msg, len) < 0) {
             DBG("Failed to receive request");
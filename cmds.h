@@ -5,8 +5,17 @@
 #include "procmgr.h"
 
 
-/* trigger event for all that listen to it */
-void cmds_trigger_event(pmgr_event_t *ev);
+struct pmgr2_msg_t;
+
+/* trigger event for all that listen to it, the fields are added to the event on v2 connections */
+void cmds_trigger_event(pmgr_event_t *ev, const pmgr2_msg_t *fields = NULL);
+
+/* makes the event and triggers it, for the pressure events task_name is the resource */
+void cmds_event(pmgr_event_e type, const std::string& task_name = "", pid_t pid = 0,
+        const pmgr2_msg_t *fields = NULL);
+
+/* if anyone listens to any of those events */
+bool cmds_has_listeners(int32_t ev_type);
 
 co::task_t co_cmds();
 
@@ -1,10 +1,58 @@
 #include <unistd.h> 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <thread>
 #include "procmgr.h"
+#include "libpmgr.h"
 #include "sys_utils.h"
 #include "co_utils.h"
 #include "path_utils.h"
 #include "pmgrch.h"
+#include "msgbuf.h"
+#include "topics.h"
+#include "retain.h"
+#include "mpscq.h"
+
+/* the bytes queued for a client after which the flags it registered with decide: the sender waits
+(default), the message is dropped (PMGR_CHAN_QDROP) or the client is disconnected (PMGR_CHAN_QDISCON) */
+#define CHAN_OUTQ_MAX_BYTES (4 * 1024 * 1024)
+#define CHAN_WRITEV_MAX     64
+
+/* the default window of the PMGR_CHAN_WACK acks, changed with PMGR_CHAN_ACK_WIN */
+#define CHAN_ACK_WIN_MSGS   64
+#define CHAN_ACK_WIN_MS     10
+
+/* the most credits a client can have at once */
+#define CHAN_CREDITS_MAX    ((int64_t)1 << 32)
+
+/* how many bytes of the chunks of a client can wait in the queues of the others, by default and at
+most (PMGR_CHAN_INFLIGHT) */
+#define CHAN_INFLIGHT_DEF   (1024 * 1024)
+#define CHAN_INFLIGHT_MAX   (64 * 1024 * 1024)
+
+/* the most topics a client can subscribe to */
+#define CHAN_TOPICS_MAX     1024
+
+/* the tcp connections (clients and bridges) get big buffers, as they carry bursts, and keepalive, to
+notice the peers that are gone. The small messages are not delayed (TCP_NODELAY), the writer corks
+the ones it writes together instead (MSG_MORE) */
+#define CHAN_TCP_BUF        (4 * 1024 * 1024)
+#define CHAN_TCP_KEEPIDLE   30  /* seconds */
+#define CHAN_TCP_KEEPINTVL  5
+#define CHAN_TCP_KEEPCNT    4
+
+/* a forwarded message goes through at most that many bridges */
+#define CHAN_FWD_MAX_HOPS   16
+
+/* how far the seq of an origin may jump ahead of the last one we had, a bigger jump is not believed,
+so a bad seq can't make us drop the next ones of that origin */
+#define CHAN_SEEN_MAX_JUMP  (1ULL << 20)
 
 struct client_t;
 struct channel_t;
@@ -14,71 +62,877 @@ using client_wp = std::weak_ptr<client_t>;
 using channel_p = std::shared_ptr<channel_t>;
 using channel_wp = std::weak_ptr<channel_t>;
 
-static std::map<std::string, channel_wp> channels;
-static std::map<std::string, std::set<client_wp, std::owner_less<client_wp>>> chan_waiters;
+/* chanmgr has a few workers, each one a thread with it's own pool. A channel (with it's clients,
+topics and retention) lives on the worker picked by the hash of it's name and nothing about it is
+seen by the other workers. The main thread only accepts the clients, reads their registration and
+gives them to the worker of their channel through the worker's queue (mpscq.h). So the state below
+is per worker (thread_local) and the channels of different workers never wait for each other. */
+#define CHAN_WORKERS_MAX    16
+#define CHAN_SHARD_BITS     4   /* the worker, in the low bits of a channel handle */
+
+/* The clients and the channels live in slots that are reused. A client id (int64) has the slot in
+it's low 32 bits and the generation of the slot in the high ones, a channel handle (int32) has the
+worker in it's low CHAN_SHARD_BITS, the slot up to CHAN_HANDLE_BITS and the generation above them. A
+stale id or handle has an older generation, so it doesn't find the new owner of the slot. The
+messages only look up ids inside the slot tables, the names are only used by the registration. */
+#define CHAN_HANDLE_BITS    20
+#define CHAN_HANDLE_MASK    ((1 << CHAN_HANDLE_BITS) - 1)
+#define CHAN_GEN_MASK       0x7ff /* the handles stay positive, they are the registration's retval */
+#define CHAN_HANDLE_SLOT(h) (((h) & CHAN_HANDLE_MASK) >> CHAN_SHARD_BITS)
+static_assert(CHAN_WORKERS_MAX <= (1 << CHAN_SHARD_BITS));
+
+struct client_slot_t {
+    client_t *client = NULL;
+    uint32_t gen = 1;
+};
+
+/* the last seq of an origin and the 64 before it, bit i is set if we had last - i */
+struct seen_t {
+    uint64_t last = 0;
+    uint64_t mask = 0;
+};
+
+/* false if seq was already seen, if it's too old to know or too far ahead to be true. The first seq
+of an origin can be anything, the channels that join a bridge late don't start from 1 */
+static bool seen_add(seen_t &s, uint64_t seq) {
+    if (s.last && seq > s.last && seq - s.last > CHAN_SEEN_MAX_JUMP)
+        return false;
+    if (seq > s.last) {
+        uint64_t shift = seq - s.last;
+        s.mask = (shift >= 64 ? 0 : s.mask << shift) | 1;
+        s.last = seq;
+        return true;
+    }
+    uint64_t bit = s.last - seq;
+    if (bit >= 64 || (s.mask & (1ULL << bit)))
+        return false;
+    s.mask |= 1ULL << bit;
+    return true;
+}
+
+struct chan_slot_t {
+    channel_wp ch;
+    uint32_t gen = 1;
+};
+
+static thread_local int shard_idx;
+static thread_local std::vector<client_slot_t> client_slots;
+static thread_local std::vector<uint32_t> free_client_slots;
+static thread_local std::vector<chan_slot_t> chan_slots;
+static thread_local std::vector<uint32_t> free_chan_slots;
+static uint64_t node_id;                    /* random, the origins of our channels start from it */
+static thread_local uint64_t chan_created;  /* a channel made again has a new origin, it's seqs restart */
+
+static thread_local std::map<std::string, int32_t> chan_handles;
+static thread_local std::vector<std::string_view> topic_levels; /* only used while splitting a topic */
+
+/* the retentions, by the name of their channel, they outlive the channels */
+static thread_local std::map<std::string, retain_p> chan_retains;
+static std::string retain_dir;
+static thread_local std::map<std::string, std::set<client_wp, std::owner_less<client_wp>>> chan_waiters;
 
-static std::vector <std::pair<client_wp, int64_t>> send_disconnects_vec;
-static co::sem_t send_disconnects_sem;
+/* the id of the client to notify and the id of the client that disconnected */
+static thread_local std::vector<std::pair<int64_t, int64_t>> send_disconnects_vec;
+static thread_local co::sem_t send_disconnects_sem;
 
 struct channel_t {
     std::string name;
-    std::map<int, client_wp> fd2client; /* fd to client */
-    std::map<int64_t, client_wp> id2client; /* id to client */
+    int32_t handle = -1;
+    std::vector<int64_t> members; /* the ids of the clients, in no order */
+    std::vector<int64_t> peers;   /* the ids of the bridges (PMGR_CHAN_PEER), not in members */
+    topic_node_t topics;          /* the subscriptions of the members */
+    retain_p retain;              /* the one of chan_retains with our name, if there is one */
+    std::map<uint64_t, seen_t> seen; /* the forwarded messages we had, by their origin */
+    uint64_t origin = 0;          /* ours in the messages we forward, a new one for each channel */
+    uint64_t fwd_seq = 0;         /* the last seq we forwarded, no gaps so the jumps stay small */
 
     ~channel_t() {
-        channels.erase(name);
+        chan_handles.erase(name);
+        if (handle >= 0) {
+            uint32_t idx = CHAN_HANDLE_SLOT(handle);
+            chan_slots[idx].ch.reset();
+            chan_slots[idx].gen = (chan_slots[idx].gen + 1) & CHAN_GEN_MASK;
+            free_chan_slots.push_back(idx);
+        }
     }
 };
 
+/* the chunks of a sender that are not written yet, the sender is not read while there are too many */
+struct inflight_t {
+    size_t bytes = 0;
+    size_t max_bytes = CHAN_INFLIGHT_DEF;
+    int waiters = 0;
+    co::sem_t sem;
+
+    void wake() {
+        for (int i = 0; i < waiters; i++)
+            sem.rel();
+    }
+
+    void release(size_t len) {
+        bytes -= len;
+        wake();
+    }
+};
+
+using inflight_p = std::shared_ptr<inflight_t>;
+
+/* a message waiting for the writer of a client, if fd is set it is sent after the message and closed */
+struct out_msg_t {
+    msgbuf_p buf;
+    int fd = -1;
+    inflight_p inflight;    /* the one of the sender, for a chunk */
+};
+
+/* the writer is the only one that writes on the socket of a client, everybody else queues */
+struct outq_t {
+    msgq_t<out_msg_t> msgs;
+    msgq_t<out_msg_t> bulk; /* the chunks, written only when there is nothing in msgs */
+    size_t bytes = 0;
+    bool closed = false;
+    int space_waiters = 0;
+    int64_t credits = -1;   /* the messages the client still takes, -1 until it gives credits */
+
+    co::sem_t data_sem;     /* the writer waits here for messages */
+    co::sem_t space_sem;    /* the senders wait here for space or for credits */
+
+    void wake_senders() {
+        for (int i = 0; i < space_waiters; i++)
+            space_sem.rel();
+    }
+
+    ~outq_t() {
+        for (size_t i = 0; i < msgs.size(); i++)
+            if (msgs.at(i).fd >= 0)
+                close(msgs.at(i).fd);
+        for (size_t i = 0; i < bulk.size(); i++)
+            bulk.at(i).inflight->release(bulk.at(i).buf.size());
+    }
+};
+
+using outq_p = std::shared_ptr<outq_t>;
+
+/* the messages of a client that had no reply, see pmgr_chann_ack_t */
+struct ack_state_t {
+    uint64_t seq = 0;           /* the last message of the client */
+    uint64_t acked = 0;         /* the seq of the last ack */
+    uint64_t first_failed = 0;
+    uint32_t failed = 0;
+    uint32_t win_msgs = CHAN_ACK_WIN_MSGS;
+    uint32_t win_ms = CHAN_ACK_WIN_MS;
+    bool timer = false;         /* an ack is already waiting for win_ms */
+};
+
 struct client_t {
-    int64_t id;
-    int     fd;
-    pid_t   pid;
+    int64_t id = 0;
+    int     fd = -1;
+    pid_t   pid = -1;
+    int32_t flags = 0;  /* pmgr_chan_flags_e, from the registration */
+    std::string peer_addr;  /* the chanmgr we connected to, for a bridge that we made */
 
     channel_p ch;
+    size_t member_idx = 0;  /* our place in ch->members */
     co::sem_t wait_ch_sem;
-    co::sem_t write_sem{1};
+    outq_p outq = std::make_shared<outq_t>();
 
     pmgr_task_t task = {};
     pmgr_chann_identity_t ident = {};
+    pmgr_chan_shm_p shm;    /* the rings, if the client asked for them */
+    ack_state_t ack;
+    inflight_p inflight = std::make_shared<inflight_t>();
 
-    std::set<client_wp, std::owner_less<client_wp>> discon_list;
+    std::set<int64_t> discon_list;  /* the ids of the clients that want to know when we leave */
+    std::set<std::string> topics;   /* what we subscribed to */
 
     ~client_t() {
+        outq->closed = true;
+        outq->data_sem.rel();
+        outq->wake_senders();
+        if (shm) {
+            /* wakes the coroutines that wait on the rings, they see that it's closed */
+            uint64_t one = 1;
+            shm->closed = true;
+            if (write(shm->rx.efd, &one, sizeof(one)) < 0 || write(shm->tx.efd, &one, sizeof(one)) < 0)
+                DBG("Failed to wake the rings");
+        }
         if (ch) {
-            ch->fd2client.erase(fd);
-            ch->id2client.erase(id);
+            channel_leave();
             close(fd);
         }
-        for (auto _client : discon_list) {
-            send_disconnects_vec.push_back({_client, id});
+        if (id) {
+            uint32_t idx = id & 0xffffffff;
+            client_slots[idx].client = NULL;
+            client_slots[idx].gen = client_slots[idx].gen % 0x7fffffff + 1; /* ids stay positive */
+            free_client_slots.push_back(idx);
+        }
+        for (auto listener : discon_list) {
+            send_disconnects_vec.push_back({listener, id});
             send_disconnects_sem.rel();
         }
     }
+
+    void channel_join(channel_p chan);
+    void channel_leave();
 };
 
+static client_t *client_find(int64_t id) {
+    uint64_t idx = (uint64_t)id & 0xffffffff;
+    if (id <= 0 || idx >= client_slots.size())
+        return NULL;
+    auto &slot = client_slots[idx];
+    return (slot.client && slot.gen == ((uint64_t)id >> 32)) ? slot.client : NULL;
+}
+
+/* the client only if it is in chan */
+static client_t *client_find(int64_t id, const channel_p &chan) {
+    client_t *ret = client_find(id);
+    return (ret && ret->ch == chan) ? ret : NULL;
+}
+
+static int64_t client_slot_get(client_t *client) {
+    uint32_t idx;
+    if (free_client_slots.size()) {
+        idx = free_client_slots.back();
+        free_client_slots.pop_back();
+    }
+    else {
+        idx = client_slots.size();
+        client_slots.push_back(client_slot_t{});
+    }
+    client_slots[idx].client = client;
+    return ((int64_t)client_slots[idx].gen << 32) | idx;
+}
+
+static channel_p channel_find(const std::string &name) {
+    if (!HAS(chan_handles, name))
+        return nullptr;
+    return chan_slots[CHAN_HANDLE_SLOT(chan_handles[name])].ch.lock();
+}
+
+static channel_p channel_create(const std::string &name) {
+    uint32_t idx;
+    if (free_chan_slots.size()) {
+        idx = free_chan_slots.back();
+        free_chan_slots.pop_back();
+    }
+    else if (chan_slots.size() <= CHAN_HANDLE_SLOT(CHAN_HANDLE_MASK)) {
+        idx = chan_slots.size();
+        chan_slots.push_back(chan_slot_t{});
+    }
+    else {
+        DBG("Too many channels");
+        return nullptr;
+    }
+    auto chan = std::make_shared<channel_t>();
+    chan->name = name;
+    chan->handle = (chan_slots[idx].gen << CHAN_HANDLE_BITS) | (idx << CHAN_SHARD_BITS) | shard_idx;
+    chan->origin = node_id + (++chan_created << CHAN_SHARD_BITS) + shard_idx;
+    chan_slots[idx].ch = chan;
+    chan_handles[name] = chan->handle;
+    if (HAS(chan_retains, name))
+        chan->retain = chan_retains[name];
+    return chan;
+}
+
+/* a bridge goes in the peers of the channel instead of the members */
+void client_t::channel_join(channel_p chan) {
+    ch = chan;
+    auto &list = (flags & PMGR_CHAN_PEER) ? ch->peers : ch->members;
+    member_idx = list.size();
+    list.push_back(id);
+}
+
+/* the last member takes our place */
+void client_t::channel_leave() {
+    for (auto &topic : topics)
+        if (topic_split(topic, true, topic_levels))
+            topic_unsub(&ch->topics, topic_levels, id);
+    topics.clear();
+
+    auto &list = (flags & PMGR_CHAN_PEER) ? ch->peers : ch->members;
+    int64_t last = list.back();
+    list[member_idx] = last;
+    list.pop_back();
+    if (client_t *moved = client_find(last); moved && moved != this)
+        moved->member_idx = member_idx;
+
+    /* nothing is forwarded to us without a bridge, the origins start over when one comes back */
+    if ((flags & PMGR_CHAN_PEER) && ch->peers.empty())
+        ch->seen.clear();
+}
+
 static std::string parent_sock;
 static std::string parent_dir;
-static int64_t last_client_id = 1;
-static int procmgr_fd = -1;
-
-/* we use this to make sure that all our messages arive in one piece at our destination */
-co::task_t write_msg(client_p client, const void *data, size_t len) {
-    co_await client->write_sem;
-    ASSERT_COFN(co_await co::write_sz(client->fd, data, len));
-    client->write_sem.rel();
+static std::string sock_path;
+static thread_local pmgr_client_p procmgr;
+
+static int tcp_port = PMGR_CHAN_TCP_PORT;
+
+/* a client that the main thread accepted and that the worker of it's channel takes from here on,
+the main thread doesn't touch the fd after it pushed it */
+struct handoff_t {
+    int fd = -1;
+    pid_t pid = -1;
+    pmgr_chann_t regmsg;
+};
+
+struct shard_t {
+    mpscq_t<handoff_t> inbox;
+    std::thread th;
+};
+
+static std::vector<std::unique_ptr<shard_t>> shards;
+
+static int shard_of(const char *chan_name) {
+    return std::hash<std::string_view>{}(chan_name) % shards.size();
+}
+
+/* the options of a tcp connection, the buffers are also set on the listening socket, as the window
+scaling is picked before accept */
+static int tcp_tune(int fd, bool listening = false) {
+    int one = 1, buf = CHAN_TCP_BUF;
+    ASSERT_FN(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf)));
+    ASSERT_FN(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf)));
+    if (listening)
+        return 0;
+
+    int idle = CHAN_TCP_KEEPIDLE, intvl = CHAN_TCP_KEEPINTVL, cnt = CHAN_TCP_KEEPCNT;
+    ASSERT_FN(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)));
+    ASSERT_FN(setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)));
+    ASSERT_FN(setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)));
+    ASSERT_FN(setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl)));
+    ASSERT_FN(setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt)));
+    return 0;
+}
+
+/* queues without looking at the size of the queue, for the replies and for what chanmgr itself sends,
+the buffer is only referenced and fd is duplicated. A chunk counts in the inflight of it's sender
+until it's written */
+void queue_msg(client_t *client, msgbuf_p buf, int fd = -1, inflight_p inflight = nullptr) {
+    out_msg_t m;
+    m.buf = std::move(buf);
+    if (fd >= 0 && (m.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0)
+        DBG("Failed to duplicate the fd");
+    client->outq->bytes += m.buf.size();
+    if (inflight) {
+        inflight->bytes += m.buf.size();
+        m.inflight = std::move(inflight);
+        client->outq->bulk.push_back(std::move(m));
+    }
+    else {
+        client->outq->msgs.push_back(std::move(m));
+    }
+    client->outq->data_sem.rel();
+}
+
+void queue_msg(client_t *client, const void *data, size_t len) {
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+    msgbuf_p buf = msgbuf_get(&iov, 1);
+    if (!buf) {
+        DBG("Failed to allocate a message buffer");
+        return ;
+    }
+    queue_msg(client, std::move(buf));
+}
+
+/* a message from another client, it goes through the ring of dst if it has one, else through it's
+queue, if there is no space the flags of dst decide what happens. dst is looked up again after
+waiting, as it can go away. buf holds the message (the one iov points to) or it is made here when a
+queue first needs it, so that all the queues share it */
+co::task_t send_msg(int64_t dst_id, const struct iovec *iov, int cnt, msgbuf_p &buf, int fd = -1,
+        inflight_p inflight = nullptr) {
+    client_t *dst = client_find(dst_id);
+    if (!dst) {
+        DBG("The destination is gone");
+        co_return -1;
+    }
+    int32_t flags = dst->flags;
+    int dst_fd = dst->fd;
+    outq_p q = dst->outq;
+
+    /* a client that gave credits takes only that many messages, the ones that are dropped use
+    their credit too */
+    if (!q->credits) {
+        if (flags & (PMGR_CHAN_QDROP | PMGR_CHAN_QDISCON)) {
+            DBG("No credits, %s", (flags & PMGR_CHAN_QDROP) ? "dropping the message" : "disconnecting");
+            if (flags & PMGR_CHAN_QDISCON)
+                shutdown(dst_fd, SHUT_RDWR);
+            co_return -1;
+        }
+
+        while (!q->credits && !q->closed) {
+            q->space_waiters++;
+            co_await q->space_sem;
+            q->space_waiters--;
+        }
+        if (!(dst = client_find(dst_id))) {
+            DBG("The destination is gone");
+            co_return -1;
+        }
+    }
+    if (q->credits > 0)
+        q->credits--;
+
+    /* the chunks always go through the queue, to wait behind the small messages and to be counted
+    in the inflight of their sender */
+    if (dst->shm && fd < 0 && !inflight) {
+        pmgr_chan_shm_p shm = dst->shm;
+
+        co_await shm->tx_sem;
+        FnScope scope([shm]{ shm->tx_sem.rel(); });
+        if (!(flags & (PMGR_CHAN_QDROP | PMGR_CHAN_QDISCON)))
+            co_return co_await co_pmgr_ring_push(shm, &shm->tx, iov, cnt);
+
+        int64_t ret;
+        ASSERT_COFN(ret = pmgr_ring_push(shm->tx, iov, cnt));
+        if (ret)
+            co_return 0;
+        DBG("Ring full, %s", (flags & PMGR_CHAN_QDROP) ? "dropping the message" : "disconnecting");
+        if (flags & PMGR_CHAN_QDISCON)
+            shutdown(dst_fd, SHUT_RDWR);
+        co_return -1;
+    }
+
+    if (q->bytes >= CHAN_OUTQ_MAX_BYTES) {
+        if (flags & (PMGR_CHAN_QDROP | PMGR_CHAN_QDISCON)) {
+            DBG("Queue full, %s", (flags & PMGR_CHAN_QDROP) ? "dropping the message" : "disconnecting");
+            if (flags & PMGR_CHAN_QDISCON)
+                shutdown(dst_fd, SHUT_RDWR);
+            co_return -1;
+        }
+
+        while (q->bytes >= CHAN_OUTQ_MAX_BYTES && !q->closed) {
+            q->space_waiters++;
+            co_await q->space_sem;
+            q->space_waiters--;
+        }
+        if (!(dst = client_find(dst_id))) {
+            DBG("The destination is gone");
+            co_return -1;
+        }
+    }
+    if (!buf && !(buf = msgbuf_get(iov, cnt))) {
+        DBG("Failed to allocate a message buffer");
+        co_return -1;
+    }
+    queue_msg(dst, buf, fd, inflight);
     co_return 0;
 }
 
-co::task_t send_fd(client_p client, int target_fd, pmgr_chann_msg_t *msg) {
-    co_await client->write_sem;
-    ASSERT_COFN(co_await co::write_sz(client->fd, msg, sizeof(*msg)));
-    ASSERT_COFN(co_await co::wait_event(client->fd, EPOLLOUT));
-    ASSERT_COFN(pmgr_send_fd(client->fd, target_fd));
-    client->write_sem.rel();
+/* sends a message of chan to it's bridges, except to the one it came from (from_id), buf is made
+once, as in send_msg. A bridge that can't take it is only logged, the clients of the channel already
+got the message */
+co::task_t co_chan_forward(channel_p chan, const struct iovec *iov, int cnt, msgbuf_p &buf,
+        int64_t from_id) {
+    if (chan->peers.empty())
+        co_return 0;
+    std::vector<int64_t> peers = chan->peers;
+    for (int64_t peer_id : peers)
+        if (peer_id != from_id && co_await send_msg(peer_id, iov, cnt, buf) < 0)
+            DBG("Failed to forward message...");
+    co_return 0;
+}
+
+/* writes the queue of a client, as many messages as it can in one call, stops at the first one that
+has a fd, as the fd is sent by itself after it. The chunks are written one at a time and only when
+there is nothing else, so the small messages wait for at most one chunk */
+co::task_t co_client_writer(client_wp _client, outq_p q, int fd) {
+    std::vector<struct iovec> iov;
+    size_t off = 0; /* what was already written from the first message of mq */
+    msgq_t<out_msg_t> *mq = &q->msgs;
+    while (true) {
+        if (q->closed)
+            co_return 0;
+        if (q->msgs.empty() && q->bulk.empty()) {
+            co_await q->data_sem;
+            continue;
+        }
+
+        /* a message that was partly written is finished first */
+        if (!off)
+            mq = q->msgs.empty() ? &q->bulk : &q->msgs;
+        size_t max_iov = (mq == &q->bulk) ? 1 : CHAN_WRITEV_MAX;
+
+        /* the client (and so the fd) is kept while writing, if the peer is gone the write fails */
+        client_p client = _client.lock();
+        if (!client)
+            co_return 0;
+        FnScope err_scope([fd]{ shutdown(fd, SHUT_RDWR); });
+
+        iov.clear();
+        size_t n = 0;
+        for (; n < mq->size(); n++) {
+            auto &m = mq->at(n);
+            size_t skip = n ? 0 : off;
+            if (m.buf)
+                iov.push_back({ .iov_base = m.buf.data() + skip, .iov_len = m.buf.size() - skip });
+            if (m.fd >= 0 || iov.size() >= max_iov) {
+                n++;
+                break;
+            }
+        }
+
+        /* on tcp, if more messages follow right away, they go in the same segments */
+        bool more = (n < mq->size() && mq->at(n - 1).fd < 0) || (mq == &q->msgs && !q->bulk.empty());
+        struct msghdr mh = {};
+        mh.msg_iov = iov.data();
+        mh.msg_iovlen = iov.size();
+        ssize_t ret = sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            ASSERT_COFN(co_await co::wait_event(fd, EPOLLOUT));
+            err_scope.disable();
+            continue;
+        }
+        ASSERT_COFN(ret);
+
+        off += ret;
+        while (mq->size() && off >= mq->front().buf.size()) {
+            if (mq->front().fd >= 0) {
+                ASSERT_COFN(co_await co::wait_event(fd, EPOLLOUT));
+                /* taken after the wait, the queue may have grown and moved meanwhile */
+                auto &m = mq->front();
+                int sret = pmgr_send_fd(fd, m.fd);
+                close(m.fd);
+                m.fd = -1;
+                ASSERT_COFN(sret);
+            }
+            size_t len = mq->front().buf.size();
+            if (mq->front().inflight)
+                mq->front().inflight->release(len);
+            off -= len;
+            q->bytes -= len;
+            mq->pop_front();
+        }
+
+        if (q->bytes < CHAN_OUTQ_MAX_BYTES)
+            q->wake_senders();
+        err_scope.disable();
+    }
     co_return 0;
 }
 
+static int create_shm(uint32_t ring_size, pmgr_chan_shm_p *shm, int *memfd) {
+    int fd, efd0, efd1;
+    ring_size = pmgr_ring_round_size(ring_size);
+
+    ASSERT_FN(fd = memfd_create("pmgr_chan", MFD_CLOEXEC));
+    FnScope scope([fd]{ close(fd); });
+    ASSERT_FN(ftruncate(fd, PMGR_RING_SHM_SIZE(ring_size)));
+
+    ASSERT_FN(efd0 = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if ((efd1 = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        close(efd0);
+        DBG("Failed to create the eventfd");
+        return -1;
+    }
+
+    auto ret = std::make_shared<pmgr_chan_shm_t>();
+    ASSERT_FN(pmgr_chan_shm_map(ret, fd, ring_size, efd0, efd1, true));
+
+    scope.disable();
+    *memfd = fd;
+    *shm = ret;
+    return 0;
+}
+
+/* the topic of a PMGR_CHAN_TOPIC message, from the start of it's content, false if it has none */
+static bool msg_topic(const struct iovec *content, int cnt, char (&topic)[PMGR_CHAN_MAX_TOPIC]) {
+    size_t len = 0;
+    for (int i = 0; i < cnt && len < sizeof(topic); i++) {
+        size_t n = std::min(content[i].iov_len, sizeof(topic) - len);
+        memcpy(topic + len, content[i].iov_base, n);
+        len += n;
+    }
+    return memchr(topic, 0, len) != NULL;
+}
+
+/* a copy, as the channel can change while we wait to send: the subscribers of the topic for a
+PMGR_CHAN_TOPIC (topic can be NULL if the message has none), the others for a broadcast, else dst_id
+if it is in the channel and it's not us or a bridge. -1 if the topic is not valid */
+static int msg_dsts(client_t *client, const pmgr_chann_msg_t *msg, const char *topic,
+        std::vector<int64_t> &ret) {
+    ret.clear();
+    if (msg->flags & PMGR_CHAN_TOPIC) {
+        if (!topic || !topic_split(topic, false, topic_levels))
+            return -1;
+        topic_match(&client->ch->topics, topic_levels, ret);
+
+        /* once for each subscriber, even if more of it's patterns match */
+        std::sort(ret.begin(), ret.end());
+        ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+        ret.erase(std::remove(ret.begin(), ret.end(), client->id), ret.end());
+    }
+    else if (msg->flags & PMGR_CHAN_BCAST) {
+        for (int64_t id : client->ch->members)
+            if (id != client->id)
+                ret.push_back(id);
+    }
+    else if (client_t *dst = client_find(msg->dst_id, client->ch);
+            dst && dst != client && !(dst->flags & PMGR_CHAN_PEER)) {
+        ret.push_back(msg->dst_id);
+    }
+    return 0;
+}
+
+/* keeps a PMGR_CHAN_RETAIN message in the retention of the channel, buf is made if it's not yet */
+static void msg_retain(client_t *client, const pmgr_chann_msg_t *msg, const struct iovec *iov, int cnt,
+        msgbuf_p &buf) {
+    retain_p r = client->ch->retain;
+    if (!r || !(msg->flags & PMGR_CHAN_RETAIN) || !(msg->flags & (PMGR_CHAN_BCAST | PMGR_CHAN_TOPIC)))
+        return ;
+    if (!buf && !(buf = msgbuf_get(iov, cnt))) {
+        DBG("Failed to allocate a message buffer");
+        return ;
+    }
+    retain_push(r.get(), buf);
+}
+
+/* sets the retention of the channel, it's kept by the name of the channel */
+static int chan_retention(channel_p chan, const pmgr_chann_retention_t *msg) {
+    std::string path = retain_dir + retain_file_name(chan->name);
+    if (!msg->max_msgs) {
+        chan_retains.erase(chan->name);
+        chan->retain = nullptr;
+        if (unlink(path.c_str()) < 0 && errno != ENOENT)
+            DBG("Failed to remove the retention file");
+        return 0;
+    }
+    if (!msg->max_bytes || msg->max_bytes > RETAIN_MAX_BYTES) {
+        DBG("Invalid retention size");
+        return -1;
+    }
+
+    retain_p r = chan->retain ? chan->retain : std::make_shared<retain_t>();
+    bool resized = r->mem && retain_ring_size(msg->max_bytes) != r->wr.size;
+    r->max_msgs = msg->max_msgs;
+    r->max_ms = msg->max_ms;
+    r->max_bytes = msg->max_bytes;
+    retain_trim(r.get());
+    chan->retain = r;
+    chan_retains[chan->name] = r;
+
+    if (!msg->persist) {
+        if (r->mem) {
+            retain_unmap(r.get());
+            unlink(path.c_str());
+        }
+        return 0;
+    }
+    if (r->mem && !resized) {
+        r->fhdr()->max_msgs = r->max_msgs;
+        r->fhdr()->max_ms = r->max_ms;
+        r->fhdr()->max_bytes = r->max_bytes;
+        return 0;
+    }
+    if (mkdir(retain_dir.c_str(), 0777) < 0 && errno != EEXIST) {
+        DBG("Failed to create the retention directory");
+        return -1;
+    }
+    return retain_persist(r.get(), path, chan->name);
+}
+
+/* a retained message is replayed to a client if it's not for a topic or if we subscribed to it */
+static bool retained_for(client_t *client, const msgbuf_p &buf, std::vector<int64_t> &subs) {
+    auto msg = (pmgr_chann_msg_t *)buf.data();
+    if (!(msg->flags & PMGR_CHAN_TOPIC))
+        return true;
+    char topic[PMGR_CHAN_MAX_TOPIC];
+    struct iovec content = { .iov_base = msg + 1, .iov_len = msg->hdr.size - sizeof(*msg) };
+    if (!msg_topic(&content, 1, topic) || !topic_split(topic, false, topic_levels))
+        return false;
+    subs.clear();
+    topic_match(&client->ch->topics, topic_levels, subs);
+    return std::find(subs.begin(), subs.end(), client->id) != subs.end();
+}
+
+/* queues the retained messages from seq from on, see pmgr_chann_replay_t */
+static int chan_replay(client_t *client, uint64_t from) {
+    pmgr_chann_replay_t mark{
+        .hdr = {
+            .size = sizeof(pmgr_chann_replay_t),
+            .type = PMGR_CHAN_REPLAY,
+        },
+        .seq = 0,
+        .time_ms = 0,
+    };
+    retain_p r = client->ch->retain;
+    if (!r) {
+        queue_msg(client, &mark, sizeof(mark));
+        return -1;
+    }
+
+    retain_trim(r.get());
+    std::vector<int64_t> subs;
+    int ret = 0;
+    for (size_t i = 0; i < r->msgs.size(); i++) {
+        auto &m = r->msgs.at(i);
+        if (m.seq < from || !retained_for(client, m.buf, subs))
+            continue;
+        mark.seq = m.seq;
+        mark.time_ms = m.time_ms;
+        queue_msg(client, &mark, sizeof(mark));
+        queue_msg(client, m.buf);
+        ret++;
+    }
+    uint64_t oldest = r->msgs.size() ? r->msgs.front().seq : r->next_seq;
+    if (from && from < oldest)
+        ret = -1;
+
+    mark.seq = r->next_seq;
+    mark.time_ms = 0;
+    queue_msg(client, &mark, sizeof(mark));
+    return ret;
+}
+
+/* the retentions that were persistent when chanmgr stopped, the ones of this worker's channels */
+static void retain_load_shard() {
+    DIR *d = opendir(retain_dir.c_str());
+    if (!d)
+        return ;
+    while (struct dirent *ent = readdir(d)) {
+        std::string fname = ent->d_name;
+        if (fname.size() < 4 || fname.substr(fname.size() - 4) != ".ret")
+            continue;
+        /* the other workers load their own files, only the header is read to know whose it is */
+        retain_file_hdr_t fhdr;
+        if (retain_read_hdr(retain_dir + fname, &fhdr) < 0 || shard_of(fhdr.chan_name) != shard_idx)
+            continue;
+        std::string chan_name = fhdr.chan_name;
+        if (retain_p r = retain_load(retain_dir + fname, fhdr)) {
+            DBG("Loaded the retention of %s: %zu messages", chan_name.c_str(), r->msgs.size());
+            chan_retains[chan_name] = r;
+        }
+    }
+    closedir(d);
+}
+
+/* counts the message and returns how it's acked, 0 if it has a reply, the flags of the message win
+over the ones of the registration */
+static int32_t msg_ack_mode(client_t *client, const pmgr_chann_msg_t *msg) {
+    client->ack.seq++;
+    int32_t mode = msg->flags & (PMGR_CHAN_NOACK | PMGR_CHAN_WACK);
+    return mode ? mode : client->flags & (PMGR_CHAN_NOACK | PMGR_CHAN_WACK);
+}
+
+/* the messages that a client sends through it's ring, only PMGR_CHAN_MESSAGE and without a reply */
+co::task_t co_client_ring(int64_t client_id, pmgr_chan_shm_p shm) {
+    std::vector<int64_t> dsts;
+    while (true) {
+        struct iovec iov[2];
+        int len = co_await co_pmgr_ring_peek(shm, &shm->rx, iov);
+
+        client_t *client = client_find(client_id);
+        if (!client || shm->closed)
+            co_return 0;
+
+        /* the client can write the ring while we read it, so the header we look at and send is
+        our own copy and only the content comes from the ring */
+        pmgr_chann_msg_t msg;
+        if (len >= (int)sizeof(msg)) {
+            size_t first = std::min(sizeof(msg), iov[0].iov_len);
+            memcpy(&msg, iov[0].iov_base, first);
+            memcpy((uint8_t *)&msg + first, iov[1].iov_base, sizeof(msg) - first);
+        }
+        if (len < (int)sizeof(msg) || msg.hdr.size != len || msg.hdr.type != PMGR_CHAN_MESSAGE) {
+            DBG("Broken ring, dropping the client");
+            shutdown(client->fd, SHUT_RDWR);
+            co_return -1;
+        }
+
+        struct iovec fwd[3] = {{ .iov_base = &msg, .iov_len = sizeof(msg) }};
+        int fwd_cnt = 1;
+        size_t skip = sizeof(msg);
+        for (int i = 0; i < 2; i++) {
+            if (iov[i].iov_len > skip)
+                fwd[fwd_cnt++] = {
+                    .iov_base = (uint8_t *)iov[i].iov_base + skip,
+                    .iov_len = iov[i].iov_len - skip
+                };
+            skip -= std::min(skip, iov[i].iov_len);
+        }
+
+        char topic[PMGR_CHAN_MAX_TOPIC];
+        bool has_topic = msg_topic(fwd + 1, fwd_cnt - 1, topic);
+        if (msg_dsts(client, &msg, has_topic ? topic : NULL, dsts) < 0)
+            DBG("Invalid topic");
+
+        /* copied out of the ring only if a client without a ring or the retention needs it */
+        msgbuf_p buf;
+        channel_p chan = client->ch;
+        msg_retain(client, &msg, fwd, fwd_cnt, buf);
+        for (int64_t dst_id : dsts)
+            if (co_await send_msg(dst_id, fwd, fwd_cnt, buf) < 0)
+                DBG("Failed to send message...");
+
+        /* and to the bridges, as the ones from the socket, the content is still in the ring */
+        if ((msg.flags & (PMGR_CHAN_BCAST | PMGR_CHAN_TOPIC)) && chan && chan->peers.size()) {
+            pmgr_chann_fwd_t fwd_msg{
+                .hdr = {
+                    .size = (int32_t)(sizeof(pmgr_chann_fwd_t) + len),
+                    .type = PMGR_CHAN_FWD,
+                },
+                .origin = chan->origin,
+                .seq = ++chan->fwd_seq,
+                .hops = 0,
+            };
+            struct iovec fwd_iov[4] = {{ .iov_base = &fwd_msg, .iov_len = sizeof(fwd_msg) }};
+            for (int i = 0; i < fwd_cnt; i++)
+                fwd_iov[i + 1] = fwd[i];
+            msgbuf_p fwd_buf;
+            co_await co_chan_forward(chan, fwd_iov, fwd_cnt + 1, fwd_buf, 0);
+        }
+
+        pmgr_ring_pop(shm->rx, len);
+    }
+    co_return 0;
+}
+
+static void client_ack_send(client_t *client) {
+    auto &a = client->ack;
+    pmgr_chann_ack_t msg{
+        .hdr = {
+            .size = sizeof(pmgr_chann_ack_t),
+            .type = PMGR_CHAN_ACK,
+        },
+        .seq = a.seq,
+        .first_failed = a.first_failed,
+        .failed = a.failed,
+    };
+    a.acked = a.seq;
+    a.first_failed = 0;
+    a.failed = 0;
+    queue_msg(client, &msg, sizeof(msg));
+}
+
+/* the ack of a window that didn't fill in win_ms */
+co::task_t co_client_ack_timer(int64_t client_id, uint32_t ms) {
+    co_await co::sleep_ms(ms);
+    client_t *client = client_find(client_id);
+    if (!client)
+        co_return 0;
+    client->ack.timer = false;
+    if (client->ack.acked != client->ack.seq)
+        client_ack_send(client);
+    co_return 0;
+}
+
+/* a message without a reply was handled, returns true if the ack timer must be started */
+static bool client_ack_count(client_t *client, int32_t mode, bool failed) {
+    auto &a = client->ack;
+    if (failed && !a.failed++)
+        a.first_failed = a.seq;
+    if (!(mode & PMGR_CHAN_WACK))
+        return false;
+    if (a.win_msgs && a.seq - a.acked >= a.win_msgs) {
+        client_ack_send(client);
+        return false;
+    }
+    if (!a.win_ms || a.timer)
+        return false;
+    a.timer = true;
+    return true;
+}
+
 co::task_t co_send_disconnects() {
     DBG_SCOPE();
     while (true) {
@@ -87,8 +941,8 @@ co::task_t co_send_disconnects() {
         auto veccpy = send_disconnects_vec;
         send_disconnects_vec.clear();
 
-        for (auto [_client, id] : veccpy) {
-            if (client_p client = _client.lock()) {
+        for (auto [listener, id] : veccpy) {
+            if (client_t *client = client_find(listener)) {
                 pmgr_chann_msg_t msg{
                     .hdr = {
                         .size = sizeof(pmgr_chann_msg_t),
@@ -96,7 +950,7 @@ co::task_t co_send_disconnects() {
                     },
                     .dst_id = id,
                 };
-                ASSERT_COFN(co_await write_msg(client, &msg, sizeof(msg)));
+                queue_msg(client, &msg, sizeof(msg));
             }
         }
     }
@@ -109,6 +963,68 @@ co::task_t co_send_disconnects() {
         co_return -1; \
     } \
 }
+/* a chunk is routed as a pmgr_chann_msg_t */
+static_assert(offsetof(pmgr_chann_chunk_t, dst_id) == offsetof(pmgr_chann_msg_t, dst_id));
+
+co::task_t co_client_messaging(client_p client);
+
+/* connects chan to the chanmgr at addr, the connection is then a client of chan with PMGR_CHAN_PEER,
+on both sides */
+co::task_t co_chan_bridge(channel_p chan, const char *addr) {
+    for (int64_t peer_id : chan->peers)
+        if (client_t *peer = client_find(peer_id); peer && peer->peer_addr == addr)
+            co_return 0;
+
+    std::string host = addr;
+    size_t colon = host.rfind(':');
+    int port = colon == host.npos ? 0 : atoi(host.c_str() + colon + 1);
+    struct sockaddr_in sa = {};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (colon == host.npos || port <= 0 || port > 0xffff ||
+            inet_pton(AF_INET, host.substr(0, colon).c_str(), &sa.sin_addr) != 1) {
+        DBG("Invalid bridge address: %s", addr);
+        co_return -1;
+    }
+
+    int fd;
+    ASSERT_COFN(fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    FnScope err_scope([fd]{ close(fd); });
+    ASSERT_COFN(tcp_tune(fd));
+    ASSERT_COFN(co_await co::connect(fd, (struct sockaddr *)&sa, sizeof(sa)));
+
+    pmgr_chann_t regmsg = {
+        .hdr = {
+            .size = sizeof(pmgr_chann_t),
+            .type = PMGR_CHAN_REGISTER,
+        },
+        .flags = pmgr_chan_flags_e(PMGR_CHAN_CREAT | PMGR_CHAN_PEER),
+    };
+    strncpy(regmsg.chan_name, chan->name.c_str(), PMGR_MAX_TASK_NAME - 1);
+    ASSERT_COFN(co_await co::write_sz(fd, &regmsg, sizeof(regmsg)));
+
+    pmgr_return_t retmsg;
+    ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, &retmsg, sizeof(retmsg)) == sizeof(retmsg)));
+    if (retmsg.hdr.type != PMGR_MSG_RETVAL || retmsg.retval < 0) {
+        DBG("The chanmgr at %s refused the bridge", addr);
+        co_return -1;
+    }
+
+    /* the same as a registered client from here on, but it only forwards */
+    client_p peer = std::make_shared<client_t>();
+    peer->id = client_slot_get(peer.get());
+    peer->fd = fd;
+    peer->flags = PMGR_CHAN_PEER;
+    peer->peer_addr = addr;
+    peer->channel_join(chan);
+    err_scope.disable();
+
+    co_await co::sched(co_client_writer(peer, peer->outq, fd));
+    co_await co::sched(co_client_messaging(peer));
+    DBG("Bridged %s to %s", chan->name.c_str(), addr);
+    co_return 0;
+}
+
 co::task_t co_client_messaging(client_p client) {
     pmgr_return_t retmsg{
         .hdr = {
@@ -118,12 +1034,13 @@ co::task_t co_client_messaging(client_p client) {
         .retval = 0,
     };
 
-    std::vector<uint8_t> msg_raw;
+    std::vector<int64_t> dsts;
     channel_p chan;
+    int32_t ack_mode;
 
     while (true) {
-        msg_raw.resize(sizeof(int));
-        ASSERT_COFN(co_await co::read_sz(client->fd, msg_raw.data(), sizeof(int)));
+        int msg_len;
+        ASSERT_COFN(co_await co::read_sz(client->fd, &msg_len, sizeof(int)));
         chan = client->ch;
         if (!chan) {
             DBG("Received a message without a valid channel registration...");
@@ -131,26 +1048,34 @@ co::task_t co_client_messaging(client_p client) {
             co_return 0;
         }
 
-        /* check for a message limit? */
-        int msg_len = *(int *)msg_raw.data();
-        if (msg_len < sizeof(pmgr_hdr_t)) {
+        /* a bigger message couldn't be received by the clients anyway, a bridge adds a header */
+        bool is_peer = client->flags & PMGR_CHAN_PEER;
+        if (msg_len < sizeof(pmgr_hdr_t) ||
+                msg_len > PMGR_CHAN_MAX_MSG + (is_peer ? sizeof(pmgr_chann_fwd_t) : 0)) {
             DBG("Invalid message size");
             co_return -1;
         }
-        msg_raw.resize(msg_len);
+        msgbuf_p buf = msgbuf_get(msg_len);
+        if (!buf) {
+            DBG("Failed to allocate a message buffer");
+            co_return -1;
+        }
+        memcpy(buf.data(), &msg_len, sizeof(int));
         int rest = msg_len - sizeof(int);
         ASSERT_COFN(CHK_BOOL(
-                co_await co::read_sz(client->fd, msg_raw.data() + sizeof(int), rest) == rest));
+                co_await co::read_sz(client->fd, buf.data() + sizeof(int), rest) == rest));
 
-        auto hdr = (pmgr_hdr_t *)msg_raw.data();
+        auto hdr = (pmgr_hdr_t *)buf.data();
+        if (is_peer != (hdr->type == PMGR_CHAN_FWD)) {
+            DBG("Only the bridges forward, and they only forward");
+            co_return -1;
+        }
         /* we now have a valid message from our peer */
         retmsg.retval = 0;
+        ack_mode = 0;
 
-        /* we just got a message, till we respond to it, we aquire the messaging for it, such
-        that the response comes first */
-        co_await client->write_sem;
-        FnScope scope([client]{ client->write_sem.rel(); });
-
+        /* the replies are queued without waiting, so they come in the order of the requests, the
+        messages for other clients can wait for space in their queues */
         switch (hdr->type) {
             case PMGR_CHAN_REGISTER: {
                 DBG("Can't register twice...");
@@ -167,22 +1092,13 @@ co::task_t co_client_messaging(client_p client) {
                 /* we only check for task identity if the task sent us a name, else we consider it
                 an independent process and only check for the  */
                 if (msg->task_name[0] != '\0') {
-                    /* first ask about the task */
-                    msg->hdr.type = PMGR_MSG_GET_PID;
-                    ASSERT_COFN(co_await co::write_sz(procmgr_fd, msg, hdr->size));
-
-                    /* second, receive the header and check if it's a message or a return value */
+                    /* ask procmgr what task has that pid */
                     pmgr_task_t task;
-                    ASSERT_COFN(co_await co::read_sz(procmgr_fd, &task, sizeof(task.hdr)));
-                    if (task.hdr.type != PMGR_MSG_ADD) {
+                    if (co_await co_pmgr_get_task(procmgr, msg->task_pid, &task) < 0) {
                         DBG("Failed to get task");
                         co_return -1;
                     }
-
-                    /* third, read the whole task */
-                    ASSERT_COFN(co_await co::read_sz(procmgr_fd, (uint8_t *)&task + sizeof(task.hdr),
-                            sizeof(task) - sizeof(task.hdr)));
-                    client->task = task; /* valid if header has PMGR_MSG_ADD */
+                    client->task = task;
 
                     if (strncmp(task.task_name, msg->task_name, PMGR_MAX_TASK_NAME) != 0) {
                         DBG("Lied about task name");
@@ -198,49 +1114,112 @@ co::task_t co_client_messaging(client_p client) {
                     co_return -1;
                 }
                 auto msg = (pmgr_chann_msg_t *)hdr;
+                ack_mode = msg_ack_mode(client.get(), msg);
 
-                if (msg->flags & PMGR_CHAN_BCAST) {
-                    for (auto [id, dst_c] : chan->id2client) {
-                        if (id != client->id) {
-                            if (co_await write_msg(dst_c.lock(), msg, hdr->size) < 0) {
-                                DBG("Failed to send message...");
-                                retmsg.retval -= 1;
-                            }
-                        }
-                    }
+                if (!(msg->flags & PMGR_CHAN_BCAST) && msg->dst_id == client->id) {
+                    retmsg.retval = -1;
+                    break;
                 }
-                else {
-                    if (HAS(chan->id2client, msg->dst_id)) {
-                        if (msg->dst_id == client->id) {
-                            retmsg.retval = -1;
-                            break;
-                        }
-                        auto dst_c = chan->id2client[msg->dst_id];
-                        if (co_await write_msg(dst_c.lock(), msg, hdr->size) < 0) {
-                            DBG("Failed to send message...");
-                            retmsg.retval = -1;
-                        }
+
+                /* message for the channel */
+                struct iovec iov = { .iov_base = msg, .iov_len = (size_t)hdr->size };
+                struct iovec content = { .iov_base = msg + 1, .iov_len = hdr->size - sizeof(*msg) };
+                char topic[PMGR_CHAN_MAX_TOPIC];
+                bool has_topic = msg_topic(&content, 1, topic);
+                if (msg_dsts(client.get(), msg, has_topic ? topic : NULL, dsts) < 0) {
+                    DBG("Invalid topic");
+                    retmsg.retval = -1;
+                    break;
+                }
+                msg_retain(client.get(), msg, &iov, 1, buf);
+                for (int64_t dst_id : dsts) {
+                    if (co_await send_msg(dst_id, &iov, 1, buf) < 0) {
+                        DBG("Failed to send message...");
+                        retmsg.retval -= 1;
                     }
                 }
-                /* message for the channel */
+
+                if ((msg->flags & (PMGR_CHAN_BCAST | PMGR_CHAN_TOPIC)) && chan->peers.size()) {
+                    pmgr_chann_fwd_t fwd{
+                        .hdr = {
+                            .size = (int32_t)(sizeof(pmgr_chann_fwd_t) + hdr->size),
+                            .type = PMGR_CHAN_FWD,
+                        },
+                        .origin = chan->origin,
+                        .seq = ++chan->fwd_seq,
+                        .hops = 0,
+                    };
+                    struct iovec fwd_iov[2] = {{ .iov_base = &fwd, .iov_len = sizeof(fwd) }, iov };
+                    msgbuf_p fwd_buf;
+                    co_await co_chan_forward(chan, fwd_iov, 2, fwd_buf, 0);
+                }
+            } break;
+            case PMGR_CHAN_FWD: {
+                if (hdr->size < sizeof(pmgr_chann_fwd_t) + sizeof(pmgr_chann_msg_t)) {
+                    DBG("Invalid size");
+                    co_return -1;
+                }
+                auto fwd = (pmgr_chann_fwd_t *)hdr;
+                auto msg = (pmgr_chann_msg_t *)(fwd + 1);
+                if (msg->hdr.size != hdr->size - sizeof(*fwd) || msg->hdr.type != PMGR_CHAN_MESSAGE ||
+                        !(msg->flags & (PMGR_CHAN_BCAST | PMGR_CHAN_TOPIC))) {
+                    DBG("Invalid forwarded message");
+                    co_return -1;
+                }
+
+                /* in a mesh the same message comes on more bridges, and ours come back */
+                if (fwd->origin == chan->origin || !seen_add(chan->seen[fwd->origin], fwd->seq))
+                    continue;
+
+                /* for our clients it comes from the bridge */
+                msg->src_id = client->id;
+                struct iovec iov = { .iov_base = msg, .iov_len = (size_t)msg->hdr.size };
+                struct iovec content = { .iov_base = msg + 1, .iov_len = msg->hdr.size - sizeof(*msg) };
+                char topic[PMGR_CHAN_MAX_TOPIC];
+                bool has_topic = msg_topic(&content, 1, topic);
+                if (msg_dsts(client.get(), msg, has_topic ? topic : NULL, dsts) < 0) {
+                    DBG("Invalid topic");
+                    continue;
+                }
+                msgbuf_p local_buf;
+                msg_retain(client.get(), msg, &iov, 1, local_buf);
+                for (int64_t dst_id : dsts)
+                    if (co_await send_msg(dst_id, &iov, 1, local_buf) < 0)
+                        DBG("Failed to send forwarded message...");
+
+                /* the same buffer goes on to the other bridges */
+                if (++fwd->hops < CHAN_FWD_MAX_HOPS) {
+                    struct iovec fwd_iov = { .iov_base = fwd, .iov_len = (size_t)hdr->size };
+                    co_await co_chan_forward(chan, &fwd_iov, 1, buf, client->id);
+                }
+                continue; /* no reply between chanmgrs */
+            } break;
+            case PMGR_CHAN_BRIDGE: {
+                VALIDATE_SIZE(hdr, pmgr_chann_bridge_t);
+                auto msg = (pmgr_chann_bridge_t *)hdr;
+                if (!memchr(msg->addr, 0, sizeof(msg->addr))) {
+                    retmsg.retval = -1;
+                    break;
+                }
+                retmsg.retval = co_await co_chan_bridge(chan, msg->addr);
             } break;
             case PMGR_CHAN_SELF: {
                 VALIDATE_SIZE(hdr, pmgr_chann_msg_t);
                 auto msg = (pmgr_chann_msg_t *)hdr;
                 msg->src_id = msg->dst_id = client->id;
-                ASSERT_COFN(co_await write_msg(client, msg, hdr->size));
+                queue_msg(client.get(), buf);
             } break;
             case PMGR_CHAN_GET_IDENT: {
                 VALIDATE_SIZE(hdr, pmgr_chann_msg_t);
                 auto msg = (pmgr_chann_msg_t *)hdr;
                 pmgr_chann_identity_t ident = {};
-                if (HAS(chan->id2client, msg->dst_id)) {
-                    ident = chan->id2client[msg->dst_id].lock()->ident;
+                if (client_t *dst = client_find(msg->dst_id, chan)) {
+                    ident = dst->ident;
                 }
                 else {
                     retmsg.retval = -1;
                 }
-                ASSERT_COFN(co_await write_msg(client, &ident, sizeof(ident)));
+                queue_msg(client.get(), &ident, sizeof(ident));
             } break;
             case PMGR_CHAN_SENDFD: {
                 VALIDATE_SIZE(hdr, pmgr_chann_msg_t);
@@ -251,44 +1230,175 @@ co::task_t co_client_messaging(client_p client) {
                 ASSERT_COFN(co_await co::wait_event(client->fd, EPOLLIN));
                 ASSERT_COFN(target_fd = pmgr_recv_fd(client->fd));
                 FnScope scope([target_fd]{ close(target_fd); });
+                ack_mode = msg_ack_mode(client.get(), msg);
 
-                if (msg->flags & PMGR_CHAN_BCAST) {
-                    for (auto [id, dst_c] : chan->id2client) {
-                        if (id != client->id) {
-                            if (co_await send_fd(dst_c.lock(), target_fd, msg) < 0) {
-                                DBG("Failed to send message...");
-                                retmsg.retval -= 1;
-                            }
-                        }
-                    }
+                if (!(msg->flags & PMGR_CHAN_BCAST) && msg->dst_id == client->id) {
+                    retmsg.retval = -1;
+                    break;
                 }
-                else {
-                    if (HAS(chan->id2client, msg->dst_id)) {
-                        if (msg->dst_id == client->id) {
-                            retmsg.retval = -1;
-                            break;
-                        }
-                        auto dst_c = chan->id2client[msg->dst_id];
-                        if (co_await send_fd(dst_c.lock(), target_fd, msg) < 0) {
-                            DBG("Failed to send message...");
-                            retmsg.retval -= 1;
-                        }
+
+                struct iovec iov = { .iov_base = msg, .iov_len = sizeof(*msg) };
+                if (msg_dsts(client.get(), msg, NULL, dsts) < 0) {
+                    DBG("A fd can't have a topic");
+                    retmsg.retval = -1;
+                    break;
+                }
+                for (int64_t dst_id : dsts) {
+                    if (co_await send_msg(dst_id, &iov, 1, buf, target_fd) < 0) {
+                        DBG("Failed to send message...");
+                        retmsg.retval -= 1;
                     }
                 }
             } break;
             case PMGR_CHAN_ON_DISCON: {
                 VALIDATE_SIZE(hdr, pmgr_chann_msg_t);
                 auto msg = (pmgr_chann_msg_t *)hdr;
-                if (HAS(chan->id2client, msg->dst_id)) {
-                    client_p dst_c = chan->id2client[msg->dst_id].lock();
-                    dst_c->discon_list.insert(client);
+                if (client_t *dst = client_find(msg->dst_id, chan)) {
+                    dst->discon_list.insert(client->id);
+                }
+                else {
+                    retmsg.retval = -1;
+                }
+            } break;
+            case PMGR_CHAN_SHM: {
+                VALIDATE_SIZE(hdr, pmgr_chann_shm_t);
+                auto msg = (pmgr_chann_shm_t *)hdr;
+
+                /* the fds can't go over tcp */
+                pmgr_chan_shm_p shm;
+                int memfd = -1;
+                if (client->pid < 0 || client->shm || create_shm(msg->ring_size, &shm, &memfd) < 0) {
+                    msg->ring_size = 0;
+                    retmsg.retval = -1;
+                    queue_msg(client.get(), msg, sizeof(*msg));
+                    break;
+                }
+                FnScope memfd_scope([memfd]{ close(memfd); });
+
+                msg->ring_size = shm->rx.size;
+                queue_msg(client.get(), buf, memfd);
+                queue_msg(client.get(), msgbuf_p(), shm->rx.efd);
+                queue_msg(client.get(), msgbuf_p(), shm->tx.efd);
+                client->shm = shm;
+                co_await co::sched(co_client_ring(client->id, shm));
+            } break;
+            case PMGR_CHAN_ACK_WIN: {
+                VALIDATE_SIZE(hdr, pmgr_chann_ack_win_t);
+                auto msg = (pmgr_chann_ack_win_t *)hdr;
+                client->ack.win_msgs = msg->win_msgs;
+                client->ack.win_ms = msg->win_ms;
+            } break;
+            case PMGR_CHAN_ACK: {
+                VALIDATE_SIZE(hdr, pmgr_chann_ack_t);
+                client_ack_send(client.get());
+            } break;
+            case PMGR_CHAN_CREDIT: {
+                VALIDATE_SIZE(hdr, pmgr_chann_credit_t);
+                auto msg = (pmgr_chann_credit_t *)hdr;
+                if (!msg->dst_id) {
+                    /* our credits, the first ones turn on the flow control */
+                    outq_p q = client->outq;
+                    int64_t have = std::max(q->credits, (int64_t)0);
+                    if (msg->credits < 0 || msg->credits > CHAN_CREDITS_MAX - have) {
+                        retmsg.retval = -1;
+                        break;
+                    }
+                    q->credits = have + msg->credits;
+                    if (q->credits)
+                        q->wake_senders();
+                    break;
+                }
+
+                /* the window of someone else */
+                if (client_t *dst = client_find(msg->dst_id, chan)) {
+                    msg->credits = dst->outq->credits;
                 }
                 else {
+                    msg->credits = -1;
+                    retmsg.retval = -1;
+                }
+                queue_msg(client.get(), buf);
+            } break;
+            case PMGR_CHAN_SUBSCRIBE:
+            case PMGR_CHAN_UNSUBSCRIBE: {
+                VALIDATE_SIZE(hdr, pmgr_chann_topic_t);
+                auto msg = (pmgr_chann_topic_t *)hdr;
+                if (!memchr(msg->topic, 0, sizeof(msg->topic))
+                        || !topic_split(msg->topic, true, topic_levels)) {
+                    DBG("Invalid topic");
+                    retmsg.retval = -1;
+                    break;
+                }
+                if (hdr->type == PMGR_CHAN_UNSUBSCRIBE) {
+                    if (topic_unsub(&chan->topics, topic_levels, client->id))
+                        client->topics.erase(msg->topic);
+                    else
+                        retmsg.retval = -1;
+                    break;
+                }
+                if (client->topics.size() >= CHAN_TOPICS_MAX) {
+                    DBG("Too many topics");
+                    retmsg.retval = -1;
+                    break;
+                }
+                if (topic_sub(&chan->topics, topic_levels, client->id))
+                    client->topics.insert(msg->topic);
+            } break;
+            case PMGR_CHAN_CHUNK: {
+                if (hdr->size < sizeof(pmgr_chann_chunk_t)) {
+                    DBG("Invalid size");
+                    co_return -1;
+                }
+                auto chunk = (pmgr_chann_chunk_t *)hdr;
+                auto msg = (pmgr_chann_msg_t *)hdr; /* the same first fields */
+                ack_mode = msg_ack_mode(client.get(), msg);
+
+                size_t data_len = hdr->size - sizeof(pmgr_chann_chunk_t);
+                if ((chunk->flags & (PMGR_CHAN_TOPIC | PMGR_CHAN_RETAIN)) ||
+                        chunk->offset > chunk->total || chunk->total - chunk->offset < data_len ||
+                        (!(chunk->flags & PMGR_CHAN_BCAST) && chunk->dst_id == client->id)) {
+                    retmsg.retval = -1;
+                    break;
+                }
+
+                /* we stop reading this client while too much of it's chunks wait for the others */
+                inflight_p inflight = client->inflight;
+                while (inflight->bytes && inflight->bytes + hdr->size > inflight->max_bytes) {
+                    inflight->waiters++;
+                    co_await inflight->sem;
+                    inflight->waiters--;
+                }
+
+                struct iovec iov = { .iov_base = chunk, .iov_len = (size_t)hdr->size };
+                msg_dsts(client.get(), msg, NULL, dsts);
+                for (int64_t dst_id : dsts) {
+                    if (co_await send_msg(dst_id, &iov, 1, buf, -1, inflight) < 0) {
+                        DBG("Failed to send chunk...");
+                        retmsg.retval -= 1;
+                    }
+                }
+            } break;
+            case PMGR_CHAN_INFLIGHT: {
+                VALIDATE_SIZE(hdr, pmgr_chann_inflight_t);
+                auto msg = (pmgr_chann_inflight_t *)hdr;
+                if (!msg->max_bytes || msg->max_bytes > CHAN_INFLIGHT_MAX) {
                     retmsg.retval = -1;
+                    break;
                 }
+                client->inflight->max_bytes = msg->max_bytes;
+                client->inflight->wake();
+            } break;
+            case PMGR_CHAN_RETENTION: {
+                VALIDATE_SIZE(hdr, pmgr_chann_retention_t);
+                retmsg.retval = chan_retention(chan, (pmgr_chann_retention_t *)hdr);
+            } break;
+            case PMGR_CHAN_REPLAY: {
+                VALIDATE_SIZE(hdr, pmgr_chann_replay_t);
+                auto msg = (pmgr_chann_replay_t *)hdr;
+                retmsg.retval = chan_replay(client.get(), msg->seq);
             } break;
             case PMGR_CHAN_LIST: {
-                for (auto &[id, _] : chan->id2client) {
+                for (int64_t id : chan->members) {
                     pmgr_chann_msg_t msg {
                         .hdr = {
                             .size = sizeof(pmgr_chann_msg_t),
@@ -296,7 +1406,7 @@ co::task_t co_client_messaging(client_p client) {
                         },
                         .dst_id = id,
                     };
-                    ASSERT_COFN(co_await co::write_sz(client->fd, &msg, sizeof(msg)));
+                    queue_msg(client.get(), &msg, sizeof(msg));
                 }
             } break;
             default: {
@@ -306,22 +1416,22 @@ co::task_t co_client_messaging(client_p client) {
             
         }
 
+        if (ack_mode) {
+            if (client_ack_count(client.get(), ack_mode, retmsg.retval < 0))
+                co_await co::sched(co_client_ack_timer(client->id, client->ack.win_ms));
+            continue;
+        }
+
         /* maybe change it a bit, for example write how many broadcasts succeded, etc. */
-        ASSERT_COFN(co_await co::write_sz(client->fd, &retmsg, retmsg.hdr.size));
-        /* here scope releases the lock */
+        queue_msg(client.get(), &retmsg, retmsg.hdr.size);
     }
     co_return 0;
 }
 
-co::task_t co_client_register(int fd, pid_t pid) {
-    pmgr_chann_t regmsg;
-    pmgr_return_t retmsg{
-        .hdr = {
-            .size = sizeof(pmgr_return_t),
-            .type = PMGR_MSG_RETVAL,
-        },
-        .retval = 0,
-    };
+/* on the main thread, reads the registration and gives the client to the worker of it's channel */
+co::task_t co_client_accept(int fd, pid_t pid) {
+    handoff_t h{ .fd = fd, .pid = pid };
+    pmgr_chann_t &regmsg = h.regmsg;
     FnScope err_scope([fd]{ close(fd); });
 
     int ret = co_await co::read_sz(fd, &regmsg, sizeof(regmsg)); /* TODO: timeo? */
@@ -348,33 +1458,58 @@ co::task_t co_client_register(int fd, pid_t pid) {
     }
     DBG("Channel: %s[flags:%x]", regmsg.chan_name, regmsg.flags);
 
-    client_p client = std::make_shared<client_t>(client_t{
-        .id = last_client_id++,
-        .fd = fd,
-        .pid = pid,
-    });
+    /* the bridges come from other chanmgrs, a local client can't forge forwarded messages */
+    if ((regmsg.flags & PMGR_CHAN_PEER) && pid >= 0) {
+        DBG("A bridge can only come over tcp");
+        co_return -1;
+    }
 
-    co_await co::sched(co_client_messaging(client));
-    channel_p chan;
+    /* the fd leaves the pool of the main thread before the worker adds it to it's own */
+    co_await co::stopfd(fd);
+    err_scope.disable();
+    shards[shard_of(regmsg.chan_name)]->inbox.push(h);
+    co_return 0;
+}
 
-    if (HAS(channels, regmsg.chan_name)) {
+/* on the worker of the channel, the rest of the registration */
+co::task_t co_client_register(handoff_t h) {
+    int fd = h.fd;
+    const pmgr_chann_t &regmsg = h.regmsg;
+    pmgr_return_t retmsg{
+        .hdr = {
+            .size = sizeof(pmgr_return_t),
+            .type = PMGR_MSG_RETVAL,
+        },
+        .retval = 0,
+    };
+    FnScope err_scope([fd]{ close(fd); });
+
+    /* made in place, a temporary would close the queue when destroyed */
+    client_p client = std::make_shared<client_t>();
+    client->id = client_slot_get(client.get());
+    client->fd = fd;
+    client->pid = h.pid;
+    client->flags = regmsg.flags;
+
+    co_await co::sched(co_client_writer(client, client->outq, fd));
+    co_await co::sched(co_client_messaging(client));
+    channel_p chan = channel_find(regmsg.chan_name);
+    if (chan) {
         DBG("Existing channel");
-        chan = channels[regmsg.chan_name].lock();
     }
-
-    if (!chan && (regmsg.flags & PMGR_CHAN_CREAT)) {
+    else if (regmsg.flags & PMGR_CHAN_CREAT) {
         DBG("Will create channel");
-        chan = std::make_shared<channel_t>(channel_t{
-            .name = regmsg.chan_name,
-        });
-        channels[regmsg.chan_name] = chan;
+        chan = channel_create(regmsg.chan_name);
     }
-    else if (!chan && (regmsg.flags & PMGR_CHAN_WAITC)) {
+    else if (regmsg.flags & PMGR_CHAN_WAITC) {
         DBG("Will wait for channel");
         chan_waiters[regmsg.chan_name].insert(client_wp(client));
         co_await client->wait_ch_sem;
+        /* also woken if the client sent something before it got it's channel */
+        chan = channel_find(regmsg.chan_name);
     }
-    else if (!chan) {
+
+    if (!chan) {
         DBG("Failed to get channel");
         co_await co::stopfd(client->fd); /* stop the reading */
 
@@ -392,22 +1527,18 @@ co::task_t co_client_register(int fd, pid_t pid) {
     chan_waiters.erase(chan->name);
 
     /* add the client to this channel */
-    chan->fd2client[fd] = client;
-    chan->id2client[client->id] = client;
-    client->ch = chan;
+    client->channel_join(chan);
 
-    /* notify that channel was aquired */
-    retmsg.retval = 0;
-    ASSERT_COFN(co_await co::write_sz(fd, &retmsg, sizeof(retmsg)));
-    DBG("Sent initial retmsg: %d", int(sizeof(retmsg)));
+    /* notify that channel was aquired, the retval is the handle of the channel */
+    retmsg.retval = chan->handle;
+    queue_msg(client.get(), &retmsg, sizeof(retmsg));
+    DBG("Queued initial retmsg: %d", int(sizeof(retmsg)));
 
     err_scope.disable();
     co_return 0;
 }
 
 co::task_t co_wait_unix() {
-    std::string sock_path = parent_dir + PMGR_CHAN_UN_NAME;
-
     int server_fd;
     struct sockaddr_un sockaddr_un = {0};
 
@@ -440,20 +1571,22 @@ co::task_t co_wait_unix() {
 
         DBG("Connected: path: [%s] pid: %d", path_pid_path(ucred.pid).c_str(), ucred.pid);
 
-        co_await co::sched(co_client_register(remote_fd, ucred.pid));
+        co_await co::sched(co_client_accept(remote_fd, ucred.pid));
     }
     co_return 0;
 }
 
 co::task_t co_wait_net() {
     int server_fd, opt = 1;
-    auto addr = create_sa_ipv4(INADDR_ANY, PMGR_CHAN_TCP_PORT);
+    auto addr = create_sa_ipv4(INADDR_ANY, tcp_port);
     socklen_t addrlen = sizeof(addr);
 
     ASSERT_ECOFN(server_fd = socket(AF_INET, SOCK_STREAM, 0));
-    ASSERT_ECOFN(setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)));
+    ASSERT_ECOFN(setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)));
+    ASSERT_ECOFN(setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)));
+    ASSERT_ECOFN(tcp_tune(server_fd, true));
     ASSERT_ECOFN(bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)));
-    ASSERT_ECOFN(listen(server_fd, 5));
+    ASSERT_ECOFN(listen(server_fd, 4096));
 
     DBG("IP Socket: %d", server_fd);
 
@@ -464,15 +1597,41 @@ co::task_t co_wait_net() {
 
         DBG("%s connected", sa2str(addr).c_str());
         /* Obs: can't get the pid of an remote process */
+        if (tcp_tune(remote_fd) < 0) {
+            close(remote_fd);
+            continue;
+        }
 
-        co_await co::sched(co_client_register(remote_fd, -1));
+        co_await co::sched(co_client_accept(remote_fd, -1));
     }
     co_return 0;
 }
 
-co::task_t co_main() {
+/* takes the clients that the main thread gives to this worker */
+co::task_t co_shard_inbox(shard_t *shard) {
+    while (true) {
+        uint64_t cnt;
+        ASSERT_COFN(co_await co::read(shard->inbox.efd, &cnt, sizeof(cnt)));
+        handoff_t h;
+        while (shard->inbox.pop(h))
+            co_await co::sched(co_client_register(h));
+    }
+    co_return 0;
+}
+
+co::task_t co_shard_main(int idx) {
     DBG_SCOPE();
+    shard_idx = idx;
+    procmgr = pmgr_client_get(parent_sock);
+    retain_load_shard();
+
     co_await co::sched(CO_REG(co_send_disconnects()));
+    co_await co::sched(CO_REG(co_shard_inbox(shards[idx].get())));
+    co_return 0;
+}
+
+co::task_t co_main() {
+    DBG_SCOPE();
     co_await co::sched(CO_REG(co_wait_net()));
     co_await co::sched(CO_REG(co_wait_unix()));
     co_return 0;
@@ -486,15 +1645,49 @@ int main(int argc, char const *argv[])
     parent_dir = path_pid_dir(getppid());
     parent_sock = parent_dir + "procmgr.sock";
 
-    ASSERT_FN(procmgr_fd = pmgr_conn_socket(parent_sock.c_str()));
+    /* the number of workers and the tcp port can be given as the first two arguments */
+    int workers = std::clamp<int>(std::thread::hardware_concurrency(), 1, CHAN_WORKERS_MAX);
+    if (argc > 1)
+        workers = std::clamp(atoi(argv[1]), 1, CHAN_WORKERS_MAX);
+    if (argc > 2 && ((tcp_port = atoi(argv[2])) <= 0 || tcp_port > 0xffff)) {
+        DBG("Invalid port: %s", argv[2]);
+        return -1;
+    }
+
+    /* more chanmgrs can run near the same procmgr, on other ports, each with it's own socket and
+    retention */
+    if (tcp_port == PMGR_CHAN_TCP_PORT) {
+        sock_path = parent_dir + PMGR_CHAN_UN_NAME;
+        retain_dir = parent_dir + "chanmgr.retain/";
+    }
+    else {
+        char name[64];
+        snprintf(name, sizeof(name), PMGR_CHAN_UN_NAME_PORT, tcp_port);
+        sock_path = parent_dir + name;
+        retain_dir = parent_dir + "chanmgr." + std::to_string(tcp_port) + ".retain/";
+    }
+    ASSERT_FN(CHK_BOOL(getrandom(&node_id, sizeof(node_id), 0) == sizeof(node_id)));
+    DBG("Workers: %d port: %d", workers, tcp_port);
 
-    DBG("post conn");
+    for (int i = 0; i < workers; i++) {
+        shards.push_back(std::make_unique<shard_t>());
+        ASSERT_FN(CHK_BOOL(shards.back()->inbox.efd >= 0));
+    }
+    for (int i = 0; i < workers; i++)
+        shards[i]->th = std::thread([i]{
+            co::pool_t pool;
+            pool.sched(co_shard_main(i));
+            pool.run();
+        });
 
     co::pool_t pool;
 
     pool.sched(co_main());
     pool.run();
 
+    for (auto &shard : shards)
+        shard->th.join();
+
     /*
         - this creates a socket inside the main's root directory
         - this also listens to a port (maybe set inside the main program's cfg)
@@ -0,0 +1,69 @@
+#ifndef MPSCQ_H
+#define MPSCQ_H
+
+/* chanmgr's queues between threads: many threads push, only the one that owns the queue pops. The
+push is a single exchange, so the producers never wait for each other or for the consumer, and the
+consumer sleeps on the eventfd of the queue, inside it's own pool (co::read on efd).
+
+A pop can miss a node that is half pushed (the producer did the exchange but not yet the link), the
+producer writes the eventfd after it links the node, so the consumer looks again after that. */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+#include <sys/eventfd.h>
+
+template <typename T>
+struct mpscq_t {
+    struct node_t {
+        std::atomic<node_t *> next{nullptr};
+        T val;
+    };
+
+    std::atomic<node_t *> head; /* the last pushed node, the producers change it */
+    node_t *tail;               /* the last popped node, only the consumer sees it */
+    node_t stub;
+    int efd = -1;
+
+    mpscq_t() : head(&stub), tail(&stub) {
+        efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~mpscq_t() {
+        T val;
+        while (pop(val))
+            ;
+        if (tail != &stub)
+            delete tail;
+        if (efd >= 0)
+            close(efd);
+    }
+
+    mpscq_t(const mpscq_t &) = delete;
+    mpscq_t &operator = (const mpscq_t &) = delete;
+
+    void push(T val) {
+        node_t *n = new node_t;
+        n->val = std::move(val);
+        node_t *prev = head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+
+        uint64_t one = 1;
+        if (write(efd, &one, sizeof(one)) < 0) {
+            /* counter full, the consumer has something to wake up for */
+        }
+    }
+
+    bool pop(T &val) {
+        node_t *next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        val = std::move(next->val);
+        if (tail != &stub)
+            delete tail;
+        tail = next;
+        return true;
+    }
+};
+
+#endif
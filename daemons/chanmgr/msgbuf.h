@@ -0,0 +1,151 @@
+#ifndef MSGBUF_H
+#define MSGBUF_H
+
+/* chanmgr message buffers: a message is read once inside a buffer and from then on it's only
+referenced, a broadcast to N clients puts the same buffer in N queues and the buffer goes back to the
+pool when the last writer is done with it. The buffers come in power of 2 size classes and the free
+ones are kept per class, so once the pool warmed up, passing messages around allocates nothing.
+
+The refcount is not atomic and the pools are per thread, a buffer is used only by the worker of it's
+channel. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <sys/uio.h>
+
+#define MSGBUF_MIN_SHIFT    8   /* 256 bytes */
+#define MSGBUF_MAX_SHIFT    20  /* 1M, the bigger ones are allocated and freed each time */
+#define MSGBUF_CLASSES      (MSGBUF_MAX_SHIFT - MSGBUF_MIN_SHIFT + 1)
+#define MSGBUF_MAX_FREE     256 /* free buffers kept per class */
+
+struct msgbuf_t {
+    uint32_t refs;
+    int32_t cls;    /* -1 if not pooled */
+    uint32_t len;
+    uint32_t cap;
+
+    uint8_t *data() { return (uint8_t *)(this + 1); }
+};
+
+inline thread_local std::vector<msgbuf_t *> msgbuf_free[MSGBUF_CLASSES];
+
+inline msgbuf_t *msgbuf_alloc(size_t len) {
+    int cls = -1;
+    size_t cap = len;
+    if (len <= (1 << MSGBUF_MAX_SHIFT)) {
+        cls = 0;
+        while ((size_t(1) << (cls + MSGBUF_MIN_SHIFT)) < len)
+            cls++;
+        cap = size_t(1) << (cls + MSGBUF_MIN_SHIFT);
+    }
+
+    msgbuf_t *b;
+    if (cls >= 0 && msgbuf_free[cls].size()) {
+        b = msgbuf_free[cls].back();
+        msgbuf_free[cls].pop_back();
+    }
+    else {
+        if (!(b = (msgbuf_t *)malloc(sizeof(msgbuf_t) + cap)))
+            return NULL;
+        b->cls = cls;
+        b->cap = cap;
+    }
+    b->refs = 1;
+    b->len = len;
+    return b;
+}
+
+inline void msgbuf_release(msgbuf_t *b) {
+    if (--b->refs)
+        return ;
+    if (b->cls >= 0 && msgbuf_free[b->cls].size() < MSGBUF_MAX_FREE) {
+        /* the free lists don't grow past MSGBUF_MAX_FREE, so they allocate only the first time */
+        if (msgbuf_free[b->cls].capacity() < MSGBUF_MAX_FREE)
+            msgbuf_free[b->cls].reserve(MSGBUF_MAX_FREE);
+        msgbuf_free[b->cls].push_back(b);
+        return ;
+    }
+    free(b);
+}
+
+/* a reference to a buffer, the content must not change once it is shared */
+struct msgbuf_p {
+    msgbuf_t *b = NULL;
+
+    msgbuf_p() {}
+    explicit msgbuf_p(msgbuf_t *b) : b(b) {}
+    msgbuf_p(const msgbuf_p &o) : b(o.b) { if (b) b->refs++; }
+    msgbuf_p(msgbuf_p &&o) : b(o.b) { o.b = NULL; }
+    ~msgbuf_p() { reset(); }
+
+    msgbuf_p &operator = (msgbuf_p o) {
+        std::swap(b, o.b);
+        return *this;
+    }
+
+    void reset() {
+        if (b)
+            msgbuf_release(b);
+        b = NULL;
+    }
+
+    explicit operator bool() const { return b != NULL; }
+    uint8_t *data() const { return b->data(); }
+    size_t size() const { return b ? b->len : 0; }
+};
+
+/* len bytes, with an undefined content, empty if the allocation failed */
+inline msgbuf_p msgbuf_get(size_t len) {
+    return msgbuf_p(msgbuf_alloc(len));
+}
+
+inline msgbuf_p msgbuf_get(const struct iovec *iov, int cnt) {
+    size_t len = 0;
+    for (int i = 0; i < cnt; i++)
+        len += iov[i].iov_len;
+    msgbuf_p ret = msgbuf_get(len);
+    if (!ret)
+        return ret;
+    uint8_t *p = ret.data();
+    for (int i = 0; i < cnt; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    return ret;
+}
+
+/* a fifo of T that keeps it's storage, so it allocates only when it grows past it's largest size */
+template <typename T>
+struct msgq_t {
+    std::vector<T> slots;
+    size_t head = 0;
+    size_t cnt = 0;
+
+    bool empty() const { return cnt == 0; }
+    size_t size() const { return cnt; }
+    T &front() { return slots[head]; }
+    T &at(size_t i) { return slots[(head + i) % slots.size()]; }
+
+    void push_back(T &&v) {
+        if (cnt == slots.size()) {
+            std::vector<T> grown(std::max(size_t(16), slots.size() * 2));
+            for (size_t i = 0; i < cnt; i++)
+                grown[i] = std::move(at(i));
+            slots.swap(grown);
+            head = 0;
+        }
+        slots[(head + cnt) % slots.size()] = std::move(v);
+        cnt++;
+    }
+
+    void pop_front() {
+        slots[head] = T();
+        head = (head + 1) % slots.size();
+        cnt--;
+    }
+};
+
+#endif
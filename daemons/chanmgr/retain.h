@@ -0,0 +1,296 @@
+#ifndef RETAIN_H
+#define RETAIN_H
+
+/* chanmgr retained messages: a channel can keep it's last PMGR_CHAN_RETAIN messages for the clients
+that come later (PMGR_CHAN_REPLAY). They are kept while they fit all the limits (count, age, bytes)
+and they are only referenced, the same buffers that went to the clients.
+
+A persistent retention also writes each message inside a file that is mapped in memory: a small
+header, then a pmgr_ring_t where each record is a pmgr_chann_replay_t followed by the message. When
+chanmgr starts it loads the retentions back from those files. Nothing is synced, the files are there
+for a restart of chanmgr, not for one of the machine. */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <memory>
+
+#include "procmgr.h"
+#include "pmgrring.h"
+#include "msgbuf.h"
+
+#define RETAIN_MAGIC        0x315445524d474d50ULL  /* "PMGMRET1" */
+#define RETAIN_FILE_HDR_SZ  256
+#define RETAIN_MIN_RING     (64 * 1024)
+#define RETAIN_MAX_BYTES    (64 * 1024 * 1024)
+
+struct retain_file_hdr_t {
+    uint64_t magic;
+    uint64_t next_seq;
+    uint32_t ring_size;
+    uint32_t max_msgs;
+    uint32_t max_ms;
+    uint32_t max_bytes;
+    char chan_name[PMGR_MAX_TASK_NAME];
+};
+static_assert(sizeof(retain_file_hdr_t) <= RETAIN_FILE_HDR_SZ);
+
+struct retained_t {
+    uint64_t seq = 0;
+    int64_t time_ms = 0;
+    msgbuf_p buf;
+};
+
+struct retain_t {
+    uint32_t max_msgs = 0;
+    uint32_t max_ms = 0;
+    uint32_t max_bytes = 0;
+
+    uint64_t next_seq = 1;
+    size_t bytes = 0;
+    msgq_t<retained_t> msgs;
+
+    /* the file, if it's persistent, the records in it are the same as msgs */
+    std::string path;
+    void *mem = NULL;
+    size_t mem_sz = 0;
+    pmgr_ring_t wr;     /* we write the tail */
+    pmgr_ring_t rd;     /* and we move the head */
+
+    retain_file_hdr_t *fhdr() { return (retain_file_hdr_t *)mem; }
+
+    ~retain_t() {
+        if (mem)
+            munmap(mem, mem_sz);
+    }
+};
+
+using retain_p = std::shared_ptr<retain_t>;
+
+inline int64_t retain_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000'000;
+}
+
+/* the records have more than the messages, so the ring is bigger than max_bytes */
+inline uint32_t retain_ring_size(uint32_t max_bytes) {
+    uint32_t ret = RETAIN_MIN_RING;
+    while (ret < 2 * (uint64_t)max_bytes)
+        ret *= 2;
+    return ret;
+}
+
+inline size_t retain_file_size(uint32_t ring_size) {
+    return RETAIN_FILE_HDR_SZ + sizeof(pmgr_ring_hdr_t) + ring_size;
+}
+
+/* a name that can't escape the directory */
+inline std::string retain_file_name(const std::string &chan_name) {
+    static const char hex[] = "0123456789abcdef";
+    std::string ret;
+    for (unsigned char c : chan_name) {
+        ret.push_back(hex[c >> 4]);
+        ret.push_back(hex[c & 0xf]);
+    }
+    return ret + ".ret";
+}
+
+inline void retain_unmap(retain_t *r) {
+    if (r->mem)
+        munmap(r->mem, r->mem_sz);
+    r->mem = NULL;
+    r->mem_sz = 0;
+}
+
+/* drops the oldest message */
+inline void retain_pop(retain_t *r) {
+    r->bytes -= r->msgs.front().buf.size();
+    r->msgs.pop_front();
+    if (r->mem) {
+        struct iovec iov[2];
+        int64_t len = pmgr_ring_peek(r->rd, iov);
+        if (len <= 0) {
+            DBG("The file of the retention is broken, it's not persistent anymore");
+            retain_unmap(r);
+            return ;
+        }
+        pmgr_ring_pop(r->rd, len);
+    }
+}
+
+inline void retain_trim(retain_t *r) {
+    int64_t now = retain_now_ms();
+    while (r->msgs.size() && (r->msgs.size() > r->max_msgs || r->bytes > r->max_bytes ||
+            (r->max_ms && now - r->msgs.front().time_ms > r->max_ms)))
+        retain_pop(r);
+}
+
+/* writes a message at the end of the file, making space if it has to */
+inline int retain_write(retain_t *r, const retained_t &m) {
+    pmgr_chann_replay_t rec{
+        .hdr = {
+            .size = (int32_t)(sizeof(rec) + m.buf.size()),
+            .type = PMGR_CHAN_REPLAY,
+        },
+        .seq = m.seq,
+        .time_ms = m.time_ms,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &rec, .iov_len = sizeof(rec) },
+        { .iov_base = m.buf.data(), .iov_len = m.buf.size() },
+    };
+    int64_t ret = 0;
+    while (r->mem && !(ret = pmgr_ring_push(r->wr, iov, 2)) && r->msgs.size())
+        retain_pop(r);
+    if (!r->mem || ret <= 0)
+        return -1;
+    r->fhdr()->next_seq = m.seq + 1;
+    return 0;
+}
+
+inline void retain_push(retain_t *r, msgbuf_p buf) {
+    if (buf.size() > r->max_bytes)
+        return ;
+    retained_t m{ .seq = r->next_seq++, .time_ms = retain_now_ms(), .buf = std::move(buf) };
+    if (r->mem && retain_write(r, m) < 0) {
+        DBG("Failed to write a retained message, it's not persistent anymore");
+        retain_unmap(r);
+    }
+    r->bytes += m.buf.size();
+    r->msgs.push_back(std::move(m));
+    retain_trim(r);
+}
+
+inline int retain_map(retain_t *r, const std::string &path, bool create) {
+    uint32_t ring_size = retain_ring_size(r->max_bytes);
+    size_t sz = retain_file_size(ring_size);
+
+    int fd;
+    ASSERT_FN(fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0600));
+    FnScope scope([fd]{ close(fd); });
+    if (create)
+        ASSERT_FN(ftruncate(fd, sz));
+
+    struct stat st;
+    ASSERT_FN(fstat(fd, &st));
+    if ((size_t)st.st_size != sz) {
+        DBG("The file of the retention has the wrong size");
+        return -1;
+    }
+    void *mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_FN(CHK_BOOL(mem != MAP_FAILED));
+
+    retain_unmap(r);
+    r->mem = mem;
+    r->mem_sz = sz;
+    r->path = path;
+    pmgr_ring_init(r->wr, (uint8_t *)mem + RETAIN_FILE_HDR_SZ, ring_size, 0, -1);
+    pmgr_ring_init(r->rd, (uint8_t *)mem + RETAIN_FILE_HDR_SZ, ring_size, 0, -1);
+    return 0;
+}
+
+/* makes r persistent, the messages it already has are written in a new file */
+inline int retain_persist(retain_t *r, const std::string &path, const std::string &chan_name) {
+    ASSERT_FN(retain_map(r, path, true));
+
+    auto fhdr = r->fhdr();
+    fhdr->magic = RETAIN_MAGIC;
+    fhdr->next_seq = r->next_seq;
+    fhdr->ring_size = r->wr.size;
+    fhdr->max_msgs = r->max_msgs;
+    fhdr->max_ms = r->max_ms;
+    fhdr->max_bytes = r->max_bytes;
+    strncpy(fhdr->chan_name, chan_name.c_str(), PMGR_MAX_TASK_NAME - 1);
+
+    /* written again as if they just came, so the oldest go if the ring is full */
+    msgq_t<retained_t> msgs;
+    std::swap(msgs, r->msgs);
+    r->bytes = 0;
+    int ret = 0;
+    while (!msgs.empty()) {
+        retained_t m = std::move(msgs.front());
+        msgs.pop_front();
+        if (r->mem && retain_write(r, m) < 0) {
+            retain_unmap(r);
+            ret = -1;
+        }
+        r->bytes += m.buf.size();
+        r->msgs.push_back(std::move(m));
+    }
+    return ret;
+}
+
+/* the header of the retention file at path, it's enough to know the channel and how big the file is,
+nothing gets mapped */
+inline int retain_read_hdr(const std::string &path, retain_file_hdr_t *fhdr) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    int ret = read(fd, fhdr, sizeof(*fhdr));
+    close(fd);
+    if (ret != sizeof(*fhdr) || fhdr->magic != RETAIN_MAGIC || !fhdr->max_msgs ||
+            fhdr->max_bytes > RETAIN_MAX_BYTES || fhdr->ring_size != retain_ring_size(fhdr->max_bytes) ||
+            !memchr(fhdr->chan_name, 0, PMGR_MAX_TASK_NAME) || !fhdr->chan_name[0]) {
+        DBG("Invalid retention file: %s", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/* the retention that was kept inside path, fhdr is the header that retain_read_hdr got from it */
+inline retain_p retain_load(const std::string &path, const retain_file_hdr_t &fhdr) {
+    auto r = std::make_shared<retain_t>();
+    r->max_msgs = fhdr.max_msgs;
+    r->max_ms = fhdr.max_ms;
+    r->max_bytes = fhdr.max_bytes;
+    r->next_seq = fhdr.next_seq;
+    if (retain_map(r.get(), path, false) < 0)
+        return nullptr;
+
+    /* the head and the tail come from the file, the ring checks them */
+    r->rd.pos = r->rd.hdr->head;
+    r->wr.pos = r->wr.hdr->tail;
+    if (r->wr.pos - r->rd.pos > r->wr.size) {
+        DBG("Broken retention file: %s", path.c_str());
+        return nullptr;
+    }
+
+    pmgr_ring_t it = r->rd;
+    while (true) {
+        struct iovec iov[2];
+        int64_t len = pmgr_ring_peek(it, iov);
+        if (!len)
+            break;
+        msgbuf_p rec;
+        if (len < (int64_t)(sizeof(pmgr_chann_replay_t) + sizeof(pmgr_hdr_t)) ||
+                !(rec = msgbuf_get(iov, 2))) {
+            DBG("Broken retention file: %s", path.c_str());
+            return nullptr;
+        }
+        retained_t m;
+        auto hdr = (pmgr_chann_replay_t *)rec.data();
+        auto msg = (pmgr_hdr_t *)(hdr + 1);
+        size_t msg_len = len - sizeof(pmgr_chann_replay_t);
+        if (msg->size != (int64_t)msg_len || !(m.buf = msgbuf_get(msg_len))) {
+            DBG("Broken retention file: %s", path.c_str());
+            return nullptr;
+        }
+        memcpy(m.buf.data(), msg, msg_len);
+        m.seq = hdr->seq;
+        m.time_ms = hdr->time_ms;
+        r->bytes += msg_len;
+        r->msgs.push_back(std::move(m));
+        it.pos += (len + PMGR_RING_ALIGN - 1) & ~(int64_t)(PMGR_RING_ALIGN - 1);
+    }
+    retain_trim(r.get());
+    return r;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef TOPICS_H
+#define TOPICS_H
+
+/* chanmgr topics: dot separated names (sensors.temp.kitchen) inside a channel. A subscription can
+have '*' as a level, for any one level, and '#' as it's last level, for any number of levels
+(none included). The subscriptions are kept in a trie with a level in each node, a publish only
+visits the nodes that can match it's topic, so it costs as much as the matches, not as much as the
+subscribers. */
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+
+struct topic_node_t {
+    std::map<std::string, std::unique_ptr<topic_node_t>, std::less<>> children;
+    std::vector<int64_t> subs;  /* the ids of the clients subscribed to the path of this node */
+};
+
+/* splits topic in levels, false if it's not a valid topic (or pattern if it can have wildcards) */
+inline bool topic_split(std::string_view topic, bool is_pattern, std::vector<std::string_view> &levels) {
+    levels.clear();
+    if (topic.empty())
+        return false;
+    size_t start = 0;
+    while (true) {
+        size_t end = topic.find('.', start);
+        std::string_view level = topic.substr(start, end == topic.npos ? topic.npos : end - start);
+        if (level.empty())
+            return false;
+        if (level.find_first_of("*#") != level.npos) {
+            if (!is_pattern || level.size() != 1)
+                return false;
+            if (level == "#" && end != topic.npos)
+                return false;
+        }
+        levels.push_back(level);
+        if (end == topic.npos)
+            return true;
+        start = end + 1;
+    }
+}
+
+/* false if id was already subscribed to that pattern */
+inline bool topic_sub(topic_node_t *root, const std::vector<std::string_view> &levels, int64_t id) {
+    topic_node_t *node = root;
+    for (auto level : levels) {
+        auto it = node->children.find(level);
+        if (it == node->children.end())
+            it = node->children.emplace(std::string(level), std::make_unique<topic_node_t>()).first;
+        node = it->second.get();
+    }
+    if (std::find(node->subs.begin(), node->subs.end(), id) != node->subs.end())
+        return false;
+    node->subs.push_back(id);
+    return true;
+}
+
+/* false if id wasn't subscribed to that pattern, the nodes left empty are removed */
+inline bool topic_unsub(topic_node_t *node, const std::vector<std::string_view> &levels, int64_t id,
+        size_t i = 0) {
+    if (i == levels.size()) {
+        auto it = std::find(node->subs.begin(), node->subs.end(), id);
+        if (it == node->subs.end())
+            return false;
+        *it = node->subs.back();
+        node->subs.pop_back();
+        return true;
+    }
+    auto it = node->children.find(levels[i]);
+    if (it == node->children.end() || !topic_unsub(it->second.get(), levels, id, i + 1))
+        return false;
+    if (it->second->subs.empty() && it->second->children.empty())
+        node->children.erase(it);
+    return true;
+}
+
+/* adds the subscribers of the patterns that match the topic to ret, a subscriber can be there more
+than once if more of it's patterns match */
+inline void topic_match(const topic_node_t *node, const std::vector<std::string_view> &levels,
+        std::vector<int64_t> &ret, size_t i = 0) {
+    if (auto it = node->children.find("#"); it != node->children.end())
+        ret.insert(ret.end(), it->second->subs.begin(), it->second->subs.end());
+    if (i == levels.size()) {
+        ret.insert(ret.end(), node->subs.begin(), node->subs.end());
+        return ;
+    }
+    if (auto it = node->children.find(levels[i]); it != node->children.end())
+        topic_match(it->second.get(), levels, ret, i + 1);
+    if (auto it = node->children.find("*"); it != node->children.end())
+        topic_match(it->second.get(), levels, ret, i + 1);
+}
+
+#endif
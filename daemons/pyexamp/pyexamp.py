@@ -81,6 +81,7 @@ async def co_server():
     pmgr.dbg("sending messages...")
     while True:
         await sendmsg(fd, msg)
+        pmgr.heartbeat()
         await asyncio.sleep(1)
 
 async def co_main():
@@ -1,5 +1,6 @@
 #include <unistd.h> 
 #include "procmgr.h"
+#include "libpmgr.h"
 #include "sys_utils.h"
 #include "co_utils.h"
 #include "path_utils.h"
@@ -13,17 +14,25 @@ const char *ev2str(pmgr_event_e ev_type) {
         case PMGR_EVENT_TASK_RM: return "PMGR_EVENT_TASK_RM";
         case PMGR_EVENT_CFG_RELOAD: return "PMGR_EVENT_CFG_RELOAD";
         case PMGR_EVENT_CLEAR: return "PMGR_EVENT_CLEAR";
+        case PMGR_EVENT_PRESSURE_ON: return "PMGR_EVENT_PRESSURE_ON";
+        case PMGR_EVENT_PRESSURE_OFF: return "PMGR_EVENT_PRESSURE_OFF";
+        case PMGR_EVENT_TASK_SHED: return "PMGR_EVENT_TASK_SHED";
+        case PMGR_EVENT_TASK_UNSHED: return "PMGR_EVENT_TASK_UNSHED";
+        case PMGR_EVENT_TASK_UNHEALTHY: return "PMGR_EVENT_TASK_UNHEALTHY";
+        case PMGR_EVENT_TASK_STATS: return "PMGR_EVENT_TASK_STATS";
         default: return "PMGR_EVENT_[UNKNOWN]";
     }
 }
 
-co::task_t co_ev_recver(int fd) {
-    pmgr_event_t evt;
-    while (true) {
-        ASSERT_ECOFN(co_await co::read_sz(fd, &evt, sizeof(evt)));
+co::task_t co_taskmon(pmgr_client_p client) {
+    /* the stats would only flood the log */
+    int32_t ev_type = PMGR_EVENT_MASK & ~PMGR_EVENT_TASK_STATS;
+    ASSERT_COFN(co_await co_pmgr_subscribe(client, ev_type, PMGR_EVENT_FLAGS_MASK, -1, "",
+            [](const pmgr_event_t &evt, const pmgr2_msg_t &) {
         DBG("Receivent: %x[%s] -> %s[%d]", evt.ev_type, ev2str(evt.ev_type),
                 evt.task_name, (int)evt.task_pid);
-    }
+    }));
+    DBG("Now waiting for events...");
     co_return 0;
 };
 
@@ -39,41 +48,9 @@ int main(int argc, char const *argv[])
     DBG("Parrent config: %s", (cfg_str).c_str());
     DBG("Parrent socket: %s", (sock_str).c_str());
 
-    int fd;
-    ASSERT_FN(fd = pmgr_conn_socket(sock_str.c_str()));
-    FnScope scope([fd]{ close(fd); });
-
-    pmgr_event_t evstart {
-        .hdr = {
-            .size = sizeof(pmgr_hdr_t),
-            .type = PMGR_MSG_EVENT_LOOP,
-        }
-    };
-    ASSERT_FN(write_sz(fd, &evstart, sizeof(evstart)));
-
-    DBG("sent evt start");
-    pmgr_event_t ev_reg {
-        .hdr = {
-            .size = sizeof(pmgr_event_t),
-            .type = PMGR_MSG_REGISTER_EVENT,
-        },
-        .ev_type = PMGR_EVENT_MASK,
-        .ev_flags = PMGR_EVENT_FLAGS_MASK,
-        .task_pid = -1,
-    };
-    strcpy(ev_reg.task_name, "[none]");
-    ASSERT_FN(write_sz(fd, &ev_reg, sizeof(ev_reg)));
-    DBG("sent registration cmd");
-
-    pmgr_return_t ret;
-    ASSERT_FN(read_sz(fd, &ret, sizeof(ret)));
-    ASSERT_FN(ret.retval);
-
-    DBG("Now waiting for events...");
-
     co::pool_t pool;
 
-    pool.sched(co_ev_recver(fd));
+    pool.sched(co_taskmon(pmgr_client_get(sock_str)));
     pool.run();
 
     return 0;
@@ -0,0 +1,173 @@
+#include "hbeat.h"
+#include "cfg.h"
+#include "tasks.h"
+#include "psi.h"
+#include "metrics.h"
+#include "time_utils.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#define HBEAT_TICK_MS 100
+
+struct hbeat_watch_t {
+    std::string task_name;
+    int32_t deadline_ms = 0;
+    bool armed = false;
+    bool freed = false; /* the task is gone, the slot is reused once it's pid is reaped */
+    pid_t pid = 0;
+    uint64_t last_beat = 0;
+    uint64_t last_change_us = 0;
+
+    int fd = -1;
+    pmgr_hb_slot_t *mem = NULL;
+};
+
+static std::unordered_map<std::string, int> name2slot;
+static std::map<int, hbeat_watch_t> watched;
+static std::vector<int> free_slots;
+
+int hbeat_init() {
+    for (int i = PMGR_HB_MAX_SLOTS - 1; i >= 0; i--)
+        free_slots.push_back(i);
+    return 0;
+}
+
+int hbeat_fd(int slot) {
+    if (!HAS(watched, slot))
+        return -1;
+    return watched[slot].fd;
+}
+
+/* every slot is a memfd of it's own, so a task can't reach the counters of the others, and it's
+sealed, as a task that shrinks it would kill procmgr with a SIGBUS on the next check */
+static int slot_map(hbeat_watch_t &w) {
+    int fd;
+    ASSERT_FN(fd = memfd_create("pmgr_hb", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    FnScope scope([fd]{ close(fd); });
+
+    size_t page_sz = sysconf(_SC_PAGESIZE);
+    ASSERT_FN(ftruncate(fd, page_sz));
+    ASSERT_FN(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL));
+
+    void *mem = mmap(NULL, page_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        DBGE("Failed to map heartbeat memory");
+        return -1;
+    }
+    scope.disable();
+    w.fd = fd;
+    w.mem = (pmgr_hb_slot_t *)mem;
+    return 0;
+}
+
+static void slot_release(int slot) {
+    auto &w = watched[slot];
+    if (w.mem)
+        munmap(w.mem, sysconf(_SC_PAGESIZE));
+    if (w.fd >= 0)
+        close(w.fd);
+    watched.erase(slot);
+    free_slots.push_back(slot);
+}
+
+int hbeat_slot(const std::string &task_name) {
+    if (!HAS(cfg_get()->heartbeats, task_name))
+        return -1;
+    if (HAS(name2slot, task_name))
+        return name2slot[task_name];
+    if (!free_slots.size()) {
+        DBG("Out of heartbeat slots");
+        return -1;
+    }
+    hbeat_watch_t w{
+        .task_name = task_name,
+        .deadline_ms = cfg_get()->heartbeats[task_name],
+    };
+    if (slot_map(w) < 0) {
+        DBG("Failed to create the heartbeat slot of %s", task_name.c_str());
+        return -1;
+    }
+    int slot = free_slots.back();
+    free_slots.pop_back();
+    name2slot[task_name] = slot;
+    watched[slot] = w;
+    return slot;
+}
+
+void hbeat_free(const std::string &task_name) {
+    if (!HAS(name2slot, task_name))
+        return ;
+    int slot = name2slot[task_name];
+    name2slot.erase(task_name);
+
+    /* the process still has the page mapped, it's checked till it's reaped */
+    if (watched[slot].armed) {
+        watched[slot].freed = true;
+        return ;
+    }
+    slot_release(slot);
+}
+
+void hbeat_arm(int slot, pid_t pid) {
+    if (!HAS(watched, slot))
+        return ;
+    auto &w = watched[slot];
+    __atomic_store_n(&w.mem->beat, 0, __ATOMIC_RELAXED);
+    w.armed = true;
+    w.pid = pid;
+    w.last_beat = 0;
+    w.last_change_us = get_time_us();
+}
+
+void hbeat_disarm(int slot) {
+    if (!HAS(watched, slot))
+        return ;
+    watched[slot].armed = false;
+    if (watched[slot].freed)
+        slot_release(slot);
+}
+
+co::task_t co_hbeat() {
+    while (true) {
+        co_await co::sleep_ms(HBEAT_TICK_MS);
+
+        uint64_t now_us = get_time_us();
+        std::vector<std::string> stalled;
+        for (auto &[slot, w] : watched) {
+            if (!w.armed || w.freed)
+                continue;
+            uint64_t beat = __atomic_load_n(&w.mem->beat, __ATOMIC_RELAXED);
+            if (beat != w.last_beat) {
+                w.last_beat = beat;
+                w.last_change_us = now_us;
+                continue;
+            }
+            if (beat == 0)
+                continue; /* didn't start beating yet */
+            if (now_us - w.last_change_us < w.deadline_ms * 1000ULL)
+                continue;
+
+            /* a frozen task doesn't beat */
+            pmgr_task_t task;
+            if (tasks_get(w.task_name, &task) < 0 || task.pid != w.pid)
+                continue;
+            if (psi_under_pressure() && (task.flags & PMGR_TASK_FLAG_SHEDFRZ)) {
+                w.last_change_us = now_us;
+                continue;
+            }
+
+            DBG("Heartbeat stalled: %s[%d] for %ldms", w.task_name.c_str(), w.pid,
+                    (now_us - w.last_change_us) / 1000);
+            w.armed = false;
+            stalled.push_back(w.task_name);
+        }
+
+        /* failing a task may change the watched list */
+        for (auto &task_name : stalled) {
+            metrics_add(task_name, "hb_stalls", 1);
+            tasks_fail(task_name);
+        }
+    }
+    co_return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef HBEAT_H
+#define HBEAT_H
+
+#include "co_utils.h"
+#include "pmgrhb.h"
+
+int hbeat_init();
+
+/* the memfd of the slot, the task gets it as PMGR_HB_FD_NUMBER */
+int hbeat_fd(int slot);
+
+/* returns the slot of a task, allocating one if needed, or -1 if the task has no heartbeat */
+int hbeat_slot(const std::string &task_name);
+
+/* the slot of a task that is still running is given back only when it's pid is reaped, as the
+process can still write it */
+void hbeat_free(const std::string &task_name);
+
+/* a slot is checked only while armed, that is between the start and the reaping of it's task */
+void hbeat_arm(int slot, pid_t pid);
+void hbeat_disarm(int slot);
+
+/* This coroutine scans the armed slots and fails the tasks whose counter stalls */
+co::task_t co_hbeat();
+
+#endif
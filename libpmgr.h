@@ -0,0 +1,715 @@
+#ifndef LIBPMGR_H
+#define LIBPMGR_H
+
+#include <deque>
+#include <functional>
+#include <algorithm>
+
+#include "co_utils.h"
+#include "procmgr.h"
+#include "pmgr2.h"
+#include "pmgrring.h"
+
+#include <sys/mman.h>
+
+/* procmgr client library
+
+This is what the procmgr cli, the daemons and the python module use to talk to procmgr and to the
+channel manager, include it and call the functions from inside a co::pool_t.
+
+The procmgr part uses the v2 protocol (pmgr2.h): a client is a connection that is kept and shared
+by all the coroutines that use the same socket, the requests are pipelined (sent without waiting for
+the replies of the requests before them) and the replies are matched to their requests in order.
+If the connection is lost, the requests that wait for a reply fail and the next request reconnects.
+The event subscriptions are remade after a reconnect, so an event listener doesn't need to care
+about procmgr restarting, it just misses the events from when it was down.
+
+The channel part is only a helper for the framing of the v1 structs that chanmgr understands, with
+the shared memory rings (pmgrring.h) as an option for local clients that send a lot. */
+
+#define PMGR_CLIENT_CONN_RETRIES    10
+#define PMGR_CLIENT_RETRY_MS        100
+#define PMGR_CLIENT_MAX_BACKOFF_MS  5000
+
+struct pmgr_client_t;
+using pmgr_client_p = std::shared_ptr<pmgr_client_t>;
+
+/* an already encoded message, it is written as it is, so a message that is sent often can be
+encoded once (it won't have a request id, the replies are matched in order anyway) */
+using pmgr_frame_p = std::shared_ptr<const std::string>;
+
+/* called from the coroutine that reads the connection, for each event that matches, msg has the
+extra fields of the event (for example the stats of PMGR_EVENT_TASK_STATS) */
+using pmgr_event_cbk_t = std::function<void(const pmgr_event_t &ev, const pmgr2_msg_t &msg)>;
+
+struct pmgr_reply_t {
+    int retval = -1;
+    std::vector<pmgr2_msg_t> msgs; /* all the replies before the PMGR_MSG_RETVAL */
+};
+
+/* the client for the procmgr at sock_path, the same one for all the calls with the same path,
+doesn't connect (that happens on the first request) */
+pmgr_client_p pmgr_client_get(const std::string &sock_path);
+
+pmgr_frame_p pmgr_encode(const pmgr2_msg_t &msg);
+
+/* the request returns the retval of the command or -1 if it couldn't be sent or answered */
+co::task_t co_pmgr_request(pmgr_client_p client, pmgr2_msg_t msg, pmgr_reply_t *reply = NULL);
+co::task_t co_pmgr_request(pmgr_client_p client, pmgr_frame_p frame, pmgr_reply_t *reply = NULL);
+
+/* for the requests that wait on a task (waitstop, waitrm, clear), procmgr answers the requests of a
+connection in order, so on the shared one they would hold back all the others, this one makes a
+connection for itself and closes it when done */
+co::task_t co_pmgr_wait_request(pmgr_client_p client, pmgr2_msg_t msg);
+
+/* control commands */
+co::task_t co_pmgr_start(pmgr_client_p client, const std::string &name);
+co::task_t co_pmgr_stop(pmgr_client_p client, const std::string &name);
+co::task_t co_pmgr_waitstop(pmgr_client_p client, const std::string &name);
+co::task_t co_pmgr_rm(pmgr_client_p client, const std::string &name);
+co::task_t co_pmgr_waitrm(pmgr_client_p client, const std::string &name);
+co::task_t co_pmgr_clear(pmgr_client_p client);
+co::task_t co_pmgr_add(pmgr_client_p client, const pmgr_task_t &task,
+        const std::vector<std::string> &argv = {}, const std::vector<std::string> &env = {});
+co::task_t co_pmgr_list(pmgr_client_p client, std::vector<pmgr_task_t> &tasks);
+co::task_t co_pmgr_metrics(pmgr_client_p client, std::vector<pmgr_metric_t> &metrics);
+co::task_t co_pmgr_get_task(pmgr_client_p client, pid_t pid, pmgr_task_t *task);
+co::task_t co_pmgr_get_task(pmgr_client_p client, const std::string &name, pmgr_task_t *task);
+
+/* the events are filtered as with pmgr_event_t (ev_flags selects the pid or name filter, pid -1 and
+an empty name match all), the subscriptions of a client can't be removed */
+co::task_t co_pmgr_subscribe(pmgr_client_p client, int32_t ev_type, int32_t ev_flags, pid_t pid,
+        const std::string &name, pmgr_event_cbk_t cbk);
+
+/* chanmgr: connects with some retries, as chanmgr may not be up yet */
+co::task_t co_pmgr_chan_connect(const std::string &sock_path, int *fd);
+
+/* if send_fd/recv_fd are used, the fd goes/comes with a PMGR_CHAN_SENDFD message */
+co::task_t co_pmgr_chan_send(int fd, const pmgr_hdr_t *msg, int send_fd = -1);
+co::task_t co_pmgr_chan_recv(int fd, std::vector<uint8_t> &msg, int *recv_fd = NULL);
+
+/* sends len bytes of data as the chunks of a stream (PMGR_CHAN_CHUNK) with the flags and dst_id of
+msg, the chunks have PMGR_CHAN_NOACK, so there are no replies to read, a PMGR_CHAN_ACK says if some
+failed. The chunks go only through the socket. */
+co::task_t co_pmgr_chan_send_chunks(int fd, const pmgr_chann_msg_t *msg, uint64_t stream_id,
+        const void *data, size_t len, size_t chunk_sz = PMGR_CHAN_CHUNK_SZ);
+
+/* chanmgr shared memory rings, asked for on a registered connection before anyone sends us
+anything, ring_size is rounded by chanmgr (0 for the default). After that the PMGR_CHAN_MESSAGE
+messages for us come only through the rx ring and we can send ours through the tx ring, those don't
+have a reply. The rest (replies, fds, disconnect notifications) still uses the socket. */
+struct pmgr_chan_shm_t;
+using pmgr_chan_shm_p = std::shared_ptr<pmgr_chan_shm_t>;
+
+co::task_t co_pmgr_chan_shm(int fd, uint32_t ring_size, pmgr_chan_shm_p *shm);
+co::task_t co_pmgr_chan_shm_send(pmgr_chan_shm_p shm, const pmgr_hdr_t *msg);
+co::task_t co_pmgr_chan_shm_recv(pmgr_chan_shm_p shm, std::vector<uint8_t> &msg);
+
+/* the waiting part of pmgr_ring_push/pmgr_ring_peek, both fail once the shm is closed */
+co::task_t co_pmgr_ring_push(pmgr_chan_shm_p shm, pmgr_ring_t *r, const struct iovec *iov, int cnt);
+co::task_t co_pmgr_ring_peek(pmgr_chan_shm_p shm, pmgr_ring_t *r, struct iovec iov[2]);
+
+
+/* IMPLEMENTATION:
+================================================================================================= */
+
+struct pmgr_pending_t {
+    pmgr_reply_t reply;
+    co::sem_t done;
+};
+
+struct pmgr_sub_t {
+    int32_t ev_type;
+    int32_t ev_flags;
+    pid_t pid;
+    std::string name;
+    pmgr_event_cbk_t cbk;
+    uint64_t id = 0;
+    bool pending = false;   /* it's registration is not answered yet, a connect doesn't redo it */
+};
+
+struct pmgr_client_t {
+    std::string sock_path;
+    int fd = -1;
+    uint32_t caps = 0;
+    uint64_t next_req_id = 1;
+    uint64_t next_sub_id = 1;
+
+    co::sem_t conn_sem{1};  /* only one coroutine connects */
+    co::sem_t write_sem{1}; /* the frames must be written whole and in the order of 'pending' */
+
+    std::deque<std::shared_ptr<pmgr_pending_t>> pending;
+    std::vector<pmgr_sub_t> subs;
+};
+
+/* per thread, as a client belongs to the pool of the thread that uses it */
+inline thread_local std::map<std::string, pmgr_client_p> pmgr_clients;
+
+inline pmgr_client_p pmgr_client_get(const std::string &sock_path) {
+    if (!HAS(pmgr_clients, sock_path)) {
+        auto client = std::make_shared<pmgr_client_t>();
+        client->sock_path = sock_path;
+        pmgr_clients[sock_path] = client;
+    }
+    return pmgr_clients[sock_path];
+}
+
+inline pmgr_frame_p pmgr_encode(const pmgr2_msg_t &msg) {
+    return std::make_shared<const std::string>(msg.encode());
+}
+
+inline co::task_t co_pmgr_connect(pmgr_client_p client);
+
+/* the requests that were not answered fail, the subscriptions are kept for the next connection,
+the fd is closed by it's reader */
+inline void pmgr_client_drop(pmgr_client_p client) {
+    if (client->fd < 0)
+        return ;
+    shutdown(client->fd, SHUT_RDWR);
+    client->fd = -1;
+    for (auto &p : client->pending) {
+        p->reply.retval = -1;
+        p->done.rel();
+    }
+    client->pending.clear();
+}
+
+inline void pmgr_client_dispatch(pmgr_client_p client, const pmgr2_msg_t &msg) {
+    pmgr_event_t ev;
+    pmgr2_get_event(msg, ev);
+    for (auto &sub : client->subs) {
+        if (!(sub.ev_type & ev.ev_type))
+            continue;
+        bool pid_ok = sub.pid == -1 || sub.pid == (pid_t)ev.task_pid;
+        bool name_ok = sub.name == "" || sub.name == ev.task_name;
+        bool match = false;
+        if (sub.ev_flags & PMGR_EVENT_FLAG_PID_FILTER)
+            match |= pid_ok;
+        if (sub.ev_flags & PMGR_EVENT_FLAG_NAME_FILTER)
+            match |= name_ok;
+        if (match)
+            sub.cbk(ev, msg);
+    }
+}
+
+/* reads the replies and the events, one per connection */
+inline co::task_t co_pmgr_client_reader(pmgr_client_p client, pmgr2_reader_t reader) {
+    int fd = reader.fd;
+    while (true) {
+        pmgr2_msg_t msg;
+        int ret = co_await co_pmgr2_read_msg(reader, msg);
+        if (client->fd != fd)
+            break;
+        if (ret <= 0) {
+            DBG("Lost the connection to procmgr");
+            pmgr_client_drop(client);
+            break;
+        }
+        if (msg.type() == PMGR_MSG_EVENT) {
+            pmgr_client_dispatch(client, msg);
+            continue;
+        }
+        if (client->pending.empty()) {
+            DBG("Reply without a request");
+            pmgr_client_drop(client);
+            break;
+        }
+        auto p = client->pending.front();
+        if (msg.type() != PMGR_MSG_RETVAL) {
+            p->reply.msgs.push_back(std::move(msg));
+            continue;
+        }
+        p->reply.retval = msg.get_int(PMGR2_F_RETVAL, -1);
+        client->pending.pop_front();
+        p->done.rel();
+    }
+    close(fd);
+
+    /* the event listeners expect to keep getting events, so reconnect for them */
+    int backoff_ms = PMGR_CLIENT_RETRY_MS;
+    while (client->subs.size() && client->fd < 0) {
+        if (co_await co_pmgr_connect(client) >= 0)
+            break;
+        co_await co::sleep_ms(backoff_ms);
+        backoff_ms = std::min(backoff_ms * 2, PMGR_CLIENT_MAX_BACKOFF_MS);
+    }
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_send(pmgr_client_p client, pmgr_frame_p frame,
+        std::shared_ptr<pmgr_pending_t> p) {
+    co_await client->write_sem;
+    FnScope scope([client]{ client->write_sem.rel(); });
+
+    if (client->fd < 0) {
+        DBG("Not connected");
+        co_return -1;
+    }
+    client->pending.push_back(p);
+    if (co_await co::write_sz(client->fd, frame->data(), frame->size()) < 0) {
+        DBGE("Failed to send request");
+        pmgr_client_drop(client);
+        co_return -1;
+    }
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_handshake(pmgr_client_p client, pmgr2_reader_t &reader) {
+    int fd = reader.fd;
+    std::string hello = pmgr2_hello(PMGR2_CAP_ALL);
+    ASSERT_COFN(co_await co::write_sz(fd, hello.data(), hello.size()));
+
+    uint32_t magic;
+    ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, &magic, sizeof(magic)) == sizeof(magic)));
+    if (magic != PMGR2_MAGIC) {
+        DBG("Not a v2 server");
+        co_return -1;
+    }
+    uint64_t version, caps;
+    ASSERT_COFN(CHK_BOOL(co_await co_pmgr2_read_varint(reader, version) > 0));
+    ASSERT_COFN(CHK_BOOL(co_await co_pmgr2_read_varint(reader, caps) > 0));
+    if (version < PMGR2_VERSION || !(caps & PMGR2_CAP_PIPELINE)) {
+        DBG("procmgr is too old, version: %lu, caps: %lx", version, caps);
+        co_return -1;
+    }
+    client->caps = caps;
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_connect(pmgr_client_p client) {
+    co_await client->conn_sem;
+    FnScope scope([client]{ client->conn_sem.rel(); });
+    if (client->fd >= 0)
+        co_return 0;
+
+    int fd;
+    struct sockaddr_un sockaddr_un = {0};
+    sockaddr_un.sun_family = AF_UNIX;
+    if (client->sock_path.size() >= sizeof(sockaddr_un.sun_path)) {
+        DBG("Socket path too long: %s", client->sock_path.c_str());
+        co_return -1;
+    }
+    strcpy(sockaddr_un.sun_path, client->sock_path.c_str());
+
+    ASSERT_COFN(fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    FnScope close_fd([fd]{ close(fd); });
+    ASSERT_COFN(connect(fd, (struct sockaddr *)&sockaddr_un, sizeof(sockaddr_un)));
+
+    pmgr2_reader_t reader{ .fd = fd };
+    ASSERT_COFN(co_await co_pmgr_handshake(client, reader));
+    close_fd.disable();
+    client->fd = fd;
+
+    co_await co::sched(co_pmgr_client_reader(client, reader));
+
+    /* the registrations are answered as any request, but no one waits for them */
+    for (auto &sub : client->subs) {
+        if (sub.pending)
+            continue;
+        pmgr2_msg_t msg(PMGR_MSG_REGISTER_EVENT);
+        msg.add_int(PMGR2_F_EV_TYPE, sub.ev_type);
+        msg.add_int(PMGR2_F_FLAGS, sub.ev_flags);
+        msg.add_int(PMGR2_F_PID, sub.pid);
+        msg.add_str(PMGR2_F_NAME, sub.name);
+        ASSERT_COFN(co_await co_pmgr_send(client, pmgr_encode(msg),
+                std::make_shared<pmgr_pending_t>()));
+    }
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_request(pmgr_client_p client, pmgr_frame_p frame, pmgr_reply_t *reply) {
+    int ret = -1;
+    for (int i = 0; i < PMGR_CLIENT_CONN_RETRIES; i++) {
+        if ((ret = co_await co_pmgr_connect(client)) >= 0)
+            break;
+        co_await co::sleep_ms(PMGR_CLIENT_RETRY_MS);
+    }
+    if (ret < 0) {
+        DBG("Can't connect to procmgr: %s", client->sock_path.c_str());
+        co_return -1;
+    }
+
+    auto p = std::make_shared<pmgr_pending_t>();
+    ASSERT_COFN(co_await co_pmgr_send(client, frame, p));
+    co_await p->done;
+
+    ret = p->reply.retval;
+    if (reply)
+        *reply = std::move(p->reply);
+    co_return ret;
+}
+
+inline co::task_t co_pmgr_request(pmgr_client_p client, pmgr2_msg_t msg, pmgr_reply_t *reply) {
+    if (!msg.has(PMGR2_F_REQ_ID))
+        msg.add_int(PMGR2_F_REQ_ID, client->next_req_id++);
+    co_return co_await co_pmgr_request(client, pmgr_encode(msg), reply);
+}
+
+inline co::task_t co_pmgr_wait_request(pmgr_client_p client, pmgr2_msg_t msg) {
+    auto own = std::make_shared<pmgr_client_t>();
+    own->sock_path = client->sock_path;
+    FnScope scope([own]{ pmgr_client_drop(own); });
+    co_return co_await co_pmgr_request(own, msg);
+}
+
+inline co::task_t co_pmgr_name_cmd(pmgr_client_p client, pmgr_msg_type_e type,
+        const std::string &name) {
+    pmgr2_msg_t msg(type);
+    msg.add_str(PMGR2_F_NAME, name);
+    if (type == PMGR_MSG_WAITSTOP || type == PMGR_MSG_WAITRM)
+        co_return co_await co_pmgr_wait_request(client, msg);
+    co_return co_await co_pmgr_request(client, msg);
+}
+
+inline co::task_t co_pmgr_start(pmgr_client_p client, const std::string &name) {
+    co_return co_await co_pmgr_name_cmd(client, PMGR_MSG_START, name);
+}
+
+inline co::task_t co_pmgr_stop(pmgr_client_p client, const std::string &name) {
+    co_return co_await co_pmgr_name_cmd(client, PMGR_MSG_STOP, name);
+}
+
+inline co::task_t co_pmgr_waitstop(pmgr_client_p client, const std::string &name) {
+    co_return co_await co_pmgr_name_cmd(client, PMGR_MSG_WAITSTOP, name);
+}
+
+inline co::task_t co_pmgr_rm(pmgr_client_p client, const std::string &name) {
+    co_return co_await co_pmgr_name_cmd(client, PMGR_MSG_RM, name);
+}
+
+inline co::task_t co_pmgr_waitrm(pmgr_client_p client, const std::string &name) {
+    co_return co_await co_pmgr_name_cmd(client, PMGR_MSG_WAITRM, name);
+}
+
+inline co::task_t co_pmgr_clear(pmgr_client_p client) {
+    co_return co_await co_pmgr_wait_request(client, pmgr2_msg_t(PMGR_MSG_CLEAR));
+}
+
+inline co::task_t co_pmgr_add(pmgr_client_p client, const pmgr_task_t &task,
+        const std::vector<std::string> &argv, const std::vector<std::string> &env) {
+    pmgr2_msg_t msg(PMGR_MSG_ADD);
+    pmgr2_put_task(msg, task);
+    for (auto &a : argv)
+        msg.add_str(PMGR2_F_ARG, a);
+    for (auto &e : env)
+        msg.add_str(PMGR2_F_ENV, e);
+    co_return co_await co_pmgr_request(client, msg);
+}
+
+inline co::task_t co_pmgr_list(pmgr_client_p client, std::vector<pmgr_task_t> &tasks) {
+    pmgr_reply_t reply;
+    ASSERT_COFN(co_await co_pmgr_request(client, pmgr2_msg_t(PMGR_MSG_LIST), &reply));
+    tasks.resize(reply.msgs.size());
+    for (int i = 0; i < reply.msgs.size(); i++)
+        pmgr2_get_task(reply.msgs[i], tasks[i]);
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_metrics(pmgr_client_p client, std::vector<pmgr_metric_t> &metrics) {
+    pmgr_reply_t reply;
+    ASSERT_COFN(co_await co_pmgr_request(client, pmgr2_msg_t(PMGR_MSG_METRICS), &reply));
+    metrics.clear();
+    for (auto &m : reply.msgs) {
+        pmgr_metric_t metric{
+            .hdr = { .size = sizeof(pmgr_metric_t), .type = PMGR_MSG_METRIC },
+            .value = m.get_int(PMGR2_F_VALUE),
+        };
+        std::string task_name = m.get_str(PMGR2_F_NAME).substr(0, PMGR_MAX_TASK_NAME - 1);
+        std::string name = m.get_str(PMGR2_F_METRIC).substr(0, PMGR_MAX_METRIC_NAME - 1);
+        strcpy(metric.task_name, task_name.c_str());
+        strcpy(metric.name, name.c_str());
+        metrics.push_back(metric);
+    }
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_get_task(pmgr_client_p client, pmgr2_msg_t msg, pmgr_task_t *task) {
+    pmgr_reply_t reply;
+    ASSERT_COFN(co_await co_pmgr_request(client, msg, &reply));
+    if (reply.msgs.size() != 1) {
+        DBG("Expected a task");
+        co_return -1;
+    }
+    pmgr2_get_task(reply.msgs[0], *task);
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_get_task(pmgr_client_p client, pid_t pid, pmgr_task_t *task) {
+    pmgr2_msg_t msg(PMGR_MSG_GET_PID);
+    msg.add_int(PMGR2_F_PID, pid);
+    co_return co_await co_pmgr_get_task(client, msg, task);
+}
+
+inline co::task_t co_pmgr_get_task(pmgr_client_p client, const std::string &name,
+        pmgr_task_t *task) {
+    pmgr2_msg_t msg(PMGR_MSG_GET_NAME);
+    msg.add_str(PMGR2_F_NAME, name);
+    co_return co_await co_pmgr_get_task(client, msg, task);
+}
+
+inline co::task_t co_pmgr_subscribe(pmgr_client_p client, int32_t ev_type, int32_t ev_flags,
+        pid_t pid, const std::string &name, pmgr_event_cbk_t cbk) {
+    pmgr2_msg_t msg(PMGR_MSG_REGISTER_EVENT);
+    msg.add_int(PMGR2_F_EV_TYPE, ev_type);
+    msg.add_int(PMGR2_F_FLAGS, ev_flags);
+    msg.add_int(PMGR2_F_PID, pid);
+    msg.add_str(PMGR2_F_NAME, name);
+
+    /* added before the request, so the events that come right after the reply are not lost, as
+    pending, else a connect made by the request would register it twice */
+    uint64_t id = client->next_sub_id++;
+    client->subs.push_back(pmgr_sub_t{
+        .ev_type = ev_type,
+        .ev_flags = ev_flags,
+        .pid = pid,
+        .name = name,
+        .cbk = cbk,
+        .id = id,
+        .pending = true,
+    });
+    int ret = co_await co_pmgr_request(client, msg);
+
+    /* the vector may have moved while we waited */
+    auto it = std::find_if(client->subs.begin(), client->subs.end(),
+            [id](const pmgr_sub_t &sub){ return sub.id == id; });
+    if (it == client->subs.end())
+        co_return -1;
+    if (ret < 0) {
+        client->subs.erase(it);
+        co_return ret;
+    }
+    it->pending = false;
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_chan_connect(const std::string &sock_path, int *fd) {
+    struct sockaddr_un sockaddr_un = {0};
+    sockaddr_un.sun_family = AF_UNIX;
+    if (sock_path.size() >= sizeof(sockaddr_un.sun_path)) {
+        DBG("Socket path too long: %s", sock_path.c_str());
+        co_return -1;
+    }
+    strcpy(sockaddr_un.sun_path, sock_path.c_str());
+
+    int sock_fd;
+    ASSERT_COFN(sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    FnScope scope([sock_fd]{ close(sock_fd); });
+
+    int ret;
+    for (int i = 0; i < PMGR_CLIENT_CONN_RETRIES; i++) {
+        ret = connect(sock_fd, (struct sockaddr *)&sockaddr_un, sizeof(sockaddr_un));
+        if (ret >= 0)
+            break;
+        co_await co::sleep_ms(PMGR_CLIENT_RETRY_MS);
+    }
+    ASSERT_COFN(ret);
+
+    scope.disable();
+    *fd = sock_fd;
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_chan_send(int fd, const pmgr_hdr_t *msg, int send_fd) {
+    ASSERT_COFN(co_await co::write_sz(fd, msg, msg->size));
+    if (send_fd >= 0) {
+        ASSERT_COFN(co_await co::wait_event(fd, EPOLLOUT));
+        ASSERT_COFN(pmgr_send_fd(fd, send_fd));
+    }
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_chan_send_chunks(int fd, const pmgr_chann_msg_t *msg, uint64_t stream_id,
+        const void *data, size_t len, size_t chunk_sz) {
+    chunk_sz = std::clamp(chunk_sz, (size_t)1, PMGR_CHAN_MAX_MSG - sizeof(pmgr_chann_chunk_t));
+    std::vector<uint8_t> buf;
+    size_t off = 0;
+    do {
+        size_t n = std::min(chunk_sz, len - off);
+        buf.resize(sizeof(pmgr_chann_chunk_t) + n);
+        auto chunk = (pmgr_chann_chunk_t *)buf.data();
+        *chunk = pmgr_chann_chunk_t{
+            .hdr = {
+                .size = (int32_t)buf.size(),
+                .type = PMGR_CHAN_CHUNK,
+            },
+            .flags = (pmgr_chan_flags_e)(msg->flags | PMGR_CHAN_NOACK),
+            .src_id = msg->src_id,
+            .dst_id = msg->dst_id,
+            .stream_id = stream_id,
+            .offset = off,
+            .total = len,
+        };
+        memcpy(chunk + 1, (const uint8_t *)data + off, n);
+        ASSERT_COFN(co_await co::write_sz(fd, buf.data(), buf.size()));
+        off += n;
+    } while (off < len);
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_chan_recv(int fd, std::vector<uint8_t> &msg, int *recv_fd) {
+    msg.resize(sizeof(pmgr_hdr_t));
+    ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, msg.data(), sizeof(pmgr_hdr_t)) ==
+            sizeof(pmgr_hdr_t)));
+
+    int size = ((pmgr_hdr_t *)msg.data())->size;
+    if (size < sizeof(pmgr_hdr_t) || size > PMGR_CHAN_MAX_MSG) {
+        DBG("Invalid message size: %d", size);
+        co_return -1;
+    }
+    msg.resize(size);
+    int rest = size - sizeof(pmgr_hdr_t);
+    if (rest) {
+        ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, msg.data() + sizeof(pmgr_hdr_t), rest) ==
+                rest));
+    }
+
+    if (((pmgr_hdr_t *)msg.data())->type == PMGR_CHAN_SENDFD) {
+        int target_fd;
+        ASSERT_COFN(co_await co::wait_event(fd, EPOLLIN));
+        ASSERT_COFN(target_fd = pmgr_recv_fd(fd));
+        if (recv_fd)
+            *recv_fd = target_fd;
+        else
+            close(target_fd);
+    }
+    co_return 0;
+}
+
+struct pmgr_chan_shm_t {
+    void *mem = MAP_FAILED;
+    size_t mem_sz = 0;
+
+    pmgr_ring_t tx;         /* we are the producer */
+    pmgr_ring_t rx;         /* we are the consumer */
+    co::sem_t tx_sem{1};    /* there must be only one producer */
+    bool closed = false;
+
+    ~pmgr_chan_shm_t() {
+        if (mem != MAP_FAILED)
+            munmap(mem, mem_sz);
+        if (tx.efd >= 0)
+            close(tx.efd);
+        if (rx.efd >= 0)
+            close(rx.efd);
+    }
+};
+
+/* the eventfds are owned by shm from here on, even if this fails, the memfd is not */
+inline int pmgr_chan_shm_map(pmgr_chan_shm_p shm, int memfd, uint32_t ring_size, int efd0, int efd1,
+        bool is_chanmgr) {
+    shm->tx.efd = is_chanmgr ? efd1 : efd0;
+    shm->rx.efd = is_chanmgr ? efd0 : efd1;
+    if (ring_size < PMGR_RING_MIN_SZ || ring_size > PMGR_RING_MAX_SZ ||
+            (ring_size & (ring_size - 1))) {
+        DBG("Invalid ring size: %u", ring_size);
+        return -1;
+    }
+    shm->mem_sz = PMGR_RING_SHM_SIZE(ring_size);
+    shm->mem = mmap(NULL, shm->mem_sz, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    ASSERT_FN(CHK_BOOL(shm->mem != MAP_FAILED));
+
+    pmgr_ring_init(shm->tx, shm->mem, ring_size, is_chanmgr ? 1 : 0, shm->tx.efd);
+    pmgr_ring_init(shm->rx, shm->mem, ring_size, is_chanmgr ? 0 : 1, shm->rx.efd);
+    return 0;
+}
+
+inline co::task_t co_pmgr_ring_push(pmgr_chan_shm_p shm, pmgr_ring_t *r,
+        const struct iovec *iov, int cnt) {
+    while (!shm->closed) {
+        int64_t ret;
+        ASSERT_COFN(ret = pmgr_ring_push(*r, iov, cnt));
+        if (ret)
+            co_return 0;
+
+        pmgr_ring_sleep_prepare(*r);
+        ASSERT_COFN(ret = pmgr_ring_push(*r, iov, cnt));
+        if (ret)
+            co_return 0;
+
+        uint64_t wakes;
+        ASSERT_COFN(co_await co::read(r->efd, &wakes, sizeof(wakes)));
+    }
+    co_return -1;
+}
+
+inline co::task_t co_pmgr_ring_peek(pmgr_chan_shm_p shm, pmgr_ring_t *r, struct iovec iov[2]) {
+    while (!shm->closed) {
+        int64_t len;
+        ASSERT_COFN(len = pmgr_ring_peek(*r, iov));
+        if (len)
+            co_return len;
+
+        pmgr_ring_sleep_prepare(*r);
+        ASSERT_COFN(len = pmgr_ring_peek(*r, iov));
+        if (len)
+            co_return len;
+
+        uint64_t wakes;
+        ASSERT_COFN(co_await co::read(r->efd, &wakes, sizeof(wakes)));
+    }
+    co_return -1;
+}
+
+inline co::task_t co_pmgr_chan_shm(int fd, uint32_t ring_size, pmgr_chan_shm_p *shm) {
+    pmgr_chann_shm_t req{
+        .hdr = {
+            .size = sizeof(pmgr_chann_shm_t),
+            .type = PMGR_CHAN_SHM,
+        },
+        .ring_size = ring_size,
+    };
+    ASSERT_COFN(co_await co::write_sz(fd, &req, sizeof(req)));
+    ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, &req, sizeof(req)) == sizeof(req)));
+    if (req.hdr.type != PMGR_CHAN_SHM) {
+        DBG("Unexpected reply: %d", req.hdr.type);
+        co_return -1;
+    }
+
+    /* the memfd and the eventfds of the two rings, only if chanmgr agreed */
+    int fds[3] = {-1, -1, -1};
+    FnScope scope([&fds]{
+        for (int fd : fds)
+            if (fd >= 0)
+                close(fd);
+    });
+    for (int i = 0; req.ring_size && i < 3; i++) {
+        ASSERT_COFN(co_await co::wait_event(fd, EPOLLIN));
+        ASSERT_COFN(fds[i] = pmgr_recv_fd(fd));
+    }
+
+    pmgr_return_t retmsg;
+    ASSERT_COFN(CHK_BOOL(co_await co::read_sz(fd, &retmsg, sizeof(retmsg)) == sizeof(retmsg)));
+    if (retmsg.retval < 0 || !req.ring_size) {
+        DBG("chanmgr refused the shared memory rings");
+        co_return -1;
+    }
+
+    auto ret = std::make_shared<pmgr_chan_shm_t>();
+    int efd0 = fds[1], efd1 = fds[2];
+    fds[1] = fds[2] = -1;
+    ASSERT_COFN(pmgr_chan_shm_map(ret, fds[0], req.ring_size, efd0, efd1, false));
+
+    *shm = ret;
+    co_return 0;
+}
+
+inline co::task_t co_pmgr_chan_shm_send(pmgr_chan_shm_p shm, const pmgr_hdr_t *msg) {
+    struct iovec iov = { .iov_base = (void *)msg, .iov_len = (size_t)msg->size };
+    co_await shm->tx_sem;
+    int ret = co_await co_pmgr_ring_push(shm, &shm->tx, &iov, 1);
+    shm->tx_sem.rel();
+    co_return ret;
+}
+
+inline co::task_t co_pmgr_chan_shm_recv(pmgr_chan_shm_p shm, std::vector<uint8_t> &msg) {
+    struct iovec iov[2];
+    int64_t len;
+    ASSERT_COFN(len = co_await co_pmgr_ring_peek(shm, &shm->rx, iov));
+    msg.resize(len);
+    memcpy(msg.data(), iov[0].iov_base, iov[0].iov_len);
+    memcpy(msg.data() + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+    pmgr_ring_pop(shm->rx, len);
+    co_return 0;
+}
+
+#endif
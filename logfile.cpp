@@ -0,0 +1,260 @@
+#include "logfile.h"
+#include "path_utils.h"
+#include "debug.h"
+
+#include <dirent.h>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sched.h>
+
+struct log_worker_t {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> jobs;
+    bool stop = false;
+    bool idle = false;      /* runs only when nothing else wants the cpu or the disk */
+    std::thread th;
+};
+
+static log_worker_t bg_worker;
+static log_worker_t idle_worker;
+
+static void post_job(log_worker_t *w, std::function<void()> job) {
+    std::lock_guard<std::mutex> guard(w->mu);
+    w->jobs.push_back(std::move(job));
+    w->cv.notify_one();
+}
+
+void logfile_post(std::function<void()> job) {
+    post_job(&bg_worker, std::move(job));
+}
+
+void logfile_post_idle(std::function<void()> job) {
+    post_job(&idle_worker, std::move(job));
+}
+
+static void th_logfile_worker(log_worker_t *w) {
+    sigset_t mask;
+    sigfillset(&mask);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    if (w->idle) {
+        struct sched_param sp = {};
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+        syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, gettid(),
+                3 << 13 /* IOPRIO_CLASS_IDLE */);
+    }
+    else {
+        /* we are the least important thing here */
+        nice(10);
+    }
+
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(w->mu);
+            w->cv.wait(lock, [w]{ return w->stop || w->jobs.size(); });
+
+            /* the idle jobs are only nice to have, they are redone on the next start */
+            if (w->stop && w->idle)
+                w->jobs.clear();
+            if (!w->jobs.size())
+                return ;
+            job = std::move(w->jobs.front());
+            w->jobs.pop_front();
+        }
+        job();
+    }
+}
+
+int logfile_init() {
+    idle_worker.idle = true;
+    bg_worker.th = std::thread(th_logfile_worker, &bg_worker);
+    idle_worker.th = std::thread(th_logfile_worker, &idle_worker);
+    return 0;
+}
+
+void logfile_uninit() {
+    for (auto w : { &idle_worker, &bg_worker }) {
+        {
+            std::lock_guard<std::mutex> guard(w->mu);
+            w->stop = true;
+            w->cv.notify_one();
+        }
+        if (w->th.joinable())
+            w->th.join();
+    }
+}
+
+static uint64_t now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/* returns the sequence numbers of the old segments, sorted, only <name>.<8 digits>.log is one, as
+<name>.<something>.log can be the live segment of another log (task "a.1" next to task "a") */
+static std::vector<uint64_t> list_segments(const std::string &dir, const std::string &name) {
+    std::vector<uint64_t> seqs;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return seqs;
+    std::string prefix = name + ".";
+    while (struct dirent *ent = readdir(d)) {
+        std::string fname = ent->d_name;
+        if (fname.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if (fname.size() != prefix.size() + 8 + 4 || fname.substr(fname.size() - 4) != ".log")
+            continue;
+        std::string seq_str = fname.substr(prefix.size(), 8);
+        if (seq_str.find_first_not_of("0123456789") != std::string::npos)
+            continue;
+        seqs.push_back(std::stoull(seq_str));
+    }
+    closedir(d);
+    std::sort(seqs.begin(), seqs.end());
+    return seqs;
+}
+
+static void trim_segments(std::string dir, std::string name, int64_t max_bytes) {
+    auto seqs = list_segments(dir, name);
+    std::vector<std::pair<std::string, int64_t>> segs;
+    int64_t total = 0;
+    for (auto seq : seqs) {
+        std::string path = dir + "/" + name + sformat(".%08lu.log", seq);
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0)
+            continue;
+        segs.push_back({path, st.st_size});
+        total += st.st_size;
+    }
+    for (auto &[path, size] : segs) {
+        if (total <= max_bytes)
+            break;
+        unlink(path.c_str());
+        total -= size;
+    }
+}
+
+std::string logfile_t::live_path() {
+    return cfg.dir + "/" + name + ".log";
+}
+
+std::string logfile_t::next_path() {
+    return cfg.dir + "/" + name + ".log.next";
+}
+
+std::string logfile_t::seg_path(uint64_t seq) {
+    return cfg.dir + "/" + name + sformat(".%08lu.log", seq);
+}
+
+static void prepare_next(logfile_t *lf, std::string next_path) {
+    int fd = ::open(next_path.c_str(), LOGFILE_OPEN_FLAGS, 0666);
+    if (fd < 0)
+        return ;
+    lf->next_fd = fd;
+}
+
+int logfile_t::open(const std::string &_name, const logfile_cfg_t &_cfg) {
+    name = _name;
+    cfg = _cfg;
+    cfg.dir = path_get_relative(cfg.dir);
+
+    if (mkdir(cfg.dir.c_str(), 0777) < 0 && errno != EEXIST)
+        return -1;
+
+    auto seqs = list_segments(cfg.dir, name);
+    last_seq = seqs.size() ? seqs.back() : 0;
+
+    /* whatever was left live by the last run is kept as it is */
+    struct stat st;
+    if (stat(live_path().c_str(), &st) == 0 && st.st_size > 0) {
+        last_seq++;
+        if (rename(live_path().c_str(), seg_path(last_seq).c_str()) < 0)
+            return -1;
+    }
+
+    fd = ::open(live_path().c_str(), LOGFILE_OPEN_FLAGS, 0666);
+    if (fd < 0)
+        return -1;
+    seg_bytes = 0;
+    seg_start_s = now_s();
+
+    std::string np = next_path();
+    std::string dir = cfg.dir;
+    std::string n = name;
+    int64_t max_bytes = cfg.max_bytes;
+    logfile_post([this, np, dir, n, max_bytes]{
+        prepare_next(this, np);
+        trim_segments(dir, n, max_bytes);
+    });
+    return 0;
+}
+
+void logfile_t::close() {
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    int nfd = next_fd.exchange(-1);
+    if (nfd >= 0)
+        ::close(nfd);
+}
+
+void logfile_t::account(size_t len) {
+    seg_bytes += len;
+    if (seg_bytes < cfg.seg_size && now_s() - seg_start_s < cfg.seg_age_s)
+        return ;
+
+    int nfd = next_fd.exchange(-1);
+    if (nfd < 0)
+        return ; /* not ready yet, we keep writing the live one */
+
+    /* ENOENT: a failed rotation already made the live segment an old one, see below */
+    uint64_t seq = last_seq + 1;
+    bool retry = false;
+    if (rename(live_path().c_str(), seg_path(seq).c_str()) < 0 && errno != ENOENT)
+        retry = true;
+    else if (rename(next_path().c_str(), live_path().c_str()) < 0) {
+        /* the live segment is put back, if that fails too it stays an old segment and we keep
+        writing in it until the next rotation */
+        if (rename(seg_path(seq).c_str(), live_path().c_str()) < 0) {
+            DBGE("Failed to put back the live segment of %s", name.c_str());
+            last_seq = seq;
+        }
+        retry = true;
+    }
+    if (retry) {
+        /* we keep the old live segment, the next one is recreated */
+        ::close(nfd);
+        std::string np = next_path();
+        logfile_post([this, np]{ prepare_next(this, np); });
+        return ;
+    }
+    last_seq = seq;
+
+    int old_fd = fd;
+    fd = nfd;
+    seg_bytes = 0;
+    seg_start_s = now_s();
+
+    std::string np = next_path();
+    std::string dir = cfg.dir;
+    std::string n = name;
+    int64_t max_bytes = cfg.max_bytes;
+    logfile_post([this, old_fd, np, dir, n, max_bytes]{
+        fsync(old_fd);
+        ::close(old_fd);
+        prepare_next(this, np);
+        trim_segments(dir, n, max_bytes);
+    });
+}
+
+int logfile_t::write(const char *data, size_t len) {
+    ASSERT_FN(write_sz(fd, data, len));
+    account(len);
+    return 0;
+}
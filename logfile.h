@@ -0,0 +1,69 @@
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <fcntl.h>
+
+/* A log file is made out of fixed size segments kept inside a directory:
+
+    <dir>/<name>.log            the live segment, the one being written
+    <dir>/<name>.log.next       pre-created, becomes the live segment on rotation
+    <dir>/<name>.<seq>.log      old segments, the oldest are deleted over max_bytes
+
+Rotation happens on the writer's thread and it's only two renames and a fd swap, closing the old
+segment, creating the next one and deleting old segments is done by a background thread. If the
+next segment is not yet ready the writer keeps writing in the live one. On open, a live segment
+left by a previous run (or crash) is kept as it is, as the newest old segment. */
+
+/* how the segments are opened, without O_APPEND as splice refuses to write in those files, only the
+writer's thread moves the file position (seg_bytes) */
+#define LOGFILE_OPEN_FLAGS  (O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC)
+
+struct logfile_cfg_t {
+    std::string dir = "./logs";
+    int64_t seg_size = 16 * 1024 * 1024;
+    int64_t seg_age_s = 24 * 60 * 60;
+    int64_t max_bytes = 256 * 1024 * 1024;
+    bool per_task = false;      /* also keep a log file per task */
+    bool splice = true;         /* move the output to the file with tee/splice (see logpump.h) */
+    bool store = true;          /* also keep the indexed binary store (see logstore.h) */
+};
+
+struct logfile_t {
+    std::string name;
+    logfile_cfg_t cfg;
+
+    int fd = -1;
+    int64_t seg_bytes = 0;
+    uint64_t seg_start_s = 0;
+    uint64_t last_seq = 0;
+    std::atomic<int> next_fd = -1;  /* set by the background thread */
+
+    int open(const std::string &name, const logfile_cfg_t &cfg);
+    void close();
+
+    /* writes and rotates if needed, never waits for the background thread */
+    int write(const char *data, size_t len);
+
+    /* for when the data was written to fd by other means (splice, etc.) */
+    void account(size_t len);
+
+    std::string live_path();
+    std::string next_path();
+    std::string seg_path(uint64_t seq);
+};
+
+int logfile_init();
+void logfile_uninit();
+
+/* runs the job on the background thread, for slow file work (fsync, unlink, etc.) */
+void logfile_post(std::function<void()> job);
+
+/* same, but on a thread with idle cpu and io priority, for the heavy work (compression), the
+pending jobs are dropped on uninit */
+void logfile_post_idle(std::function<void()> job);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef LOGFMT_H
+#define LOGFMT_H
+
+#include <time.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <stdlib.h>
+
+/* The output of the tasks is re-framed by procmgr, each line becomes a record:
+
+    [<monotonic us>][<task name>:<pid>:<out|err>] <line>\n
+
+Lines that don't have this header are procmgr's own output. */
+
+enum log_stream_e : int32_t {
+    LOG_STREAM_OUT = 1,
+    LOG_STREAM_ERR = 2,
+};
+
+inline uint64_t logfmt_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000'000ULL + ts.tv_nsec / 1000;
+}
+
+inline const char *logfmt_stream_str(int stream) {
+    return stream == LOG_STREAM_ERR ? "err" : "out";
+}
+
+/* appends a framed record to dst, line doesn't contain the newline */
+inline void logfmt_append(std::string &dst, uint64_t ts_us, const std::string &name, pid_t pid,
+        int stream, const char *line, size_t len)
+{
+    char hdr[64 + 128];
+    int hdr_len = snprintf(hdr, sizeof(hdr), "[%lu][%s:%d:%s] ", (unsigned long)ts_us,
+            name.c_str(), (int)pid, logfmt_stream_str(stream));
+    if (hdr_len >= sizeof(hdr))
+        hdr_len = sizeof(hdr) - 1;
+    dst.append(hdr, hdr_len);
+    dst.append(line, len);
+    dst.push_back('\n');
+}
+
+struct logfmt_rec_t {
+    uint64_t ts_us = 0;
+    std::string_view name;
+    pid_t pid = 0;
+    int stream = 0;
+    std::string_view msg;       /* the line, without the newline */
+};
+
+/* splits a framed record, returns false for procmgr's own lines (that are left untouched) */
+inline bool logfmt_parse(const char *line, size_t len, logfmt_rec_t &rec) {
+    std::string_view sv(line, len);
+
+    if (!sv.size() || sv[0] != '[')
+        return false;
+    size_t name_start = sv.find("][");
+    size_t hdr_end = sv.find("] ");
+    if (name_start == std::string_view::npos || hdr_end == std::string_view::npos)
+        return false;
+    size_t ts_end = name_start;
+    name_start += 2;
+    if (hdr_end <= name_start)
+        return false;
+
+    /* the name may contain ':', the pid and the stream can't */
+    std::string_view hdr = sv.substr(name_start, hdr_end - name_start);
+    size_t stream_sep = hdr.rfind(':');
+    if (stream_sep == std::string_view::npos || stream_sep == 0)
+        return false;
+    size_t pid_sep = hdr.rfind(':', stream_sep - 1);
+    if (pid_sep == std::string_view::npos)
+        return false;
+
+    rec.ts_us = strtoull(std::string(sv.substr(1, ts_end - 1)).c_str(), NULL, 10);
+    rec.name = hdr.substr(0, pid_sep);
+    rec.pid = atoi(std::string(hdr.substr(pid_sep + 1, stream_sep - pid_sep - 1)).c_str());
+    rec.stream = hdr.substr(stream_sep + 1) == "err" ? LOG_STREAM_ERR : LOG_STREAM_OUT;
+    rec.msg = sv.substr(hdr_end + 2);
+    if (rec.msg.size() && rec.msg.back() == '\n')
+        rec.msg.remove_suffix(1);
+    return true;
+}
+
+/* gets the task name out of a framed record, procmgr's own lines are named "procmgr" */
+inline std::string_view logfmt_name(const char *line, size_t len) {
+    logfmt_rec_t rec;
+    if (!logfmt_parse(line, len, rec))
+        return "procmgr";
+    return rec.name;
+}
+
+#endif
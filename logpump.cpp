@@ -0,0 +1,146 @@
+#include "logpump.h"
+#include "misc_utils.h"
+#include "debug.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <algorithm>
+
+int logpump_pipe_size(int fd, int sz) {
+    int ret = fcntl(fd, F_SETPIPE_SZ, sz);
+    if (ret < 0) {
+        DBGE("Failed to set the pipe size to %d, keeping %d", sz, fcntl(fd, F_GETPIPE_SZ));
+        return fcntl(fd, F_GETPIPE_SZ);
+    }
+    return ret;
+}
+
+int logpump_t::init(int in_fd, bool zero_copy) {
+    this->in_fd = in_fd;
+    this->zero_copy = zero_copy;
+    buff.resize(LOGPUMP_CHUNK_SZ);
+    if (zero_copy) {
+        ASSERT_FN(pipe2(tmp_pipe, O_CLOEXEC));
+        logpump_pipe_size(tmp_pipe[1], LOGPUMP_CHUNK_SZ);
+
+        /* tee can't move more than the destination pipe can hold */
+        int sz = fcntl(tmp_pipe[1], F_GETPIPE_SZ);
+        if (sz > 0 && sz < LOGPUMP_CHUNK_SZ)
+            buff.resize(sz);
+    }
+    return 0;
+}
+
+void logpump_t::uninit() {
+    for (auto &fd : tmp_pipe) {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+}
+
+/* moves len bytes from the pipe in_fd to out_fd, 1 if out_fd can't be spliced into and nothing
+was moved yet, the caller has to copy what is left, *done says how much went */
+static int splice_all(int in_fd, int out_fd, size_t len, size_t *done) {
+    *done = 0;
+    while (*done < len) {
+        ssize_t ret = splice(in_fd, NULL, out_fd, NULL, len - *done, SPLICE_F_MOVE);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && errno == EINVAL)
+            return 1;
+        if (ret <= 0)
+            return -1;
+        *done += ret;
+    }
+    return 0;
+}
+
+ssize_t logpump_t::pump_copy(int file_fd, int pipe_fd, int copy_fd) {
+    ssize_t n = read(in_fd, buff.data(), buff.size());
+    if (n <= 0)
+        return n;
+    has_bytes = true;
+    if (pipe_fd >= 0)
+        (void)!write(pipe_fd, buff.data(), n);
+    if (copy_fd >= 0 && write_sz(copy_fd, buff.data(), n) < 0)
+        return -1;
+    if (file_fd >= 0 && write_sz(file_fd, buff.data(), n) < 0)
+        return -1;
+    return n;
+}
+
+/* n bytes are waiting in the input, they are teed to the sinks that only get a copy and spliced
+into the file, which consumes them */
+ssize_t logpump_t::pump_splice(ssize_t n, int file_fd, int pipe_fd, int copy_fd) {
+    /* first, as the teed length is what all the sinks get */
+    if (copy_fd >= 0) {
+        n = tee(in_fd, tmp_pipe[1], n, 0);
+        if (n < 0 && errno == EINVAL) {
+            /* the input is not a pipe, nothing to do with zero copy here */
+            zero_copy = false;
+            return pump_copy(file_fd, pipe_fd, copy_fd);
+        }
+        if (n <= 0)
+            return -1;
+    }
+    if (pipe_fd >= 0)
+        tee(in_fd, pipe_fd, n, SPLICE_F_NONBLOCK);
+
+    size_t done;
+    if (copy_fd >= 0) {
+        int ret = splice_all(tmp_pipe[0], copy_fd, n, &done);
+        if (ret < 0)
+            return -1;
+        if (ret > 0) {
+            /* the copy sink can't be spliced into (a tty), it's written by copying from now on */
+            zero_copy = false;
+            if (read_sz(tmp_pipe[0], buff.data(), n - done) < 0 ||
+                    write_sz(copy_fd, buff.data(), n - done) < 0)
+                return -1;
+        }
+    }
+
+    if (file_fd < 0) {
+        /* nothing consumes the input, it's dropped */
+        if (read_sz(in_fd, buff.data(), n) < 0)
+            return -1;
+        has_bytes = true;
+        return n;
+    }
+    int ret = splice_all(in_fd, file_fd, n, &done);
+    if (ret < 0)
+        return -1;
+    if (ret > 0) {
+        DBG("The log file can't be spliced into, copying from now on");
+        zero_copy = false;
+        if (read_sz(in_fd, buff.data(), n - done) < 0 || write_sz(file_fd, buff.data(), n - done) < 0)
+            return -1;
+    }
+    return n;
+}
+
+ssize_t logpump_t::pump(int file_fd, int pipe_fd, int copy_fd, bool (*need_bytes)()) {
+    has_bytes = false;
+    if (!zero_copy)
+        return pump_copy(file_fd, pipe_fd, copy_fd);
+
+    /* tee and splice don't say how much there is without moving it, so we wait and ask */
+    struct pollfd pfd = { .fd = in_fd, .events = POLLIN };
+    int ret;
+    while ((ret = poll(&pfd, 1, -1)) < 0 && errno == EINTR)
+        ;
+    if (ret < 0)
+        return -1;
+    int avail = 0;
+    if (ioctl(in_fd, FIONREAD, &avail) < 0 || !avail) {
+        if (pfd.revents & (POLLHUP | POLLERR))
+            return 0;
+        return pump_copy(file_fd, pipe_fd, copy_fd);
+    }
+    if (need_bytes && need_bytes())
+        return pump_copy(file_fd, pipe_fd, copy_fd);
+
+    return pump_splice(std::min((size_t)avail, buff.size()), file_fd, pipe_fd, copy_fd);
+}
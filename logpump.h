@@ -0,0 +1,42 @@
+#ifndef LOGPUMP_H
+#define LOGPUMP_H
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* The log pump moves the output from the redirect pipe to its sinks. With zero_copy, and while no
+one needs to look at the bytes (the log ring readers, the per task split, the log store), the bytes
+reach the sinks with tee/splice only and never go through userspace. Else they are read in buff
+once and written from there. A sink that can't be spliced into (EINVAL) turns zero_copy off. */
+
+#define LOGPUMP_PIPE_SZ  (1024 * 1024)
+#define LOGPUMP_CHUNK_SZ (256 * 1024)
+
+struct logpump_t {
+    int in_fd = -1;             /* the pipe we pump from */
+    bool zero_copy = true;
+    bool has_bytes = false;     /* the last pump left the bytes it moved in buff */
+
+    int tmp_pipe[2] = { -1, -1 };   /* a teed copy of the input, spliced into the copy sink */
+    std::vector<char> buff;
+
+    int init(int in_fd, bool zero_copy);
+    void uninit();
+
+    /* Waits for data and moves it: file_fd receives everything, pipe_fd (non-blocking) loses what
+    doesn't fit, copy_fd receives everything. Any of the fds can be -1. need_bytes is asked once
+    there is data, if it says so the bytes are read in buff (has_bytes). Returns the number of bytes
+    moved, 0 on end of input and -1 on error. */
+    ssize_t pump(int file_fd, int pipe_fd, int copy_fd, bool (*need_bytes)() = NULL);
+
+private:
+    ssize_t pump_copy(int file_fd, int pipe_fd, int copy_fd);
+    ssize_t pump_splice(ssize_t n, int file_fd, int pipe_fd, int copy_fd);
+};
+
+/* tries to make the pipe at least sz big, the limit for non-root users is pipe-max-size */
+int logpump_pipe_size(int fd, int sz);
+
+#endif
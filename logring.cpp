@@ -0,0 +1,234 @@
+#include "logring.h"
+#include "logfmt.h"
+#include "cfg.h"
+#include "path_utils.h"
+
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#define LOGRING_CHUNK 65536
+
+static_assert((LOGRING_SZ & (LOGRING_SZ - 1)) == 0, "The ring size must be a power of 2");
+
+/* reserve is moved before the bytes are written and head after, a reader checks reserve after it
+copied the bytes to know if they were overwritten in the meantime */
+static char ring_buff[LOGRING_SZ];
+static std::atomic<uint64_t> ring_reserve = 0;
+static std::atomic<uint64_t> ring_head = 0;
+static int ring_efd = -1;
+
+struct log_reader_t {
+    int fd;
+    uint64_t pos;
+    std::string filter;
+    std::string line;   /* partial line, only used while filtering */
+    bool resync;        /* drop everything up to the next newline */
+    co::sem_t data_sem;
+};
+
+using log_reader_p = std::shared_ptr<log_reader_t>;
+
+static std::set<log_reader_p> readers;
+static std::atomic<int> readers_cnt = 0;   /* the size of readers, for the redirect thread */
+
+int logring_init() {
+    ASSERT_FN(ring_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    return 0;
+}
+
+bool logring_wanted() {
+    return readers_cnt.load(std::memory_order_relaxed) > 0;
+}
+
+void logring_write(const char *data, size_t len) {
+    if (len > LOGRING_SZ) {
+        data += len - LOGRING_SZ;
+        len = LOGRING_SZ;
+    }
+    uint64_t head = ring_head.load(std::memory_order_relaxed);
+    ring_reserve.store(head + len, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t off = head & (LOGRING_SZ - 1);
+    size_t first = std::min(len, (size_t)LOGRING_SZ - off);
+    memcpy(ring_buff + off, data, first);
+    memcpy(ring_buff, data + first, len - first);
+
+    ring_head.store(head + len, std::memory_order_release);
+
+    uint64_t one = 1;
+    if (write(ring_efd, &one, sizeof(one)) < 0) {
+        /* counter full, readers already have something to wake up for */
+    }
+}
+
+/* copies up to len bytes from pos, returns how many bytes were copied or -1 if pos was overwritten
+while copying */
+static int64_t ring_read(uint64_t pos, char *dst, size_t len) {
+    uint64_t head = ring_head.load(std::memory_order_acquire);
+    if (pos >= head)
+        return 0;
+    len = std::min(len, (size_t)(head - pos));
+
+    size_t off = pos & (LOGRING_SZ - 1);
+    size_t first = std::min(len, (size_t)LOGRING_SZ - off);
+    memcpy(dst, ring_buff + off, first);
+    memcpy(dst + first, ring_buff, len - first);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (ring_reserve.load(std::memory_order_relaxed) > pos + LOGRING_SZ)
+        return -1;
+    return len;
+}
+
+static uint64_t ring_oldest() {
+    uint64_t reserve = ring_reserve.load(std::memory_order_acquire);
+    return reserve > LOGRING_SZ ? reserve - LOGRING_SZ : 0;
+}
+
+int64_t logring_read(uint64_t *pos, char *dst, size_t len, uint64_t *skipped) {
+    *skipped = 0;
+    while (true) {
+        uint64_t oldest = ring_oldest();
+        if (*pos < oldest) {
+            *skipped += oldest - *pos;
+            *pos = oldest;
+        }
+        int64_t ret = ring_read(*pos, dst, len);
+        if (ret < 0)
+            continue; /* overwritten while copying, will be reported as skipped */
+        *pos += ret;
+        return ret;
+    }
+}
+
+static int open_socket() {
+    int fd;
+    struct sockaddr_un sockaddr_un = {0};
+
+    std::string sock_path = path_get_relative(cfg_get()->log_sock_path);
+    if (sock_path.size() + 1 > sizeof(sockaddr_un.sun_path)) {
+        DBG("Log socket path too long");
+        return -1;
+    }
+    sockaddr_un.sun_family = AF_UNIX;
+    strcpy(sockaddr_un.sun_path, sock_path.c_str());
+
+    ASSERT_FN(fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    remove(sockaddr_un.sun_path);
+
+    ASSERT_FN(bind(fd, (struct sockaddr *) &sockaddr_un, sizeof(struct sockaddr_un)));
+    ASSERT_FN(chmod(sockaddr_un.sun_path, cfg_get()->sock_perm));
+    return fd;
+}
+
+/* sends the lines that pass the filter, the partial line is kept for later */
+static co::task_t co_send_filtered(log_reader_p reader, const char *data, size_t len) {
+    std::string out;
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        if (!nl) {
+            if (!reader->resync)
+                reader->line.append(p, end - p);
+            break;
+        }
+        if (reader->resync) {
+            reader->resync = false;
+            p = nl + 1;
+            continue;
+        }
+        const char *line = p;
+        size_t line_len = nl - p + 1;
+        if (reader->line.size()) {
+            reader->line.append(p, line_len);
+            line = reader->line.data();
+            line_len = reader->line.size();
+        }
+        if (reader->filter == "" || logfmt_name(line, line_len) == reader->filter)
+            out.append(line, line_len);
+        reader->line.clear();
+        p = nl + 1;
+    }
+    if (out.size())
+        ASSERT_COFN(co_await co::write_sz(reader->fd, out.data(), out.size()));
+    co_return 0;
+}
+
+static co::task_t co_log_reader(log_reader_p reader) {
+    readers.insert(reader);
+    readers_cnt = readers.size();
+    FnScope scope([reader]{
+        readers.erase(reader);
+        readers_cnt = readers.size();
+        close(reader->fd);
+    });
+
+    std::vector<char> buff(LOGRING_CHUNK);
+    while (true) {
+        uint64_t skipped;
+        int64_t ret = logring_read(&reader->pos, buff.data(), buff.size(), &skipped);
+        if (skipped) {
+            std::string skip_msg = sformat(LOGRING_SKIP_FMT, skipped);
+            ASSERT_COFN(co_await co::write_sz(reader->fd, skip_msg.data(), skip_msg.size()));
+            reader->line.clear();
+            reader->resync = true;
+        }
+        if (ret == 0) {
+            co_await reader->data_sem;
+            continue;
+        }
+        ASSERT_COFN(co_await co_send_filtered(reader, buff.data(), ret));
+    }
+    co_return 0;
+}
+
+static co::task_t co_logring_notify() {
+    while (true) {
+        uint64_t cnt;
+        ASSERT_COFN(co_await co::read(ring_efd, &cnt, sizeof(cnt)));
+        for (auto &reader : readers)
+            reader->data_sem.rel();
+    }
+    co_return 0;
+}
+
+co::task_t co_logring() {
+    int server_fd;
+
+    ASSERT_ECOFN(server_fd = open_socket());
+    ASSERT_ECOFN(listen(server_fd, 4096));
+
+    co_await co::sched(co_logring_notify());
+
+    while (true) {
+        int remote_fd = co_await co::accept(server_fd, NULL, NULL);
+        ASSERT_ECOFN(remote_fd);
+
+        pmgr_log_req_t req;
+        if (co_await co::read_sz(remote_fd, &req, sizeof(req)) != sizeof(req) ||
+                req.hdr.type != PMGR_MSG_LOG_ATTACH || req.hdr.size != sizeof(req))
+        {
+            DBG("Invalid log attach request");
+            close(remote_fd);
+            continue;
+        }
+        req.task_name[PMGR_MAX_TASK_NAME - 1] = '\0';
+
+        auto reader = std::make_shared<log_reader_t>();
+        reader->fd = remote_fd;
+        reader->filter = req.task_name;
+        if (req.flags & PMGR_LOG_FROM_HEAD) {
+            reader->pos = ring_oldest();
+            reader->resync = reader->pos > 0; /* we may be in the middle of a line */
+        }
+        else {
+            uint64_t head = ring_head.load(std::memory_order_acquire);
+            reader->pos = head;
+            reader->resync = head > 0 && ring_buff[(head - 1) & (LOGRING_SZ - 1)] != '\n';
+        }
+        co_await co::sched(co_log_reader(reader));
+    }
+    co_return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include "co_utils.h"
+
+/* The log ring holds the last LOGRING_SZ bytes of output. It is written by the redirect thread,
+that never blocks on it, and read by any number of readers that connect to the log socket. A reader
+that falls behind is moved forward and receives a "skipped N bytes" line instead. The output that
+was only spliced to the log file (see logpump.h) never reaches the ring, so when nothing else reads
+the output the ring only has what came while someone was attached. */
+
+#define LOGRING_SZ (1024 * 1024)
+
+/* what a reader that fell behind receives in place of the bytes it lost */
+#define LOGRING_SKIP_FMT "[procmgr] skipped %lu bytes\n"
+
+int logring_init();
+
+/* producer side, only called from the redirect thread */
+void logring_write(const char *data, size_t len);
+
+/* reader side, copies up to len bytes from *pos and moves *pos past them. If the bytes at *pos
+were overwritten, *pos first jumps to the oldest byte still in the ring and *skipped says how many
+bytes were lost. The copy is checked against the writer, so it's never a mix of old and new */
+int64_t logring_read(uint64_t *pos, char *dst, size_t len, uint64_t *skipped);
+
+/* true while a reader is attached, the redirect thread then reads the output for the ring */
+bool logring_wanted();
+
+/* This coroutine serves the readers of the log socket */
+co::task_t co_logring();
+
+#endif
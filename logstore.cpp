@@ -0,0 +1,660 @@
+#include "logstore.h"
+#include "logfmt.h"
+#include "procmgr.h"
+#include "path_utils.h"
+#include "debug.h"
+#include "lzblk.h"
+
+#include <dirent.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static std::string store_dir;
+static logfile_cfg_t store_cfg;
+static int dat_fd = -1;
+static int idx_fd = -1;
+static int names_fd = -1;
+static uint64_t cur_seq = 0;
+static int64_t seg_bytes = 0;
+static int64_t mono2real_us = 0;
+
+static std::unordered_map<std::string, uint32_t> name_ids;
+static uint32_t next_id = 1;
+
+static std::string dat_batch;
+static std::string idx_batch;
+static logidx_t block;
+
+static std::string dat_path(const std::string &dir, uint64_t seq) {
+    return dir + sformat("/%08lu.dat", seq);
+}
+
+static std::string idx_path(const std::string &dir, uint64_t seq) {
+    return dir + sformat("/%08lu.idx", seq);
+}
+
+static std::string lz_path(const std::string &dir, uint64_t seq) {
+    return dir + sformat("/%08lu.lz", seq);
+}
+
+static std::string lzi_path(const std::string &dir, uint64_t seq) {
+    return dir + sformat("/%08lu.lzi", seq);
+}
+
+static std::string names_path(const std::string &dir) {
+    return dir + "/tasks";
+}
+
+static std::string get_store_dir(const logfile_cfg_t &cfg) {
+    return path_get_relative(cfg.dir) + "/store";
+}
+
+static int64_t now_real_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000'000LL + ts.tv_nsec / 1000;
+}
+
+static std::vector<uint64_t> list_segments(const std::string &dir) {
+    std::vector<uint64_t> seqs;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return seqs;
+    while (struct dirent *ent = readdir(d)) {
+        std::string fname = ent->d_name;
+        size_t dot = fname.find('.');
+        if (dot == 0 || dot == std::string::npos)
+            continue;
+        std::string ext = fname.substr(dot);
+        if (ext != ".dat" && ext != ".lzi")
+            continue;
+        std::string seq_str = fname.substr(0, dot);
+        if (seq_str.find_first_not_of("0123456789") != std::string::npos)
+            continue;
+        seqs.push_back(std::stoull(seq_str));
+    }
+    closedir(d);
+    std::sort(seqs.begin(), seqs.end());
+    seqs.erase(std::unique(seqs.begin(), seqs.end()), seqs.end());
+    return seqs;
+}
+
+static void trim_segments(std::string dir, int64_t max_bytes) {
+    auto seqs = list_segments(dir);
+    std::vector<std::pair<uint64_t, int64_t>> segs;
+    int64_t total = 0;
+    for (auto seq : seqs) {
+        struct stat st;
+        if (stat(dat_path(dir, seq).c_str(), &st) < 0 && stat(lz_path(dir, seq).c_str(), &st) < 0)
+            continue;
+        segs.push_back({seq, st.st_size});
+        total += st.st_size;
+    }
+    for (auto &[seq, size] : segs) {
+        if (total <= max_bytes)
+            break;
+        unlink(lzi_path(dir, seq).c_str());
+        unlink(lz_path(dir, seq).c_str());
+        unlink(idx_path(dir, seq).c_str());
+        unlink(dat_path(dir, seq).c_str());
+        total -= size;
+    }
+}
+
+/* Re-blocks the records of a closed segment and compresses each block on it's own. The index is
+rebuilt from the records, so a segment that was not fully indexed (or torn) is handled the same. */
+static int compress_segment(std::string dir, uint64_t seq) {
+    int fd = open(dat_path(dir, seq).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0; /* trimmed or already compressed */
+    FnScope scope([fd]{ close(fd); });
+
+    struct stat st;
+    ASSERT_FN(fstat(fd, &st));
+    if (!st.st_size) {
+        unlink(idx_path(dir, seq).c_str());
+        unlink(dat_path(dir, seq).c_str());
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        DBGE("Failed to map the log segment");
+        return -1;
+    }
+    scope([map, &st]{ munmap(map, st.st_size); });
+    const char *data = (const char *)map;
+
+    std::string lz_tmp = lz_path(dir, seq) + ".tmp";
+    std::string lzi_tmp = lzi_path(dir, seq) + ".tmp";
+    int lz_fd, lzi_fd;
+    ASSERT_FN(lz_fd = open(lz_tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666));
+    scope([lz_fd]{ close(lz_fd); });
+    ASSERT_FN(lzi_fd = open(lzi_tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666));
+    scope([lzi_fd]{ close(lzi_fd); });
+
+    std::vector<char> zbuff;
+    std::string zidx;
+    uint64_t zoff = 0;
+    logidx_t block{};
+
+    auto flush_block = [&]() -> int {
+        if (!block.len)
+            return 0;
+        logzidx_t ze{ .idx = block, .zoff = zoff };
+        zbuff.resize(lzblk_bound(block.len));
+        int64_t zlen = lzblk_compress(data + block.off, block.len, zbuff.data(), zbuff.size());
+        if (zlen < 0 || (uint64_t)zlen >= block.len) {
+            ze.stored = 1;
+            ze.zlen = block.len;
+            ASSERT_FN(write_sz(lz_fd, data + block.off, block.len));
+        }
+        else {
+            ze.zlen = zlen;
+            ASSERT_FN(write_sz(lz_fd, zbuff.data(), zlen));
+        }
+        zoff += ze.zlen;
+        zidx.append((const char *)&ze, sizeof(ze));
+        block = logidx_t{ .off = block.off + block.len };
+        return 0;
+    };
+
+    uint64_t pos = 0;
+    while (pos + sizeof(logrec_hdr_t) <= (uint64_t)st.st_size) {
+        logrec_hdr_t hdr;
+        memcpy(&hdr, data + pos, sizeof(hdr));
+        uint64_t rec_len = sizeof(hdr) + hdr.len;
+        if (pos + rec_len > (uint64_t)st.st_size)
+            break; /* torn at the end, dropped */
+        if (block.len && block.len + rec_len > LOGSTORE_BLOCK_SZ)
+            ASSERT_FN(flush_block());
+        if (!block.len) {
+            block.min_ts_us = hdr.ts_us;
+            block.max_ts_us = hdr.ts_us;
+        }
+        block.len += rec_len;
+        block.min_ts_us = std::min(block.min_ts_us, hdr.ts_us);
+        block.max_ts_us = std::max(block.max_ts_us, hdr.ts_us);
+        block.tasks |= 1ULL << (hdr.task_id % 64);
+        pos += rec_len;
+    }
+    ASSERT_FN(flush_block());
+    ASSERT_FN(write_sz(lzi_fd, zidx.data(), zidx.size()));
+    ASSERT_FN(fsync(lz_fd));
+    ASSERT_FN(fsync(lzi_fd));
+
+    ASSERT_FN(rename(lz_tmp.c_str(), lz_path(dir, seq).c_str()));
+    ASSERT_FN(rename(lzi_tmp.c_str(), lzi_path(dir, seq).c_str()));
+    if (access(dat_path(dir, seq).c_str(), F_OK) < 0) {
+        /* it was trimmed while we were at it */
+        unlink(lzi_path(dir, seq).c_str());
+        unlink(lz_path(dir, seq).c_str());
+        return 0;
+    }
+    unlink(idx_path(dir, seq).c_str());
+    unlink(dat_path(dir, seq).c_str());
+    return 0;
+}
+
+static void post_compress(std::string dir, uint64_t seq) {
+    logfile_post_idle([dir, seq]{
+        if (compress_segment(dir, seq) < 0)
+            DBGE("Failed to compress log segment %lu", seq);
+    });
+}
+
+static std::unordered_map<std::string, uint32_t> read_names(const std::string &dir,
+        std::vector<std::string> *names = NULL)
+{
+    std::unordered_map<std::string, uint32_t> ids;
+    ids["procmgr"] = 0;
+    if (names) {
+        names->clear();
+        names->push_back("procmgr");
+    }
+    FILE *f = fopen(names_path(dir).c_str(), "r");
+    if (!f)
+        return ids;
+    char line[PMGR_MAX_TASK_NAME + 32];
+    while (fgets(line, sizeof(line), f)) {
+        char *sep = strchr(line, ' ');
+        char *nl = strchr(line, '\n');
+        if (!sep || !nl)
+            continue;
+        *nl = 0;
+        uint32_t id = atoi(line);
+        ids[sep + 1] = id;
+        if (names) {
+            if (names->size() <= id)
+                names->resize(id + 1);
+            (*names)[id] = sep + 1;
+        }
+    }
+    fclose(f);
+    return ids;
+}
+
+static int open_segment(uint64_t seq) {
+    ASSERT_FN(dat_fd = open(dat_path(store_dir, seq).c_str(),
+            O_CREAT | O_WRONLY | O_TRUNC | O_APPEND | O_CLOEXEC, 0666));
+    ASSERT_FN(idx_fd = open(idx_path(store_dir, seq).c_str(),
+            O_CREAT | O_WRONLY | O_TRUNC | O_APPEND | O_CLOEXEC, 0666));
+    cur_seq = seq;
+    seg_bytes = 0;
+    block = logidx_t{};
+    return 0;
+}
+
+int logstore_open(const logfile_cfg_t &cfg) {
+    store_cfg = cfg;
+    store_dir = get_store_dir(cfg);
+    if (mkdir(path_get_relative(cfg.dir).c_str(), 0777) < 0 && errno != EEXIST)
+        return -1;
+    if (mkdir(store_dir.c_str(), 0777) < 0 && errno != EEXIST)
+        return -1;
+
+    /* the records are framed with the monotonic clock, the store wants wall clock time */
+    mono2real_us = now_real_us() - (int64_t)logfmt_now_us();
+
+    name_ids = read_names(store_dir);
+    for (auto &[name, id] : name_ids)
+        next_id = std::max(next_id, id + 1);
+    ASSERT_FN(names_fd = open(names_path(store_dir).c_str(),
+            O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0666));
+
+    /* the segments of the last run are left as they are, even if not fully indexed, they are
+    closed so they can be compressed */
+    auto seqs = list_segments(store_dir);
+    ASSERT_FN(open_segment(seqs.size() ? seqs.back() + 1 : 1));
+    for (auto seq : seqs)
+        if (access(lzi_path(store_dir, seq).c_str(), F_OK) < 0)
+            post_compress(store_dir, seq);
+
+    std::string dir = store_dir;
+    int64_t max_bytes = cfg.max_bytes;
+    logfile_post([dir, max_bytes]{ trim_segments(dir, max_bytes); });
+    return 0;
+}
+
+void logstore_close() {
+    logstore_flush();
+    for (auto fd : { dat_fd, idx_fd, names_fd })
+        if (fd >= 0)
+            close(fd);
+    dat_fd = idx_fd = names_fd = -1;
+}
+
+static uint32_t get_task_id(std::string_view name) {
+    std::string sname(name);
+    auto it = name_ids.find(sname);
+    if (it != name_ids.end())
+        return it->second;
+    uint32_t id = next_id++;
+    name_ids[sname] = id;
+    dprintf(names_fd, "%u %s\n", id, sname.c_str());
+    return id;
+}
+
+static void close_block() {
+    if (!block.len)
+        return ;
+    idx_batch.append((const char *)&block, sizeof(block));
+    block = logidx_t{ .off = block.off + block.len };
+}
+
+void logstore_append(const char *line, size_t len) {
+    if (dat_fd < 0)
+        return ;
+    logfmt_rec_t rec;
+    logrec_hdr_t hdr{};
+    if (logfmt_parse(line, len, rec)) {
+        hdr.task_id = get_task_id(rec.name);
+        hdr.ts_us = rec.ts_us + mono2real_us;
+        hdr.pid = rec.pid;
+        hdr.stream = rec.stream;
+    }
+    else {
+        rec.msg = std::string_view(line, len);
+        if (rec.msg.size() && rec.msg.back() == '\n')
+            rec.msg.remove_suffix(1);
+        hdr.ts_us = now_real_us();
+        hdr.pid = getpid();
+    }
+    hdr.len = rec.msg.size();
+
+    size_t rec_len = sizeof(hdr) + hdr.len;
+    if (block.len && block.len + rec_len > LOGSTORE_BLOCK_SZ)
+        close_block();
+    if (!block.len) {
+        block.min_ts_us = hdr.ts_us;
+        block.max_ts_us = hdr.ts_us;
+    }
+    block.len += rec_len;
+    block.min_ts_us = std::min(block.min_ts_us, hdr.ts_us);
+    block.max_ts_us = std::max(block.max_ts_us, hdr.ts_us);
+    block.tasks |= 1ULL << (hdr.task_id % 64);
+
+    dat_batch.append((const char *)&hdr, sizeof(hdr));
+    dat_batch.append(rec.msg.data(), rec.msg.size());
+}
+
+int logstore_flush() {
+    if (dat_fd < 0)
+        return 0;
+    if (dat_batch.size()) {
+        ASSERT_FN(write_sz(dat_fd, dat_batch.data(), dat_batch.size()));
+        seg_bytes += dat_batch.size();
+        dat_batch.clear();
+    }
+    if (seg_bytes >= store_cfg.seg_size)
+        close_block();
+    if (idx_batch.size()) {
+        ASSERT_FN(write_sz(idx_fd, idx_batch.data(), idx_batch.size()));
+        idx_batch.clear();
+    }
+    if (seg_bytes < store_cfg.seg_size)
+        return 0;
+
+    /* the segment is complete, the index too, a new one is started */
+    int old_dat = dat_fd;
+    int old_idx = idx_fd;
+    uint64_t old_seq = cur_seq;
+    ASSERT_FN(open_segment(cur_seq + 1));
+    post_compress(store_dir, old_seq);
+
+    std::string dir = store_dir;
+    int64_t max_bytes = store_cfg.max_bytes;
+    logfile_post([old_dat, old_idx, dir, max_bytes]{
+        fsync(old_dat);
+        fsync(old_idx);
+        close(old_dat);
+        close(old_idx);
+        trim_segments(dir, max_bytes);
+    });
+    return 0;
+}
+
+/* reader side */
+
+struct store_reader_t {
+    std::string dir;
+    logstore_query_t q;
+    logstore_cbk_t cbk;
+
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> names;
+    int64_t task_id = -1;       /* -1 for all, -2 if the task was not yet seen */
+
+    std::vector<char> buff = std::vector<char>(4 * LOGSTORE_BLOCK_SZ);
+
+    void load_names() {
+        ids = read_names(dir, &names);
+        if (!q.task.size())
+            task_id = -1;
+        else
+            task_id = HAS(ids, q.task) ? ids[q.task] : -2;
+    }
+
+    std::string name_of(uint32_t id) {
+        if (id >= names.size() || !names[id].size())
+            load_names();
+        if (id >= names.size())
+            return sformat("task-%u", id);
+        return names[id];
+    }
+
+    bool wants_task(uint32_t id) {
+        if (task_id == -2 && q.follow)
+            load_names();
+        return task_id == -1 || task_id == id;
+    }
+
+    /* calls cbk for the complete records in data, returns the consumed bytes, need is set to
+    the size of the first incomplete record */
+    int64_t scan_mem(const char *data, uint64_t len, uint64_t &need) {
+        uint64_t pos = 0;
+        need = 0;
+        while (pos + sizeof(logrec_hdr_t) <= len) {
+            logrec_hdr_t hdr;
+            memcpy(&hdr, data + pos, sizeof(hdr));
+            uint64_t rec_len = sizeof(hdr) + hdr.len;
+            if (pos + rec_len > len) {
+                need = rec_len;
+                break;
+            }
+            if (hdr.ts_us >= q.since_us && hdr.ts_us <= q.until_us && wants_task(hdr.task_id)) {
+                std::string line(data + pos + sizeof(hdr), hdr.len);
+                if (cbk(name_of(hdr.task_id), hdr, line.c_str()) < 0)
+                    return -2;
+            }
+            pos += rec_len;
+        }
+        return pos;
+    }
+
+    /* same as scan_mem, for [off, off + len) of fd */
+    int64_t scan(int fd, uint64_t off, uint64_t len) {
+        uint64_t done = 0;
+        while (done < len) {
+            size_t want = std::min<uint64_t>(len - done, buff.size());
+            ssize_t ret = pread(fd, buff.data(), want, off + done);
+            if (ret <= 0)
+                return ret < 0 ? -1 : done;
+
+            uint64_t need;
+            int64_t pos = scan_mem(buff.data(), ret, need);
+            if (pos < 0)
+                return pos;
+            if (pos == 0) {
+                /* the record is bigger than the buffer, else it's not complete yet (or torn) */
+                if (need > buff.size() && need <= len - done) {
+                    buff.resize(need);
+                    continue;
+                }
+                break;
+            }
+            done += pos;
+        }
+        return done;
+    }
+
+    bool block_matches(const logidx_t &idx) {
+        if (idx.max_ts_us < q.since_us || idx.min_ts_us > q.until_us)
+            return false;
+        if (task_id == -2 && q.follow)
+            load_names();
+        if (task_id == -2)
+            return false;
+        if (task_id != -1 && !(idx.tasks & (1ULL << (task_id % 64))))
+            return false;
+        return true;
+    }
+
+    /* reads a compressed segment, starting with the record at from_off, returns the offset (in
+    the uncompressed segment) up to where it was consumed or -1 if it's not compressed */
+    int64_t read_compressed(uint64_t seq, uint64_t from_off = 0) {
+        int ifd = open(lzi_path(dir, seq).c_str(), O_RDONLY | O_CLOEXEC);
+        if (ifd < 0)
+            return -1;
+        FnScope scope([ifd]{ close(ifd); });
+        int fd;
+        ASSERT_FN(fd = open(lz_path(dir, seq).c_str(), O_RDONLY | O_CLOEXEC));
+        scope([fd]{ close(fd); });
+
+        struct stat st, zst;
+        ASSERT_FN(fstat(ifd, &st));
+        ASSERT_FN(fstat(fd, &zst));
+        size_t cnt = st.st_size / sizeof(logzidx_t);
+        if (!cnt)
+            return from_off;
+        void *map = mmap(NULL, cnt * sizeof(logzidx_t), PROT_READ, MAP_SHARED, ifd, 0);
+        if (map == MAP_FAILED) {
+            DBGE("Failed to map the log index");
+            return -1;
+        }
+        scope([map, cnt]{ munmap(map, cnt * sizeof(logzidx_t)); });
+        logzidx_t *zidx = (logzidx_t *)map;
+
+        std::vector<char> zbuff;
+        std::vector<char> raw;
+        for (size_t i = 0; i < cnt; i++) {
+            auto &ze = zidx[i];
+            if (ze.idx.off + ze.idx.len <= from_off || !block_matches(ze.idx))
+                continue;
+            /* the index is not trusted, a block has to be inside the file and a stored one has the
+            size of it's records */
+            if ((ze.stored && ze.zlen != ze.idx.len) || ze.zoff > (uint64_t)zst.st_size ||
+                    ze.zlen > (uint64_t)zst.st_size - ze.zoff) {
+                DBG("Corrupted block in log segment %lu at %lu", seq, ze.idx.off);
+                continue;
+            }
+            zbuff.resize(ze.zlen);
+            if (pread(fd, zbuff.data(), ze.zlen, ze.zoff) != (ssize_t)ze.zlen) {
+                DBG("Corrupted block in log segment %lu at %lu", seq, ze.idx.off);
+                continue;
+            }
+            const char *data = zbuff.data();
+            if (!ze.stored) {
+                raw.resize(ze.idx.len);
+                if (lzblk_decompress(zbuff.data(), ze.zlen, raw.data(), ze.idx.len) < 0) {
+                    DBG("Corrupted block in log segment %lu at %lu", seq, ze.idx.off);
+                    continue;
+                }
+                data = raw.data();
+            }
+
+            /* records are never split between blocks, so from_off is a record start */
+            uint64_t skip = from_off > ze.idx.off ? from_off - ze.idx.off : 0;
+            uint64_t need;
+            if (scan_mem(data + skip, ze.idx.len - skip, need) == -2)
+                return -2;
+        }
+        auto &last = zidx[cnt - 1].idx;
+        return std::max<uint64_t>(from_off, last.off + last.len);
+    }
+
+    /* reads a whole segment, using the index to skip the blocks that can't match, returns the
+    offset up to where the segment was consumed */
+    int64_t read_segment(uint64_t seq) {
+        int fd = open(dat_path(dir, seq).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return read_compressed(seq);
+        FnScope scope([fd]{ close(fd); });
+
+        uint64_t indexed_end = 0;
+        int ifd = open(idx_path(dir, seq).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (ifd >= 0 && fstat(ifd, &st) == 0 && st.st_size >= (off_t)sizeof(logidx_t)) {
+            size_t cnt = st.st_size / sizeof(logidx_t);
+            void *map = mmap(NULL, cnt * sizeof(logidx_t), PROT_READ, MAP_SHARED, ifd, 0);
+            if (map != MAP_FAILED) {
+                FnScope unmap([map, cnt]{ munmap(map, cnt * sizeof(logidx_t)); });
+                logidx_t *idx = (logidx_t *)map;
+                for (size_t i = 0; i < cnt; i++) {
+                    indexed_end = idx[i].off + idx[i].len;
+                    if (!block_matches(idx[i]))
+                        continue;
+                    if (scan(fd, idx[i].off, idx[i].len) == -2)
+                        return -2;
+                }
+            }
+        }
+        if (ifd >= 0)
+            close(ifd);
+
+        /* the part that is not indexed yet */
+        ASSERT_FN(fstat(fd, &st));
+        if ((uint64_t)st.st_size <= indexed_end)
+            return indexed_end;
+        int64_t ret = scan(fd, indexed_end, st.st_size - indexed_end);
+        if (ret < 0)
+            return ret;
+        return indexed_end + ret;
+    }
+
+    bool segment_exists(uint64_t seq) {
+        return access(dat_path(dir, seq).c_str(), F_OK) == 0 ||
+                access(lzi_path(dir, seq).c_str(), F_OK) == 0;
+    }
+
+    int follow(uint64_t seq, uint64_t off) {
+        while (true) {
+            int fd = open(dat_path(dir, seq).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0 && access(lzi_path(dir, seq).c_str(), F_OK) == 0) {
+                /* it got closed and compressed since we last looked */
+                int64_t ret = read_compressed(seq, off);
+                if (ret == -2)
+                    return 0;
+                seq++;
+                off = 0;
+                continue;
+            }
+            if (fd < 0) {
+                /* it was trimmed, start from the oldest one */
+                auto seqs = list_segments(dir);
+                if (!seqs.size()) {
+                    sleep_ms(200);
+                    continue;
+                }
+                seq = seqs.front();
+                off = 0;
+                continue;
+            }
+            FnScope scope([fd]{ close(fd); });
+            while (true) {
+                struct stat st;
+                ASSERT_FN(fstat(fd, &st));
+                if ((uint64_t)st.st_size > off) {
+                    int64_t ret = scan(fd, off, st.st_size - off);
+                    if (ret < 0)
+                        return ret == -2 ? 0 : -1;
+                    off += ret;
+                    if (ret > 0)
+                        continue;
+                }
+                sleep_ms(200);
+
+                /* once the next segment exists nothing more is written in this one, but the last
+                batch may have been written after the check above */
+                if (segment_exists(seq + 1)) {
+                    ASSERT_FN(fstat(fd, &st));
+                    if ((uint64_t)st.st_size > off) {
+                        int64_t ret = scan(fd, off, st.st_size - off);
+                        if (ret < 0)
+                            return ret == -2 ? 0 : -1;
+                    }
+                    break;
+                }
+            }
+            seq++;
+            off = 0;
+        }
+        return 0;
+    }
+};
+
+int logstore_query(const logfile_cfg_t &cfg, const logstore_query_t &q, logstore_cbk_t cbk) {
+    store_reader_t r;
+    r.dir = get_store_dir(cfg);
+    r.q = q;
+    r.cbk = cbk;
+    r.load_names();
+    if (r.task_id == -2 && !q.follow)
+        return 0;
+
+    auto seqs = list_segments(r.dir);
+    uint64_t last_seq = 0;
+    int64_t last_off = 0;
+    for (auto seq : seqs) {
+        int64_t ret = r.read_segment(seq);
+        if (ret == -2)
+            return 0;
+        last_seq = seq;
+        last_off = std::max<int64_t>(ret, 0);
+    }
+    if (!q.follow)
+        return 0;
+    if (!seqs.size())
+        last_seq = 1;
+    return r.follow(last_seq, last_off);
+}
@@ -0,0 +1,73 @@
+#ifndef LOGSTORE_H
+#define LOGSTORE_H
+
+#include <string>
+#include <functional>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "logfile.h"
+
+/* The log store keeps the output as binary records, so it can be searched by time and by task
+without reading all of it:
+
+    <dir>/store/tasks           "<id> <name>\n" for every task name seen, append only
+    <dir>/store/<seq>.dat       logrec_hdr_t followed by the line (without the newline), repeated
+    <dir>/store/<seq>.idx       a logidx_t for every block of records, made to be mmap'ed
+    <dir>/store/<seq>.lz        the blocks of a closed segment, each compressed on it's own
+    <dir>/store/<seq>.lzi       a logzidx_t for every block of <seq>.lz
+
+A block is indexed only once it's full (LOGSTORE_BLOCK_SZ), so the end of a segment may have no
+index entry, that part is scanned. Segments are rotated at cfg.seg_size and the oldest ones are
+deleted over cfg.max_bytes. Once closed, a segment is compressed (see lzblk.h) on the idle log
+thread, the .lzi is renamed in place last, so a segment is read from the .dat until it exists.
+Timestamps are wall clock, in us. */
+
+#define LOGSTORE_BLOCK_SZ (64 * 1024)
+
+struct logrec_hdr_t {
+    uint32_t len;           /* of the line that follows */
+    uint32_t task_id;       /* 0 is procmgr itself */
+    int64_t ts_us;
+    int32_t pid;
+    int32_t stream;         /* log_stream_e, 0 for procmgr's own lines */
+};
+
+struct logidx_t {
+    uint64_t off;           /* of the first record in the block */
+    uint64_t len;
+    int64_t min_ts_us;
+    int64_t max_ts_us;
+    uint64_t tasks;         /* bit (task_id % 64) is set if the block has records of that task */
+};
+
+struct logzidx_t {
+    logidx_t idx;           /* the offsets are the ones from the .dat */
+    uint64_t zoff;          /* where the block is in the .lz */
+    uint32_t zlen;
+    uint32_t stored;        /* 1 if the block is kept as it is, because it didn't compress */
+};
+
+/* writer side, only used from the redirect thread */
+int logstore_open(const logfile_cfg_t &cfg);
+void logstore_close();
+
+/* takes one framed line (see logfmt.h), the records are only written on flush */
+void logstore_append(const char *line, size_t len);
+int logstore_flush();
+
+struct logstore_query_t {
+    std::string task;               /* empty for all the tasks */
+    int64_t since_us = 0;
+    int64_t until_us = INT64_MAX;
+    bool follow = false;            /* wait for new records after reaching the end */
+};
+
+using logstore_cbk_t = std::function<int(const std::string &task_name, const logrec_hdr_t &hdr,
+        const char *line)>;
+
+/* reader side, calls cbk for each matching record, in the order they were stored, stops if cbk
+returns something negative */
+int logstore_query(const logfile_cfg_t &cfg, const logstore_query_t &q, logstore_cbk_t cbk);
+
+#endif
@@ -0,0 +1,150 @@
+#include "lzblk.h"
+
+#include <string.h>
+#include <vector>
+
+#define LZBLK_MIN_MATCH     4
+#define LZBLK_HASH_BITS     14
+#define LZBLK_MAX_OFF       65535
+#define LZBLK_LAST_LITERALS 5       /* the block always ends in literals */
+#define LZBLK_MFLIMIT       12      /* no match starts this close to the end */
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZBLK_HASH_BITS);
+}
+
+/* writes the 255 extensions of a length that saturated its 4 bits */
+static inline bool put_len(uint8_t *&op, uint8_t *end, size_t len) {
+    while (len >= 255) {
+        if (op >= end)
+            return false;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= end)
+        return false;
+    *op++ = len;
+    return true;
+}
+
+static inline bool put_seq(uint8_t *&op, uint8_t *end, const uint8_t *lit, size_t lit_len,
+        size_t off, size_t match_len)
+{
+    if (op >= end)
+        return false;
+    uint8_t *token = op++;
+    size_t ml = match_len ? match_len - LZBLK_MIN_MATCH : 0;
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4 | (ml >= 15 ? 15 : ml);
+    if (lit_len >= 15 && !put_len(op, end, lit_len - 15))
+        return false;
+    if (op + lit_len > end)
+        return false;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (!match_len)
+        return true;
+    if (op + 2 > end)
+        return false;
+    *op++ = off & 0xff;
+    *op++ = off >> 8;
+    if (ml >= 15 && !put_len(op, end, ml - 15))
+        return false;
+    return true;
+}
+
+int64_t lzblk_compress(const char *_src, size_t len, char *_dst, size_t cap) {
+    const uint8_t *src = (const uint8_t *)_src;
+    uint8_t *op = (uint8_t *)_dst;
+    uint8_t *end = op + cap;
+
+    static thread_local std::vector<uint32_t> table;
+    table.assign(1 << LZBLK_HASH_BITS, 0);
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    if (len > LZBLK_MFLIMIT) {
+        size_t limit = len - LZBLK_MFLIMIT;
+        size_t match_end = len - LZBLK_LAST_LITERALS;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash32(seq);
+            size_t ref = table[h];
+            table[h] = ip;
+            if (ref >= ip || ip - ref > LZBLK_MAX_OFF || read32(src + ref) != seq) {
+                ip++;
+                continue;
+            }
+            size_t match_len = LZBLK_MIN_MATCH;
+            while (ip + match_len < match_end && src[ref + match_len] == src[ip + match_len])
+                match_len++;
+            if (!put_seq(op, end, src + anchor, ip - anchor, ip - ref, match_len))
+                return -1;
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+    if (!put_seq(op, end, src + anchor, len - anchor, 0, 0))
+        return -1;
+    return op - (uint8_t *)_dst;
+}
+
+/* reads the 255 extensions of a length */
+static inline bool get_len(const uint8_t *&ip, const uint8_t *end, size_t &len) {
+    uint8_t b;
+    do {
+        if (ip >= end)
+            return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+int lzblk_decompress(const char *_src, size_t len, char *_dst, size_t raw_len) {
+    const uint8_t *ip = (const uint8_t *)_src;
+    const uint8_t *end = ip + len;
+    uint8_t *dst = (uint8_t *)_dst;
+    size_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !get_len(ip, end, lit_len))
+            return -1;
+        if (lit_len > (size_t)(end - ip) || op + lit_len > raw_len)
+            return -1;
+        memcpy(dst + op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == end)
+            break; /* the last sequence has no match */
+
+        if (end - ip < 2)
+            return -1;
+        size_t off = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !get_len(ip, end, match_len))
+            return -1;
+        match_len += LZBLK_MIN_MATCH;
+        if (!off || off > op || op + match_len > raw_len)
+            return -1;
+
+        /* the match may overlap what it writes */
+        uint8_t *d = dst + op;
+        const uint8_t *s = d - off;
+        if (off >= match_len)
+            memcpy(d, s, match_len);
+        else
+            for (size_t i = 0; i < match_len; i++)
+                d[i] = s[i];
+        op += match_len;
+    }
+    return op == raw_len ? 0 : -1;
+}
@@ -0,0 +1,24 @@
+#ifndef LZBLK_H
+#define LZBLK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A small LZ77 block compressor, in the spirit of LZ4: a block is a sequence of
+[token][literals][offset][match] where the token holds the literal count and the match length (4
+bits each, extended with 255 bytes when saturated) and the offset is 16 bits little endian. Every
+block is independent, there is no dictionary kept between blocks. It's made for log lines, where
+the speed matters way more than the ratio. */
+
+/* the biggest size the compressed data may have */
+inline size_t lzblk_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+/* returns the compressed size or -1 if it doesn't fit in cap */
+int64_t lzblk_compress(const char *src, size_t len, char *dst, size_t cap);
+
+/* raw_len must be the exact uncompressed size, returns -1 on corrupted input */
+int lzblk_decompress(const char *src, size_t len, char *dst, size_t raw_len);
+
+#endif
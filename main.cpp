@@ -2,20 +2,32 @@
 
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <unordered_map>
 
 #include "debug.h"
 #include "co_utils.h"
 #include "procmgr.h"
+#include "libpmgr.h"
 #include "sys_utils.h"
 
 #include "cmds.h"
 #include "tasks.h"
 #include "cfg.h"
+#include "psi.h"
+#include "probes.h"
+#include "hbeat.h"
+#include "logring.h"
+#include "logfile.h"
+#include "logfmt.h"
+#include "logpump.h"
+#include "logstore.h"
+#include "top.h"
 #include "path_utils.h"
 
 /* TODO:
     - enable chanmgr to send file descriptors around
-    - check if this program leaks fds, others than the known ones (0, 1, 2, 1023)
+    - check if this program leaks fds, others than the known ones (0, 1, 2, 1022, 1023)
     - add a way to save runtime tasks, maybe in some sort of intermediary config?
         - maybe adding events would make this obsolete, as some sort of process could do this without
         breaking
@@ -35,23 +47,6 @@
         - watcher for all of those, so I know they work
         - some sort of updater or plugin installer (such that I can't break all other aps while
           installing a daemon)
-
-    Better output: 
-        1. Create a pipe for all outputs:
-            - err fd
-            - out fd
-        2. Replace default outputs with those (dup2)
-        3. Create coro to handle them as such:
-            - have circular buffer of 1M
-            - accept on un socket connections for each of those that consumes from pipes and
-            sends to users
-            - sends to users based on newline
-            - have a cursor for each accepted process and a default at max buff end cursor for
-            newcomers
-        This should be as such that multiple listeners can be added to the socket and not block.
-        This should also be available for taking to other daemons, making only their outputs available.
-        Usefull for watching their outputs.
-        If the cursor is forced to jump over data, then it also transmits an error
 */
 
 #define REDIR_FD_NUMBER 1023
@@ -60,6 +55,7 @@ static int redir_old_out = -1;
 static int redir_old_err = -1;
 static int redir_read_end = -1;
 static int redir_write_end = 1;
+static int own_write_end = -1;  /* procmgr's stdout and stderr, see tasks_own_output_init */
 static int redir_extern_out = -1;
 static int redir_extern_input = -1;
 static std::atomic<bool> stop_redir_thread = false;
@@ -67,6 +63,66 @@ static std::atomic<bool> force_stop_redir_thread = false;
 
 static std::thread redir_th;
 
+static logfile_t main_log;
+static logpump_t log_pump;
+static std::unordered_map<std::string, std::unique_ptr<logfile_t>> task_logs;
+static std::string partial_line;
+
+/* splits the output in lines, for the per task log files and for the log store */
+static int split_output(const char *data, size_t len) {
+    bool per_task = cfg_get()->log.per_task;
+    bool store = cfg_get()->log.store;
+    if (!per_task && !store)
+        return 0;
+
+    std::unordered_map<std::string, std::string> batches;
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        if (!nl) {
+            partial_line.append(p, end - p);
+            break;
+        }
+        const char *line = p;
+        size_t line_len = nl - p + 1;
+        if (partial_line.size()) {
+            partial_line.append(p, line_len);
+            line = partial_line.data();
+            line_len = partial_line.size();
+        }
+        if (store)
+            logstore_append(line, line_len);
+        if (per_task) {
+            auto name = logfmt_name(line, line_len);
+            if (name != "procmgr")
+                batches[std::string(name)].append(line, line_len);
+        }
+        partial_line.clear();
+        p = nl + 1;
+    }
+    if (store && logstore_flush() < 0)
+        return -1;
+    for (auto &[name, batch] : batches) {
+        if (!HAS(task_logs, name)) {
+            std::string fname = name;
+            std::replace(fname.begin(), fname.end(), '/', '_');
+            auto lf = std::make_unique<logfile_t>();
+            if (lf->open(fname, cfg_get()->log) < 0)
+                return -1;
+            task_logs[name] = std::move(lf);
+        }
+        if (task_logs[name]->write(batch.data(), batch.size()) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* the bytes are read by procmgr only if something looks at them, else they are only spliced */
+static bool log_needs_bytes() {
+    return cfg_get()->log.per_task || cfg_get()->log.store || logring_wanted();
+}
+
 /* don't want this dependent on the coro, mostly because if the coro is blocked, then no out gets
 out */
 int th_redirect_out() {
@@ -83,52 +139,47 @@ int th_redirect_out() {
 
     FnScope scope;
 
-    int file_fd = open(path_get_relative("procmgr.std-err-out").c_str(),
-            O_CREAT | O_RDWR | O_CLOEXEC | O_TRUNC, 0666);
-
-    auto errmsg = [&file_fd](const std::string &msg) {
+    auto errmsg = [](const std::string &msg) {
         if (redir_old_out >= 0)
             dprintf(redir_old_out, "[th_redirect_out] %s %s[%d]\n",
                     msg.c_str(), strerror(errno), errno);
-        if (file_fd >= 0)
-            dprintf(      file_fd, "[th_redirect_out] %s %s[%d]\n",
+        if (main_log.fd >= 0)
+            dprintf(   main_log.fd, "[th_redirect_out] %s %s[%d]\n",
                     msg.c_str(), strerror(errno), errno);
     };
 
-    if (file_fd < 0) {
+    if (main_log.open("procmgr", cfg_get()->log) < 0) {
         errmsg("Failed to open file");
         return -1;
     }
-    scope([file_fd]{ close(file_fd); });
+    if (cfg_get()->log.store && logstore_open(cfg_get()->log) < 0) {
+        errmsg("Failed to open the log store");
+        return -1;
+    }
     scope([]{
         /* This means that the handler didn't catch this up */
         if (force_stop_redir_thread)
             exit(-1);
     });
 
-    char buff[1024];
     while (!stop_redir_thread) {
-        int ret = read(redir_read_end, buff, sizeof(buff));
+        /* we know redirect out,err to a file, the extern pipe and to the old out */
+        ssize_t ret = log_pump.pump(main_log.fd, redir_extern_input, redir_old_out,
+                log_needs_bytes);
         if (ret < 0 /*&& !stop_redir_thread*/) {
-            errmsg("Failed read input");
+            errmsg("Failed to pump the output");
             return -1;
         }
+        main_log.account(ret);
+        if (!log_pump.has_bytes)
+            continue;
 
-        /* TODO: trim the output after writing too much */
-        /* we know redirect out,err to a file and to the old out */
-        if (redir_old_out >= 0) {
-            if (write_sz(redir_old_out, buff, ret) < 0) {
-                errmsg("Failed to write to old output");
-                return -1;
-            }
-        }
-        if (write_sz(file_fd, buff, ret) < 0) {
-            errmsg("Failed to write to file");
-            return -1;
-        }
+        const char *buff = log_pump.buff.data();
+        logring_write(buff, ret);
 
-        if (redir_extern_input >= 0) {
-            int ret = write(redir_extern_input, buff, ret);
+        if (split_output(buff, ret) < 0) {
+            errmsg("Failed to write to task file or log store");
+            return -1;
         }
     }
     return 0;
@@ -138,18 +189,32 @@ void redir_stop() {
     sleep_ms(100);
     fflush(stdout);
     fflush(stderr);
+
+    /* the coroutines are gone, from here procmgr writes the pipe itself */
+    dup2(redir_write_end, fileno(stdout));
+    dup2(redir_write_end, fileno(stderr));
+    close(own_write_end);
+    tasks_own_output_uninit(redir_write_end);
+
     stop_redir_thread = true;
     printf("DONE SIGNAL\n");
     fflush(stderr);
     fflush(stdout);
     if (redir_th.joinable())
         redir_th.join();
+    logstore_close();
+    logfile_uninit();
+    log_pump.uninit();
+    main_log.close();
+    for (auto &[name, lf] : task_logs)
+        lf->close();
     dprintf(redir_old_out, "[DONE REDIR]\n");
 }
 
 int init_redirect_out() {
     int redirect[2] = { -1, -1 };
     int extern_redir[2] = { -1, -1 }; 
+    int own[2] = { -1, -1 };
 
     /* This is a pipe that can be 'taken' by any 'one' app and do whatever with it, it contains
     the redirected output from all the programs. It's number is known as 1023 and can be used by
@@ -160,9 +225,23 @@ int init_redirect_out() {
     redir_extern_input = extern_redir[1];
     ASSERT_FN(dup3(extern_redir[0], REDIR_FD_NUMBER, 0));
 
+    ASSERT_FN(logring_init());
+    ASSERT_FN(logfile_init());
     ASSERT_FN(pipe2(redirect, O_CLOEXEC)); /* this is the main out redirecter pipe */
     redir_read_end = redirect[0];
-    int redir_write_end = redirect[1];
+    redir_write_end = redirect[1];
+
+    /* procmgr's own output has it's pipe, else a line could land inside a record of a task that
+    was only partly written to the main one */
+    ASSERT_FN(pipe2(own, O_CLOEXEC));
+    own_write_end = own[1];
+    ASSERT_FN(tasks_own_output_init(own[0]));
+
+    /* big pipes mean less wakeups for the pump and less tasks blocked on a full pipe */
+    logpump_pipe_size(redir_write_end, LOGPUMP_PIPE_SZ);
+    logpump_pipe_size(redir_extern_input, LOGPUMP_PIPE_SZ);
+    logpump_pipe_size(own_write_end, LOGPUMP_PIPE_SZ);
+    ASSERT_FN(log_pump.init(redir_read_end, cfg_get()->log.splice));
 
     fflush(stderr);
     fflush(stdout);
@@ -171,11 +250,11 @@ int init_redirect_out() {
     ASSERT_FN(redir_old_out = fcntl(fileno(stdout), F_DUPFD_CLOEXEC, 0));
     ASSERT_FN(redir_old_err = fcntl(fileno(stderr), F_DUPFD_CLOEXEC, 0));
 
-    if (dup2(redir_write_end, fileno(stdout)) < 0) {
+    if (dup2(own_write_end, fileno(stdout)) < 0) {
         dprintf(redir_old_out, "Failed to dup stdout: %s\n", strerror(errno));
         return -1;
     }
-    if (dup2(redir_write_end, fileno(stderr)) < 0)  {
+    if (dup2(own_write_end, fileno(stderr)) < 0)  {
         dprintf(redir_old_out, "Failed to dup stderr: %s\n", strerror(errno));
         return -1;
     }
@@ -192,6 +271,40 @@ int init_redirect_out() {
     return 0;
 }
 
+/* "-30s", "-10m", "-2h", "-1d" are relative to now, else seconds since epoch or a local time as
+"YYYY-MM-DD HH:MM:SS" (or with a 'T' in between) */
+static int parse_log_time(const std::string &str, int64_t &us) {
+    int64_t now_us = time(NULL) * 1000'000LL;
+    if (str.size() > 2 && str[0] == '-') {
+        char *end;
+        int64_t val = strtoll(str.c_str() + 1, &end, 10);
+        int64_t mul = 0;
+        switch (*end) {
+            case 's': mul = 1; break;
+            case 'm': mul = 60; break;
+            case 'h': mul = 60 * 60; break;
+            case 'd': mul = 24 * 60 * 60; break;
+        }
+        if (!mul || end[1] != 0)
+            return -1;
+        us = now_us - val * mul * 1000'000LL;
+        return 0;
+    }
+    if (str.size() && str.find_first_not_of("0123456789") == std::string::npos) {
+        us = std::stoll(str) * 1000'000LL;
+        return 0;
+    }
+    struct tm tm = {};
+    tm.tm_isdst = -1;
+    const char *end = strptime(str.c_str(), "%Y-%m-%d %H:%M:%S", &tm);
+    if (!end || *end)
+        end = strptime(str.c_str(), "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!end || *end)
+        return -1;
+    us = mktime(&tm) * 1000'000LL;
+    return 0;
+}
+
 co::task_t co_waitexit(int sigfd) {
     while (true) {
         struct signalfd_siginfo  fdsi;
@@ -224,17 +337,101 @@ co::task_t co_main(std::function<std::string(int)> args) {
     co_await co::sched(co_waitexit(sigfd));
     co_await co::sched(co_cmds());
     co_await co::sched(co_tasks(redir_write_end));
+    co_await co::sched(co_psi());
+    co_await co::sched(co_probes());
+    co_await co::sched(co_hbeat());
+    co_await co::sched(co_logring());
 
     co_return 0;
 };
 
+/* the control commands, sent to the running procmgr */
+static co::task_t co_ctrl_cmd(std::function<std::string(int)> arg, int argc) {
+    auto client = pmgr_client_get(path_get_relative(cfg_get()->sock_path));
+
+    std::string usage = arg(1);
+    std::string task = arg(2);
+    std::string path = arg(3);
+
+    if (task.size() + 1 >= PMGR_MAX_TASK_NAME) {
+        DBG("task name too long");
+        co_return -1;
+    }
+
+    if (usage == "start") {
+        co_return co_await co_pmgr_start(client, task);
+    }
+    else if (usage == "wstart") {
+        pmgr2_msg_t msg(PMGR_MSG_WAITSTART);
+        msg.add_str(PMGR2_F_NAME, task);
+        co_return co_await co_pmgr_wait_request(client, msg);
+    }
+    else if (usage == "stop") {
+        co_return co_await co_pmgr_stop(client, task);
+    }
+    else if (usage == "wstop") {
+        co_return co_await co_pmgr_waitstop(client, task);
+    }
+    else if (usage == "add") {
+        pmgr_task_t msg{};
+        strcpy(msg.task_name, task.c_str());
+
+        int flags = 0;
+        for (int i = 4; i < argc; i++) {
+            if (arg(i) == "-p") {
+                flags |= PMGR_TASK_FLAG_PERSIST;
+            }
+        }
+        msg.flags = (pmgr_task_flags_e)flags;
+
+        /* paths that don't fit in the task are sent split */
+        std::vector<std::string> argv;
+        if (path.size() + 1 < PMGR_MAX_TASK_PATH) {
+            strcpy(msg.task_path, path.c_str());
+        }
+        else {
+            ASSERT_COFN(ssplit_args(path, argv));
+        }
+
+        co_return co_await co_pmgr_add(client, msg, argv);
+    }
+    else if (usage == "rm") {
+        co_return co_await co_pmgr_rm(client, task);
+    }
+    else if (usage == "list") {
+        std::vector<pmgr_task_t> tasks;
+        ASSERT_COFN(co_await co_pmgr_list(client, tasks));
+        for (auto &t : tasks)
+            DBG("TASK:[%s] -> PATH:[%s]", t.task_name, t.task_path);
+    }
+    else if (usage == "load") {
+        co_return co_await co_pmgr_request(client, pmgr2_msg_t(PMGR_MSG_LOAD_CFG));
+    }
+    else if (usage == "metrics") {
+        std::vector<pmgr_metric_t> metrics;
+        ASSERT_COFN(co_await co_pmgr_metrics(client, metrics));
+        for (auto &m : metrics)
+            DBG("METRIC:[%s.%s] -> %ld", m.task_name, m.name, m.value);
+    }
+    else if (usage == "clear") {
+        co_return co_await co_pmgr_clear(client);
+    }
+    else {
+        DBG("Invalid ctrl seq: %s", usage.c_str());
+        co_return -1;
+    }
+    co_return 0;
+}
+
+co::task_t co_ctrl(std::function<std::string(int)> arg, int argc, int *ret) {
+    *ret = co_await co_ctrl_cmd(arg, argc);
+    co_await co::force_stop(0);
+    co_return 0;
+}
+
 int main(int argc, char const *argv[])
 {
     umask(0);
-    ASSERT_FN(init_redirect_out());
-    FnScope scope([]{ redir_stop(); });
-
-    DBG("This message, I should see it in logs");
 
     std::vector<std::string> args;
     for (int i = 0; i < argc; i++)
@@ -250,8 +447,15 @@ int main(int argc, char const *argv[])
     ASSERT_FN(cfg_read());
 
     if (usage == "daemon" || usage == "d") {
+        /* only the daemon redirects, the ctrl commands would else write over it's logs */
+        ASSERT_FN(init_redirect_out());
+        FnScope scope([]{ redir_stop(); });
+
+        DBG("This message, I should see it in logs");
+
         co::pool_t pool;
 
+        ASSERT_FN(hbeat_init());
         for (auto &t : cfg_get()->tasks)
             ASSERT_FN(tasks_add(&t));
 
@@ -259,150 +463,92 @@ int main(int argc, char const *argv[])
         pool.sched(co_main(arg));
         ASSERT_FN(pool.run());
     }
-    else {
-        int server_fd;
-
-        if ((server_fd = pmgr_conn_socket(path_get_relative(cfg_get()->sock_path).c_str())) < 0) {
-            DBG("Can't connect to procmgr, exiting");
-            return -1;
-        }
-
-        usage = arg(1);
-        std::string task = arg(2);
-        std::string path = arg(3);
-
-        if (task.size() + 1 >= PMGR_MAX_TASK_NAME) {
-            DBG("task name too long");
-            return -1;
-        }
-        if (path.size() + 1 >= PMGR_MAX_TASK_PATH) {
-            DBG("path too long");
+    else if (usage == "tail") {
+        /* follows the output, of all tasks or only of one, '-h' starts with the kept history */
+        int log_fd;
+        if ((log_fd = pmgr_conn_socket(path_get_relative(cfg_get()->log_sock_path).c_str())) < 0) {
+            DBG("Can't connect to procmgr log, exiting");
             return -1;
         }
-
-        if (usage == "start") {
-            pmgr_task_name_t msg{
-                .hdr = {
-                    .size = sizeof(pmgr_task_name_t),
-                    .type = PMGR_MSG_START,
-                },
-            };
-            strcpy(msg.task_name, task.c_str());
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
-        }
-        if (usage == "wstart") {
-            pmgr_task_name_t msg{
-                .hdr = {
-                    .size = sizeof(pmgr_task_name_t),
-                    .type = PMGR_MSG_WAITSTART,
-                },
-            };
-            strcpy(msg.task_name, task.c_str());
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
-        }
-        else if (usage == "stop") {
-            pmgr_task_name_t msg{
-                .hdr = {
-                    .size = sizeof(pmgr_task_name_t),
-                    .type = PMGR_MSG_STOP,
-                },
-            };
-            strcpy(msg.task_name, task.c_str());
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
-        }
-        else if (usage == "wstop") {
-            pmgr_task_name_t msg{
-                .hdr = {
-                    .size = sizeof(pmgr_task_name_t),
-                    .type = PMGR_MSG_WAITSTOP,
-                },
-            };
-            strcpy(msg.task_name, task.c_str());
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
-        }
-        else if (usage == "add") {
-            pmgr_task_t msg{
-                .hdr = {
-                    .size = sizeof(pmgr_task_t),
-                    .type = PMGR_MSG_ADD,
-                },
-            };
-            strcpy(msg.task_name, task.c_str());
-            strcpy(msg.task_pwd, "");
-            strcpy(msg.task_path, path.c_str());
-
-            int flags = 0;
-            for (int i = 4; i < args.size(); i++) {
-                if (arg(i) == "-p") {
-                    flags |= PMGR_TASK_FLAG_PERSIST;
-                }
+        FnScope scope([log_fd]{ close(log_fd); });
+
+        pmgr_log_req_t req{
+            .hdr = {
+                .size = sizeof(pmgr_log_req_t),
+                .type = PMGR_MSG_LOG_ATTACH,
+            },
+        };
+        int flags = 0;
+        for (int i = 2; i < args.size(); i++) {
+            if (arg(i) == "-h")
+                flags |= PMGR_LOG_FROM_HEAD;
+            else if (arg(i).size() + 1 < PMGR_MAX_TASK_NAME)
+                strcpy(req.task_name, arg(i).c_str());
+            else {
+                DBG("task name too long");
+                return -1;
             }
-            msg.flags = (pmgr_task_flags_e)flags;
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
         }
-        else if (usage == "rm") {
-            pmgr_task_name_t msg{
-                .hdr = {
-                    .size = sizeof(pmgr_task_name_t),
-                    .type = PMGR_MSG_RM,
-                },
-            };
-            strcpy(msg.task_name, task.c_str());
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
+        req.flags = (pmgr_log_flags_e)flags;
+        ASSERT_FN(write_sz(log_fd, &req, sizeof(req)));
+
+        char buff[65536];
+        while (true) {
+            int ret = read(log_fd, buff, sizeof(buff));
+            ASSERT_FN(ret);
+            if (ret == 0)
+                break;
+            ASSERT_FN(write_sz(STDOUT_FILENO, buff, ret));
         }
-        else if (usage == "list") {
-            pmgr_hdr_t msg{
-                .size = sizeof(pmgr_hdr_t),
-                .type = PMGR_MSG_LIST,
-            };
-
-            /* wait for response list */
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
-
-            while (true) {
-                pmgr_task_t reply;
-                ASSERT_FN(read_sz(server_fd, &reply, sizeof(reply)));
-
-                if (reply.list_terminator)
-                    break;
-
-                DBG("TASK:[%s] -> PATH:[%s]", reply.task_name, reply.task_path);
+    }
+    else if (usage == "logs") {
+        /* searches the log store: logs [task] [--since <time>] [--until <time>] [--follow] */
+        logstore_query_t q;
+        for (int i = 2; i < args.size(); i++) {
+            if (arg(i) == "--since" || arg(i) == "--until") {
+                int64_t &us = arg(i) == "--since" ? q.since_us : q.until_us;
+                if (parse_log_time(arg(i + 1), us) < 0) {
+                    DBG("invalid time: '%s'", arg(i + 1).c_str());
+                    return -1;
+                }
+                i++;
             }
+            else if (arg(i) == "--follow" || arg(i) == "-f")
+                q.follow = true;
+            else
+                q.task = arg(i);
         }
-        else if (usage == "load") {
-            pmgr_hdr_t msg{
-                .size = sizeof(pmgr_hdr_t),
-                .type = PMGR_MSG_LOAD_CFG,
-            };
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
-        }
-        else if (usage == "clear") {
-            pmgr_hdr_t msg{
-                .size = sizeof(pmgr_hdr_t),
-                .type = PMGR_MSG_CLEAR,
-            };
-
-            ASSERT_FN(write_sz(server_fd, &msg, sizeof(msg)));
-        }
-        else {
-            DBG("Invalid ctrl seq: %s", usage.c_str());
-            close(server_fd);
-            return -1;
-        }
-
-        pmgr_return_t retmsg;
-        ASSERT_FN(read_sz(server_fd, &retmsg, sizeof(retmsg)));
-        ASSERT_FN(retmsg.retval);
-
-        close(server_fd);
+        ASSERT_FN(logstore_query(cfg_get()->log, q, [&q](const std::string &name,
+                const logrec_hdr_t &hdr, const char *line)
+        {
+            time_t secs = hdr.ts_us / 1000'000;
+            struct tm tm;
+            char ts[64];
+            localtime_r(&secs, &tm);
+            strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+            if (hdr.stream)
+                printf("%s.%06ld [%s:%d:%s] %s\n", ts, (long)(hdr.ts_us % 1000'000), name.c_str(),
+                        hdr.pid, logfmt_stream_str(hdr.stream), line);
+            else
+                printf("%s.%06ld [%s] %s\n", ts, (long)(hdr.ts_us % 1000'000), name.c_str(), line);
+            if (q.follow)
+                fflush(stdout);
+            return 0;
+        }));
+    }
+    else if (usage == "top") {
+        int ret = -1;
+        co::pool_t pool;
+        pool.sched(co_top(arg, args.size(), &ret));
+        ASSERT_FN(pool.run());
+        ASSERT_FN(ret);
+    }
+    else {
+        int ret = -1;
+        co::pool_t pool;
+        pool.sched(co_ctrl(arg, args.size(), &ret));
+        ASSERT_FN(pool.run());
+        ASSERT_FN(ret);
     }
     return 0;
 }
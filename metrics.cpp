@@ -0,0 +1,49 @@
+#include "metrics.h"
+
+static std::map<std::string, std::map<std::string, int64_t>> metrics;
+
+int64_t &metrics_ref(const std::string &task_name, const std::string &name) {
+    return metrics[task_name][name];
+}
+
+void metrics_set(const std::string &task_name, const std::string &name, int64_t value) {
+    metrics[task_name][name] = value;
+}
+
+void metrics_add(const std::string &task_name, const std::string &name, int64_t value) {
+    metrics[task_name][name] += value;
+}
+
+void metrics_rm(const std::string &task_name) {
+    metrics.erase(task_name);
+}
+
+int metrics_list(std::vector<pmgr_metric_t> &list) {
+    for (auto &[task_name, task_metrics] : metrics) {
+        for (auto &[name, value] : task_metrics) {
+            pmgr_metric_t metric{
+                .hdr = {
+                    .size = sizeof(pmgr_metric_t),
+                    .type = PMGR_MSG_METRIC,
+                },
+                .value = value,
+            };
+            if (task_name.size() + 1 > PMGR_MAX_TASK_NAME || name.size() + 1 > PMGR_MAX_METRIC_NAME) {
+                DBG("Metric name too long: %s.%s", task_name.c_str(), name.c_str());
+                continue;
+            }
+            strcpy(metric.task_name, task_name.c_str());
+            strcpy(metric.name, name.c_str());
+            list.push_back(metric);
+        }
+    }
+    pmgr_metric_t terminator{
+        .hdr = {
+            .size = sizeof(pmgr_metric_t),
+            .type = PMGR_MSG_METRIC,
+        },
+        .list_terminator = true,
+    };
+    list.push_back(terminator);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "procmgr.h"
+
+/* Metrics are kept by task name and metric name. The references returned by metrics_ref stay valid
+until metrics_rm is called for that task, so hot paths can keep them around. */
+int64_t &metrics_ref(const std::string &task_name, const std::string &name);
+void metrics_set(const std::string &task_name, const std::string &name, int64_t value);
+void metrics_add(const std::string &task_name, const std::string &name, int64_t value);
+void metrics_rm(const std::string &task_name);
+
+/* returns all the metrics, the last one is a terminator */
+int metrics_list(std::vector<pmgr_metric_t> &list);
+
+#endif
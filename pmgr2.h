@@ -0,0 +1,391 @@
+#ifndef PMGR2_H
+#define PMGR2_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "co_utils.h"
+#include "procmgr.h"
+
+/* Protocol v2, served on the same socket as v1 (the structs from procmgr.h).
+
+A v2 connection starts with PMGR2_MAGIC (4 bytes, which would be an absurd v1 size) followed by
+a varint version and a varint of the capabilities the client wants. The server answers with the
+magic, it's version and the capabilities both sides have. After that, both sides send frames:
+
+    <varint len><fields, len bytes>
+
+and each field is a varint tag (field id << 3 | wire type) followed by a zigzag varint (wire type
+0) or by a varint length and that many bytes (wire type 2). Fields can repeat (argv, env) and
+unknown fields are skipped, so new ones can be added without a new version.
+
+Every frame has a PMGR2_F_TYPE (pmgr_msg_type_e). Requests can have a PMGR2_F_REQ_ID, that is
+copied in all the replies to that request. A request ends with a PMGR_MSG_RETVAL, optionally
+preceded by PMGR_MSG_REPLAY (tasks) or PMGR_MSG_METRIC frames. Multiple requests can be sent on a
+connection without waiting for the replies (they are answered in order). After a
+PMGR_MSG_REGISTER_EVENT the connection also receives PMGR_MSG_EVENT frames, without request ids. */
+
+#define PMGR2_MAGIC         0x32474d50  /* "PMG2" */
+#define PMGR2_VERSION       2
+#define PMGR2_MAX_FRAME     (1024 * 1024)
+
+enum pmgr2_cap_e : uint32_t {
+    PMGR2_CAP_PIPELINE  = 1,    /* more requests on a connection */
+    PMGR2_CAP_EVENTS    = 2,    /* events on the same connection as the requests */
+    PMGR2_CAP_ARGV      = 4,    /* tasks can be added with argv and env lists */
+
+    PMGR2_CAP_ALL       = 0b111, /* This needs to be kept actualized */
+};
+
+enum pmgr2_field_e : uint32_t {
+    PMGR2_F_TYPE        = 1,    /* pmgr_msg_type_e */
+    PMGR2_F_REQ_ID      = 2,
+    PMGR2_F_RETVAL      = 3,
+    PMGR2_F_NAME        = 4,    /* task name */
+    PMGR2_F_PATH        = 5,    /* the command line, as in pmgr_task_t::task_path */
+    PMGR2_F_ARG         = 6,    /* repeated, replaces PATH if present */
+    PMGR2_F_ENV         = 7,    /* repeated, "NAME=value" */
+    PMGR2_F_PWD         = 8,
+    PMGR2_F_USR         = 9,
+    PMGR2_F_GRP         = 10,
+    PMGR2_F_FLAGS       = 11,   /* pmgr_task_flags_e or pmgr_event_flags_e */
+    PMGR2_F_PID         = 12,
+    PMGR2_F_STATE       = 13,   /* pmgr_task_state_e */
+    PMGR2_F_EV_TYPE     = 14,   /* pmgr_event_e */
+    PMGR2_F_METRIC      = 15,   /* metric name */
+    PMGR2_F_VALUE       = 16,
+
+    /* task stats, in the task list replies and in the task events */
+    PMGR2_F_START_US    = 17,   /* wall clock of the last start */
+    PMGR2_F_RESTARTS    = 18,
+    PMGR2_F_EXIT        = 19,   /* wait status of the last exit, -1 if it didn't exit yet */
+    PMGR2_F_CPU         = 20,   /* in 0.1% of a cpu, over the last stats period */
+    PMGR2_F_RSS         = 21,   /* bytes */
+    PMGR2_F_OUT_RATE    = 22,   /* bytes/s of output (stdout and stderr) */
+};
+
+enum pmgr2_wire_e : uint32_t {
+    PMGR2_WIRE_VARINT   = 0,
+    PMGR2_WIRE_BYTES    = 2,
+};
+
+struct pmgr2_field_t {
+    uint32_t    id;
+    bool        is_bytes;
+    int64_t     ival;
+    std::string sval;
+};
+
+/* a message, the fields are kept in the order they were added/received */
+struct pmgr2_msg_t {
+    std::vector<pmgr2_field_t> fields;
+
+    pmgr2_msg_t() {}
+    pmgr2_msg_t(pmgr_msg_type_e type, uint64_t req_id = 0) {
+        add_int(PMGR2_F_TYPE, type);
+        if (req_id)
+            add_int(PMGR2_F_REQ_ID, req_id);
+    }
+
+    pmgr2_msg_t &add_int(uint32_t id, int64_t val) {
+        fields.push_back({ .id = id, .is_bytes = false, .ival = val });
+        return *this;
+    }
+    pmgr2_msg_t &add_str(uint32_t id, const std::string &val) {
+        fields.push_back({ .id = id, .is_bytes = true, .ival = 0, .sval = val });
+        return *this;
+    }
+
+    const pmgr2_field_t *find(uint32_t id) const {
+        for (auto &f : fields)
+            if (f.id == id)
+                return &f;
+        return NULL;
+    }
+    bool has(uint32_t id) const { return find(id) != NULL; }
+    int64_t get_int(uint32_t id, int64_t def = 0) const {
+        auto f = find(id);
+        return f && !f->is_bytes ? f->ival : def;
+    }
+    std::string get_str(uint32_t id, const std::string &def = "") const {
+        auto f = find(id);
+        return f && f->is_bytes ? f->sval : def;
+    }
+    std::vector<std::string> get_strs(uint32_t id) const {
+        std::vector<std::string> ret;
+        for (auto &f : fields)
+            if (f.id == id && f.is_bytes)
+                ret.push_back(f.sval);
+        return ret;
+    }
+    pmgr_msg_type_e type() const { return (pmgr_msg_type_e)get_int(PMGR2_F_TYPE, -1); }
+    uint64_t req_id() const { return get_int(PMGR2_F_REQ_ID); }
+
+    /* the whole frame, with the length in front */
+    std::string encode() const;
+
+    /* takes the fields of a frame, without the length */
+    int decode(const char *data, size_t len);
+};
+
+inline void pmgr2_put_varint(std::string &dst, uint64_t val) {
+    while (val >= 0x80) {
+        dst.push_back((char)(val | 0x80));
+        val >>= 7;
+    }
+    dst.push_back((char)val);
+}
+
+/* returns the number of bytes used, 0 if there are not enough and -1 if it's not a varint */
+inline int pmgr2_get_varint(const char *data, size_t len, uint64_t &val) {
+    val = 0;
+    for (size_t i = 0; i < len && i < 10; i++) {
+        val |= (uint64_t)(data[i] & 0x7f) << (7 * i);
+        if (!(data[i] & 0x80))
+            return i + 1;
+    }
+    return len >= 10 ? -1 : 0;
+}
+
+inline uint64_t pmgr2_zigzag(int64_t val) {
+    return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+inline int64_t pmgr2_unzigzag(uint64_t val) {
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+/* the v2 equivalents of the v1 structs */
+inline void pmgr2_put_task(pmgr2_msg_t &msg, const pmgr_task_t &task) {
+    msg.add_str(PMGR2_F_NAME, task.task_name);
+    msg.add_str(PMGR2_F_PATH, task.task_path);
+    if (task.task_pwd[0])
+        msg.add_str(PMGR2_F_PWD, task.task_pwd);
+    if (task.task_usr[0])
+        msg.add_str(PMGR2_F_USR, task.task_usr);
+    if (task.task_grp[0])
+        msg.add_str(PMGR2_F_GRP, task.task_grp);
+    if (task.flags)
+        msg.add_int(PMGR2_F_FLAGS, task.flags);
+    if (task.pid)
+        msg.add_int(PMGR2_F_PID, task.pid);
+    msg.add_int(PMGR2_F_STATE, task.state);
+}
+
+/* the strings that don't fit are cut */
+inline void pmgr2_get_task(const pmgr2_msg_t &msg, pmgr_task_t &task) {
+    auto copy = [&msg](char *dst, uint32_t id, size_t max_len) {
+        std::string str = msg.get_str(id);
+        str = str.substr(0, std::min(str.find('\0'), max_len - 1));
+        strcpy(dst, str.c_str());
+    };
+    task = pmgr_task_t{};
+    task.hdr.size = sizeof(pmgr_task_t);
+    task.hdr.type = PMGR_MSG_ADD;
+    copy(task.task_name, PMGR2_F_NAME, PMGR_MAX_TASK_NAME);
+    copy(task.task_path, PMGR2_F_PATH, PMGR_MAX_TASK_PATH);
+    copy(task.task_pwd, PMGR2_F_PWD, PMGR_MAX_TASK_PATH);
+    copy(task.task_usr, PMGR2_F_USR, PMGR_MAX_TASK_USR);
+    copy(task.task_grp, PMGR2_F_GRP, PMGR_MAX_TASK_GRP);
+    task.flags = (pmgr_task_flags_e)msg.get_int(PMGR2_F_FLAGS);
+    task.pid = msg.get_int(PMGR2_F_PID);
+    task.state = (pmgr_task_state_e)msg.get_int(PMGR2_F_STATE);
+}
+
+inline void pmgr2_put_event(pmgr2_msg_t &msg, const pmgr_event_t &ev) {
+    msg.add_int(PMGR2_F_EV_TYPE, ev.ev_type);
+    if (ev.task_name[0])
+        msg.add_str(PMGR2_F_NAME, ev.task_name);
+    if (ev.task_pid)
+        msg.add_int(PMGR2_F_PID, ev.task_pid);
+}
+
+/* reads frames from a connection, the input is buffered, so pipelined messages are read at once */
+struct pmgr2_reader_t {
+    int fd = -1;
+    std::string in;
+};
+
+/* both return 1 when something was read, 0 on EOF and negative on errors */
+inline co::task_t co_pmgr2_read_varint(pmgr2_reader_t &reader, uint64_t &val);
+inline co::task_t co_pmgr2_read_msg(pmgr2_reader_t &reader, pmgr2_msg_t &msg);
+
+/* writes the hello of one side of the handshake */
+inline std::string pmgr2_hello(uint32_t caps);
+
+inline void pmgr2_get_event(const pmgr2_msg_t &msg, pmgr_event_t &ev) {
+    ev = pmgr_event_t{};
+    ev.hdr.size = sizeof(pmgr_event_t);
+    ev.hdr.type = PMGR_MSG_EVENT;
+    ev.ev_type = (pmgr_event_e)msg.get_int(PMGR2_F_EV_TYPE);
+    ev.task_pid = msg.get_int(PMGR2_F_PID);
+    std::string name = msg.get_str(PMGR2_F_NAME);
+    name = name.substr(0, std::min(name.find('\0'), size_t(PMGR_MAX_TASK_NAME - 1)));
+    strcpy(ev.task_name, name.c_str());
+}
+
+/* blocking helpers, for simple clients */
+inline int pmgr2_handshake(int fd, uint32_t want_caps, uint32_t *caps = NULL);
+inline int pmgr2_send(int fd, const pmgr2_msg_t &msg);
+inline int pmgr2_recv(int fd, pmgr2_msg_t &msg);
+
+
+/* IMPLEMENTATION:
+================================================================================================= */
+
+inline std::string pmgr2_msg_t::encode() const {
+    std::string body;
+    for (auto &f : fields) {
+        pmgr2_put_varint(body, (uint64_t)f.id << 3 |
+                (f.is_bytes ? PMGR2_WIRE_BYTES : PMGR2_WIRE_VARINT));
+        if (f.is_bytes) {
+            pmgr2_put_varint(body, f.sval.size());
+            body += f.sval;
+        }
+        else {
+            pmgr2_put_varint(body, pmgr2_zigzag(f.ival));
+        }
+    }
+    std::string frame;
+    pmgr2_put_varint(frame, body.size());
+    return frame + body;
+}
+
+inline int pmgr2_msg_t::decode(const char *data, size_t len) {
+    fields.clear();
+    size_t pos = 0;
+    while (pos < len) {
+        uint64_t tag, val;
+        int ret = pmgr2_get_varint(data + pos, len - pos, tag);
+        if (ret <= 0)
+            return -1;
+        pos += ret;
+        ret = pmgr2_get_varint(data + pos, len - pos, val);
+        if (ret <= 0)
+            return -1;
+        pos += ret;
+
+        uint32_t wire = tag & 7;
+        if (wire == PMGR2_WIRE_VARINT) {
+            add_int(tag >> 3, pmgr2_unzigzag(val));
+        }
+        else if (wire == PMGR2_WIRE_BYTES) {
+            if (val > len - pos)
+                return -1;
+            add_str(tag >> 3, std::string(data + pos, val));
+            pos += val;
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+inline co::task_t co_pmgr2_fill(pmgr2_reader_t &reader) {
+    char buff[4096];
+    int len = co_await co::read(reader.fd, buff, sizeof(buff));
+    ASSERT_COFN(len);
+    reader.in.append(buff, len);
+    co_return len > 0;
+}
+
+inline co::task_t co_pmgr2_read_varint(pmgr2_reader_t &reader, uint64_t &val) {
+    while (true) {
+        int ret = pmgr2_get_varint(reader.in.data(), reader.in.size(), val);
+        if (ret < 0) {
+            DBG("Invalid varint");
+            co_return -1;
+        }
+        if (ret > 0) {
+            reader.in.erase(0, ret);
+            co_return 1;
+        }
+        ret = co_await co_pmgr2_fill(reader);
+        if (ret <= 0)
+            co_return ret;
+    }
+}
+
+inline co::task_t co_pmgr2_read_msg(pmgr2_reader_t &reader, pmgr2_msg_t &msg) {
+    uint64_t len;
+    int ret = co_await co_pmgr2_read_varint(reader, len);
+    if (ret <= 0)
+        co_return ret;
+    if (len > PMGR2_MAX_FRAME) {
+        DBG("Frame too big: %lu", len);
+        co_return -1;
+    }
+    while (reader.in.size() < len) {
+        ret = co_await co_pmgr2_fill(reader);
+        ASSERT_COFN(ret);
+        if (ret == 0) {
+            DBG("Connection closed mid frame");
+            co_return -1;
+        }
+    }
+    ASSERT_COFN(msg.decode(reader.in.data(), len));
+    reader.in.erase(0, len);
+    co_return 1;
+}
+
+inline std::string pmgr2_hello(uint32_t caps) {
+    std::string hello;
+    uint32_t magic = PMGR2_MAGIC;
+    hello.append((const char *)&magic, sizeof(magic));
+    pmgr2_put_varint(hello, PMGR2_VERSION);
+    pmgr2_put_varint(hello, caps);
+    return hello;
+}
+
+inline int pmgr2_handshake(int fd, uint32_t want_caps, uint32_t *caps) {
+    std::string hello = pmgr2_hello(want_caps);
+    ASSERT_FN(write_sz(fd, hello.data(), hello.size()));
+
+    uint32_t srv_magic;
+    ASSERT_FN(read_sz(fd, &srv_magic, sizeof(srv_magic)));
+    if (srv_magic != PMGR2_MAGIC) {
+        DBG("Not a v2 server");
+        return -1;
+    }
+    uint64_t vals[2];
+    for (auto &v : vals) {
+        char buff[10];
+        int i = 0;
+        do {
+            ASSERT_FN(read_sz(fd, &buff[i], 1));
+        } while ((buff[i++] & 0x80) && i < 10);
+        ASSERT_FN(CHK_BOOL(pmgr2_get_varint(buff, i, v) > 0));
+    }
+    if (vals[0] < PMGR2_VERSION) {
+        DBG("Server version too old: %lu", vals[0]);
+        return -1;
+    }
+    if (caps)
+        *caps = vals[1];
+    return 0;
+}
+
+inline int pmgr2_send(int fd, const pmgr2_msg_t &msg) {
+    std::string frame = msg.encode();
+    ASSERT_FN(write_sz(fd, frame.data(), frame.size()));
+    return 0;
+}
+
+inline int pmgr2_recv(int fd, pmgr2_msg_t &msg) {
+    char buff[10];
+    int i = 0;
+    do {
+        ASSERT_FN(read_sz(fd, &buff[i], 1));
+    } while ((buff[i++] & 0x80) && i < 10);
+    uint64_t len;
+    ASSERT_FN(CHK_BOOL(pmgr2_get_varint(buff, i, len) > 0));
+    ASSERT_FN(CHK_BOOL(len <= PMGR2_MAX_FRAME));
+
+    std::string body(len, 0);
+    ASSERT_FN(read_sz(fd, body.data(), len));
+    return msg.decode(body.data(), body.size());
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef PMGRHB_H
+#define PMGRHB_H
+
+/* proc manager heartbeat: a task that has "heartbeat_ms" set in the config gets a slot, a shared
+memory page of it's own owned by procmgr (a sealed memfd, so the task can't resize it, and no other
+task has it). The task calls pmgrhb_beat() from it's main loop and procmgr restarts it if the
+counter doesn't move for longer than heartbeat_ms. Beating is only an atomic increment, no
+syscalls. Slots are only checked after the first beat. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PMGR_HB_FD_NUMBER   1022
+#define PMGR_HB_MAX_SLOTS   4096
+#define PMGR_HB_ENV_FD      "PMGR_HB_FD"
+#define PMGR_HB_ENV_SLOT    "PMGR_HB_SLOT"
+
+/* at the start of the page, PMGR_HB_SLOT says where, it's 0 since each slot has it's own page */
+struct alignas(64) pmgr_hb_slot_t {
+    uint64_t beat;
+};
+
+inline pmgr_hb_slot_t *pmgrhb_slot = NULL;
+
+/* maps the slot of this task, returns -1 if the task has no heartbeat */
+inline int pmgrhb_init() {
+    const char *fd_str = getenv(PMGR_HB_ENV_FD);
+    const char *slot_str = getenv(PMGR_HB_ENV_SLOT);
+    if (!fd_str || !slot_str)
+        return -1;
+
+    int fd = atoi(fd_str);
+    int slot = atoi(slot_str);
+    if (slot < 0 || slot >= PMGR_HB_MAX_SLOTS)
+        return -1;
+
+    /* only the page that holds our slot */
+    size_t page_sz = sysconf(_SC_PAGESIZE);
+    size_t off = slot * sizeof(pmgr_hb_slot_t);
+    size_t page_off = off & ~(page_sz - 1);
+
+    void *page = mmap(NULL, page_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, page_off);
+    if (page == MAP_FAILED)
+        return -1;
+    close(fd);
+
+    pmgrhb_slot = (pmgr_hb_slot_t *)((uint8_t *)page + (off - page_off));
+    return 0;
+}
+
+inline void pmgrhb_beat() {
+    if (pmgrhb_slot)
+        __atomic_fetch_add(&pmgrhb_slot->beat, 1, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef PMGRRING_H
+#define PMGRRING_H
+
+/* proc manager shared memory rings: a single producer, single consumer ring of messages that lives
+inside a memfd shared by two processes. chanmgr gives a local client two of them when it asks with
+PMGR_CHAN_SHM: the first one carries the client's messages to chanmgr and the second one the messages
+for the client. A message is written once inside the ring by it's producer and chanmgr moves it from
+one ring to the other, without any syscall as long as the consumer of a ring is awake.
+
+Each ring has an eventfd, written only if the other side sleeps on it: the consumer sleeps when the
+ring is empty and the producer when the ring is full, both can't happen at once. The positions of the
+other side are not trusted, a ring that makes no sense is reported as an error (-1).
+
+Inside the ring a message is a full message (it starts with a pmgr_hdr_t), padded to 8 bytes. */
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "procmgr.h"
+
+#define PMGR_RING_MIN_SZ    (2 * 1024 * 1024)
+#define PMGR_RING_MAX_SZ    (256 * 1024 * 1024)
+#define PMGR_RING_DEF_SZ    (4 * 1024 * 1024)
+#define PMGR_RING_ALIGN     8
+
+/* the head is moved by the consumer, the tail by the producer, each on it's own cache line */
+struct pmgr_ring_hdr_t {
+    alignas(64) uint64_t head;
+    alignas(64) uint64_t tail;
+    alignas(64) uint32_t waiting;
+};
+
+/* both rings, one after the other, the data of a ring follows it's header */
+#define PMGR_RING_SHM_SIZE(sz) (2 * (sizeof(pmgr_ring_hdr_t) + (sz)))
+
+struct pmgr_ring_t {
+    pmgr_ring_hdr_t *hdr = NULL;
+    uint8_t *data = NULL;
+    uint32_t size = 0;  /* our copy, the one inside the shared memory could be changed */
+    uint64_t pos = 0;   /* our position: the head for the consumer, the tail for the producer */
+    int efd = -1;
+};
+
+inline uint32_t pmgr_ring_round_size(uint32_t sz) {
+    if (!sz)
+        return PMGR_RING_DEF_SZ;
+    uint32_t ret = PMGR_RING_MIN_SZ;
+    while (ret < sz && ret < PMGR_RING_MAX_SZ)
+        ret *= 2;
+    return ret;
+}
+
+/* idx 0 is the ring to chanmgr, idx 1 the ring from chanmgr */
+inline void pmgr_ring_init(pmgr_ring_t &r, void *mem, uint32_t size, int idx, int efd) {
+    uint8_t *base = (uint8_t *)mem + idx * (sizeof(pmgr_ring_hdr_t) + size);
+    r.hdr = (pmgr_ring_hdr_t *)base;
+    r.data = base + sizeof(pmgr_ring_hdr_t);
+    r.size = size;
+    r.pos = 0;
+    r.efd = efd;
+}
+
+inline void pmgr_ring_wake(pmgr_ring_t &r) {
+    if (__atomic_exchange_n(&r.hdr->waiting, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(r.efd, &one, sizeof(one)) < 0) {
+            /* counter full, the other side has something to wake up for */
+        }
+    }
+}
+
+/* called before sleeping on the eventfd, the ring must be checked once more after it */
+inline void pmgr_ring_sleep_prepare(pmgr_ring_t &r) {
+    __atomic_store_n(&r.hdr->waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+inline void pmgr_ring_copy_in(pmgr_ring_t &r, uint64_t pos, const void *src, size_t len) {
+    size_t off = pos & (r.size - 1);
+    size_t first = std::min(len, (size_t)r.size - off);
+    memcpy(r.data + off, src, first);
+    memcpy(r.data, (const uint8_t *)src + first, len - first);
+}
+
+/* producer: returns the pushed length, 0 if there is no space yet or -1 if the message can never
+fit or the ring is broken */
+inline int64_t pmgr_ring_push(pmgr_ring_t &r, const struct iovec *iov, int cnt) {
+    size_t len = 0;
+    for (int i = 0; i < cnt; i++)
+        len += iov[i].iov_len;
+    size_t rec_len = (len + PMGR_RING_ALIGN - 1) & ~(size_t)(PMGR_RING_ALIGN - 1);
+    if (len < sizeof(pmgr_hdr_t) || rec_len > r.size)
+        return -1;
+
+    uint64_t head = __atomic_load_n(&r.hdr->head, __ATOMIC_ACQUIRE);
+    if (r.pos - head > r.size)
+        return -1;
+    if (r.size - (r.pos - head) < rec_len)
+        return 0;
+
+    uint64_t pos = r.pos;
+    for (int i = 0; i < cnt; i++) {
+        pmgr_ring_copy_in(r, pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    r.pos += rec_len;
+    __atomic_store_n(&r.hdr->tail, r.pos, __ATOMIC_SEQ_CST);
+    pmgr_ring_wake(r);
+    return len;
+}
+
+/* consumer: points iov at the next message (in two parts if it wraps), returns it's length, 0 if
+the ring is empty or -1 if the ring is broken. The message stays there until pmgr_ring_pop. */
+inline int64_t pmgr_ring_peek(pmgr_ring_t &r, struct iovec iov[2]) {
+    uint64_t tail = __atomic_load_n(&r.hdr->tail, __ATOMIC_ACQUIRE);
+    uint64_t used = tail - r.pos;
+    if (used > r.size || used % PMGR_RING_ALIGN)
+        return -1;
+    if (!used)
+        return 0;
+
+    pmgr_hdr_t hdr;
+    size_t off = r.pos & (r.size - 1);
+    size_t first = std::min(sizeof(hdr), (size_t)r.size - off);
+    memcpy(&hdr, r.data + off, first);
+    memcpy((uint8_t *)&hdr + first, r.data, sizeof(hdr) - first);
+
+    size_t len = hdr.size;
+    if (hdr.size < (int32_t)sizeof(pmgr_hdr_t) || len > used)
+        return -1;
+
+    first = std::min(len, (size_t)r.size - off);
+    iov[0] = { .iov_base = r.data + off, .iov_len = first };
+    iov[1] = { .iov_base = r.data, .iov_len = len - first };
+    return len;
+}
+
+inline void pmgr_ring_pop(pmgr_ring_t &r, size_t len) {
+    r.pos += (len + PMGR_RING_ALIGN - 1) & ~(size_t)(PMGR_RING_ALIGN - 1);
+    __atomic_store_n(&r.hdr->head, r.pos, __ATOMIC_SEQ_CST);
+    pmgr_ring_wake(r);
+}
+
+#endif
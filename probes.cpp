@@ -0,0 +1,248 @@
+#include "probes.h"
+#include "cfg.h"
+#include "tasks.h"
+#include "psi.h"
+#include "metrics.h"
+#include "libpmgr.h"
+#include "path_utils.h"
+#include "time_utils.h"
+
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* state shared between a running probe and it's timeout */
+struct probe_run_t {
+    bool done = false;
+    bool timed_out = false;
+    pid_t pid = -1;
+    int fd = -1;
+};
+
+using probe_run_p = std::shared_ptr<probe_run_t>;
+
+static co::task_t co_probe_timeo(probe_run_p run, int32_t timeout_ms) {
+    co_await co::sleep_ms(timeout_ms);
+    if (run->done)
+        co_return 0;
+    run->timed_out = true;
+    if (run->pid > 0)
+        kill(run->pid, SIGKILL);
+    if (run->fd >= 0)
+        co_await co::stopfd(run->fd);
+    co_return 0;
+}
+
+static co::task_t co_probe_exec(probe_run_p run, cfg_probe_t probe) {
+    std::vector<std::string> args;
+    ASSERT_COFN(ssplit_args(probe.target, args));
+    if (args.size() == 0 || args[0] == "") {
+        DBG("Invalid probe command");
+        co_return -1;
+    }
+    std::vector<const char *> argv;
+    for (auto& a : args)
+        argv.push_back(a.c_str());
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        sigset_t mask;
+        sigfillset(&mask);
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        execvp(argv[0], (char * const *)argv.data());
+        _exit(127);
+    }
+    ASSERT_COFN(pid);
+
+    /* no awaiting between the fork and this, else the tasks coroutine may reap the child first */
+    tasks_watch_pid(pid);
+    run->pid = pid;
+
+    int wstat = 0;
+    ASSERT_COFN(co_await co_tasks_waitpid(pid, &wstat));
+    run->pid = -1;
+
+    if (!WIFEXITED(wstat) || WEXITSTATUS(wstat) != 0)
+        co_return -1;
+    co_return 0;
+}
+
+static co::task_t co_probe_connect(probe_run_p run, int fd, sockaddr *addr, socklen_t len) {
+    run->fd = fd;
+    if (connect(fd, addr, len) < 0) {
+        if (errno != EINPROGRESS)
+            co_return -1;
+        ASSERT_COFN(co_await co::wait_event(fd, EPOLLOUT));
+        if (run->timed_out)
+            co_return -1;
+
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        ASSERT_COFN(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len));
+        if (err != 0)
+            co_return -1;
+    }
+    co_return 0;
+}
+
+static co::task_t co_probe_unix(probe_run_p run, cfg_probe_t probe) {
+    struct sockaddr_un addr = {0};
+    std::string sock_path = path_get_relative(probe.target);
+    if (sock_path.size() + 1 > sizeof(addr.sun_path)) {
+        DBG("Probe socket path too long");
+        co_return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path.c_str());
+
+    int fd;
+    ASSERT_COFN(fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    FnScope scope([fd]{ close(fd); });
+
+    co_return co_await co_probe_connect(run, fd, (sockaddr *)&addr, sizeof(addr));
+}
+
+static co::task_t co_probe_tcp(probe_run_p run, cfg_probe_t probe) {
+    int port;
+    ASSERT_COFN(port = cfg_probe_port(probe.target)); /* checked when the config was read */
+    auto addr = create_sa_ipv4(INADDR_LOOPBACK, port);
+
+    int fd;
+    ASSERT_COFN(fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    FnScope scope([fd]{ close(fd); });
+
+    co_return co_await co_probe_connect(run, fd, (sockaddr *)&addr, sizeof(addr));
+}
+
+/* The channel is pinged by joining it and asking chanmgr for it's members, it is considered alive
+if chanmgr answers and there is someone else in the channel besides us */
+static co::task_t co_probe_chan(probe_run_p run, cfg_probe_t probe) {
+    struct sockaddr_un addr = {0};
+    std::string sock_path = path_get_relative(PMGR_CHAN_UN_NAME);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path.c_str());
+
+    if (probe.target.size() + 1 > PMGR_MAX_TASK_NAME) {
+        DBG("Probe channel name too long");
+        co_return -1;
+    }
+
+    int fd;
+    ASSERT_COFN(fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    FnScope scope([fd]{ close(fd); });
+
+    ASSERT_COFN(co_await co_probe_connect(run, fd, (sockaddr *)&addr, sizeof(addr)));
+
+    pmgr_chann_t regmsg{
+        .hdr = {
+            .size = sizeof(pmgr_chann_t),
+            .type = PMGR_CHAN_REGISTER,
+        },
+    };
+    strcpy(regmsg.chan_name, probe.target.c_str());
+    ASSERT_COFN(co_await co_pmgr_chan_send(fd, &regmsg.hdr));
+
+    std::vector<uint8_t> msg;
+    ASSERT_COFN(co_await co_pmgr_chan_recv(fd, msg));
+    auto ret = (pmgr_return_t *)msg.data();
+    if (ret->hdr.type != PMGR_MSG_RETVAL || ret->retval < 0)
+        co_return -1;
+
+    pmgr_chann_msg_t listmsg{
+        .hdr = {
+            .size = sizeof(pmgr_chann_msg_t),
+            .type = PMGR_CHAN_LIST,
+        },
+    };
+    ASSERT_COFN(co_await co_pmgr_chan_send(fd, &listmsg.hdr));
+
+    /* the members of the channel may send us messages meanwhile, those are not members */
+    int members = 0;
+    while (true) {
+        ASSERT_COFN(co_await co_pmgr_chan_recv(fd, msg));
+        auto hdr = (pmgr_hdr_t *)msg.data();
+        if (hdr->type == PMGR_MSG_RETVAL)
+            break;
+        if (hdr->type == PMGR_CHAN_LIST && hdr->size == sizeof(pmgr_chann_msg_t))
+            members++;
+    }
+    co_return members > 1 ? 0 : -1;
+}
+
+static co::task_t co_probe_once(cfg_probe_t probe) {
+    auto run = std::make_shared<probe_run_t>();
+    co_await co::sched(co_probe_timeo(run, probe.timeout_ms));
+
+    int ret = -1;
+    if (probe.type == "exec")
+        ret = co_await co_probe_exec(run, probe);
+    else if (probe.type == "unix")
+        ret = co_await co_probe_unix(run, probe);
+    else if (probe.type == "tcp")
+        ret = co_await co_probe_tcp(run, probe);
+    else if (probe.type == "chan")
+        ret = co_await co_probe_chan(run, probe);
+
+    run->done = true;
+    if (run->timed_out)
+        co_return -1;
+    co_return ret;
+}
+
+static co::task_t co_probe(std::string task_name, cfg_probe_t probe) {
+    int fails = 0;
+    uint64_t last_pid = 0;
+
+    while (true) {
+        co_await co::sleep_ms(probe.interval_ms);
+
+        pmgr_task_t task;
+        if (!tasks_exists(task_name) || tasks_get(task_name, &task) < 0)
+            continue;
+        if (task.state != PMGR_TASK_STATE_RUNNING) {
+            fails = 0;
+            continue;
+        }
+        if (psi_under_pressure() && (task.flags & PMGR_TASK_FLAG_SHEDFRZ))
+            continue; /* most likely frozen */
+
+        /* a freshly started task gets one interval to get up */
+        if (task.pid != last_pid) {
+            last_pid = task.pid;
+            fails = 0;
+            continue;
+        }
+
+        uint64_t start_us = get_time_us();
+        int ret = co_await co_probe_once(probe);
+        metrics_set(task_name, "probe_latency_us", get_time_us() - start_us);
+
+        if (ret >= 0) {
+            metrics_add(task_name, "probe_ok", 1);
+            fails = 0;
+            continue;
+        }
+        metrics_add(task_name, "probe_fail", 1);
+        fails++;
+        DBG("Probe failed: %s[%d/%d]", task_name.c_str(), fails, probe.failures);
+
+        if (fails >= probe.failures && tasks_exists(task_name)) {
+            fails = 0;
+            tasks_fail(task_name);
+        }
+    }
+    co_return 0;
+}
+
+co::task_t co_probes() {
+    for (auto &[task_name, probe] : cfg_get()->probes)
+        co_await co::sched(co_probe(task_name, probe));
+    co_return 0;
+}
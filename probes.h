@@ -0,0 +1,9 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include "co_utils.h"
+
+/* This coroutine starts the health probes of the tasks from the config */
+co::task_t co_probes();
+
+#endif
@@ -11,10 +11,17 @@
 #define PMGR_MAX_TASK_PATH  512
 #define PMGR_MAX_TASK_USR   64
 #define PMGR_MAX_TASK_GRP   64
-
-/* maybe I will make it configurable later on */
+#define PMGR_MAX_METRIC_NAME 64
+#define PMGR_CHAN_MAX_TOPIC 256
+#define PMGR_CHAN_MAX_MSG   (1024 * 1024)   /* the biggest message, the bigger ones go in chunks */
+#define PMGR_CHAN_CHUNK_SZ  (64 * 1024)     /* the data of a chunk, if there is no reason for more */
+#define PMGR_CHAN_MAX_ADDR  64
+
+/* the default, chanmgr can be given another one (it's second argument), the socket of a chanmgr
+on another port is PMGR_CHAN_UN_NAME_PORT, so more of them can run near the same procmgr */
 #define PMGR_CHAN_TCP_PORT  7275
 #define PMGR_CHAN_UN_NAME   "chanmgr.sock"
+#define PMGR_CHAN_UN_NAME_PORT "chanmgr.%d.sock"
 #define PMGR_CHAN_UN_PERM   0666
 
 enum pmgr_msg_type_e : int32_t {
@@ -72,7 +79,7 @@ enum pmgr_msg_type_e : int32_t {
     /* --- Chann messages (see the chanmgr daemon) --- */
 
     /* all bellow end with a PMGR_MSG_RETVAL message */
-    PMGR_CHAN_REGISTER, /* creates/connects to a channel  */
+    PMGR_CHAN_REGISTER, /* creates/connects to a channel, the retval is the channel handle */
     PMGR_CHAN_IDENTITY, /* sends own identity to the channel (will be checked) */
     PMGR_CHAN_MESSAGE,  /* sends a message to someone */
     PMGR_CHAN_GET_IDENT,/* get's the identity of the client (pmgr_chann_msg_t) */
@@ -80,6 +87,54 @@ enum pmgr_msg_type_e : int32_t {
     PMGR_CHAN_LIST,     /* asks for the list of connected clients up to this point */
     PMGR_CHAN_SELF,     /* asks about own id (pmgr_chann_msg_t, in dst) */
     PMGR_CHAN_SENDFD,   /* send the file descriptor to another connected task (pmgr_chann_msg_t) */
+
+    /* --- Added later, kept here so the values above don't change --- */
+
+    /* Asks for all the metrics, multiple pmgr_metric_t (PMGR_MSG_METRIC) will be sent, the last
+    one having the 'list_terminator' field set, followed by a PMGR_MSG_RETVAL */
+    PMGR_MSG_METRICS,
+    PMGR_MSG_METRIC,
+
+    /* First and only message on the log socket (pmgr_log_req_t), after it the log is streamed */
+    PMGR_MSG_LOG_ATTACH,
+
+    /* An event pushed on a v2 connection (see pmgr2.h), v1 connections get pmgr_event_t */
+    PMGR_MSG_EVENT,
+
+    /* asks chanmgr for the shared memory rings (pmgr_chann_shm_t), see pmgrring.h */
+    PMGR_CHAN_SHM,
+
+    /* sets the window of the PMGR_CHAN_WACK acks (pmgr_chann_ack_win_t) */
+    PMGR_CHAN_ACK_WIN,
+
+    /* an ack of the messages sent without a reply (pmgr_chann_ack_t), pushed by chanmgr for the
+    PMGR_CHAN_WACK messages or asked for at any time, then it's followed by a PMGR_MSG_RETVAL */
+    PMGR_CHAN_ACK,
+
+    /* gives credits to chanmgr or asks for the credits of someone (pmgr_chann_credit_t) */
+    PMGR_CHAN_CREDIT,
+
+    /* subscribes to/unsubscribes from a topic of our channel (pmgr_chann_topic_t) */
+    PMGR_CHAN_SUBSCRIBE,
+    PMGR_CHAN_UNSUBSCRIBE,
+
+    /* sets how many of the PMGR_CHAN_RETAIN messages the channel keeps (pmgr_chann_retention_t) */
+    PMGR_CHAN_RETENTION,
+
+    /* asks for the retained messages of the channel (pmgr_chann_replay_t) */
+    PMGR_CHAN_REPLAY,
+
+    /* a part of a big message (pmgr_chann_chunk_t), handled as a PMGR_CHAN_MESSAGE */
+    PMGR_CHAN_CHUNK,
+
+    /* sets how many bytes of our chunks can wait inside chanmgr (pmgr_chann_inflight_t) */
+    PMGR_CHAN_INFLIGHT,
+
+    /* bridges our channel to the one with the same name of another chanmgr (pmgr_chann_bridge_t) */
+    PMGR_CHAN_BRIDGE,
+
+    /* only between bridged chanmgrs, a forwarded message (pmgr_chann_fwd_t), it has no reply */
+    PMGR_CHAN_FWD,
 };
 
 enum pmgr_task_state_e : int32_t {
@@ -94,8 +149,11 @@ enum pmgr_task_flags_e : int32_t {
     PMGR_TASK_FLAG_NOSTDIO = 2, /* close sandard io (0, 1, 2) TODO: change this to redirect to null */
     PMGR_TASK_FLAG_PWDSELF = 4, /* working dir is inherited (works with abs paths) */
     PMGR_TASK_FLAG_AUTORUN = 8, /* runs when added to the tasks list */
+    PMGR_TASK_FLAG_LOWPRIO = 16, /* under pressure (see psi in the config) restarts are paused */
+    PMGR_TASK_FLAG_SHEDSTOP = 32, /* under pressure the task is stopped, restarted after */
+    PMGR_TASK_FLAG_SHEDFRZ = 64, /* under pressure the task is frozen (SIGSTOP), resumed after */
 
-    PMGR_TASK_FLAG_MASK = 0b1111,  /* This needs to be kept actualized */
+    PMGR_TASK_FLAG_MASK = 0b1111111,  /* This needs to be kept actualized */
 };
 
 enum pmgr_event_e : int32_t {
@@ -106,7 +164,24 @@ enum pmgr_event_e : int32_t {
     PMGR_EVENT_CFG_RELOAD = 16,
     PMGR_EVENT_CLEAR      = 32,
 
-    PMGR_EVENT_MASK = 0b111111, /* This needs to be kept actualized */
+    /* for those two the task_name holds the resource name (cpu, memory, io) */
+    PMGR_EVENT_PRESSURE_ON  = 64,
+    PMGR_EVENT_PRESSURE_OFF = 128,
+
+    /* a task was stopped/frozen/held back because of pressure or it was let go afterwards */
+    PMGR_EVENT_TASK_SHED    = 256,
+    PMGR_EVENT_TASK_UNSHED  = 512,
+
+    /* the health probe of the task failed too many times, the task is being stopped */
+    PMGR_EVENT_TASK_UNHEALTHY = 1024,
+
+    /* the cpu, memory or output rate of some running tasks changed, only sent on v2 connections, as
+    the values are in the event (see pmgr2.h), sampled every 'stats_ms' only if someone listens.
+    One event per sample for all the tasks, without a task name or pid (so only the listeners
+    without a filter get it), each task is a PMGR2_F_NAME followed by it's stats fields */
+    PMGR_EVENT_TASK_STATS     = 2048,
+
+    PMGR_EVENT_MASK = 0b111111111111, /* This needs to be kept actualized */
 };
 
 enum pmgr_event_flags_e : int32_t {
@@ -120,6 +195,31 @@ enum pmgr_chan_flags_e : int32_t {
     PMGR_CHAN_CREAT = 1,    /* creates channel if it doesn't exist */
     PMGR_CHAN_WAITC = 2,    /* wait for channel to be created */
     PMGR_CHAN_BCAST = 4,    /* broadcasts message inside the channel */
+
+    /* what chanmgr does with a message for us when our queue is full, by default the sender waits */
+    PMGR_CHAN_QDROP = 8,    /* the message is dropped */
+    PMGR_CHAN_QDISCON = 16, /* we are disconnected */
+
+    /* the reply of a PMGR_CHAN_MESSAGE/PMGR_CHAN_SENDFD, set on the message or on the registration
+    for all the messages of the connection, by default each message is followed by a PMGR_MSG_RETVAL */
+    PMGR_CHAN_NOACK = 32,   /* no reply, only counted in the next PMGR_CHAN_ACK */
+    PMGR_CHAN_WACK = 64,    /* no reply, a PMGR_CHAN_ACK comes every few messages or milliseconds */
+
+    /* the message goes to the subscribers of a topic, it's content starts with the topic (null
+    terminated, without wildcards), the rest of the content follows it */
+    PMGR_CHAN_TOPIC = 128,
+
+    /* a PMGR_CHAN_BCAST or PMGR_CHAN_TOPIC message that is also kept for the clients that come
+    later, if the channel has a retention (PMGR_CHAN_RETENTION) */
+    PMGR_CHAN_RETAIN = 256,
+
+    /* the registration of another chanmgr, for a bridge (PMGR_CHAN_BRIDGE), it only sends and
+    gets PMGR_CHAN_FWD, only taken over tcp */
+    PMGR_CHAN_PEER = 512,
+};
+
+enum pmgr_log_flags_e : int32_t {
+    PMGR_LOG_FROM_HEAD = 1, /* start from the oldest output that is still kept, else from now */
 };
 
 struct PACKED_STRUCT pmgr_hdr_t {
@@ -146,6 +246,124 @@ struct PACKED_STRUCT pmgr_chann_msg_t {
     /* content: The rest of the message will stay here */
 };
 
+/* the request and the reply for PMGR_CHAN_SHM, if ring_size in the reply is not 0 the memfd and the
+eventfds of the two rings follow (pmgr_recv_fd), then the pmgr_return_t */
+struct PACKED_STRUCT pmgr_chann_shm_t {
+    pmgr_hdr_t hdr;
+
+    uint32_t ring_size; /* bytes of each ring */
+};
+
+/* The messages (PMGR_CHAN_MESSAGE, PMGR_CHAN_SENDFD and PMGR_CHAN_CHUNK) of a connection are numbered from 1 in the
+order they are sent (not the ones that go through the rings), an ack covers all of them up to seq,
+so the sender knows what was done and what failed (dropped, or the destination is gone) of those
+that had no reply since the last ack */
+struct PACKED_STRUCT pmgr_chann_ack_t {
+    pmgr_hdr_t hdr;
+
+    uint64_t seq;           /* the last message handled */
+    uint64_t first_failed;  /* the first message that failed since the last ack, 0 if none */
+    uint32_t failed;        /* how many failed since the last ack */
+};
+
+/* an ack every win_msgs messages or win_ms after the first message that wasn't acked, 0 for none */
+struct PACKED_STRUCT pmgr_chann_ack_win_t {
+    pmgr_hdr_t hdr;
+
+    uint32_t win_msgs;
+    uint32_t win_ms;
+};
+
+/* Flow control, a client that gives credits gets only that many messages (each message to it uses
+one), the senders wait for more credits or the flags of the client decide, as with a full queue.
+With dst_id 0 it gives us credits, the first time the flow control is turned on for us. Else it asks
+for the credits of dst_id, the same message comes back with them (-1 if there is no flow control),
+then the PMGR_MSG_RETVAL. */
+struct PACKED_STRUCT pmgr_chann_credit_t {
+    pmgr_hdr_t hdr;
+
+    int64_t dst_id;
+    int64_t credits;
+};
+
+/* Topics are dot separated (sensors.temp.kitchen), a subscription can have '*' as a level, for any
+one level, and '#' as it's last level, for any number of levels */
+struct PACKED_STRUCT pmgr_chann_topic_t {
+    pmgr_hdr_t hdr;
+
+    char topic[PMGR_CHAN_MAX_TOPIC];
+};
+
+/* The retention of a channel keeps the last max_msgs messages, for at most max_ms (0 for no limit)
+and max_bytes, max_msgs 0 turns it off. It belongs to the name of the channel, it stays while the
+channel has no clients and with persist it also stays when chanmgr restarts. */
+struct PACKED_STRUCT pmgr_chann_retention_t {
+    pmgr_hdr_t hdr;
+
+    uint32_t max_msgs;
+    uint32_t max_ms;
+    uint32_t max_bytes;
+    uint32_t persist;
+};
+
+/* Asks for the retained messages from seq on (0 for all of them). Each one comes after a
+pmgr_chann_replay_t with it's seq and time (realtime, in ms), the topic ones only if they match our
+subscriptions. A last pmgr_chann_replay_t has the seq of the next retained message and time_ms 0,
+then the PMGR_MSG_RETVAL has the number of messages, -1 if some from seq are already gone or if the
+channel has no retention. */
+struct PACKED_STRUCT pmgr_chann_replay_t {
+    pmgr_hdr_t hdr;
+
+    uint64_t seq;
+    int64_t time_ms;
+};
+
+/* A message too big for PMGR_CHAN_MAX_MSG is sent in chunks, each one is forwarded as soon as it
+comes and the messages of the others can go between them. The first fields are the ones of
+pmgr_chann_msg_t (without PMGR_CHAN_TOPIC or PMGR_CHAN_RETAIN), the data follows. The chunks of a
+stream are in order, stream_id is picked by the sender and the last chunk ends at total. */
+struct PACKED_STRUCT pmgr_chann_chunk_t {
+    pmgr_hdr_t hdr;
+
+    pmgr_chan_flags_e flags;
+    int64_t src_id;
+    int64_t dst_id;
+
+    uint64_t stream_id;
+    uint64_t offset;    /* of the data of this chunk inside the whole message */
+    uint64_t total;     /* the size of the whole message */
+};
+
+/* a sender waits while the chunks it sent that are not yet written to their destinations have more
+than max_bytes, the default is 1M */
+struct PACKED_STRUCT pmgr_chann_inflight_t {
+    pmgr_hdr_t hdr;
+
+    uint32_t max_bytes;
+};
+
+/* Bridges our channel to the channel with the same name of the chanmgr at addr ("ip:port"), it's
+created there if it doesn't exist. The PMGR_CHAN_BCAST and PMGR_CHAN_TOPIC messages of each side then
+also go to the clients of the other one (with the src_id of the bridge), a bridged chanmgr forwards
+them further on it's own bridges. A bridge lasts until the connection between the two is lost, the
+retval is 0 also if the bridge was already there. */
+struct PACKED_STRUCT pmgr_chann_bridge_t {
+    pmgr_hdr_t hdr;
+
+    char addr[PMGR_CHAN_MAX_ADDR];
+};
+
+/* A forwarded message, the pmgr_chann_msg_t follows. origin is the channel where it was sent (one of
+it's chanmgr, new each time the channel is made) and seq is it's number there, so a chanmgr that
+gets it on more paths takes it only once. */
+struct PACKED_STRUCT pmgr_chann_fwd_t {
+    pmgr_hdr_t hdr;
+
+    uint64_t origin;
+    uint64_t seq;
+    uint32_t hops;      /* the bridges it went through */
+};
+
 /* message to send identity of a connected client */
 struct PACKED_STRUCT pmgr_chann_identity_t {
     pmgr_hdr_t          hdr;
@@ -198,6 +416,25 @@ struct PACKED_STRUCT pmgr_task_t {
     char task_path[PMGR_MAX_TASK_PATH];
 };
 
+/* a named value kept by procmgr for a task, for example the latency of it's health probe */
+struct PACKED_STRUCT pmgr_metric_t {
+    pmgr_hdr_t hdr;
+
+    int32_t list_terminator;
+
+    char task_name[PMGR_MAX_TASK_NAME];
+    char name[PMGR_MAX_METRIC_NAME];
+    int64_t value;
+};
+
+/* attaches to the log, optionally only to the output of a task (empty name for all) */
+struct PACKED_STRUCT pmgr_log_req_t {
+    pmgr_hdr_t hdr;
+
+    pmgr_log_flags_e flags;
+    char task_name[PMGR_MAX_TASK_NAME];
+};
+
 struct PACKED_STRUCT pmgr_return_t {
     pmgr_hdr_t hdr;
     int32_t retval;
@@ -0,0 +1,78 @@
+#include "psi.h"
+#include "cfg.h"
+#include "cmds.h"
+#include "tasks.h"
+#include "time_utils.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+#define PSI_CHECK_MS 500
+
+static bool under_pressure = false;
+static uint64_t last_trig_us = 0;
+static std::string last_res;
+
+bool psi_under_pressure() {
+    return under_pressure;
+}
+
+static co::task_t co_psi_trigger(cfg_psi_t psi) {
+    std::string psi_path = "/proc/pressure/" + psi.res;
+
+    /* the trigger lives as long as the file is kept open */
+    int fd = open(psi_path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        DBGE("Pressure stall information not available: %s", psi_path.c_str());
+        co_return -1;
+    }
+    FnScope scope([fd]{ close(fd); });
+
+    std::string trig = sformat("%s %ld %ld", psi.kind.c_str(), psi.stall_us, psi.window_us);
+    if (write(fd, trig.c_str(), trig.size() + 1) < 0) {
+        DBGE("Failed to register trigger [%s] on %s", trig.c_str(), psi_path.c_str());
+        co_return -1;
+    }
+    DBG("Pressure trigger: %s[%s]", psi.res.c_str(), trig.c_str());
+
+    while (true) {
+        /* the kernel signals a crossed threshold with POLLPRI, at most once per window */
+        ASSERT_COFN(co_await co::wait_event(fd, EPOLLPRI));
+
+        last_trig_us = get_time_us();
+        if (under_pressure)
+            continue;
+
+        under_pressure = true;
+        last_res = psi.res;
+        DBG("Pressure on: %s", psi.res.c_str());
+        cmds_event(PMGR_EVENT_PRESSURE_ON, psi.res);
+        tasks_pressure(true);
+    }
+    co_return 0;
+}
+
+co::task_t co_psi() {
+    if (!cfg_get()->psi.size())
+        co_return 0;
+
+    for (auto &psi : cfg_get()->psi)
+        co_await co::sched(co_psi_trigger(psi));
+
+    /* there is no notification for the pressure going away, so we wait for the triggers to stay
+    quiet for a while */
+    while (true) {
+        co_await co::sleep_ms(PSI_CHECK_MS);
+
+        if (!under_pressure)
+            continue;
+        if (get_time_us() - last_trig_us < cfg_get()->psi_hold_ms * 1000ULL)
+            continue;
+
+        under_pressure = false;
+        DBG("Pressure off: %s", last_res.c_str());
+        cmds_event(PMGR_EVENT_PRESSURE_OFF, last_res);
+        tasks_pressure(false);
+    }
+    co_return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef PSI_H
+#define PSI_H
+
+#include "co_utils.h"
+
+/* true while at least one of the configured pressure triggers fired recently */
+bool psi_under_pressure();
+
+/* This coroutine watches the /proc/pressure triggers from the config */
+co::task_t co_psi();
+
+#endif
@@ -6,13 +6,18 @@ int json2pmgr_values(std::string &values_json) {
     try {
         json jdefs = {
             /* increment this number each time you actualize this structure */
-            {"PMGR_BINDING_VERSION", 2},
+            {"PMGR_BINDING_VERSION", 15},
 
             /* defines related to object names */
             {"PMGR_MAX_TASK_NAME", PMGR_MAX_TASK_NAME},
             {"PMGR_MAX_TASK_PATH", PMGR_MAX_TASK_PATH},
             {"PMGR_MAX_TASK_USR", PMGR_MAX_TASK_USR},
             {"PMGR_MAX_TASK_GRP", PMGR_MAX_TASK_GRP},
+            {"PMGR_MAX_METRIC_NAME", PMGR_MAX_METRIC_NAME},
+            {"PMGR_CHAN_MAX_TOPIC", PMGR_CHAN_MAX_TOPIC},
+            {"PMGR_CHAN_MAX_MSG", PMGR_CHAN_MAX_MSG},
+            {"PMGR_CHAN_CHUNK_SZ", PMGR_CHAN_CHUNK_SZ},
+            {"PMGR_CHAN_MAX_ADDR", PMGR_CHAN_MAX_ADDR},
 
             /* defines related to addreeses */
             {"PMGR_CHAN_TCP_PORT", PMGR_CHAN_TCP_PORT},
@@ -45,6 +50,22 @@ int json2pmgr_values(std::string &values_json) {
                 {"PMGR_CHAN_LIST", PMGR_CHAN_LIST},
                 {"PMGR_CHAN_SELF", PMGR_CHAN_SELF},
                 {"PMGR_CHAN_SENDFD", PMGR_CHAN_SENDFD},
+                {"PMGR_MSG_METRICS", PMGR_MSG_METRICS},
+                {"PMGR_MSG_METRIC", PMGR_MSG_METRIC},
+                {"PMGR_MSG_LOG_ATTACH", PMGR_MSG_LOG_ATTACH},
+                {"PMGR_MSG_EVENT", PMGR_MSG_EVENT},
+                {"PMGR_CHAN_SHM", PMGR_CHAN_SHM},
+                {"PMGR_CHAN_ACK_WIN", PMGR_CHAN_ACK_WIN},
+                {"PMGR_CHAN_ACK", PMGR_CHAN_ACK},
+                {"PMGR_CHAN_CREDIT", PMGR_CHAN_CREDIT},
+                {"PMGR_CHAN_SUBSCRIBE", PMGR_CHAN_SUBSCRIBE},
+                {"PMGR_CHAN_UNSUBSCRIBE", PMGR_CHAN_UNSUBSCRIBE},
+                {"PMGR_CHAN_RETENTION", PMGR_CHAN_RETENTION},
+                {"PMGR_CHAN_REPLAY", PMGR_CHAN_REPLAY},
+                {"PMGR_CHAN_CHUNK", PMGR_CHAN_CHUNK},
+                {"PMGR_CHAN_INFLIGHT", PMGR_CHAN_INFLIGHT},
+                {"PMGR_CHAN_BRIDGE", PMGR_CHAN_BRIDGE},
+                {"PMGR_CHAN_FWD", PMGR_CHAN_FWD},
             }},
 
             {"pmgr_task_state_e", {
@@ -59,6 +80,9 @@ int json2pmgr_values(std::string &values_json) {
                 {"PMGR_TASK_FLAG_NOSTDIO", PMGR_TASK_FLAG_NOSTDIO},
                 {"PMGR_TASK_FLAG_PWDSELF", PMGR_TASK_FLAG_PWDSELF},
                 {"PMGR_TASK_FLAG_AUTORUN", PMGR_TASK_FLAG_AUTORUN},
+                {"PMGR_TASK_FLAG_LOWPRIO", PMGR_TASK_FLAG_LOWPRIO},
+                {"PMGR_TASK_FLAG_SHEDSTOP", PMGR_TASK_FLAG_SHEDSTOP},
+                {"PMGR_TASK_FLAG_SHEDFRZ", PMGR_TASK_FLAG_SHEDFRZ},
                 {"PMGR_TASK_FLAG_MASK", PMGR_TASK_FLAG_MASK},
             }},
 
@@ -69,6 +93,12 @@ int json2pmgr_values(std::string &values_json) {
                 {"PMGR_EVENT_TASK_RM", PMGR_EVENT_TASK_RM},
                 {"PMGR_EVENT_CFG_RELOAD", PMGR_EVENT_CFG_RELOAD},
                 {"PMGR_EVENT_CLEAR", PMGR_EVENT_CLEAR},
+                {"PMGR_EVENT_PRESSURE_ON", PMGR_EVENT_PRESSURE_ON},
+                {"PMGR_EVENT_PRESSURE_OFF", PMGR_EVENT_PRESSURE_OFF},
+                {"PMGR_EVENT_TASK_SHED", PMGR_EVENT_TASK_SHED},
+                {"PMGR_EVENT_TASK_UNSHED", PMGR_EVENT_TASK_UNSHED},
+                {"PMGR_EVENT_TASK_UNHEALTHY", PMGR_EVENT_TASK_UNHEALTHY},
+                {"PMGR_EVENT_TASK_STATS", PMGR_EVENT_TASK_STATS},
                 {"PMGR_EVENT_MASK", PMGR_EVENT_MASK},
             }},
 
@@ -78,11 +108,22 @@ int json2pmgr_values(std::string &values_json) {
                 {"PMGR_EVENT_FLAGS_MASK", PMGR_EVENT_FLAGS_MASK},
             }},
 
+            {"pmgr_log_flags_e", {
+                {"PMGR_LOG_FROM_HEAD", PMGR_LOG_FROM_HEAD},
+            }},
+
             /* pmgr_chan_flags_e */
             {"pmgr_chan_flags_e", {
                 {"PMGR_CHAN_CREAT", PMGR_CHAN_CREAT},
                 {"PMGR_CHAN_WAITC", PMGR_CHAN_WAITC},
                 {"PMGR_CHAN_BCAST", PMGR_CHAN_BCAST},
+                {"PMGR_CHAN_QDROP", PMGR_CHAN_QDROP},
+                {"PMGR_CHAN_QDISCON", PMGR_CHAN_QDISCON},
+                {"PMGR_CHAN_NOACK", PMGR_CHAN_NOACK},
+                {"PMGR_CHAN_WACK", PMGR_CHAN_WACK},
+                {"PMGR_CHAN_TOPIC", PMGR_CHAN_TOPIC},
+                {"PMGR_CHAN_RETAIN", PMGR_CHAN_RETAIN},
+                {"PMGR_CHAN_PEER", PMGR_CHAN_PEER},
             }},
         };
 
@@ -156,6 +197,7 @@ int json2pmgr(std::string &src, std::shared_ptr<pmgr_hdr_t> &dst, int &target_fd
 
             case PMGR_MSG_LIST:
             case PMGR_MSG_CLEAR:
+            case PMGR_MSG_METRICS:
             case PMGR_MSG_LOAD_CFG: {
                 auto _ptr = new pmgr_hdr_t{
                     .size = sizeof(pmgr_hdr_t),
@@ -198,6 +240,34 @@ int json2pmgr(std::string &src, std::shared_ptr<pmgr_hdr_t> &dst, int &target_fd
             }
             break;
 
+            case PMGR_MSG_METRIC: {
+                auto _ptr = new pmgr_metric_t{
+                    .hdr = { .size = sizeof(pmgr_metric_t), .type = msg_type },
+                    .list_terminator = jsrc["list_terminator"].get<int32_t>(),
+                    .value = jsrc["value"].get<int64_t>(),
+                };
+                FnScope scope([&_ptr]{ delete _ptr; });
+                COPY_STRING(_ptr->task_name, jsrc["task_name"], PMGR_MAX_TASK_NAME);
+                COPY_STRING(_ptr->name, jsrc["name"], PMGR_MAX_METRIC_NAME);
+                scope.disable();
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            case PMGR_MSG_LOG_ATTACH: {
+                auto _ptr = new pmgr_log_req_t{
+                    .hdr = { .size = sizeof(pmgr_log_req_t), .type = msg_type },
+                    .flags = (pmgr_log_flags_e)jsrc["flags"].get<int32_t>(),
+                };
+                FnScope scope([&_ptr]{ delete _ptr; });
+                COPY_STRING(_ptr->task_name, jsrc["task_name"], PMGR_MAX_TASK_NAME);
+                scope.disable();
+
+                TRANSFER_HELPER;
+            }
+            break;
+
             case PMGR_MSG_RETVAL: {
                 auto _ptr = new pmgr_return_t{
                     .hdr = { .size = sizeof(pmgr_return_t), .type = msg_type },
@@ -208,6 +278,122 @@ int json2pmgr(std::string &src, std::shared_ptr<pmgr_hdr_t> &dst, int &target_fd
             }
             break;
 
+            case PMGR_CHAN_ACK_WIN: {
+                auto _ptr = new pmgr_chann_ack_win_t{
+                    .hdr = { .size = sizeof(pmgr_chann_ack_win_t), .type = msg_type },
+                    .win_msgs = jsrc["win_msgs"].get<uint32_t>(),
+                    .win_ms = jsrc["win_ms"].get<uint32_t>(),
+                };
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            /* asks for an ack now, the fields are only filled by chanmgr */
+            case PMGR_CHAN_ACK: {
+                auto _ptr = new pmgr_chann_ack_t{
+                    .hdr = { .size = sizeof(pmgr_chann_ack_t), .type = msg_type },
+                };
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            case PMGR_CHAN_CREDIT: {
+                auto _ptr = new pmgr_chann_credit_t{
+                    .hdr = { .size = sizeof(pmgr_chann_credit_t), .type = msg_type },
+                    .dst_id = jsrc["dst_id"].get<int64_t>(),
+                    .credits = jsrc["credits"].get<int64_t>(),
+                };
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            case PMGR_CHAN_SUBSCRIBE:
+            case PMGR_CHAN_UNSUBSCRIBE: {
+                auto _ptr = new pmgr_chann_topic_t{
+                    .hdr = { .size = sizeof(pmgr_chann_topic_t), .type = msg_type },
+                };
+                FnScope scope([&_ptr]{ delete _ptr; });
+                COPY_STRING(_ptr->topic, jsrc["topic"], PMGR_CHAN_MAX_TOPIC);
+                scope.disable();
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            case PMGR_CHAN_RETENTION: {
+                auto _ptr = new pmgr_chann_retention_t{
+                    .hdr = { .size = sizeof(pmgr_chann_retention_t), .type = msg_type },
+                    .max_msgs = jsrc["max_msgs"].get<uint32_t>(),
+                    .max_ms = jsrc["max_ms"].get<uint32_t>(),
+                    .max_bytes = jsrc["max_bytes"].get<uint32_t>(),
+                    .persist = jsrc["persist"].get<uint32_t>(),
+                };
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            case PMGR_CHAN_REPLAY: {
+                auto _ptr = new pmgr_chann_replay_t{
+                    .hdr = { .size = sizeof(pmgr_chann_replay_t), .type = msg_type },
+                    .seq = jsrc["seq"].get<uint64_t>(),
+                };
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            /* the contents are the data of this chunk only, without a null at the end */
+            case PMGR_CHAN_CHUNK: {
+                std::string contents = jsrc["contents"].get<std::string>();
+                if (contents.size() + sizeof(pmgr_chann_chunk_t) > PMGR_CHAN_MAX_MSG) {
+                    DBG("Chunk too large");
+                    return -1;
+                }
+                int data_len = sizeof(pmgr_chann_chunk_t) + contents.size();
+                uint8_t *data = new uint8_t[data_len];
+                auto msg = (pmgr_chann_chunk_t *)data;
+                *msg = pmgr_chann_chunk_t {
+                    .hdr = { .size = data_len, .type = msg_type },
+                    .flags = (pmgr_chan_flags_e)jsrc["flags"].get<int32_t>(),
+                    .src_id = jsrc["src_id"].get<int64_t>(),
+                    .dst_id = jsrc["dst_id"].get<int64_t>(),
+                    .stream_id = jsrc["stream_id"].get<uint64_t>(),
+                    .offset = jsrc["offset"].get<uint64_t>(),
+                    .total = jsrc["total"].get<uint64_t>(),
+                };
+                memcpy(msg + 1, contents.data(), contents.size());
+
+                ptr = (pmgr_hdr_t *)data;
+                free_fn = [](pmgr_hdr_t *p) { delete [] (uint8_t *)p; };
+            }
+            break;
+
+            case PMGR_CHAN_INFLIGHT: {
+                auto _ptr = new pmgr_chann_inflight_t{
+                    .hdr = { .size = sizeof(pmgr_chann_inflight_t), .type = msg_type },
+                    .max_bytes = jsrc["max_bytes"].get<uint32_t>(),
+                };
+
+                TRANSFER_HELPER;
+            }
+            break;
+
+            case PMGR_CHAN_BRIDGE: {
+                auto _ptr = new pmgr_chann_bridge_t{
+                    .hdr = { .size = sizeof(pmgr_chann_bridge_t), .type = msg_type },
+                };
+                FnScope scope([&_ptr]{ delete _ptr; });
+                COPY_STRING(_ptr->addr, jsrc["addr"], PMGR_CHAN_MAX_ADDR);
+                scope.disable();
+
+                TRANSFER_HELPER;
+            }
+            break;
+
             case PMGR_CHAN_REGISTER: {
                 auto _ptr = new pmgr_chann_t{
                     .hdr = { .size = sizeof(pmgr_chann_t), .type = msg_type },
@@ -223,20 +409,33 @@ int json2pmgr(std::string &src, std::shared_ptr<pmgr_hdr_t> &dst, int &target_fd
 
             case PMGR_CHAN_MESSAGE: {
                 std::string contents = jsrc["contents"].get<std::string>();
-                if (contents.size() > 2000'000'000) {
-                    DBG("Contents are too large...");
+                if (contents.size() + sizeof(pmgr_chann_msg_t) + PMGR_CHAN_MAX_TOPIC > PMGR_CHAN_MAX_MSG) {
+                    DBG("Contents are too large, they should be sent in chunks");
                     return -1;
                 }
-                int data_len = sizeof(pmgr_chann_msg_t) + contents.size() + 1;
+                int32_t flags = jsrc["flags"].get<int32_t>();
+
+                /* with a topic the content is the topic and the contents, both null terminated */
+                std::string topic;
+                if (flags & PMGR_CHAN_TOPIC) {
+                    topic = jsrc["topic"].get<std::string>();
+                    if (topic.size() + 1 > PMGR_CHAN_MAX_TOPIC) {
+                        DBG("String too large");
+                        return -1;
+                    }
+                    topic.push_back('\0');
+                }
+                int data_len = sizeof(pmgr_chann_msg_t) + topic.size() + contents.size() + 1;
                 uint8_t *data = new uint8_t[data_len];
                 auto msg = (pmgr_chann_msg_t *)data;
                 *msg = pmgr_chann_msg_t {
                     .hdr = { .size = data_len, .type = msg_type },
-                    .flags = (pmgr_chan_flags_e)jsrc["flags"].get<int32_t>(),
+                    .flags = (pmgr_chan_flags_e)flags,
                     .src_id = jsrc["src_id"].get<int64_t>(),
                     .dst_id = jsrc["dst_id"].get<int64_t>(),
                 };
-                memcpy(msg + 1, contents.c_str(), contents.size() + 1);
+                memcpy(msg + 1, topic.data(), topic.size());
+                memcpy((uint8_t *)(msg + 1) + topic.size(), contents.c_str(), contents.size() + 1);
 
                 ptr = (pmgr_hdr_t *)data;
                 free_fn = [](pmgr_hdr_t *p) { delete [] (uint8_t *)p; };
@@ -321,6 +520,7 @@ int json2pmgr(pmgr_hdr_t *src, std::string &dst, int &target_fd) {
 
         case PMGR_MSG_LIST:
         case PMGR_MSG_CLEAR:
+        case PMGR_MSG_METRICS:
         case PMGR_MSG_LOAD_CFG: {
             VALIDATE_SIZE(src, pmgr_hdr_t);
             json jdst = {
@@ -363,6 +563,32 @@ int json2pmgr(pmgr_hdr_t *src, std::string &dst, int &target_fd) {
         }
         break;
 
+        case PMGR_MSG_METRIC: {
+            VALIDATE_SIZE(src, pmgr_metric_t);
+            auto msg = (pmgr_metric_t *)src;
+            json jdst = {
+                {"hdr", {{"type", (int32_t)src->type}, {"size", (int32_t)src->size}}},
+                {"list_terminator", (int32_t)msg->list_terminator},
+                {"task_name", msg->task_name},
+                {"name", msg->name},
+                {"value", (int64_t)msg->value},
+            };
+            dst = jdst.dump(4, ' ');
+        }
+        break;
+
+        case PMGR_MSG_LOG_ATTACH: {
+            VALIDATE_SIZE(src, pmgr_log_req_t);
+            auto msg = (pmgr_log_req_t *)src;
+            json jdst = {
+                {"hdr", {{"type", (int32_t)src->type}, {"size", (int32_t)src->size}}},
+                {"flags", (int32_t)msg->flags},
+                {"task_name", msg->task_name},
+            };
+            dst = jdst.dump(4, ' ');
+        }
+        break;
+
         case PMGR_MSG_RETVAL: {
             VALIDATE_SIZE(src, pmgr_return_t);
             auto msg = (pmgr_return_t *)src;
@@ -374,6 +600,64 @@ int json2pmgr(pmgr_hdr_t *src, std::string &dst, int &target_fd) {
         }
         break;
 
+        case PMGR_CHAN_ACK: {
+            VALIDATE_SIZE(src, pmgr_chann_ack_t);
+            auto msg = (pmgr_chann_ack_t *)src;
+            json jdst = {
+                {"hdr", {{"type", (int32_t)src->type}, {"size", (int32_t)src->size}}},
+                {"seq", (uint64_t)msg->seq},
+                {"first_failed", (uint64_t)msg->first_failed},
+                {"failed", (uint32_t)msg->failed},
+            };
+            dst = jdst.dump(4, ' ');
+        }
+        break;
+
+        case PMGR_CHAN_CREDIT: {
+            VALIDATE_SIZE(src, pmgr_chann_credit_t);
+            auto msg = (pmgr_chann_credit_t *)src;
+            json jdst = {
+                {"hdr", {{"type", (int32_t)src->type}, {"size", (int32_t)src->size}}},
+                {"dst_id", (int64_t)msg->dst_id},
+                {"credits", (int64_t)msg->credits},
+            };
+            dst = jdst.dump(4, ' ');
+        }
+        break;
+
+        case PMGR_CHAN_REPLAY: {
+            VALIDATE_SIZE(src, pmgr_chann_replay_t);
+            auto msg = (pmgr_chann_replay_t *)src;
+            json jdst = {
+                {"hdr", {{"type", (int32_t)src->type}, {"size", (int32_t)src->size}}},
+                {"seq", (uint64_t)msg->seq},
+                {"time_ms", (int64_t)msg->time_ms},
+            };
+            dst = jdst.dump(4, ' ');
+        }
+        break;
+
+        case PMGR_CHAN_CHUNK: {
+            if (src->size < sizeof(pmgr_chann_chunk_t)) {
+                DBG("Invalid size");
+                return -1;
+            }
+            auto msg = (pmgr_chann_chunk_t *)src;
+            json jdst = {
+                {"hdr", {{"type", (int32_t)src->type}, {"size", (int32_t)src->size}}},
+                {"flags", (int32_t)msg->flags},
+                {"src_id", (int64_t)msg->src_id},
+                {"dst_id", (int64_t)msg->dst_id},
+                {"stream_id", (uint64_t)msg->stream_id},
+                {"offset", (uint64_t)msg->offset},
+                {"total", (uint64_t)msg->total},
+                {"contents", std::string((char *)(msg + 1), src->size - sizeof(*msg))},
+            };
+            /* the data is not always text */
+            dst = jdst.dump(4, ' ', false, json::error_handler_t::replace);
+        }
+        break;
+
         case PMGR_CHAN_REGISTER: {
             VALIDATE_SIZE(src, pmgr_chann_t);
             auto msg = (pmgr_chann_t *)src;
@@ -394,8 +678,22 @@ int json2pmgr(pmgr_hdr_t *src, std::string &dst, int &target_fd) {
             // we need to make sure that the content is a string, else just don't add it
             auto msg = (pmgr_chann_msg_t *)src;
             auto contents = (char *)(msg + 1);
+            int contents_len = src->size - sizeof(pmgr_chann_msg_t);
+
+            /* the topic is the first string of the content */
+            const char *topic = "";
+            if (msg->flags & PMGR_CHAN_TOPIC) {
+                auto end = (char *)memchr(contents, 0, contents_len);
+                if (!end) {
+                    DBG("Invalid topic");
+                    return -1;
+                }
+                topic = contents;
+                contents_len -= end + 1 - contents;
+                contents = end + 1;
+            }
             bool has_null = false;
-            for (int i = 0; i < src->size - sizeof(pmgr_chann_msg_t); i++)
+            for (int i = 0; i < contents_len; i++)
                 if (contents[i] == '\0') {
                     has_null = true;
                     break;
@@ -405,6 +703,7 @@ int json2pmgr(pmgr_hdr_t *src, std::string &dst, int &target_fd) {
                 {"flags", (int32_t)msg->flags},
                 {"src_id", (int64_t)msg->src_id},
                 {"dst_id", (int64_t)msg->dst_id},
+                {"topic", topic},
                 {"contents", has_null ? contents : ""},
             };
             dst = jdst.dump(4, ' ');
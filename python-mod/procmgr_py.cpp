@@ -5,7 +5,9 @@
 #include "thco.h"
 #include "json2pmgr.h"
 #include "procmgr.h"
+#include "libpmgr.h"
 #include "pmgrch.h"
+#include "pmgrhb.h"
 
 #include <thread>
 #include <frameobject.h>
@@ -21,6 +23,8 @@ enum awaiter_type_e {
     AWAITER_TYPE_STOP_APP,
     AWAITER_TYPE_WRITE,
     AWAITER_TYPE_READ,
+    AWAITER_TYPE_SHM,
+    AWAITER_TYPE_RING_WRITE,
 };
 
 struct awaiter_t {
@@ -30,6 +34,7 @@ struct awaiter_t {
     int64_t chan_id;
     std::string conn_path;
     std::string json_str;
+    uint32_t ring_size = 0;
 };
 
 static std::thread event_loop_thread;
@@ -41,6 +46,8 @@ static std::vector<awaiter_t> awaiters;
 
 struct chann_state_t {
     int fd;
+    std::vector<uint8_t> msg_data; /* reused by co_read, so reading doesn't allocate every time */
+    pmgr_chan_shm_p shm;            /* the rings, if chan_shm was called */
 };
 
 static int64_t curr_alloc_id = 0;
@@ -89,21 +96,7 @@ co::task_t co_open_conn(awaiter_t awaiter) {
     scope([&awaiter]{ awake_awaiter_exception(awaiter.aw, NULL); });
 
     int fd;
-    struct sockaddr_un sockaddr_un = {0};
-
-    sockaddr_un.sun_family = AF_UNIX;
-    strcpy(sockaddr_un.sun_path, awaiter.conn_path.c_str());
-
-    ASSERT_COFN(fd = socket(AF_UNIX, SOCK_STREAM, 0));
-
-    int ret; /* some retries, chanmgr may not be awake yet */
-    for (int i = 0; i < 10; i++) {
-        ret = connect(fd, (struct sockaddr *) &sockaddr_un, sizeof(struct sockaddr_un));
-        if (ret >= 0)
-            break;
-        co_await co::sleep_ms(100);
-    }
-    ASSERT_COFN(ret);
+    ASSERT_COFN(co_await co_pmgr_chan_connect(awaiter.conn_path, &fd));
 
     scope([fd]{ close(fd); });
 
@@ -151,11 +144,7 @@ co::task_t co_write(awaiter_t awaiter) {
     std::shared_ptr<pmgr_hdr_t> msg;
     int target_fd = -1;
     ASSERT_COFN(json2pmgr(awaiter.json_str, msg, target_fd));
-    ASSERT_COFN(co_await co::write_sz(state->fd, msg.get(), msg->size));
-    if (target_fd != -1) {
-        ASSERT_COFN(co_await co::wait_event(state->fd, EPOLLOUT));
-        ASSERT_COFN(pmgr_send_fd(state->fd, target_fd));
-    }
+    ASSERT_COFN(co_await co_pmgr_chan_send(state->fd, msg.get(), target_fd));
 
     int64_t ret = 0;
     ASSERT_COFN(awake_awaiter(awaiter.aw, "K", ret));
@@ -173,26 +162,12 @@ co::task_t co_read(awaiter_t awaiter) {
     ASSERT_COFN(CHK_BOOL(awaiter.chan_id >= 0));
     ASSERT_COFN(CHK_BOOL(HAS(chan_state, awaiter.chan_id)));
 
-    auto &state = chan_state[awaiter.chan_id];
-
-    int msg_len = 0;
-    std::vector<uint8_t> msg_data(sizeof(pmgr_hdr_t));
-    ASSERT_COFN(co_await co::read_sz(state->fd, msg_data.data(), sizeof(pmgr_hdr_t)));
+    /* a copy, the channel can be closed while we wait */
+    auto state = chan_state[awaiter.chan_id];
 
-    auto hdr = (pmgr_hdr_t *)msg_data.data();
-    ASSERT_COFN(CHK_BOOL(hdr->size >= sizeof(pmgr_hdr_t)));
-
-    if (hdr->size > sizeof(pmgr_hdr_t)) {
-        int rem = hdr->size - sizeof(pmgr_hdr_t);
-        msg_data.resize(hdr->size);
-        ASSERT_COFN(co_await co::read_sz(state->fd, msg_data.data() + sizeof(pmgr_hdr_t), rem));
-        hdr = (pmgr_hdr_t *)msg_data.data();
-    }
     int target_fd = -1;
-    if (hdr->type == PMGR_CHAN_SENDFD) {
-        ASSERT_COFN(co_await co::wait_event(state->fd, EPOLLIN));
-        ASSERT_COFN(target_fd = pmgr_recv_fd(state->fd));
-    }
+    ASSERT_COFN(co_await co_pmgr_chan_recv(state->fd, state->msg_data, &target_fd));
+    auto hdr = (pmgr_hdr_t *)state->msg_data.data();
 
     std::string json_str;
     ASSERT_COFN(json2pmgr(hdr, json_str, target_fd));
@@ -202,6 +177,46 @@ co::task_t co_read(awaiter_t awaiter) {
     co_return 0;
 }
 
+co::task_t co_chan_shm(awaiter_t awaiter) {
+    FnScope scope;
+    scope([&awaiter]{ awake_awaiter_exception(awaiter.aw, NULL); });
+
+    ASSERT_COFN(CHK_BOOL(awaiter.chan_id >= 0));
+    ASSERT_COFN(CHK_BOOL(HAS(chan_state, awaiter.chan_id)));
+
+    auto state = chan_state[awaiter.chan_id];
+    ASSERT_COFN(co_await co_pmgr_chan_shm(state->fd, awaiter.ring_size, &state->shm));
+
+    int64_t ret = 0;
+    ASSERT_COFN(awake_awaiter(awaiter.aw, "K", ret));
+
+    scope.disable();
+    co_return 0;
+}
+
+/* a PMGR_CHAN_MESSAGE through the ring, there is no reply to read for it */
+co::task_t co_ring_write(awaiter_t awaiter) {
+    FnScope scope;
+    scope([&awaiter]{ awake_awaiter_exception(awaiter.aw, NULL); });
+
+    ASSERT_COFN(CHK_BOOL(awaiter.chan_id >= 0));
+    ASSERT_COFN(CHK_BOOL(HAS(chan_state, awaiter.chan_id)));
+
+    auto state = chan_state[awaiter.chan_id];
+    ASSERT_COFN(CHK_BOOL(state->shm));
+
+    std::shared_ptr<pmgr_hdr_t> msg;
+    int target_fd = -1;
+    ASSERT_COFN(json2pmgr(awaiter.json_str, msg, target_fd));
+    ASSERT_COFN(CHK_BOOL(msg->type == PMGR_CHAN_MESSAGE));
+    ASSERT_COFN(co_await co_pmgr_chan_shm_send(state->shm, msg.get()));
+
+    int64_t ret = 0;
+    ASSERT_COFN(awake_awaiter(awaiter.aw, "K", ret));
+
+    scope.disable();
+    co_return 0;
+}
 
 /* This corutine waits for the awaiters to come and dispatches them to different waiting coros */
 co::task_t co_await_register() {
@@ -238,6 +253,14 @@ co::task_t co_await_register() {
                 co_await co::sched(co_write(awaiter));
             };
             break;
+            case AWAITER_TYPE_SHM: {
+                co_await co::sched(co_chan_shm(awaiter));
+            };
+            break;
+            case AWAITER_TYPE_RING_WRITE: {
+                co_await co::sched(co_ring_write(awaiter));
+            };
+            break;
             default: {
                 DBG("This can't happen");
             }
@@ -355,6 +378,44 @@ static PyObject *read_msg(PyObject *self, PyObject *args) {
     return aw;
 }
 
+static PyObject *chan_shm(PyObject *self, PyObject *args) {
+    int64_t chan_id;
+    uint32_t ring_size;
+    if (!PyArg_ParseTuple(args, "KI", &chan_id, &ring_size)) {
+        DBG("Failed parse args");
+        return NULL;
+    }
+    auto aw = pymod_await_new(NULL);
+    ASSERT_PYFN(CHK_BOOL(aw));
+    Py_INCREF(aw);
+    await_register_queue.push(awaiter_t{
+        .type = AWAITER_TYPE_SHM,
+        .aw = aw,
+        .chan_id = chan_id,
+        .ring_size = ring_size,
+    });
+    return aw;
+}
+
+static PyObject *ring_write_msg(PyObject *self, PyObject *args) {
+    int64_t chan_id;
+    const char *str_msg;
+    if (!PyArg_ParseTuple(args, "Ks", &chan_id, &str_msg)) {
+        DBG("Failed parse args");
+        return NULL;
+    }
+    auto aw = pymod_await_new(NULL);
+    ASSERT_PYFN(CHK_BOOL(aw));
+    Py_INCREF(aw);
+    await_register_queue.push(awaiter_t{
+        .type = AWAITER_TYPE_RING_WRITE,
+        .aw = aw,
+        .chan_id = chan_id,
+        .json_str = str_msg,
+    });
+    return aw;
+}
+
 // static PyObject *get_parent_dir(PyObject *self, PyObject *args) {
 //     return PyUnicode_FromString(path_pid_dir(getppid()).c_str());
 // }
@@ -368,6 +429,17 @@ static PyObject *install_crash_handler(PyObject *self, PyObject *args) {
     return Py_BuildValue("s", "ok");
 }
 
+static PyObject *heartbeat(PyObject *self, PyObject *args) {
+    static bool hb_init = false;
+    if (!hb_init) {
+        hb_init = true;
+        if (pmgrhb_init() < 0)
+            DBG("This task has no heartbeat slot, beats will be ignored");
+    }
+    pmgrhb_beat();
+    return Py_BuildValue("s", "ok");
+}
+
 static PyObject *log_str(PyObject *self, PyObject *args) {
     std::string caller_name = "unknown";
     std::string fn_name = "unknown";
@@ -394,8 +466,11 @@ std::vector<PyMethodDef> module_methods = {
     PyMethodDef{"disconnect", disconnect, METH_VARARGS, "doc:disconnect"},
     PyMethodDef{"write_msg", write_msg, METH_VARARGS, "doc:write_msg"},
     PyMethodDef{"read_msg", read_msg, METH_VARARGS, "doc:read_msg"},
+    PyMethodDef{"chan_shm", chan_shm, METH_VARARGS, "doc: ask chanmgr for the shared memory rings"},
+    PyMethodDef{"ring_write_msg", ring_write_msg, METH_VARARGS, "doc: send a message through the ring"},
     PyMethodDef{"get_mod_dir", get_mod_dir, METH_VARARGS, "doc:get_mod_dir"},
     PyMethodDef{"install_crash_handler", install_crash_handler, METH_VARARGS, "doc:install_crash_handler"},
+    PyMethodDef{"heartbeat", heartbeat, METH_VARARGS, "doc: tell procmgr that the main loop is alive"},
     PyMethodDef{"dbg", log_str, METH_VARARGS, "doc: add to the same logs as the lib"},
 };
 
@@ -0,0 +1,118 @@
+#!/usr/bin/python3
+
+# Bridges a channel between the chanmgr of the running procmgr and a second chanmgr on another port,
+# that this test adds to procmgr for itself. The two chanmgrs are bridged both ways, so each
+# forwarded message comes on two paths and must still be delivered once.
+
+import asyncio
+import json
+import os
+import procmgr_py as pmgr
+from munch import DefaultMunch
+
+pmgr_defs = DefaultMunch.fromDict(json.loads(pmgr.get_defs()))
+msg_type = pmgr_defs.pmgr_msg_type_e
+chan_flags = pmgr_defs.pmgr_chan_flags_e
+
+pmgr_dir = f"{pmgr.get_mod_dir()}/../"
+main_port = 7275   # PMGR_CHAN_TCP_PORT, the port of procmgr's own chanmgr
+test_port = 7276
+test_task = "chanmgr.test"
+test_chan = "test.bridge"
+
+async def sendmsg(fd, msg):
+    await pmgr.write_msg(fd, json.dumps(msg))
+    rsp = json.loads(await pmgr.read_msg(fd))
+    if rsp["retval"] < 0:
+        raise Exception(f"Failed to send message: {msg}")
+
+async def recvmsg(fd):
+    return json.loads(await pmgr.read_msg(fd))
+
+def task_msg(type, name, path = ""):
+    return {
+        "hdr": { "type": type },
+        "p": 0, "pid": 0, "state": 0, "list_terminator": 0,
+        "flags": pmgr_defs.pmgr_task_flags_e.PMGR_TASK_FLAG_PWDSELF,
+        "task_name": name, "task_pwd": "", "task_usr": "", "task_grp": "", "task_path": path,
+    }
+
+async def chan_connect(sock_name):
+    for i in range(50):
+        if os.path.exists(f"{pmgr_dir}/{sock_name}"):
+            break
+        await asyncio.sleep(0.1)
+    fd = await pmgr.connect(f"{pmgr_dir}/{sock_name}")
+    await sendmsg(fd, {
+        "hdr": { "type": msg_type.PMGR_CHAN_REGISTER },
+        "flags": chan_flags.PMGR_CHAN_CREAT,
+        "chan_name": test_chan,
+    })
+    return fd
+
+async def bcast(fd, contents):
+    await sendmsg(fd, {
+        "hdr": { "type": msg_type.PMGR_CHAN_MESSAGE },
+        "flags": chan_flags.PMGR_CHAN_BCAST,
+        "src_id": 0,
+        "dst_id": 0,
+        "contents": contents,
+    })
+
+# the same, but through the shared memory ring of fd, that has no reply
+async def ring_bcast(fd, contents):
+    await pmgr.ring_write_msg(fd, json.dumps({
+        "hdr": { "type": msg_type.PMGR_CHAN_MESSAGE },
+        "flags": chan_flags.PMGR_CHAN_BCAST,
+        "src_id": 0,
+        "dst_id": 0,
+        "contents": contents,
+    }))
+
+async def bridge(fd, port):
+    await sendmsg(fd, {
+        "hdr": { "type": msg_type.PMGR_CHAN_BRIDGE },
+        "addr": f"127.0.0.1:{port}",
+    })
+
+async def main():
+    pfd = await pmgr.connect(f"{pmgr_dir}/procmgr.sock")
+    await sendmsg(pfd, task_msg(msg_type.PMGR_MSG_ADD, test_task,
+            f"./daemons/chanmgr/chanmgr 1 {test_port}"))
+    try:
+        await sendmsg(pfd, task_msg(msg_type.PMGR_MSG_START, test_task))
+
+        # the second chanmgr has it's own socket, the first one's is left alone
+        a = await chan_connect("chanmgr.sock")
+        b = await chan_connect(f"chanmgr.{test_port}.sock")
+
+        # two bridges between the same channels, a mesh with a cycle
+        await bridge(a, test_port)
+        await bridge(b, main_port)
+
+        # the second copy of hello would come before end, on the other bridge
+        await bcast(a, "hello")
+        await asyncio.sleep(0.5)
+        await bcast(a, "end")
+        got = []
+        while not got or got[-1] != "end":
+            got.append((await recvmsg(b))["contents"])
+        assert got == ["hello", "end"], f"forwarded twice: {got}"
+
+        # and a's own messages don't come back to it through b
+        await bcast(b, "back")
+        got = (await recvmsg(a))["contents"]
+        assert got == "back", f"own message came back: {got}"
+
+        # a message that comes through a ring is forwarded as well
+        c = await chan_connect("chanmgr.sock")
+        await pmgr.chan_shm(c, 2 * 1024 * 1024)
+        await ring_bcast(c, "ring")
+        got = (await recvmsg(b))["contents"]
+        assert got == "ring", f"ring message not forwarded: {got}"
+
+        print("bridge: ok")
+    finally:
+        await sendmsg(pfd, task_msg(msg_type.PMGR_MSG_WAITRM, test_task))
+
+asyncio.run(main())
@@ -3,6 +3,7 @@
 import asyncio
 import time
 import json
+import subprocess
 import procmgr_py as pmgr
 from munch import DefaultMunch
 
@@ -22,3 +23,10 @@ async def main():
     print("b")
 
 asyncio.run(main())
+
+# what has no python side (see tests/units/README) is checked by tests/units, it's exit code says if
+# all passed
+units_dir = f"{pmgr.get_mod_dir()}/../tests/units"
+subprocess.run(["make", "-C", units_dir], check=True)
+subprocess.run(["./units"], cwd=units_dir, check=True)
+print("units: ok")
@@ -1,50 +1,116 @@
 #include "tasks.h"
 #include "path_utils.h"
 #include "cmds.h"
+#include "pmgr2.h"
+#include "metrics.h"
+#include "hbeat.h"
+#include "logfmt.h"
+#include "cfg.h"
 
 #include <signal.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <sys/wait.h>
 #include <grp.h>
 #include <pwd.h>
+#include <thread>
+#include <mutex>
 
 #define START_DEAD_TIMER 30
+#define OUTPUT_BATCH_SZ  65536
+#define OUTPUT_MAX_LINE  4096 /* longer lines are split in multiple records */
+#define OUTPUT_MARKER_US 1000'000 /* how often the suppressed output is reported */
+
+/* a stat is sent again only when it moved by 1/16 of it's last value and by at least this much */
+#define STATS_MIN_CPU    10              /* 1% of a cpu */
+#define STATS_MIN_RSS    (1024 * 1024)
+#define STATS_MIN_RATE   1024
 
 struct pmgr_private_task_t {
     pmgr_task_t o;
     int dead_timer = 0;
     bool revive = false;
     bool removing = false;
+    bool shed = false; /* held back, stopped or frozen because of pressure */
+    int hb_slot = -1;
+    std::vector<std::string> argv; /* if not empty, used instead of o.task_path */
+    std::vector<std::string> env;
+
+    int64_t start_us = 0;   /* wall clock */
+    int64_t starts = 0;
+    int64_t last_wstat = -1;
+
+    /* the last stats sample and the values last sent with PMGR_EVENT_TASK_STATS */
+    int64_t cpu_ticks = -1;
+    int64_t out_bytes = 0;
+    int64_t cpu = 0;
+    int64_t rss = 0;
+    int64_t out_rate = 0;
     co::sem_t closed_sem;
     co::sem_t start_sem;
 };
 
 using ptask_t = std::shared_ptr<pmgr_private_task_t>;
 
+/* an output pipe of a task that needs a reader */
+struct task_output_t {
+    ptask_t task;
+    pid_t pid;
+    int fd;
+    log_stream_e stream;
+};
+
+/* the output rate limit of a task, shared by it's out and err and by all it's runs */
+struct out_limit_t {
+    cfg_ratelim_t cfg;
+    double bytes = 0;           /* the tokens */
+    double lines = 0;
+    uint64_t last_us = 0;
+    uint64_t sample_cnt = 0;
+
+    /* dropped since the last marker */
+    int64_t dropped_bytes = 0;
+    int64_t dropped_lines = 0;
+    uint64_t last_marker_us = 0;
+
+    bool admit(uint64_t now_us, size_t len);
+};
+
+struct pid_waiter_t {
+    co::sem_t exit_sem;
+    int wstat = 0;
+};
+
 /* bucket for tasks that don't need to be running now */
 static std::vector<ptask_t> dead_tasks;
 static std::set<ptask_t> tokill_tasks;
 static std::unordered_map<std::string, ptask_t> tasks;
 static std::unordered_map<pid_t, ptask_t> pid2task;
+static std::unordered_map<pid_t, std::shared_ptr<pid_waiter_t>> pid_waiters;
+static std::vector<task_output_t> new_outputs;
+static std::unordered_map<std::string, std::shared_ptr<out_limit_t>> out_limits;
+static co::sem_t new_outputs_sem;
 static bool shutdown_flag = false;
+static bool pressure_flag = false;
 static int redir_write_end;
+static co::sem_t redir_write_sem{1}; /* the frames of the tasks must not be interleaved */
+
+/* procmgr's own output, read by own_th and written between the frames of the tasks */
+static int own_read_end = -1;
+static int own_efd = -1;
+static std::thread own_th;
+static std::mutex own_mu;
+static std::string own_lines; /* whole lines that were read but not yet written, under own_mu */
 
 extern char **environ;
 
-static void trigger_event(pmgr_event_e type, std::string task_name, pid_t pid) {
-    pmgr_event_t ev{
-        .hdr {
-            .size = sizeof(pmgr_event_t),
-            .type = PMGR_MSG_EVENT_LOOP,
-        },
-        .ev_type = type,
-        .task_pid = pid,
-    };
-    strcpy(ev.task_name, task_name.c_str());
-    cmds_trigger_event(&ev);
+static int64_t now_real_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000'000LL + ts.tv_nsec / 1000;
 }
 
 static bool is_prefix(const std::string& prefix, const std::string& dst) {
@@ -73,8 +139,10 @@ static pid_t exec_task(ptask_t task) {
         gid = gp->gr_gid;
     }
 
-    std::vector<std::string> args;
-    ASSERT_FN(ssplit_args(task->o.task_path, args));
+    std::vector<std::string> args = task->argv;
+    if (args.empty()) {
+        ASSERT_FN(ssplit_args(task->o.task_path, args));
+    }
     if (args.size() == 0 || args[0] == "") {
         DBG("Invalid exec_str");
         return -1;
@@ -98,7 +166,16 @@ static pid_t exec_task(ptask_t task) {
     bool has_pwd = pwd != "";
     std::string new_pwd = path_get_relative(pwd);
     std::string new_pwd_env = sformat("PWD=%s", new_pwd.c_str());
+    auto overriden = [&task](const char *env) {
+        for (auto &e : task->env)
+            if (is_prefix(e.substr(0, e.find('=') + 1), env))
+                return true;
+        return false;
+    };
     for (char **env = environ; *env; env++) {
+        if (overriden(*env)) {
+            continue;
+        }
         if (has_pwd && is_prefix("PWD=", *env)) {
             envp.push_back(new_pwd_env.c_str());
         }
@@ -106,8 +183,30 @@ static pid_t exec_task(ptask_t task) {
             envp.push_back(*env);
         }
     }
+    for (auto &e : task->env)
+        envp.push_back(e.c_str());
+    std::string hb_fd_env = sformat("%s=%d", PMGR_HB_ENV_FD, PMGR_HB_FD_NUMBER);
+    std::string hb_slot_env = sformat("%s=%d", PMGR_HB_ENV_SLOT, 0);
+    int hb_fd = task->hb_slot >= 0 ? hbeat_fd(task->hb_slot) : -1;
+    if (hb_fd >= 0) {
+        envp.push_back(hb_fd_env.c_str());
+        envp.push_back(hb_slot_env.c_str());
+    }
     envp.push_back(NULL);
 
+    /* each task gets it's own pipes, so it's output can be told apart from the others */
+    int out_pipe[2] = { -1, -1 };
+    int err_pipe[2] = { -1, -1 };
+    if (!cutstdio) {
+        ASSERT_FN(pipe2(out_pipe, O_CLOEXEC));
+        if (pipe2(err_pipe, O_CLOEXEC) < 0) {
+            DBGE("Failed to create the err pipe");
+            close(out_pipe[0]);
+            close(out_pipe[1]);
+            return -1;
+        }
+    }
+
     pid_t child_pid = fork();
 
     if (child_pid == 0) {
@@ -129,8 +228,16 @@ static pid_t exec_task(ptask_t task) {
             }
         }
         else {
-            dup2(redir_write_end, STDOUT_FILENO);
-            dup2(redir_write_end, STDERR_FILENO);
+            dup2(out_pipe[1], STDOUT_FILENO);
+            dup2(err_pipe[1], STDERR_FILENO);
+        }
+        if (hb_fd >= 0) {
+            /* dup2 drops the CLOEXEC flag, so only this copy is inherited */
+            if (dup2(hb_fd, PMGR_HB_FD_NUMBER) < 0) {
+                DBGE("Failed to pass the heartbeat memory");
+                kill(getpid(), SIGTERM);
+                exit(-1);
+            }
         }
         if (usr != "") {
             if (setgid(gid) < 0) {
@@ -170,7 +277,22 @@ static pid_t exec_task(ptask_t task) {
         }
     }
     else {
+        if (!cutstdio) {
+            close(out_pipe[1]);
+            close(err_pipe[1]);
+            if (child_pid < 0) {
+                close(out_pipe[0]);
+                close(err_pipe[0]);
+            }
+        }
         ASSERT_FN(child_pid);
+        if (!cutstdio) {
+            fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+            fcntl(err_pipe[0], F_SETFL, O_NONBLOCK);
+            new_outputs.push_back({task, child_pid, out_pipe[0], LOG_STREAM_OUT});
+            new_outputs.push_back({task, child_pid, err_pipe[0], LOG_STREAM_ERR});
+            new_outputs_sem.rel();
+        }
         return child_pid;
     }
     return 0;
@@ -192,6 +314,8 @@ static int kill_task(ptask_t task, bool force) {
     }
     else {
         ASSERT_FN(kill(task->o.pid, SIGTERM));
+        if (task->shed && (task->o.flags & PMGR_TASK_FLAG_SHEDFRZ))
+            kill(task->o.pid, SIGCONT); /* else it won't get to see the SIGTERM */
 
         task->o.state = PMGR_TASK_STATE_STOPING;
         task->dead_timer = START_DEAD_TIMER;
@@ -207,21 +331,86 @@ static void run_task(ptask_t task) {
         return ;
     if (task->removing)
         return ;
+    task->hb_slot = hbeat_slot(task->o.task_name);
     pid_t ret = exec_task(task);
     if (ret > 0) {
         task->o.pid = ret;
         task->o.state = PMGR_TASK_STATE_RUNNING;
+        hbeat_arm(task->hb_slot, ret);
         task->start_sem.rel();
         task->closed_sem = co::sem_t(0);
         pid2task[ret] = task;
+        task->start_us = now_real_us();
+        task->starts++;
         DBG("Started: %s[%ld]", task->o.task_name, task->o.pid);
-        trigger_event(PMGR_EVENT_TASK_START, task->o.task_name, task->o.pid);
+
+        pmgr2_msg_t fields;
+        fields.add_int(PMGR2_F_START_US, task->start_us);
+        fields.add_int(PMGR2_F_RESTARTS, task->starts - 1);
+        cmds_event(PMGR_EVENT_TASK_START, task->o.task_name, task->o.pid, &fields);
     }
     else if (HAS(tasks, task->o.task_name) && (task->o.flags & PMGR_TASK_FLAG_PERSIST)) {
         dead_tasks.push_back(task);
     }
 }
 
+static void shed_task(ptask_t task) {
+    if (task->shed || task->removing)
+        return ;
+    if (task->o.state != PMGR_TASK_STATE_RUNNING)
+        return ;
+    if (task->o.flags & PMGR_TASK_FLAG_SHEDFRZ) {
+        if (kill(task->o.pid, SIGSTOP) < 0) {
+            DBGE("Failed to freeze: %s[%ld]", task->o.task_name, task->o.pid);
+            return ;
+        }
+        DBG("Shed(frozen): %s[%ld]", task->o.task_name, task->o.pid);
+    }
+    else if (task->o.flags & PMGR_TASK_FLAG_SHEDSTOP) {
+        if (kill_task(task, false) < 0) {
+            DBG("Failed to stop: %s[%ld]", task->o.task_name, task->o.pid);
+            return ;
+        }
+        DBG("Shed(stopped): %s[%ld]", task->o.task_name, task->o.pid);
+    }
+    else {
+        return ;
+    }
+    task->shed = true;
+    cmds_event(PMGR_EVENT_TASK_SHED, task->o.task_name, task->o.pid);
+}
+
+static void unshed_task(ptask_t task) {
+    if (!task->shed)
+        return ;
+    task->shed = false;
+    if ((task->o.flags & PMGR_TASK_FLAG_SHEDFRZ) && task->o.state == PMGR_TASK_STATE_RUNNING) {
+        kill(task->o.pid, SIGCONT);
+        DBG("Unshed(resumed): %s[%ld]", task->o.task_name, task->o.pid);
+    }
+    else if (task->o.state == PMGR_TASK_STATE_STOPING) {
+        task->revive = true;
+    }
+    else if (!task->removing && HAS(tasks, task->o.task_name)) {
+        /* both stopped and held back tasks go trough the normal restart path */
+        dead_tasks.push_back(task);
+        DBG("Unshed(restart): %s", task->o.task_name);
+    }
+    cmds_event(PMGR_EVENT_TASK_UNSHED, task->o.task_name, task->o.pid);
+}
+
+void tasks_pressure(bool on) {
+    if (pressure_flag == on)
+        return ;
+    pressure_flag = on;
+    for (auto &[name, task] : tasks) {
+        if (on)
+            shed_task(task);
+        else
+            unshed_task(task);
+    }
+}
+
 /* start a task */
 int tasks_start(const std::string& task_name) {
     if (shutdown_flag) {
@@ -253,8 +442,40 @@ int tasks_stop(const std::string& task_name) {
     return 0;
 }
 
+int tasks_fail(const std::string& task_name) {
+    if (!HAS(tasks, task_name)) {
+        DBG("Task does not exist: %s", task_name.c_str());
+        return -1;
+    }
+    auto task = tasks[task_name];
+    DBG("Failed: %s[%ld]", task->o.task_name, task->o.pid);
+    cmds_event(PMGR_EVENT_TASK_UNHEALTHY, task->o.task_name, task->o.pid);
+    ASSERT_FN(kill_task(task, false));
+    return 0;
+}
+
+void tasks_watch_pid(pid_t pid) {
+    pid_waiters[pid] = std::make_shared<pid_waiter_t>();
+}
+
+co::task_t co_tasks_waitpid(pid_t pid, int *wstat) {
+    if (!HAS(pid_waiters, pid)) {
+        DBG("Pid[%d] is not watched", pid);
+        co_return -1;
+    }
+    auto waiter = pid_waiters[pid];
+    co_await waiter->exit_sem;
+    *wstat = waiter->wstat;
+    co_return 0;
+}
+
 /* add a task */
 int tasks_add(pmgr_task_t *msg) {
+    return tasks_add(msg, {}, {});
+}
+
+int tasks_add(pmgr_task_t *msg, const std::vector<std::string>& argv,
+        const std::vector<std::string>& env) {
     if (shutdown_flag) {
         DBG("Can't do that, shuting down...");
         return -1;
@@ -308,13 +529,28 @@ int tasks_add(pmgr_task_t *msg) {
         return -1;
     }
 
+    if (argv.size() && argv[0] == "") {
+        DBG("The program name must not be empty");
+        return -1;
+    }
+    for (auto &e : env) {
+        if (e.find('=') == std::string::npos || e[0] == '=') {
+            DBG("Invalid environment variable: %s", e.c_str());
+            return -1;
+        }
+    }
+
     /* This is here just to do the check */
     std::vector<std::string> args;
-    ASSERT_FN(ssplit_args(msg->task_path, args));
+    if (argv.empty()) {
+        ASSERT_FN(ssplit_args(msg->task_path, args));
+    }
 
     auto task = std::make_shared<pmgr_private_task_t>();
     tasks[msg->task_name] = task;
     task->o = *msg;
+    task->argv = argv;
+    task->env = env;
     task->o.p = (intptr_t)task.get();
     task->o.hdr.type = PMGR_MSG_ADD;
 
@@ -322,7 +558,7 @@ int tasks_add(pmgr_task_t *msg) {
     if (task->o.flags & PMGR_TASK_FLAG_AUTORUN)
         run_task(task);
     
-    trigger_event(PMGR_EVENT_TASK_ADD, task->o.task_name, task->o.pid);
+    cmds_event(PMGR_EVENT_TASK_ADD, task->o.task_name, task->o.pid);
     return 0;
 }
 
@@ -333,9 +569,12 @@ int tasks_rm(const std::string& task_name) {
         return -1;
     }
     auto task = tasks[task_name];
-    trigger_event(PMGR_EVENT_TASK_RM, task->o.task_name, task->o.pid);
+    cmds_event(PMGR_EVENT_TASK_RM, task->o.task_name, task->o.pid);
     task->start_sem.rel();
     tasks.erase(task_name);
+    metrics_rm(task_name);
+    hbeat_free(task_name);
+    out_limits.erase(task_name);
     return 0;
 }
 
@@ -355,6 +594,19 @@ int tasks_list(std::vector<pmgr_task_t>& list) {
     return 0;
 }
 
+void tasks_put_stats(const std::string& task_name, pmgr2_msg_t &msg) {
+    if (!HAS(tasks, task_name))
+        return ;
+    auto task = tasks[task_name];
+    if (task->starts)
+        msg.add_int(PMGR2_F_START_US, task->start_us);
+    msg.add_int(PMGR2_F_RESTARTS, std::max(task->starts - 1, int64_t(0)));
+    msg.add_int(PMGR2_F_EXIT, task->last_wstat);
+    msg.add_int(PMGR2_F_CPU, task->cpu);
+    msg.add_int(PMGR2_F_RSS, task->rss);
+    msg.add_int(PMGR2_F_OUT_RATE, task->out_rate);
+}
+
 bool tasks_exists(const std::string& task_name) {
     return HAS(tasks, task_name);
 }
@@ -411,14 +663,33 @@ static co::task_t co_handle_procs(int sigfd) {
                 DBG("%d continued\n", pid);
             }
 
+            if (closed_proc && HAS(pid_waiters, pid)) {
+                auto waiter = pid_waiters[pid];
+                pid_waiters.erase(pid);
+                waiter->wstat = wstat;
+                waiter->exit_sem.rel();
+                continue;
+            }
+            if (closed_proc && !HAS(pid2task, pid)) {
+                DBG("Unknown child exited: %d", pid);
+                continue;
+            }
+
             if (closed_proc) {
                 auto task = pid2task[pid];
 
                 pid2task.erase(pid);
+                hbeat_disarm(task->hb_slot);
                 task->closed_sem.rel();
                 task->o.state = PMGR_TASK_STATE_STOPPED;
+                task->last_wstat = wstat;
+                task->cpu_ticks = -1;
+                task->cpu = task->rss = task->out_rate = 0;
                 DBG("Stopped: %s[%ld]", task->o.task_name, task->o.pid);
-                trigger_event(PMGR_EVENT_TASK_STOP, task->o.task_name, task->o.pid);
+
+                pmgr2_msg_t fields;
+                fields.add_int(PMGR2_F_EXIT, wstat);
+                cmds_event(PMGR_EVENT_TASK_STOP, task->o.task_name, task->o.pid, &fields);
                 if ((task->o.flags & PMGR_TASK_FLAG_PERSIST) && !task->removing) {
                     dead_tasks.push_back(task);
                 }
@@ -433,6 +704,340 @@ static co::task_t co_handle_procs(int sigfd) {
     co_return 0;
 }
 
+bool out_limit_t::admit(uint64_t now_us, size_t len) {
+    double dt = last_us ? (now_us - last_us) / 1e6 : 0;
+    last_us = now_us;
+    if (cfg.bytes_s)
+        bytes = std::min<double>(cfg.burst_bytes, bytes + dt * cfg.bytes_s);
+    if (cfg.lines_s)
+        lines = std::min<double>(cfg.burst_lines, lines + dt * cfg.lines_s);
+
+    /* a line bigger than the burst can still pass, with a full bucket */
+    double cost = std::min<double>(len, cfg.burst_bytes);
+    if ((!cfg.bytes_s || bytes >= cost) && (!cfg.lines_s || lines >= 1)) {
+        if (cfg.bytes_s)
+            bytes -= cost;
+        if (cfg.lines_s)
+            lines -= 1;
+        return true;
+    }
+    if (cfg.sample && sample_cnt++ % cfg.sample == 0)
+        return true;
+    dropped_bytes += len;
+    dropped_lines++;
+    return false;
+}
+
+/* the limit of the task, if it has one */
+static std::shared_ptr<out_limit_t> get_out_limit(const std::string &name) {
+    if (HAS(out_limits, name))
+        return out_limits[name];
+    if (!HAS(cfg_get()->ratelims, name))
+        return nullptr;
+    auto lim = std::make_shared<out_limit_t>();
+    lim->cfg = cfg_get()->ratelims[name];
+    lim->bytes = lim->cfg.burst_bytes;
+    lim->lines = lim->cfg.burst_lines;
+    out_limits[name] = lim;
+    return lim;
+}
+
+/* the pipe can be full (slow disk, a task that floods), only the tasks that write wait for it */
+static co::task_t co_redir_write(const std::string& framed) {
+    co_await redir_write_sem;
+    FnScope scope([]{ redir_write_sem.rel(); });
+    co_return co_await co::write_sz(redir_write_end, framed.data(), framed.size());
+}
+
+/* DBG writes from any thread and blocks on a full pipe, so it's pipe is emptied by a thread that
+doesn't wait for the coroutines, and co_own_output writes the lines with co_redir_write */
+static void th_own_output() {
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    std::vector<char> buff(OUTPUT_MAX_LINE);
+    std::string partial;
+    while (true) {
+        ssize_t ret = read(own_read_end, buff.data(), buff.size());
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        partial.append(buff.data(), ret);
+
+        /* a line that doesn't end is cut as the ones of the tasks */
+        size_t len = partial.rfind('\n') + 1;
+        if (!len && partial.size() >= OUTPUT_MAX_LINE) {
+            partial.push_back('\n');
+            len = partial.size();
+        }
+        if (!len)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(own_mu);
+            own_lines.append(partial, 0, len);
+        }
+        partial.erase(0, len);
+        uint64_t one = 1;
+        (void)!write(own_efd, &one, sizeof(one));
+    }
+    if (partial.size()) {
+        std::lock_guard<std::mutex> lock(own_mu);
+        own_lines.append(partial + "\n");
+    }
+}
+
+static co::task_t co_own_output() {
+    while (true) {
+        uint64_t cnt;
+        ASSERT_COFN(co_await co::read(own_efd, &cnt, sizeof(cnt)));
+        std::string lines;
+        {
+            std::lock_guard<std::mutex> lock(own_mu);
+            lines.swap(own_lines);
+        }
+        /* no DBG on failure, it would only add to what can't be written */
+        if (lines.size() && co_await co_redir_write(lines) < 0)
+            continue;
+    }
+    co_return 0;
+}
+
+int tasks_own_output_init(int read_end) {
+    own_read_end = read_end;
+    ASSERT_FN(own_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    own_th = std::thread(th_own_output);
+    return 0;
+}
+
+void tasks_own_output_uninit(int write_end) {
+    if (own_th.joinable())
+        own_th.join();
+    std::lock_guard<std::mutex> lock(own_mu);
+    /* the coroutines are done, nothing else writes the pipe now */
+    if (own_lines.size())
+        write_sz(write_end, own_lines.data(), own_lines.size());
+    own_lines.clear();
+    close(own_read_end);
+    close(own_efd);
+}
+
+/* Reads the output of a task in batches and re-frames it line by line, such that it can be told
+apart from the output of the other tasks. Ends when all the write ends are closed, which may be
+after the task itself is gone if it left children behind. Lines over the task's rate limit are
+dropped here and replaced by a "suppressed" record every OUTPUT_MARKER_US. */
+static co::task_t co_task_output(task_output_t out) {
+    FnScope scope([fd = out.fd]{ close(fd); });
+
+    std::string name = out.task->o.task_name;
+    std::vector<char> buff(OUTPUT_BATCH_SZ);
+    std::string partial;
+    bool split = false;     /* the start of the line in partial was already emitted */
+    std::string framed;
+    auto lim = get_out_limit(name);
+
+    auto is_live = [&out, &name]{ return HAS(tasks, name) && tasks[name] == out.task; };
+    const char *bytes_metric = out.stream == LOG_STREAM_OUT ? "out_bytes" : "err_bytes";
+    const char *lines_metric = out.stream == LOG_STREAM_OUT ? "out_lines" : "err_lines";
+
+    uint64_t ts_us = 0;
+    int64_t lines = 0;
+    auto emit = [&](const char *line, size_t len) {
+        lines++;
+        if (lim && !lim->admit(ts_us, len + 1))
+            return ;
+        logfmt_append(framed, ts_us, name, out.pid, out.stream, line, len);
+    };
+    /* a line is never longer than OUTPUT_MAX_LINE in a record, an empty one is still a record */
+    auto emit_split = [&](const char *line, size_t len) {
+        do {
+            size_t n = std::min(len, (size_t)OUTPUT_MAX_LINE);
+            emit(line, n);
+            line += n;
+            len -= n;
+        } while (len);
+    };
+    auto emit_suppressed = [&](bool force) {
+        if (!lim || !lim->dropped_lines)
+            return ;
+        if (!force && ts_us - lim->last_marker_us < OUTPUT_MARKER_US)
+            return ;
+        std::string marker = sformat("[procmgr] suppressed %ld lines, %ld bytes",
+                lim->dropped_lines, lim->dropped_bytes);
+        logfmt_append(framed, ts_us, name, out.pid, out.stream, marker.data(), marker.size());
+        if (is_live()) {
+            metrics_add(name, "dropped_lines", lim->dropped_lines);
+            metrics_add(name, "dropped_bytes", lim->dropped_bytes);
+        }
+        lim->dropped_lines = 0;
+        lim->dropped_bytes = 0;
+        lim->last_marker_us = ts_us;
+    };
+
+    while (true) {
+        ssize_t ret = co_await co::read(out.fd, buff.data(), buff.size());
+        if (ret <= 0)
+            break;
+
+        ts_us = logfmt_now_us();
+        lines = 0;
+        framed.clear();
+
+        char *p = buff.data();
+        char *end = p + ret;
+        while (p < end) {
+            char *nl = (char *)memchr(p, '\n', end - p);
+            if (!nl) {
+                /* the whole chunks go now, the rest waits for the end of the line */
+                partial.append(p, end - p);
+                size_t done = partial.size() - partial.size() % OUTPUT_MAX_LINE;
+                for (size_t off = 0; off < done; off += OUTPUT_MAX_LINE)
+                    emit(partial.data() + off, OUTPUT_MAX_LINE);
+                partial.erase(0, done);
+                split |= done > 0;
+                break;
+            }
+            if (partial.size()) {
+                partial.append(p, nl - p);
+                emit_split(partial.data(), partial.size());
+                partial.clear();
+            }
+            else if (!split || nl > p) {
+                emit_split(p, nl - p);
+            }
+            split = false;
+            p = nl + 1;
+        }
+        emit_suppressed(false);
+
+        if (framed.size() && co_await co_redir_write(framed) < 0) {
+            DBG("Failed to write the output of %s", name.c_str());
+            break;
+        }
+        if (is_live()) {
+            metrics_add(name, bytes_metric, ret);
+            metrics_add(name, lines_metric, lines);
+        }
+    }
+
+    framed.clear();
+    ts_us = logfmt_now_us();
+    lines = 0;
+    if (partial.size())
+        emit_split(partial.data(), partial.size());
+    emit_suppressed(true);
+    if (framed.size())
+        co_await co_redir_write(framed);
+    if (lines && is_live())
+        metrics_add(name, lines_metric, lines);
+    co_return 0;
+}
+
+static co::task_t co_task_outputs() {
+    while (true) {
+        co_await new_outputs_sem;
+
+        auto outputs = new_outputs;
+        new_outputs.clear();
+        for (auto &out : outputs)
+            co_await co::sched(co_task_output(out));
+    }
+    co_return 0;
+}
+
+/* cpu time in ticks and rss in pages, from /proc/<pid>/stat */
+static int read_proc_stat(pid_t pid, int64_t &ticks, int64_t &rss) {
+    char path[64];
+    char buff[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1; /* it may have just exited */
+    int len = read(fd, buff, sizeof(buff) - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    buff[len] = 0;
+
+    /* the name can have spaces and parantheses in it, so start after the last ')' */
+    char *p = strrchr(buff, ')');
+    if (!p)
+        return -1;
+    unsigned long utime, stime;
+    long pages;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d "
+            "%*u %*u %ld", &utime, &stime, &pages) != 3)
+        return -1;
+    ticks = utime + stime;
+    rss = pages;
+    return 0;
+}
+
+static bool stat_moved(int64_t sent, int64_t now, int64_t min) {
+    if ((sent == 0) != (now == 0))
+        return true;
+    return std::abs(now - sent) >= std::max(min, std::abs(sent) / 16);
+}
+
+/* Samples the running tasks and sends the stats of those that moved enough, all in one event per
+period, so the listeners get at most one frame each stats_ms. The sampling itself still reads the
+/proc stat of each running task, but only while someone listens to PMGR_EVENT_TASK_STATS. */
+static co::task_t co_task_stats() {
+    const int64_t tick_us = 1000'000 / sysconf(_SC_CLK_TCK);
+    const int64_t page_sz = sysconf(_SC_PAGESIZE);
+    uint64_t last_us = 0;
+
+    while (true) {
+        co_await co::sleep_ms(cfg_get()->stats_ms);
+        if (!cmds_has_listeners(PMGR_EVENT_TASK_STATS)) {
+            last_us = 0;
+            continue;
+        }
+
+        uint64_t now_us = logfmt_now_us();
+        int64_t dt_us = now_us - last_us;
+        bool first = last_us == 0;
+        last_us = now_us;
+
+        pmgr2_msg_t fields;
+        for (auto &[pid, task] : pid2task) {
+            int64_t ticks, pages;
+            if (read_proc_stat(pid, ticks, pages) < 0)
+                continue;
+            std::string name = task->o.task_name;
+            int64_t out_bytes = metrics_ref(name, "out_bytes") + metrics_ref(name, "err_bytes");
+
+            int64_t prev_ticks = task->cpu_ticks;
+            int64_t prev_out = task->out_bytes;
+            task->cpu_ticks = ticks;
+            task->out_bytes = out_bytes;
+            if (first || prev_ticks < 0 || dt_us <= 0)
+                continue;
+
+            int64_t cpu = (ticks - prev_ticks) * tick_us * 1000 / dt_us;
+            int64_t rss = pages * page_sz;
+            int64_t out_rate = (out_bytes - prev_out) * 1000'000 / dt_us;
+            if (!stat_moved(task->cpu, cpu, STATS_MIN_CPU) &&
+                    !stat_moved(task->rss, rss, STATS_MIN_RSS) &&
+                    !stat_moved(task->out_rate, out_rate, STATS_MIN_RATE))
+                continue;
+            task->cpu = cpu;
+            task->rss = rss;
+            task->out_rate = out_rate;
+
+            fields.add_str(PMGR2_F_NAME, name);
+            fields.add_int(PMGR2_F_PID, pid);
+            fields.add_int(PMGR2_F_CPU, cpu);
+            fields.add_int(PMGR2_F_RSS, rss);
+            fields.add_int(PMGR2_F_OUT_RATE, out_rate);
+        }
+        if (fields.fields.size())
+            cmds_event(PMGR_EVENT_TASK_STATS, "", 0, &fields);
+    }
+    co_return 0;
+}
+
 co::task_t co_shutdown() {
     if (shutdown_flag) {
         DBG("Double shutdown!?");
@@ -482,12 +1087,21 @@ co::task_t co_tasks_waitrm(const std::string& task_name) {
     task->removing = true;
     ASSERT_COFN(co_await co_tasks_waitstop(task_name))
     tasks.erase(task_name);
+    metrics_rm(task_name);
+    hbeat_free(task_name);
+    out_limits.erase(task_name);
     co_return 0;
 }
 
 /* This coroutine handles tasks, their starting/stopping/etc. */
 co::task_t co_tasks(int _redir_write_end) {
-    redir_write_end = _redir_write_end;
+    /* our own description of the pipe, non blocking, as stdout and stderr share the other one */
+    std::string redir_path = sformat("/proc/self/fd/%d", _redir_write_end);
+    redir_write_end = open(redir_path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (redir_write_end < 0) {
+        DBGE("Failed to reopen the redirect pipe, the output of the tasks may block procmgr");
+        redir_write_end = _redir_write_end;
+    }
     int sigfd;
     sigset_t mask;
 
@@ -497,6 +1111,9 @@ co::task_t co_tasks(int _redir_write_end) {
     ASSERT_ECOFN(sigfd = signalfd(-1, &mask, SFD_CLOEXEC));
 
     co_await co::sched(co_handle_procs(sigfd));
+    co_await co::sched(co_task_outputs());
+    co_await co::sched(co_own_output());
+    co_await co::sched(co_task_stats());
 
     while (true) {
         co_await co::sleep_s(1);
@@ -505,6 +1122,14 @@ co::task_t co_tasks(int _redir_write_end) {
             auto save_dt = dead_tasks;
             dead_tasks.clear();
             for (auto &t : save_dt) {
+                if (t->shed)
+                    continue; /* will be pushed back here when the pressure goes away */
+                if (pressure_flag && (t->o.flags & PMGR_TASK_FLAG_LOWPRIO)) {
+                    t->shed = true;
+                    DBG("Shed(held): %s", t->o.task_name);
+                    cmds_event(PMGR_EVENT_TASK_SHED, t->o.task_name, t->o.pid);
+                    continue;
+                }
                 run_task(t);
             }
         }
@@ -7,13 +7,40 @@
 int tasks_start(const std::string& task_name);
 int tasks_stop(const std::string& task_name);
 int tasks_add(pmgr_task_t *task);
+
+/* the argv replaces the task_path when the task is executed (the path is kept for display) and the
+env entries ("NAME=value") are added over the environment of procmgr */
+int tasks_add(pmgr_task_t *task, const std::vector<std::string>& argv,
+        const std::vector<std::string>& env);
 int tasks_rm(const std::string& task_name);
 int tasks_list(std::vector<pmgr_task_t>& list);
 
+/* the task is stopped, it's restart policy decides if it will be started again */
+int tasks_fail(const std::string& task_name);
+
+/* children that are not tasks (probes, etc.) are reaped by the tasks coroutine, so they need to be
+registered right after fork and then waited with co_tasks_waitpid */
+void tasks_watch_pid(pid_t pid);
+co::task_t co_tasks_waitpid(pid_t pid, int *wstat);
+
+/* called when the system enters or leaves pressure, sheds or restores the tasks that allow it */
+void tasks_pressure(bool on);
+
+struct pmgr2_msg_t;
+
+/* adds the stats of the task (start time, restarts, last exit, cpu, rss, output rate) to msg */
+void tasks_put_stats(const std::string& task_name, pmgr2_msg_t &msg);
+
 bool tasks_exists(const std::string& task_name);
 int tasks_get(pid_t pid, pmgr_task_t *task);
 int tasks_get(std::string name, pmgr_task_t *task);
 
+/* procmgr's own output (stdout, stderr) is read from read_end and written to the redirect pipe
+between the records of the tasks, uninit is called once it's write ends are closed and the
+coroutines are done, it writes what was left directly to write_end */
+int tasks_own_output_init(int read_end);
+void tasks_own_output_uninit(int write_end);
+
 co::task_t co_tasks(int redir_write_end);
 co::task_t co_tasks_clear();
 co::task_t co_shutdown();
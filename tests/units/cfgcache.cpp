@@ -0,0 +1,118 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <limits.h>
+
+#include "units.h"
+#include "cfg.h"
+
+#define CACHE_PATH CONFIG_PATH ".cache"
+#define CHILD_OUT_FD 3      /* where ./units cfg_read says what it got, stdout has the logs */
+
+/* the config has one task, the files of two names of the same length have the same size */
+static void write_cfg(const char *task, int64_t mtime_s = 0) {
+    std::string data = sformat(R"({
+        "sock_path": "./units.sock", "sock_perm": "0666", "conf_dir": "./units.none",
+        "tasks": [{
+            "name": "%s", "path": "/bin/true", "heartbeat_ms": 100,
+            "probe": { "type": "tcp", "target": "8080", "interval_ms": 10, "timeout_ms": 5,
+                    "failures": 2 },
+            "rate_limit": { "bytes_s": 1000, "lines_s": 10 }
+        }]
+    })", task);
+    int fd = open(CONFIG_PATH, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    TEST(fd >= 0 && write(fd, data.data(), data.size()) == (ssize_t)data.size());
+    close(fd);
+    if (mtime_s) {
+        struct timespec ts[2] = { { .tv_sec = mtime_s }, { .tv_sec = mtime_s } };
+        TEST(utimensat(AT_FDCWD, CONFIG_PATH, ts, 0) == 0);
+    }
+}
+
+/* what cfg_read got, the task and it's options as they came from the file or the cache */
+static std::string cfg_got() {
+    auto c = cfg_get();
+    if (c->tasks.size() != 1)
+        return "";
+    std::string name = c->tasks[0].task_name;
+    return sformat("%s %s %d %ld %ld", name.c_str(), c->probes[name].target.c_str(),
+            c->heartbeats[name], c->ratelims[name].bytes_s, c->ratelims[name].burst_bytes);
+}
+
+static std::string cfg_read_here() {
+    return cfg_read() < 0 ? "error" : cfg_got();
+}
+
+int cfg_read_child() {
+    std::string got = cfg_read_here();
+    return write_sz(CHILD_OUT_FD, got.data(), got.size()) < 0 ? -1 : 0;
+}
+
+/* the same, in a new process (./units cfg_read), that has only the cache on disk */
+static std::string cfg_read_fresh() {
+    char exe[PATH_MAX] = {};
+    int fds[2];
+    if (readlink("/proc/self/exe", exe, sizeof(exe) - 1) < 0 || pipe(fds) < 0)
+        return "error";
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], CHILD_OUT_FD);
+        execl(exe, exe, "cfg_read", NULL);
+        _exit(-1);
+    }
+    close(fds[1]);
+    char buff[256] = {};
+    (void)!read(fds[0], buff, sizeof(buff) - 1);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return buff;
+}
+
+static ino_t cache_ino() {
+    struct stat st;
+    return stat(CACHE_PATH, &st) < 0 ? 0 : st.st_ino;
+}
+
+void test_cfg_cache() {
+    unlink(CACHE_PATH);
+    int64_t t0 = time(NULL) - 100;
+
+    write_cfg("one", t0);
+    TEST(cfg_read_here() == "one 8080 100 1000 1000");
+    TEST(cache_ino() != 0);
+
+    /* same mtime and size, the cached parse is used, from memory or from the disk, even if the
+    content changed */
+    write_cfg("two", t0);
+    TEST(cfg_read_here() == "one 8080 100 1000 1000");
+    TEST(cfg_read_fresh() == "one 8080 100 1000 1000");
+
+    /* a cut cache or one that is not a cache is ignored */
+    ino_t ino = cache_ino();
+    TEST(truncate(CACHE_PATH, file_size(CACHE_PATH) - 1) == 0);
+    TEST(cfg_read_fresh() == "two 8080 100 1000 1000");
+    TEST(cache_ino() != ino);           /* and made again */
+    int fd = open(CACHE_PATH, O_WRONLY);
+    TEST(fd >= 0 && write(fd, "PMGRCFG0", 8) == 8);
+    close(fd);
+    write_cfg("one", t0);
+    TEST(cfg_read_fresh() == "one 8080 100 1000 1000");
+
+    /* another mtime or another size, the file is read again and the hash differs */
+    write_cfg("two", t0 + 1);
+    TEST(cfg_read_here() == "two 8080 100 1000 1000");
+    write_cfg("three", t0 + 1);
+    TEST(cfg_read_here() == "three 8080 100 1000 1000");
+
+    /* only touched, the hash matches and the cache is saved with the new mtime */
+    ino = cache_ino();
+    write_cfg("three", t0 + 2);
+    TEST(cfg_read_here() == "three 8080 100 1000 1000");
+    TEST(cache_ino() != ino);
+    write_cfg("seven", t0 + 2);
+    TEST(cfg_read_fresh() == "three 8080 100 1000 1000");
+
+    unlink(CONFIG_PATH);
+    unlink(CACHE_PATH);
+}
@@ -0,0 +1,84 @@
+#include <string>
+
+#include "units.h"
+#include "lzblk.h"
+
+/* compresses and decompresses src, true if it came back as it was */
+static bool round_trip(const std::string &src, int64_t *zlen = NULL) {
+    std::vector<char> z(lzblk_bound(src.size()));
+    int64_t ret = lzblk_compress(src.data(), src.size(), z.data(), z.size());
+    if (zlen)
+        *zlen = ret;
+    if (ret < 0)
+        return false;
+    std::string raw(src.size(), 0);
+    return lzblk_decompress(z.data(), ret, raw.data(), raw.size()) == 0 && raw == src;
+}
+
+static std::string log_text(size_t len) {
+    std::string ret;
+    for (int i = 0; ret.size() < len; i++)
+        ret += sformat("[%d][task.%d:%d:out] request %d done in %d us\n", 1000 + i * 17, i % 5,
+                100 + i % 5, i, (i * 7919) % 1000);
+    ret.resize(len);
+    return ret;
+}
+
+static std::string random_bytes(size_t len, uint32_t seed) {
+    std::string ret(len, 0);
+    for (auto &c : ret) {
+        seed = seed * 1103515245 + 12345;
+        c = seed >> 16;
+    }
+    return ret;
+}
+
+void test_lzblk() {
+    /* log lines, around the sizes where matches are allowed, and long runs that need the 255
+    extensions and matches that overlap what they write */
+    for (size_t len : { 1, 4, 12, 13, 17, 100, 4096, 65536 })
+        TEST(round_trip(log_text(len)));
+    int64_t zlen;
+    TEST(round_trip(log_text(65536), &zlen) && zlen < 65536 / 2);
+    TEST(round_trip(std::string(100000, 'x'), &zlen) && zlen < 1000);
+    TEST(round_trip("ab" + std::string(5000, 'a') + random_bytes(300, 1) + std::string(20, 'b')));
+
+    /* an empty block is only a token, data that doesn't compress stays under the bound */
+    TEST(round_trip("", &zlen) && zlen == 1);
+    std::string noise = random_bytes(65536, 2);
+    TEST(round_trip(noise, &zlen) && zlen >= 65536 && zlen <= (int64_t)lzblk_bound(65536));
+
+    /* a destination that is too small */
+    std::vector<char> z(lzblk_bound(noise.size()));
+    TEST(lzblk_compress(noise.data(), noise.size(), z.data(), noise.size() / 2) == -1);
+    TEST(lzblk_compress("abc", 3, z.data(), 2) == -1);
+
+    /* corrupted input fails, and nothing is written past raw_len */
+    std::string src = log_text(8192);
+    zlen = lzblk_compress(src.data(), src.size(), z.data(), z.size());
+    TEST(zlen > 0);
+    if (zlen <= 0)
+        return ;
+    std::vector<char> raw(src.size() + 64, 0x5a);
+    auto guard_ok = [&raw, &src]{
+        for (size_t i = src.size(); i < raw.size(); i++)
+            if (raw[i] != 0x5a)
+                return false;
+        return true;
+    };
+    for (int64_t cut = 0; cut < zlen; cut++)
+        TEST(lzblk_decompress(z.data(), cut, raw.data(), src.size()) == -1);
+    TEST(lzblk_decompress(z.data(), zlen, raw.data(), src.size() - 1) == -1);
+    TEST(lzblk_decompress(z.data(), zlen, raw.data(), src.size() + 1) == -1);
+    int bad = 0;
+    for (int64_t i = 0; i < zlen; i++) {
+        std::vector<char> broken(z.begin(), z.begin() + zlen);
+        broken[i] ^= 1 + i % 255;
+        int ret = lzblk_decompress(broken.data(), zlen, raw.data(), src.size());
+        bad += ret < 0;
+        TEST(ret <= 0 && guard_ok());
+    }
+    TEST(bad > 0);
+    TEST(lzblk_decompress(z.data(), zlen, raw.data(), src.size()) == 0 &&
+            std::string(raw.data(), src.size()) == src && guard_ok());
+}
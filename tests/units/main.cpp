@@ -0,0 +1,32 @@
+#include "units.h"
+#include "logfile.h"
+
+int failed = 0;
+
+int main(int argc, char const *argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "cfg_read")
+        return cfg_read_child();
+    if (logfile_init() < 0)
+        return -1;
+
+    test_topics();
+    test_ring();
+    test_ring_broken();
+    test_msgbuf();
+    test_retain();
+    test_pmgr2();
+    test_logfile();
+    test_logring();
+    test_logstore();
+    test_lzblk();
+    test_cfg_cache();
+    logfile_uninit();
+
+    if (failed) {
+        DBG("%d checks failed", failed);
+        return -1;
+    }
+    DBG("All good");
+    return 0;
+}
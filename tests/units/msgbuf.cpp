@@ -0,0 +1,45 @@
+#include "units.h"
+#include "msgbuf.h"
+
+void test_msgbuf() {
+    msgbuf_t *first;
+    {
+        msgbuf_p a = msgbuf_get(100);
+        TEST(a && a.size() == 100 && a.b->cap == 256);
+        first = a.b;
+        msgbuf_p b = a;
+        TEST(a.b->refs == 2);
+        b.reset();
+        TEST(a.b->refs == 1);
+    }
+    /* the same size class comes back from the pool */
+    msgbuf_p c = msgbuf_get(200);
+    TEST(c.b == first && c.size() == 200);
+    msgbuf_p d = msgbuf_get(257);
+    TEST(d.b->cap == 512);
+    msgbuf_p big = msgbuf_get((1 << MSGBUF_MAX_SHIFT) + 1);
+    TEST(big && big.b->cls == -1);
+
+    const char part1[] = "hello ", part2[] = "world";
+    struct iovec iov[2] = {
+        { .iov_base = (void *)part1, .iov_len = strlen(part1) },
+        { .iov_base = (void *)part2, .iov_len = strlen(part2) + 1 },
+    };
+    msgbuf_p e = msgbuf_get(iov, 2);
+    TEST(e.size() == 12 && !strcmp((char *)e.data(), "hello world"));
+
+    /* the fifo keeps it's order while it wraps and grows */
+    msgq_t<int> q;
+    int next_in = 0, next_out = 0;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 20 + round; i++)
+            q.push_back(next_in++);
+        for (int i = 0; i < 15; i++) {
+            TEST(q.front() == next_out++);
+            q.pop_front();
+        }
+    }
+    TEST(q.size() == (size_t)(next_in - next_out));
+    for (size_t i = 0; i < q.size(); i++)
+        TEST(q.at(i) == next_out + (int)i);
+}
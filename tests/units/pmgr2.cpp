@@ -0,0 +1,51 @@
+#include "units.h"
+#include "pmgr2.h"
+
+void test_pmgr2() {
+    for (uint64_t v : { 0ull, 1ull, 127ull, 128ull, 300ull, 1ull << 35, ~0ull }) {
+        std::string s;
+        pmgr2_put_varint(s, v);
+        uint64_t got;
+        TEST(pmgr2_get_varint(s.data(), s.size(), got) == (int)s.size() && got == v);
+        TEST(pmgr2_get_varint(s.data(), s.size() - 1, got) == 0);  /* truncated */
+    }
+    std::string endless(10, (char)0x80);
+    uint64_t got;
+    TEST(pmgr2_get_varint(endless.data(), endless.size(), got) == -1);
+
+    for (int64_t v : std::vector<int64_t>{ 0, 1, -1, 63, -64, INT64_MAX, INT64_MIN })
+        TEST(pmgr2_unzigzag(pmgr2_zigzag(v)) == v);
+    TEST(pmgr2_zigzag(-1) == 1 && pmgr2_zigzag(1) == 2);
+
+    pmgr2_msg_t msg(PMGR_MSG_ADD, 42);
+    msg.add_str(PMGR2_F_NAME, "task").add_int(PMGR2_F_PID, -7)
+            .add_str(PMGR2_F_ARG, "a").add_str(PMGR2_F_ARG, std::string("b\0c", 3))
+            .add_int(100, INT64_MIN);                   /* unknown ids are kept */
+    std::string frame = msg.encode();
+    uint64_t len;
+    int hlen = pmgr2_get_varint(frame.data(), frame.size(), len);
+    TEST(hlen > 0 && hlen + len == frame.size());
+
+    pmgr2_msg_t dec;
+    TEST(dec.decode(frame.data() + hlen, len) == 0);
+    TEST(dec.type() == PMGR_MSG_ADD && dec.req_id() == 42);
+    TEST(dec.get_str(PMGR2_F_NAME) == "task" && dec.get_int(PMGR2_F_PID) == -7);
+    TEST(dec.get_strs(PMGR2_F_ARG) == std::vector<std::string>({ "a", std::string("b\0c", 3) }));
+    TEST(dec.get_int(100) == INT64_MIN && dec.get_int(PMGR2_F_NAME, 5) == 5);
+
+    /* a body cut anywhere fails, or has only the fields before the cut */
+    for (size_t cut = 0; cut < len; cut++) {
+        pmgr2_msg_t part;
+        int ret = part.decode(frame.data() + hlen, cut);
+        TEST(ret == -1 || part.fields.size() < msg.fields.size());
+    }
+    std::string bad_wire;
+    pmgr2_put_varint(bad_wire, PMGR2_F_NAME << 3 | 5);
+    pmgr2_put_varint(bad_wire, 1);
+    TEST(dec.decode(bad_wire.data(), bad_wire.size()) == -1);
+    std::string long_str;
+    pmgr2_put_varint(long_str, PMGR2_F_NAME << 3 | PMGR2_WIRE_BYTES);
+    pmgr2_put_varint(long_str, 100);
+    long_str += "short";
+    TEST(dec.decode(long_str.data(), long_str.size()) == -1);
+}
@@ -0,0 +1,66 @@
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "units.h"
+#include "retain.h"
+
+static msgbuf_p retain_msg(size_t len, uint8_t seed) {
+    auto msg = test_msg(len, seed);
+    struct iovec iov = { .iov_base = msg.data(), .iov_len = msg.size() };
+    return msgbuf_get(&iov, 1);
+}
+
+void test_retain() {
+    /* trimmed by count, then by bytes */
+    retain_t r;
+    r.max_msgs = 3;
+    r.max_bytes = 1000;
+    for (int i = 0; i < 5; i++)
+        retain_push(&r, retain_msg(100, i));
+    TEST(r.msgs.size() == 3 && r.msgs.front().seq == 3 && r.bytes == 300);
+    retain_push(&r, retain_msg(850, 5));
+    TEST(r.msgs.size() == 2 && r.msgs.front().seq == 5 && r.bytes == 950);
+    retain_push(&r, retain_msg(2000, 6));              /* never fits, not kept */
+    TEST(r.msgs.size() == 2 && r.next_seq == 7);
+
+    /* persisted, then loaded back as it was */
+    char dir[] = "/tmp/pmgr_units_XXXXXX";
+    TEST(mkdtemp(dir) != NULL);
+    std::string path = std::string(dir) + "/" + retain_file_name("units.chan");
+    {
+        retain_t p;
+        p.max_msgs = 10;
+        p.max_bytes = 64 * 1024;
+        retain_push(&p, retain_msg(100, 0));
+        TEST(retain_persist(&p, path, "units.chan") == 0);
+        for (int i = 1; i < 15; i++)
+            retain_push(&p, retain_msg(1000 + i, i));
+        TEST(p.msgs.size() == 10 && p.msgs.front().seq == 6);
+    }
+    retain_file_hdr_t fhdr;
+    TEST(retain_read_hdr(path, &fhdr) == 0 && !strcmp(fhdr.chan_name, "units.chan"));
+    retain_p l = retain_load(path, fhdr);
+    TEST(l && l->msgs.size() == 10 && l->next_seq == 16 && l->msgs.front().seq == 6);
+    if (l) {
+        for (size_t i = 0; i < l->msgs.size(); i++) {
+            auto want = retain_msg(1000 + 5 + i, 5 + i);
+            TEST(l->msgs.at(i).buf.size() == want.size() &&
+                    !memcmp(l->msgs.at(i).buf.data(), want.data(), want.size()));
+        }
+        /* and it goes on where it was */
+        retain_push(l.get(), retain_msg(100, 0));
+        TEST(l->msgs.size() == 10 && l->msgs.at(9).seq == 16);
+    }
+    l.reset();
+
+    /* a file that was cut or that is not a retention */
+    TEST(truncate(path.c_str(), retain_file_size(fhdr.ring_size) - 1) == 0);
+    TEST(retain_read_hdr(path, &fhdr) == 0 && !retain_load(path, fhdr));
+    int fd = open(path.c_str(), O_WRONLY);
+    uint64_t bad_magic = 0;
+    TEST(fd >= 0 && pwrite(fd, &bad_magic, sizeof(bad_magic), 0) == sizeof(bad_magic));
+    close(fd);
+    TEST(retain_read_hdr(path, &fhdr) < 0);
+    unlink(path.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <sys/eventfd.h>
+
+#include "units.h"
+#include "pmgrring.h"
+
+struct ring_pair_t {
+    void *mem = NULL;
+    pmgr_ring_t prod;
+    pmgr_ring_t cons;
+
+    ring_pair_t(uint32_t size) {
+        mem = aligned_alloc(64, PMGR_RING_SHM_SIZE(size));
+        memset(mem, 0, PMGR_RING_SHM_SIZE(size));
+        int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        pmgr_ring_init(prod, mem, size, 0, efd);
+        pmgr_ring_init(cons, mem, size, 0, efd);
+    }
+    ~ring_pair_t() {
+        close(prod.efd);
+        free(mem);
+    }
+};
+
+void test_ring() {
+    TEST(pmgr_ring_round_size(0) == PMGR_RING_DEF_SZ);
+    TEST(pmgr_ring_round_size(1) == PMGR_RING_MIN_SZ);
+    TEST(pmgr_ring_round_size(PMGR_RING_MIN_SZ + 1) == 2 * PMGR_RING_MIN_SZ);
+    TEST(pmgr_ring_round_size(~0u) == PMGR_RING_MAX_SZ);
+
+    /* odd sizes, so the messages end anywhere and some of them wrap */
+    ring_pair_t rp(PMGR_RING_MIN_SZ);
+    int wrapped = 0;
+    uint8_t seed = 0;
+    for (int i = 0; i < 2000; i++) {
+        auto msg = test_msg(3000 + (i * 37) % 5000, seed++);
+        struct iovec in = { .iov_base = msg.data(), .iov_len = msg.size() };
+        TEST(pmgr_ring_push(rp.prod, &in, 1) == (int64_t)msg.size());
+
+        struct iovec out[2];
+        int64_t len = pmgr_ring_peek(rp.cons, out);
+        TEST(len == (int64_t)msg.size());
+        if (len != (int64_t)msg.size())
+            return ;
+        wrapped += out[1].iov_len > 0;
+        std::vector<uint8_t> got;
+        for (auto &part : out) {
+            auto p = (uint8_t *)part.iov_base;
+            got.insert(got.end(), p, p + part.iov_len);
+        }
+        TEST(got == msg);
+        pmgr_ring_pop(rp.cons, len);
+    }
+    TEST(wrapped > 0);
+    struct iovec out[2];
+    TEST(pmgr_ring_peek(rp.cons, out) == 0);
+
+    /* full, then space again after a pop */
+    auto msg = test_msg(64 * 1024, 1);
+    struct iovec in = { .iov_base = msg.data(), .iov_len = msg.size() };
+    int pushed = 0;
+    while (pmgr_ring_push(rp.prod, &in, 1) > 0)
+        pushed++;
+    TEST(pushed == PMGR_RING_MIN_SZ / (64 * 1024));
+    TEST(pmgr_ring_push(rp.prod, &in, 1) == 0);
+    TEST(pmgr_ring_peek(rp.cons, out) == (int64_t)msg.size());
+    pmgr_ring_pop(rp.cons, msg.size());
+    TEST(pmgr_ring_push(rp.prod, &in, 1) == (int64_t)msg.size());
+
+    /* what can never fit */
+    auto big = test_msg(PMGR_RING_MIN_SZ + 8, 0);
+    struct iovec big_in = { .iov_base = big.data(), .iov_len = big.size() };
+    TEST(pmgr_ring_push(rp.prod, &big_in, 1) == -1);
+    pmgr_hdr_t small{};
+    struct iovec small_in = { .iov_base = &small, .iov_len = sizeof(small) - 1 };
+    TEST(pmgr_ring_push(rp.prod, &small_in, 1) == -1);
+}
+
+void test_ring_broken() {
+    struct iovec out[2];
+    {
+        /* a tail too far ahead or not aligned */
+        ring_pair_t rp(PMGR_RING_MIN_SZ);
+        rp.cons.hdr->tail = PMGR_RING_MIN_SZ + PMGR_RING_ALIGN;
+        TEST(pmgr_ring_peek(rp.cons, out) == -1);
+        rp.cons.hdr->tail = 12;
+        TEST(pmgr_ring_peek(rp.cons, out) == -1);
+    }
+    {
+        /* a message bigger than what was pushed, or smaller than it's header */
+        ring_pair_t rp(PMGR_RING_MIN_SZ);
+        auto msg = test_msg(64, 0);
+        struct iovec in = { .iov_base = msg.data(), .iov_len = msg.size() };
+        TEST(pmgr_ring_push(rp.prod, &in, 1) == 64);
+        ((pmgr_hdr_t *)rp.cons.data)->size = 128;
+        TEST(pmgr_ring_peek(rp.cons, out) == -1);
+        ((pmgr_hdr_t *)rp.cons.data)->size = 4;
+        TEST(pmgr_ring_peek(rp.cons, out) == -1);
+    }
+    {
+        /* a head that the consumer moved past the tail */
+        ring_pair_t rp(PMGR_RING_MIN_SZ);
+        rp.prod.hdr->head = 64;
+        auto msg = test_msg(64, 0);
+        struct iovec in = { .iov_base = msg.data(), .iov_len = msg.size() };
+        TEST(pmgr_ring_push(rp.prod, &in, 1) == -1);
+    }
+}
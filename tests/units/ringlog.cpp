@@ -0,0 +1,71 @@
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+
+#include "units.h"
+#include "logring.h"
+
+/* the byte at pos in the output, so a byte that was overwritten doesn't match */
+static char out_byte(uint64_t pos) {
+    return (pos * 0x9E3779B97F4A7C15ull) >> 56;
+}
+
+static void out_write(uint64_t *pos, size_t len) {
+    std::vector<char> buff(len);
+    for (size_t i = 0; i < len; i++)
+        buff[i] = out_byte(*pos + i);
+    logring_write(buff.data(), len);
+    *pos += len;
+}
+
+static bool out_check(uint64_t pos, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        if (data[i] != out_byte(pos + i))
+            return false;
+    return true;
+}
+
+void test_logring() {
+    TEST(logring_init() == 0);
+    std::vector<char> buff(LOGRING_SZ);
+    uint64_t wpos = 0, rpos = 0, skipped;
+
+    TEST(logring_read(&rpos, buff.data(), buff.size(), &skipped) == 0 && !skipped);
+    out_write(&wpos, 100);
+    TEST(logring_read(&rpos, buff.data(), buff.size(), &skipped) == 100 && !skipped);
+    TEST(rpos == 100 && out_check(0, buff.data(), 100));
+
+    /* a reader that fell behind is moved to the oldest byte and told how much it lost */
+    for (int i = 0; i < 16; i++)
+        out_write(&wpos, LOGRING_SZ / 16);
+    out_write(&wpos, 500);
+    TEST(logring_read(&rpos, buff.data(), 1000, &skipped) == 1000 && skipped == 500);
+    TEST(rpos == 1600 && out_check(600, buff.data(), 1000));
+    TEST(logring_read(&rpos, buff.data(), buff.size(), &skipped) == LOGRING_SZ - 1000);
+    TEST(!skipped && rpos == wpos && out_check(1600, buff.data(), LOGRING_SZ - 1000));
+
+    /* a reader racing the writer loses bytes, but never gets bytes that were overwritten while it
+    copied them, the copies are as big as the ring so the writer is often inside them */
+    std::atomic<bool> done = false;
+    uint64_t start = wpos, total = wpos + 256 * LOGRING_SZ;
+    std::thread writer([&]{
+        for (int i = 0; wpos < total; i++)
+            out_write(&wpos, 1 + (i * 4099) % 65536);
+        done = true;
+    });
+    uint64_t got = 0, lost = 0, bad = 0;
+    for (int i = 0; true; i++) {
+        bool last = done;
+        uint64_t from = rpos;
+        int64_t ret = logring_read(&rpos, buff.data(), buff.size(), &skipped);
+        lost += skipped;
+        got += ret;
+        bad += !out_check(rpos - ret, buff.data(), ret);
+        TEST(rpos == from + skipped + ret);
+        if (last && !ret)
+            break;
+    }
+    writer.join();
+    TEST(!bad);
+    TEST(rpos == wpos && got + lost == wpos - start);
+}
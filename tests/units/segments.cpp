@@ -0,0 +1,105 @@
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <future>
+#include <algorithm>
+
+#include "units.h"
+#include "logfile.h"
+
+void logfile_sync() {
+    for (auto post : { logfile_post, logfile_post_idle, logfile_post }) {
+        std::promise<void> done;
+        post([&done]{ done.set_value(); });
+        done.get_future().wait();
+    }
+}
+
+std::vector<std::string> dir_files(const std::string &dir) {
+    std::vector<std::string> ret;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return ret;
+    while (struct dirent *ent = readdir(d))
+        if (ent->d_name[0] != '.')
+            ret.push_back(ent->d_name);
+    closedir(d);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+int64_t file_size(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) < 0 ? -1 : st.st_size;
+}
+
+std::string test_dir() {
+    char dir[] = "./units.XXXXXX";
+    if (!mkdtemp(dir))
+        return "";
+    return dir;
+}
+
+void rm_dir(const std::string &dir) {
+    for (auto &f : dir_files(dir))
+        unlink((dir + "/" + f).c_str());
+    rmdir(dir.c_str());
+}
+
+void test_logfile() {
+    std::string dir = test_dir();
+    TEST(dir.size());
+
+    /* the live segment of task "a.1" and a file of someone else look like segments of "a" */
+    for (auto f : { "/a.1.log", "/a.123456789.log", "/a.0000001x.log" }) {
+        int fd = open((dir + f).c_str(), O_CREAT | O_WRONLY, 0666);
+        TEST(fd >= 0 && write(fd, "x", 1) == 1);
+        close(fd);
+    }
+
+    logfile_cfg_t cfg;
+    cfg.dir = dir;
+    cfg.seg_size = 1000;
+    cfg.max_bytes = 2500;
+    std::string line(100, 'x');
+    logfile_t lf;
+    TEST(lf.open("a", cfg) == 0 && lf.last_seq == 0);
+    logfile_sync();
+
+    /* rotated every 1000 bytes, the old segments are trimmed to 2500 bytes */
+    for (int seg = 0; seg < 6; seg++) {
+        for (int i = 0; i < 10; i++)
+            TEST(lf.write(line.data(), line.size()) == 0);
+        TEST(lf.last_seq == (uint64_t)seg + 1 && lf.seg_bytes == 0);
+        logfile_sync();
+    }
+    auto files = dir_files(dir);
+    TEST(files == std::vector<std::string>({ "a.00000005.log", "a.00000006.log", "a.0000001x.log",
+            "a.1.log", "a.123456789.log", "a.log", "a.log.next" }));
+    TEST(file_size(lf.seg_path(5)) == 1000 && file_size(lf.live_path()) == 0);
+
+    /* the next segment is gone, the rotation is undone and the live segment kept */
+    TEST(lf.write(line.data(), line.size()) == 0);
+    TEST(unlink(lf.next_path().c_str()) == 0);
+    for (int i = 0; i < 9; i++)
+        TEST(lf.write(line.data(), line.size()) == 0);
+    TEST(lf.last_seq == 6 && file_size(lf.live_path()) == 1000);
+    TEST(file_size(lf.seg_path(7)) == -1);
+    logfile_sync();
+    TEST(lf.write(line.data(), line.size()) == 0);      /* and done with the new next one */
+    TEST(lf.last_seq == 7 && file_size(lf.seg_path(7)) == 1100);
+    logfile_sync();
+
+    /* on reopen, what was left live is kept as the newest old segment */
+    for (int i = 0; i < 5; i++)
+        TEST(lf.write(line.data(), line.size()) == 0);
+    lf.close();
+    logfile_t again;
+    TEST(again.open("a", cfg) == 0 && again.last_seq == 8);
+    logfile_sync();
+    TEST(file_size(again.seg_path(8)) == 500 && file_size(again.live_path()) == 0);
+    TEST(file_size(again.seg_path(6)) == -1);           /* trimmed */
+    TEST(file_size(dir + "/a.1.log") == 1);
+    again.close();
+    rm_dir(dir);
+}
@@ -0,0 +1,120 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+
+#include "units.h"
+#include "logstore.h"
+#include "logfmt.h"
+
+struct store_rec_t {
+    std::string task;
+    int64_t ts_us;
+    std::string line;
+};
+
+static std::vector<store_rec_t> query(const logfile_cfg_t &cfg, const logstore_query_t &q) {
+    std::vector<store_rec_t> ret;
+    int err = logstore_query(cfg, q, [&ret](const std::string &task, const logrec_hdr_t &hdr,
+            const char *line)
+    {
+        ret.push_back({ task, hdr.ts_us, line });
+        return 0;
+    });
+    if (err < 0)
+        ret.push_back({ "error" });
+    return ret;
+}
+
+static std::string line_of(const std::string &task, int i) {
+    return sformat("line %d of %s ", i, task.c_str()) + std::string(60, 'a' + i % 26);
+}
+
+/* cnt lines of task, numbered from first, they take about 100 bytes each in the store */
+static void store_lines(const std::string &task, int first, int cnt) {
+    for (int i = first; i < first + cnt; i++) {
+        std::string rec;
+        std::string line = line_of(task, i);
+        logfmt_append(rec, 1000 + i, task, 10, LOG_STREAM_OUT, line.data(), line.size());
+        logstore_append(rec.data(), rec.size());
+    }
+    TEST(logstore_flush() == 0);
+}
+
+static bool is_line(const store_rec_t &rec, const std::string &task, int i) {
+    return rec.task == task && rec.line == line_of(task, i);
+}
+
+void test_logstore() {
+    std::string dir = test_dir();
+    TEST(dir.size());
+    std::string sdir = dir + "/store";
+    logfile_cfg_t cfg;
+    cfg.dir = dir;
+    cfg.seg_size = 1024 * 1024;
+    TEST(logstore_open(cfg) == 0);
+
+    /* a few blocks of "a", then "b", a line of procmgr itself and a part that is not indexed */
+    store_lines("a", 0, 2000);
+    store_lines("b", 0, 100);
+    std::string own = "procmgr's own line\n";
+    logstore_append(own.data(), own.size());
+    store_lines("a", 2000, 10);
+    TEST(file_size(sdir + "/00000001.idx") >= (int64_t)(3 * sizeof(logidx_t)));
+
+    auto all = query(cfg, {});
+    TEST(all.size() == 2111);
+    TEST(all.size() > 2110 && is_line(all[0], "a", 0) && is_line(all[2000], "b", 0));
+    TEST(all.size() > 2110 && all[2100].task == "procmgr" && all[2100].line + "\n" == own);
+    TEST(all.size() > 2110 && is_line(all[2110], "a", 2009));
+
+    auto b = query(cfg, { .task = "b" });
+    TEST(b.size() == 100 && is_line(b[0], "b", 0) && is_line(b[99], "b", 99));
+    TEST(query(cfg, { .task = "c" }).empty());
+
+    /* the times are the ones of the records, moved to the wall clock */
+    auto some = query(cfg, { .task = "a", .since_us = all[10].ts_us, .until_us = all[19].ts_us });
+    TEST(some.size() == 10 && is_line(some[0], "a", 10) && is_line(some[9], "a", 19));
+
+    /* reopened, the old segment is compressed and the task keeps it's id */
+    logstore_close();
+    TEST(logstore_open(cfg) == 0);
+    store_lines("a", 3000, 10);
+    logfile_sync();
+    TEST(file_size(sdir + "/00000001.dat") == -1 && file_size(sdir + "/00000001.lzi") > 0);
+    auto again = query(cfg, { .task = "a" });
+    TEST(again.size() == 2020 && is_line(again[2009], "a", 2009));
+    TEST(again.size() == 2020 && is_line(again[2010], "a", 3000));
+    TEST(file_size(sdir + "/tasks") == (int64_t)strlen("1 a\n2 b\n"));
+
+    /* a record longer than what is left of the segment ends it */
+    store_lines("b", 100, 10);
+    logstore_close();
+    std::string dat2 = sdir + "/00000002.dat";
+    int fd = open(dat2.c_str(), O_WRONLY | O_APPEND);
+    logrec_hdr_t bad{ .len = 1 << 30 };
+    TEST(fd >= 0 && write(fd, &bad, sizeof(bad)) == sizeof(bad));
+    close(fd);
+    auto tail = query(cfg, { .task = "b" });
+    TEST(tail.size() == 110 && is_line(tail[109], "b", 109));
+
+    /* a segment cut in the middle of a record has the records before the cut */
+    TEST(truncate(dat2.c_str(), file_size(dat2) - sizeof(bad) - 10) == 0);
+    auto cut = query(cfg, { .task = "b" });
+    TEST(cut.size() == 109 && is_line(cut[108], "b", 108));
+
+    /* a compressed segment that lost it's end has the blocks that are left, and a block the
+    index places outside of the file is skipped */
+    TEST(truncate((sdir + "/00000001.lz").c_str(), file_size(sdir + "/00000001.lz") / 2) == 0);
+    auto half = query(cfg, { .task = "a" });
+    TEST(half.size() > 0 && half.size() < 2020 && is_line(half[0], "a", 0));
+    TEST(is_line(half.back(), "a", 3009));
+    fd = open((sdir + "/00000001.lzi").c_str(), O_WRONLY);
+    uint64_t far = 1ull << 40;
+    TEST(fd >= 0 && pwrite(fd, &far, sizeof(far), offsetof(logzidx_t, zoff)) == sizeof(far));
+    close(fd);
+    auto skipped = query(cfg, { .task = "a" });
+    TEST(skipped.size() > 0 && skipped.size() < half.size() && !is_line(skipped[0], "a", 0));
+
+    rm_dir(sdir);
+    rm_dir(dir);
+}
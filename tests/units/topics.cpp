@@ -0,0 +1,62 @@
+#include "units.h"
+#include "topics.h"
+
+/* the subscribers that match topic, sorted, so the order of the trie doesn't matter */
+static std::vector<int64_t> matches(topic_node_t *root, const char *topic) {
+    std::vector<std::string_view> levels;
+    std::vector<int64_t> ret;
+    if (!topic_split(topic, false, levels))
+        return { -1 };
+    topic_match(root, levels, ret);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+static bool sub(topic_node_t *root, const char *pattern, int64_t id, bool unsub = false) {
+    std::vector<std::string_view> levels;
+    if (!topic_split(pattern, true, levels))
+        return false;
+    return unsub ? topic_unsub(root, levels, id) : topic_sub(root, levels, id);
+}
+
+void test_topics() {
+    std::vector<std::string_view> levels;
+    TEST(topic_split("a.b.c", false, levels) && levels.size() == 3 && levels[1] == "b");
+    TEST(!topic_split("", true, levels));
+    TEST(!topic_split("a..b", true, levels));
+    TEST(!topic_split("a.", true, levels));
+    TEST(!topic_split("a.*", false, levels));       /* no wildcards in a published topic */
+    TEST(!topic_split("a.b*", true, levels));       /* a wildcard is a whole level */
+    TEST(!topic_split("a.#.b", true, levels));      /* '#' only as the last level */
+    TEST(topic_split("*.#", true, levels));
+
+    topic_node_t root;
+    TEST(sub(&root, "a.*.c", 1));
+    TEST(sub(&root, "a.#", 2));
+    TEST(sub(&root, "#", 3));
+    TEST(sub(&root, "a.b", 4));
+    TEST(sub(&root, "*", 5));
+    TEST(!sub(&root, "a.b", 4));                    /* already there */
+
+    TEST(matches(&root, "a.b.c") == std::vector<int64_t>({ 1, 2, 3 }));
+    TEST(matches(&root, "a.x.c") == std::vector<int64_t>({ 1, 2, 3 }));
+    TEST(matches(&root, "a.b") == std::vector<int64_t>({ 2, 3, 4 }));
+    TEST(matches(&root, "a") == std::vector<int64_t>({ 2, 3, 5 }));  /* "a.#" has "a" too */
+    TEST(matches(&root, "a.b.c.d") == std::vector<int64_t>({ 2, 3 }));
+    TEST(matches(&root, "x") == std::vector<int64_t>({ 3, 5 }));
+    TEST(matches(&root, "x.c") == std::vector<int64_t>({ 3 }));
+
+    /* the nodes that are left empty go away, the ones still used stay */
+    TEST(!sub(&root, "a.*.c", 2, true));
+    TEST(sub(&root, "a.*.c", 1, true));
+    TEST(!root.children["a"]->children.count("*"));
+    TEST(matches(&root, "a.b.c") == std::vector<int64_t>({ 2, 3 }));
+    TEST(sub(&root, "a.b", 4, true));
+    TEST(root.children["a"]->children.size() == 1);  /* only '#' */
+    TEST(sub(&root, "a.#", 2, true));
+    TEST(!root.children.count("a"));
+    TEST(sub(&root, "#", 3, true));
+    TEST(sub(&root, "*", 5, true));
+    TEST(root.children.empty());
+    TEST(matches(&root, "a") == std::vector<int64_t>());
+}
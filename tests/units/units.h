@@ -0,0 +1,58 @@
+#ifndef UNITS_H
+#define UNITS_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "debug.h"
+#include "misc_utils.h"
+#include "procmgr.h"
+
+/* each <module>.cpp has the checks of one module, main.cpp runs them all */
+
+extern int failed;
+
+#define TEST(cond) do { \
+    if (!(cond)) { \
+        DBG("FAILED: %s", #cond); \
+        failed++; \
+    } \
+} while (0)
+
+/* a message of len bytes (header included), it's bytes follow from seed */
+inline std::vector<uint8_t> test_msg(size_t len, uint8_t seed) {
+    std::vector<uint8_t> ret(len);
+    for (size_t i = 0; i < len; i++)
+        ret[i] = seed + i;
+    *(pmgr_hdr_t *)ret.data() = pmgr_hdr_t{ .size = (int32_t)len, .type = PMGR_CHAN_MESSAGE };
+    return ret;
+}
+
+/* returns when the log jobs posted before it are done, on both log threads (see logfile.h) */
+void logfile_sync();
+
+std::vector<std::string> dir_files(const std::string &dir);
+int64_t file_size(const std::string &path);
+void rm_dir(const std::string &dir);
+
+/* a new dir inside the current one, the log and config paths go through path_get_relative, so
+./units has to run from tests/units, where it is */
+std::string test_dir();
+
+void test_topics();
+void test_ring();
+void test_ring_broken();
+void test_msgbuf();
+void test_retain();
+void test_pmgr2();
+void test_logfile();
+void test_logring();
+void test_logstore();
+void test_lzblk();
+void test_cfg_cache();
+
+/* ./units cfg_read, reads the config and prints what it got, for test_cfg_cache */
+int cfg_read_child();
+
+#endif
@@ -0,0 +1,359 @@
+#include "top.h"
+#include "cfg.h"
+#include "libpmgr.h"
+#include "path_utils.h"
+
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <algorithm>
+
+#define TOP_REFRESH_MS  1000
+#define TOP_EVENTS      (PMGR_EVENT_TASK_START | PMGR_EVENT_TASK_STOP | PMGR_EVENT_TASK_ADD | \
+                         PMGR_EVENT_TASK_RM | PMGR_EVENT_CLEAR | PMGR_EVENT_TASK_SHED | \
+                         PMGR_EVENT_TASK_UNSHED | PMGR_EVENT_TASK_UNHEALTHY | PMGR_EVENT_TASK_STATS)
+
+enum top_sort_e {
+    TOP_SORT_NAME = 0,
+    TOP_SORT_STATE,
+    TOP_SORT_UPTIME,
+    TOP_SORT_RESTARTS,
+    TOP_SORT_CPU,
+    TOP_SORT_RSS,
+    TOP_SORT_RATE,
+
+    TOP_SORT_CNT,
+};
+
+static const char *sort_names[TOP_SORT_CNT] = {
+    "name", "state", "uptime", "restarts", "cpu", "rss", "rate"
+};
+
+struct top_row_t {
+    std::string name;
+    pmgr_task_state_e state = PMGR_TASK_STATE_INIT;
+    pid_t pid = 0;
+    bool shed = false;
+    bool unhealthy = false;
+    int64_t start_us = 0;
+    int64_t restarts = 0;
+    int64_t exit = -1;
+    int64_t cpu = 0;
+    int64_t rss = 0;
+    int64_t out_rate = 0;
+};
+
+static std::map<std::string, top_row_t> rows;
+static int sort_by = TOP_SORT_CPU;
+static bool sort_reverse = false;
+static std::string filter;
+static bool interactive = false;
+static struct termios old_term;
+static int *top_ret;
+
+static int64_t now_real_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000'000LL + ts.tv_nsec / 1000;
+}
+
+static void set_stats(top_row_t &row, const pmgr2_msg_t &msg) {
+    row.start_us = msg.get_int(PMGR2_F_START_US, row.start_us);
+    row.restarts = msg.get_int(PMGR2_F_RESTARTS, row.restarts);
+    row.exit = msg.get_int(PMGR2_F_EXIT, row.exit);
+    row.cpu = msg.get_int(PMGR2_F_CPU, row.cpu);
+    row.rss = msg.get_int(PMGR2_F_RSS, row.rss);
+    row.out_rate = msg.get_int(PMGR2_F_OUT_RATE, row.out_rate);
+}
+
+/* the stats event has a group of fields for each task, starting with it's name */
+static void on_stats(const pmgr2_msg_t &msg) {
+    top_row_t *row = NULL;
+    for (auto &f : msg.fields) {
+        if (f.id == PMGR2_F_NAME) {
+            row = HAS(rows, f.sval) ? &rows[f.sval] : NULL;
+            continue;
+        }
+        if (!row || f.is_bytes)
+            continue;
+        switch (f.id) {
+            case PMGR2_F_CPU: row->cpu = f.ival; break;
+            case PMGR2_F_RSS: row->rss = f.ival; break;
+            case PMGR2_F_OUT_RATE: row->out_rate = f.ival; break;
+            default: break;
+        }
+    }
+}
+
+static void on_event(const pmgr_event_t &ev, const pmgr2_msg_t &msg) {
+    if (ev.ev_type == PMGR_EVENT_TASK_STATS) {
+        on_stats(msg);
+        return ;
+    }
+    std::string name = ev.task_name;
+    if (ev.ev_type == PMGR_EVENT_CLEAR) {
+        rows.clear();
+        return ;
+    }
+    if (ev.ev_type == PMGR_EVENT_TASK_RM) {
+        rows.erase(name);
+        return ;
+    }
+
+    auto &row = rows[name];
+    row.name = name;
+    switch (ev.ev_type) {
+        case PMGR_EVENT_TASK_START: {
+            row.state = PMGR_TASK_STATE_RUNNING;
+            row.pid = ev.task_pid;
+            row.unhealthy = false;
+        } break;
+        case PMGR_EVENT_TASK_STOP: {
+            row.state = PMGR_TASK_STATE_STOPPED;
+            row.cpu = row.rss = row.out_rate = 0;
+        } break;
+        case PMGR_EVENT_TASK_SHED: row.shed = true; break;
+        case PMGR_EVENT_TASK_UNSHED: row.shed = false; break;
+        case PMGR_EVENT_TASK_UNHEALTHY: row.unhealthy = true; break;
+        default: break;
+    }
+    set_stats(row, msg);
+}
+
+/* the whole table, after connecting and after reconnecting, the events keep it up to date */
+static co::task_t co_load_rows(pmgr_client_p client) {
+    pmgr_reply_t reply;
+    ASSERT_COFN(co_await co_pmgr_request(client, pmgr2_msg_t(PMGR_MSG_LIST), &reply));
+    rows.clear();
+    for (auto &msg : reply.msgs) {
+        pmgr_task_t task;
+        pmgr2_get_task(msg, task);
+        auto &row = rows[task.task_name];
+        row.name = task.task_name;
+        row.state = task.state;
+        row.pid = task.pid;
+        set_stats(row, msg);
+    }
+    co_return 0;
+}
+
+static std::string fmt_bytes(int64_t bytes) {
+    if (bytes < 1024)
+        return sformat("%ldB", bytes);
+    if (bytes < 1024 * 1024)
+        return sformat("%.1fK", bytes / 1024.);
+    if (bytes < 1024 * 1024 * 1024)
+        return sformat("%.1fM", bytes / (1024. * 1024));
+    return sformat("%.1fG", bytes / (1024. * 1024 * 1024));
+}
+
+static std::string fmt_uptime(const top_row_t &row) {
+    if (row.state != PMGR_TASK_STATE_RUNNING || !row.start_us)
+        return "-";
+    int64_t s = std::max(int64_t(0), (now_real_us() - row.start_us) / 1000'000);
+    if (s >= 86400)
+        return sformat("%ldd%02ldh", s / 86400, s % 86400 / 3600);
+    if (s >= 3600)
+        return sformat("%ldh%02ldm", s / 3600, s % 3600 / 60);
+    return sformat("%ldm%02lds", s / 60, s % 60);
+}
+
+static std::string fmt_exit(int64_t wstat) {
+    if (wstat < 0)
+        return "-";
+    if (WIFEXITED(wstat))
+        return sformat("exit %d", WEXITSTATUS(wstat));
+    if (WIFSIGNALED(wstat))
+        return sformat("signal %d", WTERMSIG(wstat));
+    return "?";
+}
+
+static std::string fmt_state(const top_row_t &row) {
+    std::string ret;
+    switch (row.state) {
+        case PMGR_TASK_STATE_INIT: ret = "init"; break;
+        case PMGR_TASK_STATE_STOPPED: ret = "stopped"; break;
+        case PMGR_TASK_STATE_STOPING: ret = "stopping"; break;
+        case PMGR_TASK_STATE_RUNNING: ret = "running"; break;
+    }
+    if (row.shed)
+        ret = "shed";
+    if (row.unhealthy)
+        ret += "!";
+    return ret;
+}
+
+static int64_t sort_key(const top_row_t &row) {
+    switch (sort_by) {
+        case TOP_SORT_STATE: return row.state;
+        case TOP_SORT_UPTIME: return row.state == PMGR_TASK_STATE_RUNNING ? -row.start_us : 0;
+        case TOP_SORT_RESTARTS: return row.restarts;
+        case TOP_SORT_CPU: return row.cpu;
+        case TOP_SORT_RSS: return row.rss;
+        case TOP_SORT_RATE: return row.out_rate;
+        default: return 0;
+    }
+}
+
+static void render(bool connected) {
+    std::vector<const top_row_t *> shown;
+    int running = 0;
+    for (auto &[name, row] : rows) {
+        running += row.state == PMGR_TASK_STATE_RUNNING;
+        if (filter == "" || name.find(filter) != std::string::npos)
+            shown.push_back(&row);
+    }
+
+    /* names ascending, the rest with the biggest first, 'r' flips it */
+    std::stable_sort(shown.begin(), shown.end(), [](const top_row_t *a, const top_row_t *b) {
+        if (sort_by == TOP_SORT_NAME)
+            return sort_reverse ? a->name > b->name : a->name < b->name;
+        int64_t ka = sort_key(*a);
+        int64_t kb = sort_key(*b);
+        if (ka == kb)
+            return a->name < b->name;
+        return sort_reverse ? ka < kb : ka > kb;
+    });
+
+    int max_lines = shown.size();
+    struct winsize ws;
+    if (interactive && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 4)
+        max_lines = std::min(max_lines, ws.ws_row - 4);
+
+    std::string out = interactive ? "\033[H\033[2J" : "\n";
+    out += sformat("procmgr top - %zu tasks, %d running, sort: %s%s%s%s\n",
+            rows.size(), running, sort_names[sort_by], sort_reverse ? " (reversed)" : "",
+            filter.size() ? (", filter: " + filter).c_str() : "",
+            connected ? "" : " [disconnected]");
+    if (interactive)
+        out += "keys: s - sort, r - reverse, q - quit\n";
+    out += sformat("%-32s %-10s %8s %9s %8s %6s %8s %8s %s\n", "NAME", "STATE", "PID", "UPTIME",
+            "RESTARTS", "CPU%", "RSS", "OUT/s", "LAST EXIT");
+    for (int i = 0; i < max_lines; i++) {
+        auto row = shown[i];
+        bool running = row->state == PMGR_TASK_STATE_RUNNING;
+        out += sformat("%-32.32s %-10s %8s %9s %8ld %6s %8s %8s %s\n", row->name.c_str(),
+                fmt_state(*row).c_str(), running ? sformat("%d", row->pid).c_str() : "-",
+                fmt_uptime(*row).c_str(), row->restarts,
+                running ? sformat("%.1f", row->cpu / 10.).c_str() : "-",
+                running ? fmt_bytes(row->rss).c_str() : "-",
+                running ? fmt_bytes(row->out_rate).c_str() : "-",
+                fmt_exit(row->exit).c_str());
+    }
+    write_sz(STDOUT_FILENO, out.data(), out.size());
+}
+
+static co::task_t co_top_quit(int ret) {
+    if (interactive) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &old_term);
+        const char *show_cursor = "\033[?25h";
+        write_sz(STDOUT_FILENO, show_cursor, strlen(show_cursor));
+    }
+    *top_ret = ret;
+    co_await co::force_stop(0);
+    co_return 0;
+}
+
+static co::task_t co_top_keys() {
+    while (true) {
+        char key;
+        int ret = co_await co::read(STDIN_FILENO, &key, 1);
+        if (ret <= 0 || key == 'q') {
+            co_await co_top_quit(0);
+            co_return 0;
+        }
+        if (key == 's')
+            sort_by = (sort_by + 1) % TOP_SORT_CNT;
+        else if (key == 'r')
+            sort_reverse = !sort_reverse;
+        else
+            continue;
+        render(true);
+    }
+    co_return 0;
+}
+
+static co::task_t co_top_signals(int sigfd) {
+    struct signalfd_siginfo fdsi;
+    co_await co::read(sigfd, &fdsi, sizeof(fdsi));
+    co_await co_top_quit(0);
+    co_return 0;
+}
+
+static co::task_t co_top_run(std::function<std::string(int)> arg, int argc) {
+    int refreshes = -1;
+    for (int i = 2; i < argc; i++) {
+        if (arg(i) == "-s") {
+            auto it = std::find(sort_names, sort_names + TOP_SORT_CNT, arg(i + 1));
+            if (it == sort_names + TOP_SORT_CNT) {
+                DBG("Unknown sort: '%s', one of: name, state, uptime, restarts, cpu, rss, rate",
+                        arg(i + 1).c_str());
+                co_return -1;
+            }
+            sort_by = it - sort_names;
+            i++;
+        }
+        else if (arg(i) == "-f") {
+            filter = arg(++i);
+        }
+        else if (arg(i) == "-n") {
+            refreshes = atoi(arg(++i).c_str());
+        }
+        else {
+            DBG("Unknown option: '%s'", arg(i).c_str());
+            co_return -1;
+        }
+    }
+
+    auto client = pmgr_client_get(path_get_relative(cfg_get()->sock_path));
+
+    /* subscribe first, so nothing is lost between the list and the events */
+    ASSERT_COFN(co_await co_pmgr_subscribe(client, TOP_EVENTS, PMGR_EVENT_FLAG_PID_FILTER, -1, "",
+            on_event));
+    ASSERT_COFN(co_await co_load_rows(client));
+
+    interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+    if (interactive) {
+        struct termios term;
+        ASSERT_COFN(tcgetattr(STDIN_FILENO, &old_term));
+        term = old_term;
+        term.c_lflag &= ~(ICANON | ECHO);
+        term.c_cc[VMIN] = 1;
+        term.c_cc[VTIME] = 0;
+        ASSERT_COFN(tcsetattr(STDIN_FILENO, TCSANOW, &term));
+        const char *hide_cursor = "\033[?25l";
+        write_sz(STDOUT_FILENO, hide_cursor, strlen(hide_cursor));
+
+        int sigfd;
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGHUP);
+        ASSERT_COFN(sigprocmask(SIG_BLOCK, &mask, NULL));
+        ASSERT_COFN(sigfd = signalfd(-1, &mask, SFD_CLOEXEC));
+        co_await co::sched(co_top_signals(sigfd));
+        co_await co::sched(co_top_keys());
+    }
+
+    bool was_connected = true;
+    for (int i = 0; refreshes < 0 || i < refreshes; i++) {
+        bool connected = client->fd >= 0;
+        if (connected && !was_connected && co_await co_load_rows(client) < 0)
+            connected = false;
+        was_connected = connected;
+
+        render(connected);
+        if (refreshes < 0 || i + 1 < refreshes)
+            co_await co::sleep_ms(TOP_REFRESH_MS);
+    }
+    co_return 0;
+}
+
+co::task_t co_top(std::function<std::string(int)> arg, int argc, int *ret) {
+    top_ret = ret;
+    int run_ret = co_await co_top_run(arg, argc);
+    co_await co_top_quit(run_ret);
+    co_return 0;
+}
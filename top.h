@@ -0,0 +1,14 @@
+#ifndef TOP_H
+#define TOP_H
+
+#include "co_utils.h"
+
+/* procmgr top [-s <sort>] [-f <filter>] [-n <refreshes>]
+
+A live table of the tasks, built from one task list and then kept up to date by the task events,
+the stats (cpu, rss, output rate) come with PMGR_EVENT_TASK_STATS only for the tasks that changed,
+all of them in one event.
+Stops the pool when it's done, ret is set to the result. */
+co::task_t co_top(std::function<std::string(int)> arg, int argc, int *ret);
+
+#endif